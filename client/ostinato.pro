@@ -31,6 +31,7 @@ win32 {
         "../rpc/libpbrpc.a"
 }
 LIBS += -lprotobuf
+LIBS += -lz
 LIBS += -L"../extra/qhexedit2/$(OBJECTS_DIR)/" -lqhexedit2
 RESOURCES += ostinato.qrc 
 HEADERS += \
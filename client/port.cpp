@@ -58,6 +58,8 @@ Port::Port(quint32 id, quint32 portGroupId)
     mPortGroupId = portGroupId;
     capFile_ = NULL;
     dirty_ = false;
+    deviceNeighborGeneration_ = 0;
+    isDeviceNeighborGenerationValid_ = false;
 }
 
 Port::~Port()
@@ -337,7 +339,9 @@ bool Port::deleteStreamAt(int index)
 
 bool Port::insertStream(uint streamId)
 {
-    Stream    *s = new Stream;
+    // Stream will be filled in later - by its summary and, on demand,
+    // its config
+    Stream    *s = new Stream(false);
 
     s->setId(streamId);
 
@@ -368,12 +372,42 @@ bool Port::updateStream(uint streamId, OstProto::Stream *stream)
 _found:
     streamIndex = i;
 
-    mStreams[streamIndex]->protoDataCopyFrom(*stream);
+    mStreams[streamIndex]->configCopyFrom(*stream);
     reorderStreamsByOrdinals();
 
     return true;
 }
 
+/*!
+ Updates the streams whose config is not yet loaded from their summaries
+*/
+void Port::updateStreamSummaries(const OstProto::StreamSummaryList &summaries)
+{
+    QHash<quint32, Stream*> streams;
+
+    for (int i = 0; i < mStreams.size(); i++)
+        streams.insert(mStreams.at(i)->id(), mStreams.at(i));
+
+    for (int i = 0; i < summaries.stream_size(); i++)
+    {
+        const OstProto::Stream &summary = summaries.stream(i);
+        Stream *s = streams.value(summary.stream_id().id());
+
+        if (!s) {
+            qDebug("%s: Invalid stream id %d", __FUNCTION__,
+                    summary.stream_id().id());
+            continue;
+        }
+        s->summaryCopyFrom(summary);
+    }
+
+    // Reorder once for all the summaries, not once per stream
+    reorderStreamsByOrdinals();
+    recalculateAverageRates();
+
+    emit streamListChanged(mPortGroupId, mPortId);
+}
+
 void Port::getDeletedStreamsSinceLastSync(
     OstProto::StreamIdList &streamIdList)
 {
@@ -436,12 +470,31 @@ void Port::getModifiedStreamsSinceLastSync(
     {
         OstProto::Stream    *s;
 
+        // Unloaded streams are unchanged - see getModifiedUnloadedStreams()
+        if (!mStreams[i]->isConfigLoaded())
+            continue;
+
         s = streamConfigList.add_stream();
         mStreams[i]->protoDataCopyInto(*s);
     }
     qDebug("Done %s", __FUNCTION__);
 }
 
+/*!
+ Returns the indexes of the streams whose config is not loaded but have
+ been changed locally (e.g. moved or rate changed) - these need to be
+ loaded before they can be sent to the server as modified
+*/
+void Port::getModifiedUnloadedStreams(QList<int> &streamIndexes)
+{
+    streamIndexes.clear();
+    for (int i = 0; i < mStreams.size(); i++)
+    {
+        if (mStreams[i]->isSummaryChanged())
+            streamIndexes.append(i);
+    }
+}
+
 void Port::getDeletedDeviceGroupsSinceLastSync(
     OstProto::DeviceGroupIdList &deviceGroupIdList)
 {
@@ -937,13 +990,16 @@ void Port::clearDeviceNeighbors()
     ndpResolvedCount_.clear();
     qDeleteAll(deviceNeighbors_);
     deviceNeighbors_.clear();
+    isDeviceNeighborGenerationValid_ = false;
 }
 
+// Insert or replace (in case of a delta update) a device's neighbors
 void Port::insertDeviceNeighbors(const OstEmul::DeviceNeighborList &neighList)
 {
     int count;
     OstEmul::DeviceNeighborList *neighbors =
         new OstEmul::DeviceNeighborList(neighList);
+    delete deviceNeighbors_.value(neighList.device_index());
     deviceNeighbors_.insert(neighList.device_index(), neighbors);
 
     count = 0;
@@ -959,6 +1015,24 @@ void Port::insertDeviceNeighbors(const OstEmul::DeviceNeighborList &neighList)
     ndpResolvedCount_.insert(neighbors->device_index(), count);
 }
 
+//! Server neighbor generation that our device neighbors correspond to
+quint32 Port::deviceNeighborGeneration()
+{
+    return deviceNeighborGeneration_;
+}
+
+//! Returns true if we have all device neighbors upto the generation
+bool Port::isDeviceNeighborGenerationValid()
+{
+    return isDeviceNeighborGenerationValid_;
+}
+
+void Port::setDeviceNeighborGeneration(quint32 generation, bool isValid)
+{
+    deviceNeighborGeneration_ = generation;
+    isDeviceNeighborGenerationValid_ = isValid;
+}
+
 void Port::deviceInfoRefreshed()
 {
     emit deviceInfoChanged();
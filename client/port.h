@@ -66,6 +66,8 @@ class Port : public QObject {
     QHash<quint32, OstEmul::DeviceNeighborList*> deviceNeighbors_;
     QHash<quint32, quint32> arpResolvedCount_;
     QHash<quint32, quint32> ndpResolvedCount_;
+    quint32 deviceNeighborGeneration_;
+    bool isDeviceNeighborGenerationValid_;
 
     uint newStreamId();
     void updateStreamOrdinalsFromIndex();
@@ -102,6 +104,12 @@ public:
         { return d.transmit_mode(); }
     bool trackStreamStats() const
         { return d.is_tracking_stream_stats(); }
+    int numaNode() const
+        { return d.numa_node(); }
+    const QString txCpuList() const
+        { return QString().fromStdString(d.tx_cpu_list()); }
+    const QString rxCpuList() const
+        { return QString().fromStdString(d.rx_cpu_list()); }
     double averagePacketRate() const
         { return avgPacketsPerSec_; }
     double averageBitRate() const
@@ -158,6 +166,7 @@ public:
     //@{
     bool insertStream(uint streamId);
     bool updateStream(uint streamId, OstProto::Stream *stream);
+    void updateStreamSummaries(const OstProto::StreamSummaryList &summaries);
     //@}
 
     bool isDirty() { return dirty_; }
@@ -165,6 +174,7 @@ public:
     void getNewStreamsSinceLastSync(OstProto::StreamIdList &streamIdList);
     void getModifiedStreamsSinceLastSync(
         OstProto::StreamConfigList &streamConfigList);
+    void getModifiedUnloadedStreams(QList<int> &streamIndexes);
 
     void getDeletedDeviceGroupsSinceLastSync(
             OstProto::DeviceGroupIdList &streamIdList);
@@ -229,6 +239,9 @@ public:
     //! Used by MyService::Stub to update from config received from server
     void clearDeviceNeighbors();
     void insertDeviceNeighbors(const OstEmul::DeviceNeighborList &neighList);
+    quint32 deviceNeighborGeneration();
+    bool isDeviceNeighborGenerationValid();
+    void setDeviceNeighborGeneration(quint32 generation, bool isValid);
 
     void deviceInfoRefreshed();
 
@@ -69,6 +69,14 @@ PortConfigDialog::PortConfigDialog(
     exclusiveControlButton->setChecked(portConfig_.is_exclusive_control());
     streamStatsButton->setChecked(portConfig_.is_tracking_stream_stats());
 
+    // Thread Placement (read-only)
+    numaNode->setText(portConfig_.numa_node() >= 0 ?
+            QString::number(portConfig_.numa_node()) : QString("Unknown"));
+    txCpuList->setText(portConfig_.tx_cpu_list().empty() ? QString("Any") :
+            QString::fromStdString(portConfig_.tx_cpu_list()));
+    rxCpuList->setText(portConfig_.rx_cpu_list().empty() ? QString("Any") :
+            QString::fromStdString(portConfig_.rx_cpu_list()));
+
     // Disable UI elements based on portState
     if (portState.is_transmit_on()) {
         transmitModeBox->setDisabled(true);
@@ -128,5 +136,10 @@ void PortConfigDialog::accept()
     else
         portConfig_.clear_is_tracking_stream_stats();
 
+    // Thread placement is not modifiable
+    portConfig_.clear_numa_node();
+    portConfig_.clear_tx_cpu_list();
+    portConfig_.clear_rx_cpu_list();
+
     QDialog::accept();
 }
@@ -54,6 +54,8 @@ PortGroup::PortGroup(QString serverName, quint16 port)
 
     statsController = new PbRpcController(portIdList_, portStatsList_);
     isGetStatsPending_ = false;
+    isStatsSubscribed_ = false;
+    isStreamConfigLoadPending_ = false;
 
     atConnectConfig_ = NULL;
 
@@ -246,6 +248,8 @@ void PortGroup::on_rpcChannel_disconnected()
     emit portGroupDataChanged(mPortGroupId);
 
     isGetStatsPending_ = false;
+    isStatsSubscribed_ = false;
+    isStreamConfigLoadPending_ = false;
 
     if (reconnect)
     {
@@ -309,6 +313,27 @@ void PortGroup::on_rpcChannel_notification(int notifType,
                     controller));
             break;
         }
+        case OstProto::portLinkStateChanged:
+            // Link state is part of the port stats - refresh them now
+            // instead of waiting for the next poll
+            getPortStats();
+            break;
+        case OstProto::portStatsUpdate: {
+            OstProto::PortStatsList *portStatsList =
+                                        notif->mutable_port_stats_list();
+
+            for (int i = 0; i < portStatsList->port_stats_size(); i++)
+            {
+                int id = portStatsList->port_stats(i).port_id().id();
+                // FIXME: don't mix port id & index into mPorts[]
+                if (id >= mPorts.size())
+                    continue;
+                mPorts[id]->updateStats(portStatsList->mutable_port_stats(i));
+            }
+
+            emit statsChanged(mPortGroupId);
+            break;
+        }
         default:
             break;
     }
@@ -371,6 +396,8 @@ void PortGroup::processPortIdList(PbRpcController *controller)
 
     portIdList_->CopyFrom(*portIdList);
 
+    subscribePortStats();
+
     // Request PortConfigList
     {
         qDebug("requesting port config list ...");
@@ -492,6 +519,18 @@ void PortGroup::when_configApply(int portIndex)
     QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
     mainWindow->setDisabled(true);
 
+    // Unloaded streams that were changed locally (moved, rate changed
+    // etc.) need to be sent as modified - ensure we have their config
+    // first; loading retains the local changes
+    QList<int> modifiedStreams;
+    mPorts[portIndex]->getModifiedUnloadedStreams(modifiedStreams);
+    if (!loadStreamConfig(mPorts[portIndex], modifiedStreams)) {
+        qWarning("unable to load config of modified streams");
+        mainWindow->setEnabled(true);
+        QApplication::restoreOverrideCursor();
+        return;
+    }
+
     // FIXME: as currently written this code will make unnecessary RPCs
     // even if the request contains no data; the fix will need to take
     // care to identify when sync is complete
@@ -637,6 +676,78 @@ void PortGroup::processModifyStreamAck(int portIndex,
 
     mainWindow->setEnabled(true);
     QApplication::restoreOverrideCursor();
+
+    // The streams are applied even if the packet list could not be built
+    // (e.g. over the memory budget) - tell the user why
+    if (controller->Failed())
+    {
+        qDebug("%s: rpc failed(%s)", __FUNCTION__,
+                qPrintable(controller->ErrorString()));
+        getPacketListInfo(portIndex);
+    }
+
+    delete controller;
+}
+
+void PortGroup::getPacketListInfo(int portIndex)
+{
+    OstProto::PortIdList *portIdList;
+    OstProto::PacketListInfoList *infoList;
+    PbRpcController *controller;
+
+    Q_ASSERT(portIndex < mPorts.size());
+
+    if (state() != QAbstractSocket::ConnectedState)
+        return;
+
+    portIdList = new OstProto::PortIdList;
+    portIdList->add_port_id()->set_id(mPorts[portIndex]->id());
+    infoList = new OstProto::PacketListInfoList;
+    controller = new PbRpcController(portIdList, infoList);
+
+    serviceStub->getPacketListInfo(controller, portIdList, infoList,
+        NewCallback(this, &PortGroup::processPacketListInfo,
+                    portIndex, controller));
+}
+
+void PortGroup::processPacketListInfo(int portIndex,
+        PbRpcController *controller)
+{
+    OstProto::PacketListInfoList *infoList
+        = static_cast<OstProto::PacketListInfoList*>(controller->response());
+
+    qDebug("In %s", __FUNCTION__);
+
+    if (controller->Failed())
+    {
+        qDebug("%s: rpc failed(%s)", __FUNCTION__,
+                qPrintable(controller->ErrorString()));
+        goto _exit;
+    }
+
+    if (infoList->packet_list_info_size() < 1)
+        goto _exit;
+
+    {
+        const OstProto::PacketListInfo &info = infoList->packet_list_info(0);
+
+        if (info.error().empty())
+            goto _exit;
+
+        QMessageBox::warning(NULL, tr("Apply"),
+                tr("Port %1-%2: transmit is not possible - %3.\n\n"
+                   "Packet list memory in use (MB) - port: %4 of %5, "
+                   "all ports: %6 of %7 (0 is unlimited)")
+                    .arg(mPortGroupId)
+                    .arg(mPorts[portIndex]->id())
+                    .arg(QString::fromStdString(info.error()))
+                    .arg(info.memory_used() >> 20)
+                    .arg(info.memory_budget() >> 20)
+                    .arg(infoList->memory_used() >> 20)
+                    .arg(infoList->memory_budget() >> 20));
+    }
+
+_exit:
     delete controller;
 }
 
@@ -644,7 +755,6 @@ void PortGroup::getDeviceInfo(int portIndex)
 {
     OstProto::PortId *portId;
     OstProto::PortDeviceList *deviceList;
-    OstProto::PortNeighborList *neighList;
     PbRpcController *controller;
 
     Q_ASSERT(portIndex < mPorts.size());
@@ -661,12 +771,31 @@ void PortGroup::getDeviceInfo(int portIndex)
         NewCallback(this, &PortGroup::processDeviceList,
                     portIndex, controller));
 
-    portId = new OstProto::PortId;
-    portId->set_id(mPorts[portIndex]->id());
+    getDeviceNeighbors(portIndex);
+}
+
+// If we are in sync with the server, fetch only the neighbor changes,
+// else fetch all neighbors - a page at a time starting at deviceIndex
+void PortGroup::getDeviceNeighbors(int portIndex, int deviceIndex)
+{
+    const int kDeviceNeighborPageSize = 1024;
+    OstProto::PortNeighborQuery *query;
+    OstProto::PortNeighborList *neighList;
+    PbRpcController *controller;
+    Port *port = mPorts[portIndex];
+
+    query = new OstProto::PortNeighborQuery;
+    query->mutable_port_id()->set_id(port->id());
+    if ((deviceIndex == 0) && port->isDeviceNeighborGenerationValid())
+        query->set_since_generation(port->deviceNeighborGeneration());
+    else {
+        query->set_device_index(deviceIndex);
+        query->set_device_count(kDeviceNeighborPageSize);
+    }
     neighList = new OstProto::PortNeighborList;
-    controller = new PbRpcController(portId, neighList);
+    controller = new PbRpcController(query, neighList);
 
-    serviceStub->getDeviceNeighbors(controller, portId, neighList,
+    serviceStub->getDeviceNeighborUpdates(controller, query, neighList,
         NewCallback(this, &PortGroup::processDeviceNeighbors,
                     portIndex, controller));
 }
@@ -707,8 +836,11 @@ _exit:
 void PortGroup::processDeviceNeighbors(
         int portIndex, PbRpcController *controller)
 {
+    OstProto::PortNeighborQuery *query
+        = static_cast<OstProto::PortNeighborQuery*>(controller->request());
     OstProto::PortNeighborList *neighList
         = static_cast<OstProto::PortNeighborList*>(controller->response());
+    uint nextIndex;
 
     qDebug("In %s (portIndex = %d)", __FUNCTION__, portIndex);
 
@@ -728,12 +860,33 @@ void PortGroup::processDeviceNeighbors(
         goto _exit;
     }
 
-    mPorts[portIndex]->clearDeviceNeighbors();
+    // A full (non-delta) list replaces whatever we have; the generation
+    // of the first page is used so that changes made on the server while
+    // we fetch the remaining pages are fetched again on the next refresh
+    if (!neighList->is_delta() && (query->device_index() == 0)) {
+        mPorts[portIndex]->clearDeviceNeighbors();
+        mPorts[portIndex]->setDeviceNeighborGeneration(
+                neighList->generation(), false);
+    }
+
     for(int i=0; i < neighList->ExtensionSize(OstEmul::device_neighbor); i++) {
         mPorts[portIndex]->insertDeviceNeighbors(
                 neighList->GetExtension(OstEmul::device_neighbor, i));
     }
 
+    nextIndex = query->device_index() + query->device_count();
+    if (query->device_count() && (nextIndex < neighList->device_count())) {
+        getDeviceNeighbors(portIndex, nextIndex);
+        goto _exit;
+    }
+
+    if (neighList->is_delta())
+        mPorts[portIndex]->setDeviceNeighborGeneration(
+                neighList->generation(), true);
+    else
+        mPorts[portIndex]->setDeviceNeighborGeneration(
+                mPorts[portIndex]->deviceNeighborGeneration(), true);
+
     mPorts[portIndex]->deviceInfoRefreshed();
 
 _exit:
@@ -1005,7 +1158,9 @@ void PortGroup::processStreamIdList(int portIndex, PbRpcController *controller)
 
         mPorts[portIndex]->when_syncComplete();
 
-        getStreamConfigList(portIndex);
+        // Only the stream summaries are fetched now; a stream's config
+        // is fetched when it is needed - see loadStreamConfig()
+        getStreamSummaryList(portIndex);
     }
 
 _exit:
@@ -1085,6 +1240,141 @@ _exit:
     delete controller;
 }
 
+void PortGroup::getStreamSummaryList(int portIndex, int streamIndex)
+{
+    if (mPorts[portIndex]->numStreams() == 0)
+        return;
+
+    qDebug("requesting stream summary list (port %d, stream %d)...",
+            portIndex, streamIndex);
+
+    OstProto::StreamSummaryQuery *query = new OstProto::StreamSummaryQuery;
+    OstProto::StreamSummaryList *summaryList
+            = new OstProto::StreamSummaryList;
+    PbRpcController *controller = new PbRpcController(query, summaryList);
+
+    query->mutable_port_id()->set_id(mPorts[portIndex]->id());
+    query->set_stream_index(streamIndex);
+    query->set_stream_count(kStreamSummaryPageSize);
+
+    serviceStub->getStreamSummaryList(controller, query, summaryList,
+            NewCallback(this, &PortGroup::processStreamSummaryList,
+                portIndex, controller));
+}
+
+void PortGroup::processStreamSummaryList(int portIndex,
+        PbRpcController *controller)
+{
+    OstProto::StreamSummaryQuery *query
+        = static_cast<OstProto::StreamSummaryQuery*>(controller->request());
+    OstProto::StreamSummaryList *summaryList
+        = static_cast<OstProto::StreamSummaryList*>(controller->response());
+    int nextIndex;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    if (controller->Failed())
+    {
+        // Older drone - fetch the config of all the streams instead
+        qDebug("%s: rpc failed(%s), fetching stream configs", __FUNCTION__,
+                qPrintable(controller->ErrorString()));
+        if (portIndex < numPorts())
+            getStreamConfigList(portIndex);
+        goto _exit;
+    }
+
+    Q_ASSERT(portIndex < numPorts());
+
+    if (summaryList->port_id().id() != mPorts[portIndex]->id())
+    {
+        qDebug("Invalid portId %d (expected %d) received for portIndex %d",
+            summaryList->port_id().id(), mPorts[portIndex]->id(), portIndex);
+        goto _exit;
+    }
+
+    mPorts[portIndex]->updateStreamSummaries(*summaryList);
+
+    // Request the next page, if any
+    nextIndex = query->stream_index() + summaryList->stream_size();
+    if (summaryList->stream_size()
+            && (nextIndex < int(summaryList->total_streams())))
+        getStreamSummaryList(portIndex, nextIndex);
+
+_exit:
+    delete controller;
+}
+
+/*!
+ Fetches the config of the given streams of the port, if not already
+ loaded, and waits for it
+
+ Returns true if the config of all the given streams is loaded
+*/
+bool PortGroup::loadStreamConfig(Port *port, const QList<int> &streamIndexes)
+{
+    int portIndex = mPorts.indexOf(port);
+    bool isLoaded = true;
+
+    if (portIndex < 0)
+        return false;
+
+    OstProto::StreamIdList *streamIdList = new OstProto::StreamIdList;
+    OstProto::StreamConfigList *streamConfigList
+            = new OstProto::StreamConfigList;
+    PbRpcController *controller = new PbRpcController(
+            streamIdList, streamConfigList);
+
+    streamIdList->mutable_port_id()->set_id(port->id());
+    foreach(int index, streamIndexes)
+    {
+        const Stream *stream = port->streamByIndex(index);
+        if (!stream->isConfigLoaded())
+            streamIdList->add_stream_id()->set_id(stream->id());
+    }
+
+    if (!streamIdList->stream_id_size()) {
+        delete controller;
+        return true;
+    }
+
+    if (state() != QAbstractSocket::ConnectedState) {
+        delete controller;
+        return false;
+    }
+
+    qDebug("loading stream config list (port %d, %d streams)...",
+            portIndex, streamIdList->stream_id_size());
+
+    isStreamConfigLoadPending_ = true;
+    serviceStub->getStreamConfig(controller, streamIdList, streamConfigList,
+            NewCallback(this, &PortGroup::processLoadedStreamConfigList,
+                portIndex, controller));
+
+    QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
+    while (isStreamConfigLoadPending_)
+        qApp->processEvents(QEventLoop::ExcludeUserInputEvents);
+    QApplication::restoreOverrideCursor();
+
+    // Port is deleted if we got disconnected meanwhile
+    if (state() != QAbstractSocket::ConnectedState)
+        return false;
+
+    foreach(int index, streamIndexes)
+    {
+        if (!port->streamByIndex(index)->isConfigLoaded())
+            isLoaded = false;
+    }
+
+    return isLoaded;
+}
+
+void PortGroup::processLoadedStreamConfigList(int portIndex,
+        PbRpcController *controller)
+{
+    processStreamConfigList(portIndex, controller);
+    isStreamConfigLoadPending_ = false;
+}
+
 void PortGroup::getDeviceGroupIdList()
 {
     using OstProto::PortId;
@@ -1283,6 +1573,14 @@ void PortGroup::processStartTxAck(PbRpcController *controller)
 {
     qDebug("In %s", __FUNCTION__);
 
+    if (controller->Failed())
+    {
+        qDebug("%s: rpc failed(%s)", __FUNCTION__,
+                qPrintable(controller->ErrorString()));
+        QMessageBox::warning(NULL, tr("Start Transmit"),
+                controller->ErrorString());
+    }
+
     delete controller;
 }
 
@@ -1521,6 +1819,47 @@ void PortGroup::processClearDeviceNeighborsAck(PbRpcController *controller)
     delete controller;
 }
 
+/*!
+ Ask drone to push port stats for all ports of this portgroup instead of
+ us polling for them; if drone doesn't support stats subscription (older
+ version), we fall back to polling via getPortStats()
+*/
+void PortGroup::subscribePortStats()
+{
+    qDebug("In %s", __FUNCTION__);
+
+    if (state() != QAbstractSocket::ConnectedState)
+        return;
+
+    OstProto::StatsSubscription *subscription =
+                                    new OstProto::StatsSubscription;
+    OstProto::Ack *ack = new OstProto::Ack;
+    PbRpcController *controller = new PbRpcController(subscription, ack);
+
+    subscription->mutable_port_id_list()->CopyFrom(*portIdList_);
+    subscription->set_interval(1000);
+
+    serviceStub->subscribeStats(controller, subscription, ack,
+            NewCallback(this, &PortGroup::processStatsSubscriptionAck,
+                        controller));
+}
+
+void PortGroup::processStatsSubscriptionAck(PbRpcController *controller)
+{
+    qDebug("In %s", __FUNCTION__);
+
+    if (controller->Failed()) {
+        qDebug("%s: rpc failed(%s), will poll for stats instead",
+                __FUNCTION__, qPrintable(controller->ErrorString()));
+        goto _exit;
+    }
+
+    isStatsSubscribed_ = true;
+
+_exit:
+    delete controller;
+}
+
 void PortGroup::getPortStats()
 {
     //qDebug("In %s", __FUNCTION__);
@@ -62,6 +62,9 @@ private:
     PbRpcChannel    *rpcChannel;
     PbRpcController *statsController;
     bool            isGetStatsPending_;
+    bool            isStatsSubscribed_;
+    bool            isStreamConfigLoadPending_;
+    static const int kStreamSummaryPageSize = 1000;
 
     OstProto::OstService::Stub *serviceStub;
 
@@ -118,12 +121,15 @@ public:
     void processAddStreamAck(PbRpcController *controller);
     void processDeleteStreamAck(PbRpcController *controller);
     void processModifyStreamAck(int portIndex, PbRpcController *controller);
+    void getPacketListInfo(int portIndex);
+    void processPacketListInfo(int portIndex, PbRpcController *controller);
 
     void processAddDeviceGroupAck(PbRpcController *controller);
     void processDeleteDeviceGroupAck(PbRpcController *controller);
     void processModifyDeviceGroupAck(int portIndex, PbRpcController *controller);
 
     void processDeviceList(int portIndex, PbRpcController *controller);
+    void getDeviceNeighbors(int portIndex, int deviceIndex = 0);
     void processDeviceNeighbors(int portIndex, PbRpcController *controller);
 
     void modifyPort(int portId, OstProto::Port portConfig);
@@ -134,6 +140,11 @@ public:
     void processStreamIdList(int portIndex, PbRpcController *controller);
     void getStreamConfigList(int portIndex);
     void processStreamConfigList(int portIndex, PbRpcController *controller);
+    void getStreamSummaryList(int portIndex, int streamIndex = 0);
+    void processStreamSummaryList(int portIndex, PbRpcController *controller);
+    bool loadStreamConfig(Port *port, const QList<int> &streamIndexes);
+    void processLoadedStreamConfigList(int portIndex,
+                                       PbRpcController *controller);
 
     void processModifyStreamAck(OstProto::Ack *ack);
 
@@ -161,6 +172,9 @@ public:
     void clearDeviceNeighbors(QList<uint> *portList = NULL);
     void processClearDeviceNeighborsAck(PbRpcController *controller);
 
+    bool isStatsSubscribed() const { return isStatsSubscribed_; }
+    void subscribePortStats();
+    void processStatsSubscriptionAck(PbRpcController *controller);
     void getPortStats();
     void processPortStatsList();
     void clearPortStats(QList<uint> *portList = NULL);
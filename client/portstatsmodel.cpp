@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "portgrouplist.h"
 
 #include <QTimer>
+#include <QtAlgorithms>
 
 enum {
     // XXX: The byte stats don't include FCS so include it in the overhead
@@ -73,19 +74,14 @@ void PortStatsModel::getDomainIndexes(const QModelIndex &index,
 {
     int portNum;
 
-    // TODO(LOW): Optimize using binary search: see qLowerBound()
+    // numPorts is sorted (cumulative), so find the first portgroup whose
+    // cumulative port count covers this port
     portNum = index.column() + 1;
-    for (portGroupIdx = 0; portGroupIdx < (uint) numPorts.size(); portGroupIdx++)
-        if (portNum <= numPorts.at(portGroupIdx))
-            break;
+    portGroupIdx = qLowerBound(numPorts.constBegin(), numPorts.constEnd(),
+                               quint16(portNum)) - numPorts.constBegin();
 
     if (portGroupIdx)
-    {
-        if (numPorts.at(portGroupIdx -1))
-            portIdx = (portNum - 1) - numPorts.at(portGroupIdx - 1); 
-        else
-            portIdx = portNum - 1; 
-    }
+        portIdx = (portNum - 1) - numPorts.at(portGroupIdx - 1);
     else
         portIdx = portNum - 1; 
 
@@ -117,9 +113,7 @@ QVariant PortStatsModel::data(const QModelIndex &index, int role) const
     // Check role
     if (role == Qt::DisplayRole)
     {
-        OstProto::PortStats    stats;
-
-        stats = pgl->mPortGroups.at(pgidx)->mPorts[pidx]->getStats();
+        quint64 value = stats_.value(index.column()*e_STAT_MAX + row);
 
         switch(row)
         {
@@ -129,76 +123,15 @@ QVariant PortStatsModel::data(const QModelIndex &index, int role) const
 
             // States
             case e_LINK_STATE:
-                return LinkStateName.at(stats.state().link_state());
+                return LinkStateName.value(int(value));
 
             case e_TRANSMIT_STATE:
-                return BoolStateName.at(stats.state().is_transmit_on());
-
             case e_CAPTURE_STATE:
-                return BoolStateName.at(stats.state().is_capture_on());
+                return BoolStateName.value(int(value));
 
             // Statistics
-            case e_STAT_FRAMES_RCVD:
-                return QString("%L1").arg(quint64(stats.rx_pkts()));
-
-            case e_STAT_FRAMES_SENT:
-                return QString("%L1").arg(quint64(stats.tx_pkts()));
-
-            case e_STAT_FRAME_SEND_RATE:
-                return QString("%L1").arg(quint64(stats.tx_pps()));
-
-            case e_STAT_FRAME_RECV_RATE:
-                return QString("%L1").arg(quint64(stats.rx_pps()));
-
-            case e_STAT_BYTES_RCVD:
-                return QString("%L1").arg(quint64(stats.rx_bytes()));
-
-            case e_STAT_BYTES_SENT:
-                return QString("%L1").arg(quint64(stats.tx_bytes()));
-
-            case e_STAT_BYTE_SEND_RATE:
-                return QString("%L1").arg(quint64(stats.tx_bps()));
-
-            case e_STAT_BYTE_RECV_RATE:
-                return QString("%L1").arg(quint64(stats.rx_bps()));
-
-            case e_STAT_BIT_SEND_RATE:
-                return QString("%L1").arg(quint64(
-                            stats.tx_bps()
-                                + stats.tx_pps()*kPerPacketByteOverhead)*8);
-
-            case e_STAT_BIT_RECV_RATE:
-                return QString("%L1").arg(quint64(
-                            stats.rx_bps()
-                                + stats.rx_pps()*kPerPacketByteOverhead)*8);
-
-#if 0
-            case e_STAT_FRAMES_RCVD_NIC:
-                return stats.rx_pkts_nic();
-
-            case e_STAT_FRAMES_SENT_NIC:
-                return stats.tx_pkts_nic();
-
-            case e_STAT_BYTES_RCVD_NIC:
-                return stats.rx_bytes_nic();
-
-            case e_STAT_BYTES_SENT_NIC:
-                return stats.tx_bytes_nic();
-#endif
-
-            case e_STAT_RX_DROPS:
-                return QString("%L1").arg(quint64(stats.rx_drops()));
-            case e_STAT_RX_ERRORS:
-                return QString("%L1").arg(quint64(stats.rx_errors()));
-            case e_STAT_RX_FIFO_ERRORS:
-                return QString("%L1").arg(quint64(stats.rx_fifo_errors()));
-            case e_STAT_RX_FRAME_ERRORS:
-                return QString("%L1").arg(quint64(stats.rx_frame_errors()));
-
             default:
-                qWarning("%s: Unhandled stats id %d\n", __FUNCTION__,
-                        index.row());
-                return 0;
+                return QString("%L1").arg(value);
         }
     }
     else if (role == Qt::TextAlignmentRole) 
@@ -301,6 +234,117 @@ void PortStatsModel::portListFromIndex(QModelIndexList indices,
     }
 }
 
+/*!
+ Returns the value to be displayed for the stat 'row' of a port as an
+ integer - states are returned as their enum values
+*/
+static quint64 statValue(const OstProto::PortStats &stats, int row)
+{
+    switch(row)
+    {
+        // States
+        case e_LINK_STATE:
+            return stats.state().link_state();
+        case e_TRANSMIT_STATE:
+            return stats.state().is_transmit_on();
+        case e_CAPTURE_STATE:
+            return stats.state().is_capture_on();
+
+        // Statistics
+        case e_STAT_FRAMES_RCVD:
+            return stats.rx_pkts();
+        case e_STAT_FRAMES_SENT:
+            return stats.tx_pkts();
+        case e_STAT_FRAME_SEND_RATE:
+            return stats.tx_pps();
+        case e_STAT_FRAME_RECV_RATE:
+            return stats.rx_pps();
+        case e_STAT_BYTES_RCVD:
+            return stats.rx_bytes();
+        case e_STAT_BYTES_SENT:
+            return stats.tx_bytes();
+        case e_STAT_BYTE_SEND_RATE:
+            return stats.tx_bps();
+        case e_STAT_BYTE_RECV_RATE:
+            return stats.rx_bps();
+        case e_STAT_BIT_SEND_RATE:
+            return quint64(stats.tx_bps()
+                    + stats.tx_pps()*kPerPacketByteOverhead)*8;
+        case e_STAT_BIT_RECV_RATE:
+            return quint64(stats.rx_bps()
+                    + stats.rx_pps()*kPerPacketByteOverhead)*8;
+
+        case e_STAT_RX_DROPS:
+            return stats.rx_drops();
+        case e_STAT_RX_ERRORS:
+            return stats.rx_errors();
+        case e_STAT_RX_FIFO_ERRORS:
+            return stats.rx_fifo_errors();
+        case e_STAT_RX_FRAME_ERRORS:
+            return stats.rx_frame_errors();
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+/*!
+ Refreshes the cached stats of all ports of the given portgroup
+
+ Returns true if any cached value changed, with topLeft and bottomRight
+ set to the smallest range covering all changed cells
+*/
+bool PortStatsModel::updateStatsCache(int portGroupIdx,
+        QModelIndex &topLeft, QModelIndex &bottomRight)
+{
+    PortGroup *portGroup = pgl->mPortGroups.at(portGroupIdx);
+    int firstCol = portGroupIdx ? numPorts.at(portGroupIdx - 1) : 0;
+    int lastCol = numPorts.at(portGroupIdx) - 1;
+    int top = e_STAT_MAX, bottom = -1, left = -1, right = -1;
+
+    // Port list may have changed without us having been told yet
+    if ((lastCol - firstCol + 1) > portGroup->numPorts())
+        lastCol = firstCol + portGroup->numPorts() - 1;
+
+    for (int col = firstCol; col <= lastCol; col++)
+    {
+        OstProto::PortStats stats = portGroup->mPorts.at(col - firstCol)
+                                                            ->getStats();
+        quint64 *cache = stats_.data() + col*e_STAT_MAX;
+        bool changed = false;
+
+        for (int row = e_STATE_START; row <= e_STATISTICS_END; row++)
+        {
+            quint64 value = statValue(stats, row);
+
+            if (cache[row] == value)
+                continue;
+
+            cache[row] = value;
+            changed = true;
+            if (row < top)
+                top = row;
+            if (row > bottom)
+                bottom = row;
+        }
+
+        if (changed) {
+            if (left < 0)
+                left = col;
+            right = col;
+        }
+    }
+
+    if (left < 0)
+        return false;
+
+    topLeft = index(top, left);
+    bottomRight = index(bottom, right);
+    return true;
+}
+
 //
 // Slots
 //
@@ -320,6 +364,13 @@ void PortStatsModel::when_portListChanged()
         numPorts.append(count);
     }
 
+    stats_.fill(0, count*e_STAT_MAX);
+    for (i = 0; i < numPorts.size(); i++)
+    {
+        QModelIndex topLeft, bottomRight;
+        updateStatsCache(i, topLeft, bottomRight);
+    }
+
     endResetModel();
 }
 
@@ -337,17 +388,26 @@ void PortStatsModel::on_portStatsUpdate(int port, void* /*stats*/)
 void PortStatsModel::updateStats()
 {
     // Request each portgroup to fetch updated stats - the port group
-    // raises a signal once updated stats are available
-    for (int i = 0; i < pgl->mPortGroups.size(); i++)
-        pgl->mPortGroups[i]->getPortStats();
+    // raises a signal once updated stats are available; portgroups that
+    // have subscribed to stats get them pushed by drone and are skipped
+    for (int i = 0; i < pgl->mPortGroups.size(); i++) {
+        if (!pgl->mPortGroups[i]->isStatsSubscribed())
+            pgl->mPortGroups[i]->getPortStats();
+    }
 }
 
-void PortStatsModel::when_portGroup_stats_update(quint32 /*portGroupId*/)
+void PortStatsModel::when_portGroup_stats_update(quint32 portGroupId)
 {
-    // FIXME(MED): update only the changed ports, not all
+    QModelIndex topLeft, bottomRight;
 
-    QModelIndex topLeft = index(0, 0, QModelIndex());
-    QModelIndex bottomRight = index(rowCount()-1, columnCount()-1, QModelIndex());
+    for (int i = 0; i < numPorts.size(); i++)
+    {
+        if (pgl->mPortGroups.at(i)->id() != portGroupId)
+            continue;
 
-    emit dataChanged(topLeft, bottomRight);
+        // Update only the changed cells of this portgroup's ports
+        if (updateStatsCache(i, topLeft, bottomRight))
+            emit dataChanged(topLeft, bottomRight);
+        break;
+    }
 }
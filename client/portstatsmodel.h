@@ -22,6 +22,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <QAbstractTableModel>
 #include <QStringList>
+#include <QVector>
 
 class QTimer;
 
@@ -156,10 +157,17 @@ class PortStatsModel : public QAbstractTableModel
         // Also it stores them as cumulative totals
         QList<quint16>    numPorts;
 
+        // Cached stat values - e_STAT_MAX values per port (column) stored
+        // contiguously in column order; data() is served from here and
+        // only the cells that changed are signalled on a stats update
+        QVector<quint64>  stats_;
+
         QTimer *timer;
 
         void getDomainIndexes(const QModelIndex &index,
               uint &portGroupIdx, uint &portIdx) const;
+        bool updateStatsCache(int portGroupIdx,
+              QModelIndex &topLeft, QModelIndex &bottomRight);
 
 };
 
@@ -223,7 +223,7 @@ bool PortsWindow::openSession(
  */
 bool PortsWindow::saveSession(
         OstProto::SessionContent *session, // OUT param
-        QString & /*error*/,
+        QString &error,
         QProgressDialog *progress)
 {
     int n = portGroupCount();
@@ -258,6 +258,15 @@ bool PortsWindow::saveSession(
             // fields
             pg.mPorts.at(j)->protoDataCopyInto(p);
 
+            QList<int> streamIndexes;
+            for (int k = 0; k < pg.mPorts.at(j)->numStreams(); k++)
+                streamIndexes.append(k);
+            if (!pg.loadStreamConfig(pg.mPorts.at(j), streamIndexes)) {
+                error = QString("Unable to fetch the streams of port %1-%2")
+                            .arg(pg.id()).arg(pg.mPorts.at(j)->id());
+                return false;
+            }
+
             for (int k = 0; k < pg.mPorts.at(j)->numStreams(); k++)
             {
                 OstProto::Stream *s = pc->add_streams();
@@ -283,6 +292,24 @@ bool PortsWindow::saveSession(
     return true;
 }
 
+/*!
+ Ensures the config of the given streams of the port is loaded - only the
+ stream summaries are fetched from drone when we connect to it
+*/
+bool PortsWindow::loadStreamConfig(const QModelIndex &portIndex,
+        const QList<int> &streamIndexes)
+{
+    PortGroup &portGroup = plm->portGroup(portIndex.parent());
+
+    if (portGroup.loadStreamConfig(&plm->port(portIndex), streamIndexes))
+        return true;
+
+    QMessageBox::warning(this, qApp->applicationName(),
+            tr("Unable to fetch the stream configuration from the port "
+               "group"));
+    return false;
+}
+
 void PortsWindow::showMyReservedPortsOnly(bool enabled)
 {
     if (!proxyPortModel)
@@ -310,9 +337,14 @@ void PortsWindow::on_tvStreamList_activated(const QModelIndex & index)
 
     qDebug("stream list activated\n");
 
-    Port &curPort = plm->port(proxyPortModel ?
+    QModelIndex current = proxyPortModel ?
         proxyPortModel->mapToSource(tvPortList->currentIndex()) :
-        tvPortList->currentIndex());
+        tvPortList->currentIndex();
+
+    if (!loadStreamConfig(current, QList<int>() << index.row()))
+        return;
+
+    Port &curPort = plm->port(current);
 
     QList<Stream*> streams;
     streams.append(curPort.mutableStreamByIndex(index.row(), false));
@@ -766,6 +798,10 @@ void PortsWindow::on_actionPort_Configuration_triggered()
     config.set_is_tracking_stream_stats(port.trackStreamStats());
     config.set_is_exclusive_control(port.hasExclusiveControl());
     config.set_user_name(port.userName().toStdString());
+    // Read-only, for display only
+    config.set_numa_node(port.numaNode());
+    config.set_tx_cpu_list(port.txCpuList().toStdString());
+    config.set_rx_cpu_list(port.rxCpuList().toStdString());
 
     PortConfigDialog dialog(config, port.getStats().state(), this);
 
@@ -818,13 +854,22 @@ void PortsWindow::on_actionEdit_Stream_triggered()
     if (!streamModel->hasSelection())
         return;
 
-    Port &curPort = plm->port(proxyPortModel ?
+    QModelIndex current = proxyPortModel ?
         proxyPortModel->mapToSource(tvPortList->currentIndex()) :
-        tvPortList->currentIndex());
+        tvPortList->currentIndex();
 
-    QList<Stream*> streams;
+    QList<int> rows;
     foreach(QModelIndex index, streamModel->selectedRows())
-        streams.append(curPort.mutableStreamByIndex(index.row(), false));
+        rows.append(index.row());
+
+    if (!loadStreamConfig(current, rows))
+        return;
+
+    Port &curPort = plm->port(current);
+
+    QList<Stream*> streams;
+    foreach(int row, rows)
+        streams.append(curPort.mutableStreamByIndex(row, false));
 
     StreamConfigDialog scd(streams, curPort, this);
     if (scd.exec() == QDialog::Accepted) {
@@ -855,6 +900,8 @@ void PortsWindow::on_actionDuplicate_Stream_triggered()
         QList<int> list;
         foreach(QModelIndex index, model->selectedRows())
             list.append(index.row());
+        if (!loadStreamConfig(current, list))
+            return;
         plm->port(current).duplicateStreams(list, count);
     }
     else
@@ -1016,6 +1063,14 @@ _retry:
 
     // TODO: all or selected?
 
+    {
+        QList<int> streamIndexes;
+        for (int i = 0; i < plm->port(current).numStreams(); i++)
+            streamIndexes.append(i);
+        if (!loadStreamConfig(current, streamIndexes))
+            goto _exit;
+    }
+
     if (!plm->port(current).saveStreams(fileName, fileType, errorStr))
         QMessageBox::critical(this, qApp->applicationName(), errorStr);
     else if (!errorStr.isEmpty())
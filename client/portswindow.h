@@ -62,6 +62,9 @@ private:
     QAbstractItemDelegate *delegate;
     QSortFilterProxyModel *proxyPortModel;
 
+    bool loadStreamConfig(const QModelIndex &portIndex,
+                          const QList<int> &streamIndexes);
+
 public slots:
     void showMyReservedPortsOnly(bool enabled);
 
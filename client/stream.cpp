@@ -28,9 +28,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "../common/protocollistiterator.h"
 #include "../common/abstractprotocol.h"
 
-Stream::Stream()
+Stream::Stream(bool isConfigLoaded)
+    : StreamBase(-1, isConfigLoaded)
 {
     //mId = 0xFFFFFFFF;
+    isConfigLoaded_ = isConfigLoaded;
     setEnabled(true);
 }
 
@@ -50,6 +52,64 @@ void Stream::storeProtocolWidgets()
     return;
 }
 
+/*!
+ Updates an unloaded stream from the summary received from the server;
+ ignored once the stream's (full) config is loaded
+*/
+void Stream::summaryCopyFrom(const OstProto::Stream &summary)
+{
+    if (isConfigLoaded_)
+        return;
+
+    protoDataCopyFrom(summary);
+    summary_.Clear();
+    summaryCopyInto(summary_);
+}
+
+/*!
+ Updates the stream from its (full) config received from the server
+
+ If the stream was not loaded and its core or control (e.g. ordinal or
+ rate) has been changed locally since its summary was received, the local
+ changes are retained - only the rest of the config is taken from stream
+*/
+void Stream::configCopyFrom(const OstProto::Stream &stream)
+{
+    if (isSummaryChanged()) {
+        OstProto::Stream config(stream);
+        OstProto::Stream local;
+
+        summaryCopyInto(local);
+        config.mutable_core()->CopyFrom(local.core());
+        config.mutable_control()->CopyFrom(local.control());
+        protoDataCopyFrom(config);
+    }
+    else
+        protoDataCopyFrom(stream);
+
+    isConfigLoaded_ = true;
+    summary_.Clear();
+}
+
+/*!
+ Returns true if the core or control of an unloaded stream has been
+ changed locally (e.g. moved or rate changed) since its summary was
+ received - such a stream needs to be loaded to be sent back to the server
+*/
+bool Stream::isSummaryChanged() const
+{
+    OstProto::Stream local;
+
+    if (isConfigLoaded_)
+        return false;
+
+    summaryCopyInto(local);
+    return (local.core().SerializeAsString()
+                != summary_.core().SerializeAsString())
+        || (local.control().SerializeAsString()
+                != summary_.control().SerializeAsString());
+}
+
 quint64 getDeviceMacAddress(
         int /*portId*/,
         int /*streamId*/,
@@ -31,12 +31,22 @@ class Stream : public StreamBase {
 
     //quint32                    mId;
 
+    bool isConfigLoaded_;
+    OstProto::Stream summary_;
+
 public:
-    Stream();
+    Stream(bool isConfigLoaded = true);
     ~Stream();
 
     void loadProtocolWidgets();
     void storeProtocolWidgets();
+
+    // A stream whose config is not (yet) loaded has only what's in its
+    // summary - id, core and control - and no protocols
+    bool isConfigLoaded() const { return isConfigLoaded_; }
+    void summaryCopyFrom(const OstProto::Stream &summary);
+    void configCopyFrom(const OstProto::Stream &stream);
+    bool isSummaryChanged() const;
 };
 
 #endif
@@ -402,6 +402,9 @@ void StreamConfigDialog::storeProtocolWidgets()
         w->storeWidget(p);
     }
     delete iter;
+
+    // Protocol fields are modified directly by the widgets
+    mpStream->invalidateFrameLayout();
 }
 
 void StreamConfigDialog::on_cmbPktLenMode_currentIndexChanged(QString mode)
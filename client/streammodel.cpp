@@ -151,6 +151,17 @@ bool StreamModel::setData(const QModelIndex &index, const QVariant &value, int r
 
     if (index.isValid()) 
     {
+        // Stream can be modified only after its config is loaded
+        if (index.column() != StreamIcon)
+        {
+            int pgIndex = pgl->indexOfPortGroup(mCurrentPort->portGroupId());
+            QList<int> rows = QList<int>() << index.row();
+
+            if ((pgIndex < 0) || !pgl->mPortGroups.at(pgIndex)
+                                    ->loadStreamConfig(mCurrentPort, rows))
+                return false;
+        }
+
         switch (index.column())
         {
         // Edit Supported Fields
@@ -49,8 +49,6 @@ static QStringList aggrStatTitles = QStringList()
     << "Total\nRx Pkts"
     << "Total\nPkt Loss";
 
-static const uint kAggrGuid = 0xffffffff;
-
 StreamStatsModel::StreamStatsModel(QObject *parent)
     : QAbstractTableModel(parent)
 {
@@ -59,7 +57,10 @@ StreamStatsModel::StreamStatsModel(QObject *parent)
 
 int StreamStatsModel::rowCount(const QModelIndex &/*parent*/) const
 {
-    return guidList_.size();
+    if (!guidList_.size())
+        return 0;
+
+    return guidList_.size() + 1; // +1 for the aggregate row
 }
 
 int StreamStatsModel::columnCount(const QModelIndex &/*parent*/) const
@@ -87,7 +88,7 @@ QVariant StreamStatsModel::headerData(
                         .arg(portList_.at(section/kMaxStreamStats).second)
                         .arg(statTitles.at(section % kMaxStreamStats));
     case Qt::Vertical:   // Row Header
-        if (section == (guidList_.size() - 1))
+        if (section == guidList_.size())
             return QString("GUID Total");
         return QString("Stream GUID %1")
                         .arg(guidList_.at(section));
@@ -102,53 +103,63 @@ QVariant StreamStatsModel::data(const QModelIndex &index, int role) const
     if (role == Qt::TextAlignmentRole)
         return Qt::AlignRight;
 
+    int row = index.row();
+    bool isAggrRow = (row == guidList_.size());
     int portColumn = index.column() - kMaxAggrStreamStats;
     if (role == Qt::BackgroundRole) {
         if (portColumn < 0)
             return QBrush(QColor("lavender")); // Aggregate Column
-        if (index.row() == (guidList_.size() - 1))
+        if (isAggrRow)
             return QBrush(QColor("burlywood")); // Aggregate Row
         else if ((portColumn/kMaxStreamStats) & 1)
             return QBrush(QColor("beige")); // Color alternate Ports
     }
 
-    Guid guid = guidList_.at(index.row());
-    if (role == Qt::ForegroundRole) {
-        if ((index.column() == kAggrPktLoss)
-                && aggrGuidStats_.value(guid).pktLoss)
-            return QBrush(QColor("firebrick"));
-    }
-
-    if (role != Qt::DisplayRole)
+    if ((role != Qt::DisplayRole) && (role != Qt::ForegroundRole))
         return QVariant();
 
     if (index.column() < kMaxAggrStreamStats) {
+        AggrGuidStats aggr = isAggrRow ?
+                                aggrAggrStats_ : aggrGuidStats_.value(row);
+
+        if (role == Qt::ForegroundRole) {
+            if ((index.column() == kAggrPktLoss) && aggr.pktLoss)
+                return QBrush(QColor("firebrick"));
+            return QVariant();
+        }
+
         int stat = index.column() % kMaxAggrStreamStats;
         switch (stat) {
         case kAggrRxPkts:
-            return QString("%L1").arg(aggrGuidStats_.value(guid).rxPkts);
+            return QString("%L1").arg(aggr.rxPkts);
         case kAggrTxPkts:
-            return QString("%L1").arg(aggrGuidStats_.value(guid).txPkts);
+            return QString("%L1").arg(aggr.txPkts);
         case kAggrPktLoss:
-            return QString("%L1").arg(aggrGuidStats_.value(guid).pktLoss);
+            return QString("%L1").arg(aggr.pktLoss);
         default:
             break;
         };
         return QVariant();
     }
 
-    PortGroupPort pgp = portList_.at(portColumn/kMaxStreamStats);
+    if (role != Qt::DisplayRole)
+        return QVariant();
+
+    int port = portColumn/kMaxStreamStats;
+    StreamStats ss = isAggrRow ?
+                        aggrPortStats_.value(port) :
+                        streamStats_.at(port).value(row);
     int stat = portColumn % kMaxStreamStats;
 
     switch (stat) {
     case kRxPkts:
-        return QString("%L1").arg(streamStats_.value(guid).value(pgp).rxPkts);
+        return QString("%L1").arg(ss.rxPkts);
     case kTxPkts:
-        return QString("%L1").arg(streamStats_.value(guid).value(pgp).txPkts);
+        return QString("%L1").arg(ss.txPkts);
     case kRxBytes:
-        return QString("%L1").arg(streamStats_.value(guid).value(pgp).rxBytes);
+        return QString("%L1").arg(ss.rxBytes);
     case kTxBytes:
-        return QString("%L1").arg(streamStats_.value(guid).value(pgp).txBytes);
+        return QString("%L1").arg(ss.txBytes);
     default:
         break;
     }
@@ -166,9 +177,13 @@ void StreamStatsModel::clearStats()
 #endif
 
     guidList_.clear();
+    guidRow_.clear();
     portList_.clear();
+    portIndex_.clear();
     streamStats_.clear();
+    aggrPortStats_.clear();
     aggrGuidStats_.clear();
+    aggrAggrStats_ = AggrGuidStats();
 
 #if QT_VERSION >= 0x040600
     endResetModel();
@@ -182,52 +197,119 @@ void StreamStatsModel::appendStreamStatsList(
         const OstProto::StreamStatsList *stats)
 {
     int n = stats->stream_stats_size();
+    QList<Guid> newGuids;
+    QList<PortGroupPort> newPorts;
+    int top = -1, bottom = -1, left = -1, right = -1;
 
-#if QT_VERSION >= 0x040600
-    beginResetModel();
-#endif
-
+    // Find the new guids (rows) and ports (columns) first, so that they
+    // are inserted in one go instead of resetting the whole model
     for (int i = 0; i < n; i++) {
         const OstProto::StreamStats &s = stats->stream_stats(i);
         PortGroupPort pgp = PortGroupPort(portGroupId, s.port_id().id());
         Guid guid = s.stream_guid().id();
-        StreamStats &ss = streamStats_[guid][pgp];
-        StreamStats &aggrPort = streamStats_[kAggrGuid][pgp];
-        AggrGuidStats &aggrGuid = aggrGuidStats_[guid];
-        AggrGuidStats &aggrAggr = aggrGuidStats_[kAggrGuid];
+
+        if (!guidRow_.contains(guid)) {
+            guidRow_.insert(guid, guidList_.size() + newGuids.size());
+            newGuids.append(guid);
+        }
+        if (!portIndex_.contains(pgp)) {
+            portIndex_.insert(pgp, portList_.size() + newPorts.size());
+            newPorts.append(pgp);
+        }
+    }
+
+    if (newGuids.size()) {
+        // New rows go before the aggregate row (added with the first rows)
+        int first = guidList_.size();
+        int last = first + newGuids.size() - (guidList_.size() ? 1 : 0);
+
+        beginInsertRows(QModelIndex(), first, last);
+        guidList_.append(newGuids);
+        aggrGuidStats_.insert(aggrGuidStats_.size(), newGuids.size(),
+                              AggrGuidStats());
+        endInsertRows();
+    }
+
+    if (newPorts.size()) {
+        // Aggregate columns are added with the first port's columns
+        int first = portList_.size() ?
+                kMaxAggrStreamStats + portList_.size()*kMaxStreamStats : 0;
+        int last = kMaxAggrStreamStats
+                + (portList_.size() + newPorts.size())*kMaxStreamStats - 1;
+
+        beginInsertColumns(QModelIndex(), first, last);
+        portList_.append(newPorts);
+        for (int i = 0; i < newPorts.size(); i++)
+            streamStats_.append(QVector<StreamStats>());
+        aggrPortStats_.insert(aggrPortStats_.size(), newPorts.size(),
+                              StreamStats());
+        endInsertColumns();
+    }
+
+    for (int i = 0; i < n; i++) {
+        const OstProto::StreamStats &s = stats->stream_stats(i);
+        PortGroupPort pgp = PortGroupPort(portGroupId, s.port_id().id());
+        int row = guidRow_.value(s.stream_guid().id());
+        int port = portIndex_.value(pgp);
+        QVector<StreamStats> &portStats = streamStats_[port];
+
+        if (portStats.size() <= row)
+            portStats.insert(portStats.size(),
+                             guidList_.size() - portStats.size(),
+                             StreamStats());
+
+        StreamStats &ss = portStats[row];
+        StreamStats old = ss;
+        StreamStats &aggrPort = aggrPortStats_[port];
+        AggrGuidStats &aggrGuid = aggrGuidStats_[row];
 
         ss.rxPkts = s.rx_pkts();
         ss.txPkts = s.tx_pkts();
         ss.rxBytes = s.rx_bytes();
         ss.txBytes = s.tx_bytes();
 
-        aggrPort.rxPkts += ss.rxPkts;
-        aggrPort.txPkts += ss.txPkts;
-        aggrPort.rxBytes += ss.rxBytes;
-        aggrPort.txBytes += ss.txBytes;
-
-        aggrGuid.rxPkts += ss.rxPkts;
-        aggrGuid.txPkts += ss.txPkts;
-        aggrGuid.pktLoss += ss.txPkts - ss.rxPkts;
-
-        aggrAggr.rxPkts += ss.rxPkts;
-        aggrAggr.txPkts += ss.txPkts;
-        aggrAggr.pktLoss += ss.txPkts - ss.rxPkts;
-
-        if (!portList_.contains(pgp))
-            portList_.append(pgp);
-        if (!guidList_.contains(guid))
-            guidList_.append(guid);
+        if ((ss.rxPkts == old.rxPkts) && (ss.txPkts == old.txPkts)
+                && (ss.rxBytes == old.rxBytes) && (ss.txBytes == old.txBytes))
+            continue;
+
+        // Apply only the delta to the aggregates
+        aggrPort.rxPkts += ss.rxPkts - old.rxPkts;
+        aggrPort.txPkts += ss.txPkts - old.txPkts;
+        aggrPort.rxBytes += ss.rxBytes - old.rxBytes;
+        aggrPort.txBytes += ss.txBytes - old.txBytes;
+
+        qint64 lossDelta = qint64(ss.txPkts - ss.rxPkts)
+                            - qint64(old.txPkts - old.rxPkts);
+
+        aggrGuid.rxPkts += ss.rxPkts - old.rxPkts;
+        aggrGuid.txPkts += ss.txPkts - old.txPkts;
+        aggrGuid.pktLoss += lossDelta;
+
+        aggrAggrStats_.rxPkts += ss.rxPkts - old.rxPkts;
+        aggrAggrStats_.txPkts += ss.txPkts - old.txPkts;
+        aggrAggrStats_.pktLoss += lossDelta;
+
+        if ((top < 0) || (row < top))
+            top = row;
+        if (row > bottom)
+            bottom = row;
+        if ((left < 0) || (port < left))
+            left = port;
+        if (port > right)
+            right = port;
     }
 
-    if (guidList_.size())
-        guidList_.append(kAggrGuid);
+    if (top >= 0) {
+        int aggrRow = guidList_.size();
+        int firstCol = kMaxAggrStreamStats + left*kMaxStreamStats;
+        int lastCol = kMaxAggrStreamStats + (right + 1)*kMaxStreamStats - 1;
 
-#if QT_VERSION >= 0x040600
-    endResetModel();
-#else
-    reset();
-#endif
+        // Changed cells, their aggregate columns and their aggregate row
+        emit dataChanged(index(top, firstCol), index(bottom, lastCol));
+        emit dataChanged(index(top, 0),
+                         index(aggrRow, kMaxAggrStreamStats - 1));
+        emit dataChanged(index(aggrRow, firstCol), index(aggrRow, lastCol));
+    }
 
     // Prevent receiving any future updates from this sender
     disconnect(sender(), 0, this, 0);
@@ -25,6 +25,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QList>
 #include <QPair>
 #include <QStringList>
+#include <QVector>
 
 namespace OstProto {
     class StreamStatsList;
@@ -61,10 +62,18 @@ private:
         quint64 txPkts;
         qint64 pktLoss;
     };
-    QList<Guid> guidList_;
+
+    // Stats are kept in flat arrays - per port (column group) and indexed
+    // by the guid's row - so that an update touches only the cells that
+    // changed; aggregates are adjusted by the delta, not recomputed
+    QList<Guid> guidList_; // excludes the aggregate (total) row
+    QHash<Guid, int> guidRow_;
     QList<PortGroupPort> portList_;
-    QHash<Guid, QHash<PortGroupPort, StreamStats> > streamStats_;
-    QHash<Guid, AggrGuidStats> aggrGuidStats_;
+    QHash<PortGroupPort, int> portIndex_;
+    QList<QVector<StreamStats> > streamStats_;  // [port][row]
+    QVector<StreamStats> aggrPortStats_;        // [port]
+    QVector<AggrGuidStats> aggrGuidStats_;      // [row]
+    AggrGuidStats aggrAggrStats_;
 };
 #endif
 
@@ -23,9 +23,21 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "streambase.h"
 
 #include "bswap.h"
+#include "checksum.h"
+#include "prng.h"
 
+#include <QThreadStorage>
+#include <QVarLengthArray>
 #include <qendian.h>
 
+// randomKey() index range for the variable fields
+static const int kVariableFieldRandomIndex = 0x8000;
+
+#ifndef QT_NO_DEBUG
+// protocolFrameCksum() recursion depth of each thread
+static QThreadStorage<int*> cksumRecursionCount;
+#endif
+
 /*!
   \class AbstractProtocol
 
@@ -80,6 +92,7 @@ AbstractProtocol::AbstractProtocol(StreamBase *stream, AbstractProtocol *parent)
     _frameFieldCount = -1;
     _frameVariableCount = -1;
     protoSize = -1;
+    _isRandomKeyValid = false;
     _hasPayload = true;
     _cacheFlags |= FieldFrameBitOffsetCache;
 }
@@ -151,6 +164,9 @@ void AbstractProtocol::commonProtoDataCopyFrom(const OstProto::Protocol &protoco
         vf = _data.add_variable_field();
         vf->CopyFrom(protocol.variable_field(i));
     }
+
+    if (mpStream)
+        mpStream->invalidateFrameLayout();
 }
 
 /*!
@@ -405,6 +421,8 @@ void AbstractProtocol::appendVariableField(const OstProto::VariableField &vf)
 
     // Update the cached value
     _frameVariableCount = lcm(_frameVariableCount, vf.count());
+    if (mpStream)
+        mpStream->invalidateFrameLayout();
 }
 
 /*!
@@ -436,6 +454,8 @@ void AbstractProtocol::removeVariableField(int index)
         _frameVariableCount = lcm(_frameVariableCount,
                                   _data.variable_field(i).count());
     }
+    if (mpStream)
+        mpStream->invalidateFrameLayout();
 }
 
 /*!
@@ -460,10 +480,22 @@ OstProto::VariableField* AbstractProtocol::mutableVariableField(int index)
 
     // Invalidate the cached value as the caller may potentially modify it
     _frameVariableCount = -1;
+    if (mpStream)
+        mpStream->invalidateFrameLayout();
 
     return _data.mutable_variable_field(index);
 }
 
+/*!
+ * Returns the prng key of the variableField at the specified index - the
+ * value of a kRandom variableField for a frame is value + (the type sized
+ * part of) prng::value(key, frameIndex), masked
+ */
+quint64 AbstractProtocol::variableFieldRandomKey(int index) const
+{
+    return randomKey(kVariableFieldRandomIndex | index);
+}
+
 /*!
   Returns the protocolIdType for the protocol
 
@@ -552,6 +584,12 @@ int AbstractProtocol::protocolFrameOffset(int streamIndex) const
 {
     int size = 0;
     AbstractProtocol *p = prev;
+
+    // Use the stream's cached frame layout, if available
+    if (mpStream && ((size = mpStream->protocolFrameOffset(this)) >= 0))
+        return size;
+
+    size = 0;
     while (p)
     {
         size += p->protocolFrameSize(streamIndex);
@@ -575,6 +613,12 @@ int AbstractProtocol::protocolFramePayloadSize(int streamIndex) const
 {
     int size = 0;
     AbstractProtocol *p = next;
+
+    // Use the stream's cached frame layout, if available
+    if (mpStream && ((size = mpStream->protocolFramePayloadSize(this)) >= 0))
+        return size;
+
+    size = 0;
     while (p)
     {
         size += p->protocolFrameSize(streamIndex);
@@ -694,12 +738,105 @@ QByteArray AbstractProtocol::protocolFrameValue(int streamIndex, bool forCksum)
     for (int i = 0; i < _data.variable_field_size(); i++)
     {
         OstProto::VariableField vf = _data.variable_field(i);
-        varyProtocolFrameValue(proto, streamIndex, vf);
+        varyProtocolFrameValue((uchar*)proto.data(), proto.size(),
+                               streamIndex, vf, variableFieldRandomKey(i));
     }
 
     return proto;
 }
 
+/*!
+  Encodes the protocol (and its fields) into buf which has space for 
+  bufSize bytes and returns the number of bytes written - this is the same 
+  as the QByteArray returned by protocolFrameValue(streamIndex, forCksum),
+  truncated to bufSize if required
+
+  Unlike the QByteArray variant, this does not allocate any memory if the
+  protocol implements writeProtocolFrameValue(); otherwise it falls back
+  to the QByteArray variant
+*/
+int AbstractProtocol::protocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    int len = writeProtocolFrameValue(buf, bufSize, streamIndex, forCksum);
+
+    if (len < 0) {
+        QByteArray proto = protocolFrameValue(streamIndex, forCksum);
+
+        len = qMin(proto.size(), bufSize);
+        memcpy(buf, proto.constData(), len);
+        return len;
+    }
+
+    for (int i = 0; i < _data.variable_field_size(); i++)
+    {
+        varyProtocolFrameValue(buf, len, streamIndex, _data.variable_field(i),
+                               variableFieldRandomKey(i));
+    }
+
+    return len;
+}
+
+/*!
+  Encodes the protocol directly into buf (which has space for bufSize 
+  bytes) without going through fieldData() and returns the number of 
+  bytes written; variable fields are applied by the caller
+
+  A subclass may reimplement this as a fast path for building packets - 
+  the encoded value MUST be the same as that from fieldData(). If the 
+  subclass cannot encode the current configuration (or the buffer is too
+  small), it should return -1 and protocolFrameValue() falls back to the
+  fieldData() based encoding
+
+  The default implementation returns -1
+*/
+int AbstractProtocol::writeProtocolFrameValue(uchar* /*buf*/, int /*bufSize*/,
+        int /*streamIndex*/, bool /*forCksum*/) const
+{
+    return -1;
+}
+
+/*!
+  Computes the lazily evaluated caches (field counts, size, variable count,
+  field offsets etc.) of the protocol upfront
+
+  Once primed, generating a frame only reads these caches, so that frames
+  can be generated concurrently from multiple threads - see
+  isProtocolFrameValueThreadSafe() and StreamBase::renderFrames()
+
+  Subclasses which have lazy caches of their own or contain other protocols
+  should reimplement this and call the base class method
+*/
+void AbstractProtocol::primeCaches() const
+{
+    metaFieldCount();
+    frameFieldCount();
+    shortName();
+    protocolFrameVariableCount();
+    protocolFrameSize();
+    protocolRandomKey();
+
+    if (_cacheFlags & FieldFrameBitOffsetCache) {
+        for (int i = 0; i < fieldCount(); i++) {
+            if (fieldFlags(i).testFlag(FrameField))
+                fieldFrameBitOffset(i);
+        }
+    }
+}
+
+/*!
+  Returns true if protocolFrameValue() can be called concurrently from
+  multiple threads after primeCaches(), false otherwise
+
+  The default implementation returns true. A subclass should reimplement
+  if it uses non-reentrant services to build its frame value e.g. MAC
+  address resolution
+*/
+bool AbstractProtocol::isProtocolFrameValueThreadSafe() const
+{
+    return true;
+}
+
 /*!
   Returns true if the protocol varies one or more of its fields at run-time,
   false otherwise
@@ -709,6 +846,27 @@ bool AbstractProtocol::isProtocolFrameValueVariable() const
     return (protocolFrameVariableCount() > 1);
 }
 
+/*!
+  Returns true if the protocol has one or more random fields, false
+  otherwise
+
+  Random field values depend on the stream index itself and do not repeat
+  every protocolFrameVariableCount() frames like other varying fields
+
+  The default implementation returns true if any of the variableFields is
+  random. A subclass with its own random fields should reimplement and
+  also call the base class method
+*/
+bool AbstractProtocol::isProtocolFrameValueRandom() const
+{
+    for (int i = 0; i < _data.variable_field_size(); i++) {
+        if (_data.variable_field(i).mode() == OstProto::VariableField::kRandom)
+            return true;
+    }
+
+    return false;
+}
+
 /*!
   Returns true if the protocol varies its size at run-time, false otherwise
 
@@ -851,40 +1009,27 @@ bool AbstractProtocol::protocolHasPayload() const
 quint32 AbstractProtocol::protocolFrameCksum(int streamIndex,
     CksumType cksumType) const
 {
-    static int recursionCount = 0;
     quint32 cksum = 0xFFFFFFFF;
 
+#ifndef QT_NO_DEBUG
+    // Per thread, as frames may be generated concurrently
+    if (!cksumRecursionCount.hasLocalData())
+        cksumRecursionCount.setLocalData(new int(0));
+    int &recursionCount = *cksumRecursionCount.localData();
+
     recursionCount++;
     Q_ASSERT_X(recursionCount < 10, "protocolFrameCksum", "potential infinite recursion - does a protocol checksum field not implement FieldBitSize?");
+#endif
 
     switch(cksumType)
     {
         case CksumIp:
         {
-            QByteArray fv;
-            quint16 *ip;
-            quint32 len, sum = 0;
-
-            fv = protocolFrameValue(streamIndex, true);
-            ip = (quint16*) fv.constData();
-            len = fv.size();
-
-            while(len > 1)
-            {
-                sum += *ip;
-                if(sum & 0x80000000)
-                    sum = (sum & 0xFFFF) + (sum >> 16);
-                ip++;
-                len -= 2;
-            }
-
-            if (len)
-                sum += (unsigned short) *(unsigned char *)ip;
+            QVarLengthArray<uchar, 2048> fv(protocolFrameSize(streamIndex));
+            int len;
 
-            while(sum>>16)
-                sum = (sum & 0xFFFF) + (sum >> 16);
-
-            cksum = qFromBigEndian((quint16) ~sum);
+            len = protocolFrameValue(fv.data(), fv.size(), streamIndex, true);
+            cksum = ipCksum(fv.constData(), len);
             break;
         }
 
@@ -910,10 +1055,24 @@ quint32 AbstractProtocol::protocolFrameCksum(int streamIndex,
             break;
     }
 
+#ifndef QT_NO_DEBUG
     recursionCount--;
+#endif
     return cksum;
 }
 
+/*!
+  Returns the IP checksum of the given buffer in the same form as 
+  protocolFrameCksum() i.e. to be written into the frame using 
+  qToBigEndian()
+*/
+quint16 AbstractProtocol::ipCksum(const uchar *buf, int len)
+{
+    quint16 sum = checksumOnesSum(buf, len);
+
+    return qFromBigEndian((quint16) ~sum);
+}
+
 /*!
   Returns the checksum of the requested type for the protocol's header 
 
@@ -1074,27 +1233,82 @@ quint64 AbstractProtocol::lcm(quint64 u, quint64 v)
     return (u * v)/gcd(u, v);
 }
 
+/*!
+  Returns the key of the random sequence identified by index for this
+  protocol in its stream - use with the prng:: functions and the stream
+  index as counter so that the random value for a frame is always the same
+
+  Subclasses use the field index as index; indices 0x8000 and above are
+  reserved for the variable fields
+
+  The protocol's position in the stream is mixed into the key, so that
+  multiple instances of the same protocol in a stream (e.g. IPv4 over
+  IPv4 or stacked VLANs) have different random sequences
+*/
+quint64 AbstractProtocol::randomKey(int index) const
+{
+    return prng::value(protocolRandomKey(), quint64(index & 0xffff));
+}
+
+/*!
+  Returns the key of this protocol in its stream from which randomKey()
+  derives the key for each index
+
+  The key is cached (and computed upfront by primeCaches()) as it is
+  needed for every random value of every frame - it is recomputed only
+  after the stream or its protocols change
+*/
+quint64 AbstractProtocol::protocolRandomKey() const
+{
+    quint32 domain = protocolNumber() << 16;
+    quint64 position = 0;
+
+    if (mpStream && _isRandomKeyValid
+            && (_randomKeyGeneration == mpStream->layoutGeneration()))
+        return _randomKey;
+
+    // Position is the number of protocols preceding this one at each
+    // level - from this protocol upto the top level one containing it
+    for (const AbstractProtocol *p = this; p; p = p->parent) {
+        quint64 count = 0;
+
+        for (const AbstractProtocol *q = p->prev; q; q = q->prev)
+            count++;
+        position = (position << 8) | (count & 0xff);
+    }
+
+    if (!mpStream)
+        return prng::key(prng::key(0, domain), position);
+
+    _randomKey = prng::key(mpStream->randomKey(domain), position);
+    _randomKeyGeneration = mpStream->layoutGeneration();
+    _isRandomKeyValid = true;
+
+    return _randomKey;
+}
+
 /* 
  * XXX: varyCounter() is not a member of AbstractProtocol to avoid
  * moving it into the header file and thereby keeping the header file
  * clean
  */
 template <typename T>
-bool varyCounter(QString protocolName, QByteArray &buf, int frameIndex, 
-                 const OstProto::VariableField &varField)
+bool varyCounter(QString protocolName, uchar *buf, int bufSize,
+                 int frameIndex, const OstProto::VariableField &varField,
+                 quint64 randomKey)
 {
     int x = (frameIndex % varField.count()) * varField.step();
 
     T oldfv, newfv;
 
-    if ((varField.offset() + sizeof(T)) > uint(buf.size()))
+    if ((varField.offset() + sizeof(T)) > uint(bufSize))
     {
         qWarning("%s varField ofs %d beyond protocol frame %d - skipping", 
-                qPrintable(protocolName), varField.offset(), buf.size());
+                qPrintable(protocolName), varField.offset(), bufSize);
         return false;
     }
 
-    oldfv = *((T*)((uchar*)buf.constData() + varField.offset()));
+    oldfv = *((T*)(buf + varField.offset()));
     if (sizeof(T) > sizeof(quint8))
         oldfv = qFromBigEndian(oldfv);
 
@@ -1110,7 +1324,8 @@ bool varyCounter(QString protocolName, QByteArray &buf, int frameIndex,
             break;
         case OstProto::VariableField::kRandom:
             newfv = (oldfv & ~varField.mask()) 
-                | ((varField.value() + qrand()) & varField.mask());
+                | ((varField.value() + T(prng::value(randomKey, frameIndex)))
+                    & varField.mask());
             break;
         default:
             qWarning("%s Unsupported varField mode %d", 
@@ -1119,28 +1334,32 @@ bool varyCounter(QString protocolName, QByteArray &buf, int frameIndex,
     }
 
     if (sizeof(T) == sizeof(quint8))
-        *((uchar*)buf.constData() + varField.offset()) = newfv;
+        *(buf + varField.offset()) = newfv;
     else
-        qToBigEndian(newfv, (uchar*)buf.constData() + varField.offset());
+        qToBigEndian(newfv, buf + varField.offset());
 
     qDebug("%s varField ofs %d oldfv %x newfv %x", 
             qPrintable(protocolName), varField.offset(), oldfv, newfv);
     return true;
 }
 
-void AbstractProtocol::varyProtocolFrameValue(QByteArray &buf, int frameIndex,
-        const OstProto::VariableField &varField) const
+void AbstractProtocol::varyProtocolFrameValue(uchar *buf, int bufSize,
+        int frameIndex, const OstProto::VariableField &varField,
+        quint64 randomKey) const
 {
 
     switch (varField.type()) {
     case OstProto::VariableField::kCounter8:
-        varyCounter<quint8>(shortName(), buf, frameIndex, varField);
+        varyCounter<quint8>(shortName(), buf, bufSize, frameIndex, varField,
+                           randomKey);
         break;
     case OstProto::VariableField::kCounter16:
-        varyCounter<quint16>(shortName(), buf, frameIndex, varField);
+        varyCounter<quint16>(shortName(), buf, bufSize, frameIndex, varField,
+                           randomKey);
         break;
     case OstProto::VariableField::kCounter32:
-        varyCounter<quint32>(shortName(), buf, frameIndex, varField);
+        varyCounter<quint32>(shortName(), buf, bufSize, frameIndex, varField,
+                           randomKey);
         break;
     default:
         break;
@@ -52,6 +52,9 @@ private:
     mutable int protoSize;
     mutable QString protoAbbr;
     mutable QHash<int, int> _fieldFrameBitOffset;
+    mutable quint64 _randomKey;
+    mutable quint32 _randomKeyGeneration;
+    mutable bool _isRandomKeyValid;
     OstProto::Protocol _data;
 
 protected:
@@ -146,14 +149,21 @@ public:
     void removeVariableField(int index);
     const OstProto::VariableField& variableField(int index) const;
     OstProto::VariableField* mutableVariableField(int index);
+    quint64 variableFieldRandomKey(int index) const;
 
     QByteArray protocolFrameValue(int streamIndex = 0,
         bool forCksum = false) const;
+    int protocolFrameValue(uchar *buf, int bufSize, int streamIndex = 0,
+        bool forCksum = false) const;
     virtual int protocolFrameSize(int streamIndex = 0) const;
     int protocolFrameOffset(int streamIndex = 0) const;
     int protocolFramePayloadSize(int streamIndex = 0) const;
 
+    virtual void primeCaches() const;
+    virtual bool isProtocolFrameValueThreadSafe() const;
+
     virtual bool isProtocolFrameValueVariable() const;
+    virtual bool isProtocolFrameValueRandom() const;
     virtual bool isProtocolFrameSizeVariable() const;
     virtual int protocolFrameVariableCount() const;
     bool isProtocolFramePayloadValueVariable() const;
@@ -174,9 +184,17 @@ public:
     static quint64 lcm(quint64 u, quint64 v);
     static quint64 gcd(quint64 u, quint64 v);
 
+protected:
+    virtual int writeProtocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const;
+    static quint16 ipCksum(const uchar *buf, int len);
+    quint64 randomKey(int index) const;
+
 private:
-    void varyProtocolFrameValue(QByteArray &buf, int frameIndex,
-                                const OstProto::VariableField &varField) const;
+    quint64 protocolRandomKey() const;
+    void varyProtocolFrameValue(uchar *buf, int bufSize, int frameIndex,
+                                const OstProto::VariableField &varField,
+                                quint64 randomKey) const;
 };
 Q_DECLARE_OPERATORS_FOR_FLAGS(AbstractProtocol::FieldFlags);
 #endif
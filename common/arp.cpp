@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
 #include "arp.h"
+#include "prng.h"
 
 #include <QHostAddress>
 #include <QRegExp>
@@ -346,7 +347,9 @@ QVariant ArpProtocol::fieldData(int index, FieldAttrib attrib,
                 case OstProto::Arp::kRandomHost:
                     subnet = data.sender_proto_addr() 
                             & data.sender_proto_addr_mask();
-                    host = (qrand() & ~data.sender_proto_addr_mask());
+                    host = (prng::value32(randomKey(arp_senderProtoAddr),
+                                streamIndex)
+                            & ~data.sender_proto_addr_mask());
                     protoAddr = subnet | host;
                     break;
                 default:
@@ -454,7 +457,9 @@ QVariant ArpProtocol::fieldData(int index, FieldAttrib attrib,
                 case OstProto::Arp::kRandomHost:
                     subnet = data.target_proto_addr() 
                             & data.target_proto_addr_mask();
-                    host = (qrand() & ~data.target_proto_addr_mask());
+                    host = (prng::value32(randomKey(arp_targetProtoAddr),
+                                streamIndex)
+                            & ~data.target_proto_addr_mask());
                     protoAddr = subnet | host;
                     break;
                 default:
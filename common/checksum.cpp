@@ -0,0 +1,497 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "checksum.h"
+
+#include "crc32c.h"
+
+#include <string.h>
+
+#if defined(Q_CC_GNU) && defined(__x86_64__)
+#define CHECKSUM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+// Reflected polynomials
+static const quint32 kCrc32cPoly = 0x82F63B78;
+static const quint32 kCrc32Poly = 0xEDB88320;
+
+// The CRC32C kernel runs three independent crc32 instruction chains on
+// three consecutive blocks (hiding the instruction latency) and combines
+// the three CRCs; large buffers use long blocks, smaller ones short blocks
+static const uint kCrc32cLongBlock = 4096;
+static const uint kCrc32cShortBlock = 256;
+
+/*!
+ * Returns a*b modulo the (reflected) polynomial - a must be non-zero
+ */
+static quint32 multModPoly(quint32 a, quint32 b, quint32 poly)
+{
+    quint32 m = 1U << 31, p = 0;
+
+    while (1) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ poly : b >> 1;
+    }
+
+    return p;
+}
+
+//! Returns x^(8*n) modulo the (reflected) polynomial
+static quint32 xPow8nModPoly(quint64 n, quint32 poly)
+{
+    quint32 result = 1U << 31; // x^0
+    quint32 square = 1U << 30; // x^1
+
+    n *= 8;
+    while (n) {
+        if (n & 1)
+            result = multModPoly(square, result, poly);
+        square = multModPoly(square, square, poly);
+        n >>= 1;
+    }
+
+    return result;
+}
+
+/*
+ * Multiplication of a CRC by a constant (x^(8*n) i.e. shifting the CRC
+ * over n zero bytes) using per byte lookup tables
+ */
+struct CrcShift
+{
+    void init(quint64 n, quint32 poly)
+    {
+        quint32 k = xPow8nModPoly(n, poly);
+
+        for (int j = 0; j < 4; j++)
+            for (int i = 0; i < 256; i++)
+                table[j][i] = multModPoly(k, quint32(i) << (8*j), poly);
+    }
+
+    inline quint32 shift(quint32 crc) const
+    {
+        return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF]
+            ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+    }
+
+    quint32 table[4][256];
+};
+
+//
+// Portable kernels
+//
+static quint32 crc32Table[256];
+
+static quint32 crc32UpdateTable(quint32 crc, const quint8 *buffer,
+                                uint length)
+{
+    for (uint i = 0; i < length; i++)
+        crc = (crc >> 8) ^ crc32Table[(crc ^ buffer[i]) & 0xFF];
+
+    return crc;
+}
+
+static inline quint16 onesSumFold(quint64 sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return quint16(sum);
+}
+
+/*
+ * Since 2^16 is 1 modulo 0xFFFF, the ones' complement sum of 16-bit
+ * words is the same as that of 32-bit words (folded) - so sum 32-bit words
+ * into a 64-bit accumulator that doesn't need a carry fold every add
+ */
+static quint16 onesSumPortable(const quint8 *buffer, uint length, quint16 sum)
+{
+    quint64 acc = sum;
+    quint32 w32;
+    quint16 w16;
+
+    while (length >= 4) {
+        memcpy(&w32, buffer, 4);
+        acc += w32;
+        buffer += 4;
+        length -= 4;
+    }
+    if (length >= 2) {
+        memcpy(&w16, buffer, 2);
+        acc += w16;
+        buffer += 2;
+        length -= 2;
+    }
+    if (length) {
+        quint8 last[2] = { buffer[0], 0 };
+
+        memcpy(&w16, last, 2);
+        acc += w16;
+    }
+
+    return onesSumFold(acc);
+}
+
+//
+// CPU specific kernels
+//
+#ifdef CHECKSUM_X86_KERNELS
+
+static CrcShift crc32cLongShift[2];  // by 1 and 2 long blocks
+static CrcShift crc32cShortShift[2]; // by 1 and 2 short blocks
+
+__attribute__((target("sse4.2")))
+static inline quint32 crc32c3Way(quint32 crc, const quint8 *buffer,
+                                 uint block, const CrcShift *shift)
+{
+    quint64 crc0 = crc, crc1 = 0, crc2 = 0;
+    const quint8 *end = buffer + block;
+
+    while (buffer < end) {
+        quint64 w0, w1, w2;
+
+        memcpy(&w0, buffer, 8);
+        memcpy(&w1, buffer + block, 8);
+        memcpy(&w2, buffer + 2*block, 8);
+        crc0 = _mm_crc32_u64(crc0, w0);
+        crc1 = _mm_crc32_u64(crc1, w1);
+        crc2 = _mm_crc32_u64(crc2, w2);
+        buffer += 8;
+    }
+
+    return shift[1].shift(quint32(crc0)) ^ shift[0].shift(quint32(crc1))
+        ^ quint32(crc2);
+}
+
+__attribute__((target("sse4.2")))
+static quint32 crc32cUpdateSse42(quint32 crc, const quint8 *buffer,
+                                 uint length)
+{
+    quint64 crc64, w;
+
+    while (length && (quintptr(buffer) & 7)) {
+        crc = _mm_crc32_u8(crc, *buffer++);
+        length--;
+    }
+
+    while (length >= 3*kCrc32cLongBlock) {
+        crc = crc32c3Way(crc, buffer, kCrc32cLongBlock, crc32cLongShift);
+        buffer += 3*kCrc32cLongBlock;
+        length -= 3*kCrc32cLongBlock;
+    }
+
+    while (length >= 3*kCrc32cShortBlock) {
+        crc = crc32c3Way(crc, buffer, kCrc32cShortBlock, crc32cShortShift);
+        buffer += 3*kCrc32cShortBlock;
+        length -= 3*kCrc32cShortBlock;
+    }
+
+    crc64 = crc;
+    while (length >= 8) {
+        memcpy(&w, buffer, 8);
+        crc64 = _mm_crc32_u64(crc64, w);
+        buffer += 8;
+        length -= 8;
+    }
+    crc = quint32(crc64);
+
+    while (length--)
+        crc = _mm_crc32_u8(crc, *buffer++);
+
+    return crc;
+}
+
+/*
+ * Folds 4 x 128 bits at a time with carry-less multiplication and then
+ * Barrett reduces to 32 bits - "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction" (Intel); the constants are
+ * for the bit reflected IEEE 802.3 polynomial
+ */
+__attribute__((target("pclmul,sse4.1")))
+static quint32 crc32UpdatePclmul(quint32 crc, const quint8 *buffer,
+                                 uint length)
+{
+    static const quint64 __attribute__((aligned(16))) k1k2[] =
+            { 0x0154442bd4ULL, 0x01c6e41596ULL };
+    static const quint64 __attribute__((aligned(16))) k3k4[] =
+            { 0x01751997d0ULL, 0x00ccaa009eULL };
+    static const quint64 __attribute__((aligned(16))) k5k0[] =
+            { 0x0163cd6124ULL, 0x0000000000ULL };
+    static const quint64 __attribute__((aligned(16))) poly[] =
+            { 0x01db710641ULL, 0x01f7011641ULL };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    if (length < 64)
+        return crc32UpdateTable(crc, buffer, length);
+
+    x1 = _mm_loadu_si128((const __m128i*)(buffer + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(buffer + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(buffer + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(buffer + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(int(crc)));
+    x0 = _mm_load_si128((const __m128i*)k1k2);
+    buffer += 64;
+    length -= 64;
+
+    // Fold 4 x 128 bits in parallel
+    while (length >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i*)(buffer + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(buffer + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(buffer + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(buffer + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buffer += 64;
+        length -= 64;
+    }
+
+    // Fold into 128 bits
+    x0 = _mm_load_si128((const __m128i*)k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Fold 128 bits at a time
+    while (length >= 16) {
+        x2 = _mm_loadu_si128((const __m128i*)buffer);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buffer += 16;
+        length -= 16;
+    }
+
+    // Fold 128 bits to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduce to 32 bits
+    x0 = _mm_load_si128((const __m128i*)poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    crc = quint32(_mm_extract_epi32(x1, 1));
+
+    return crc32UpdateTable(crc, buffer, length);
+}
+
+/*
+ * Sums 32-bit words into 64-bit lanes (see onesSumPortable()), 64 bytes
+ * at a time into two accumulators
+ */
+__attribute__((target("avx2")))
+static quint16 onesSumAvx2(const quint8 *buffer, uint length, quint16 sum)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    quint64 __attribute__((aligned(32))) lanes[4];
+    quint64 total;
+
+    while (length >= 64) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i*)buffer);
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)(buffer + 32));
+
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+        buffer += 64;
+        length -= 64;
+    }
+
+    _mm256_store_si256((__m256i*)lanes, _mm256_add_epi64(acc0, acc1));
+    total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    // Remaining bytes start at an even offset, so just continue the sum
+    return onesSumPortable(buffer, length, onesSumFold(total + sum));
+}
+
+#endif // CHECKSUM_X86_KERNELS
+
+//
+// Kernel selection
+//
+struct ChecksumKernels
+{
+    ChecksumKernels()
+    {
+        for (quint32 i = 0; i < 256; i++) {
+            quint32 c = i;
+
+            for (int j = 0; j < 8; j++)
+                c = c & 1 ? (c >> 1) ^ kCrc32Poly : c >> 1;
+            crc32Table[i] = c;
+        }
+
+        crc32c = NULL;
+        crc32 = NULL;
+        onesSum = NULL;
+        useHw = true;
+
+#ifdef CHECKSUM_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2")) {
+            for (int i = 0; i < 2; i++) {
+                crc32cLongShift[i].init((i+1)*kCrc32cLongBlock, kCrc32cPoly);
+                crc32cShortShift[i].init((i+1)*kCrc32cShortBlock,
+                                         kCrc32cPoly);
+            }
+            crc32c = crc32cUpdateSse42;
+        }
+        if (__builtin_cpu_supports("pclmul")
+                && __builtin_cpu_supports("sse4.1"))
+            crc32 = crc32UpdatePclmul;
+        if (__builtin_cpu_supports("avx2"))
+            onesSum = onesSumAvx2;
+#endif
+        qDebug("checksum kernels: %s", hwNames());
+    }
+
+    const char* hwNames() const
+    {
+        if (crc32c && crc32 && onesSum)
+            return "crc32c: sse4.2 (3-way), crc32: pclmul, ones sum: avx2";
+
+        return crc32c || crc32 || onesSum ?
+            "crc32c, crc32, ones sum: partially cpu specific" :
+            "crc32c, crc32, ones sum: portable";
+    }
+
+    quint32 (*crc32c)(quint32 crc, const quint8 *buffer, uint length);
+    quint32 (*crc32)(quint32 crc, const quint8 *buffer, uint length);
+    quint16 (*onesSum)(const quint8 *buffer, uint length, quint16 sum);
+    bool useHw;
+};
+
+static ChecksumKernels& kernels()
+{
+    static ChecksumKernels kernels;
+
+    return kernels;
+}
+
+quint32 checksumCrc32C(const quint8 *buffer, uint length)
+{
+    return checksumCrc32CFinal(checksumCrc32CUpdate(~0U, buffer, length));
+}
+
+quint32 checksumCrc32CUpdate(quint32 crc, const quint8 *buffer, uint length)
+{
+    const ChecksumKernels &k = kernels();
+
+    if (k.useHw && k.crc32c)
+        return k.crc32c(crc, buffer, length);
+
+    return crc32cUpdateTable(crc, buffer, length);
+}
+
+quint32 checksumCrc32CFinal(quint32 crc)
+{
+    return crc32cFinal(crc);
+}
+
+quint32 checksumCrc32(const quint8 *buffer, uint length)
+{
+    return checksumCrc32Final(checksumCrc32Update(~0U, buffer, length));
+}
+
+quint32 checksumCrc32Update(quint32 crc, const quint8 *buffer, uint length)
+{
+    const ChecksumKernels &k = kernels();
+
+    if (k.useHw && k.crc32)
+        return k.crc32(crc, buffer, length);
+
+    return crc32UpdateTable(crc, buffer, length);
+}
+
+quint32 checksumCrc32Final(quint32 crc)
+{
+    return ~crc;
+}
+
+quint16 checksumOnesSum(const quint8 *buffer, uint length, quint16 sum)
+{
+    const ChecksumKernels &k = kernels();
+
+    if (k.useHw && k.onesSum)
+        return k.onesSum(buffer, length, sum);
+
+    return onesSumPortable(buffer, length, sum);
+}
+
+bool checksumSetHwKernels(bool enable)
+{
+    bool prev = kernels().useHw;
+
+    kernels().useHw = enable;
+
+    return prev;
+}
+
+const char* checksumKernelNames()
+{
+    return kernels().useHw ?
+        kernels().hwNames() : "crc32c, crc32, ones sum: portable";
+}
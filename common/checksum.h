@@ -0,0 +1,57 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _CHECKSUM_H
+#define _CHECKSUM_H
+
+#include <QtGlobal>
+
+/*
+ * Checksum primitives
+ *
+ * Each of these uses a CPU specific kernel (SSE4.2 crc32, PCLMULQDQ,
+ * AVX2) if the CPU supports it and a portable implementation otherwise -
+ * the kernel is selected at runtime
+ *
+ * The *Update() functions work on the running CRC which starts as ~0
+ * (the *Final() function of the same CRC converts it to the checksum) -
+ * this allows a checksum to be computed piecemeal
+ */
+
+// CRC32C (Castagnoli) - as used by SCTP and the native file format
+quint32 checksumCrc32C(const quint8 *buffer, uint length);
+quint32 checksumCrc32CUpdate(quint32 crc, const quint8 *buffer, uint length);
+quint32 checksumCrc32CFinal(quint32 crc);
+
+// CRC32 (IEEE 802.3) - as used for the Ethernet FCS
+quint32 checksumCrc32(const quint8 *buffer, uint length);
+quint32 checksumCrc32Update(quint32 crc, const quint8 *buffer, uint length);
+quint32 checksumCrc32Final(quint32 crc);
+
+// Ones' complement sum (folded to 16 bits) of the buffer taken as 16-bit
+// words in host byte order - add to sum, if given; the IP checksum is the
+// ones' complement of this sum
+quint16 checksumOnesSum(const quint8 *buffer, uint length, quint16 sum = 0);
+
+// For tests and benchmarks - use (if supported) CPU specific kernels or
+// not; returns the previous setting
+bool checksumSetHwKernels(bool enable);
+const char* checksumKernelNames();
+
+#endif
@@ -150,6 +150,18 @@ public:
     int protocolFramePayloadSize() const;
 #endif
 
+    virtual void primeCaches() const
+    {
+        AbstractProtocol::primeCaches();
+        protoA->primeCaches();
+        protoB->primeCaches();
+    }
+    virtual bool isProtocolFrameValueThreadSafe() const
+    {
+        return (protoA->isProtocolFrameValueThreadSafe()
+            && protoB->isProtocolFrameValueThreadSafe());
+    }
+
     virtual bool isProtocolFrameSizeVariable() const
     {
         return (protoA->isProtocolFrameSizeVariable()
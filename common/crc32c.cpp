@@ -95,17 +95,26 @@ quint32 crc_c[256] =
     0xBE2DA0A5L, 0x4C4623A6L, 0x5F16D052L, 0xAD7D5351L,
 };
 
-quint32 checksumCrc32C(quint8 *buffer, uint length)
+/*!
+ * Updates the running (un-negated) CRC with the given bytes - this is the
+ * portable implementation used by checksumCrc32CUpdate()
+ */
+quint32 crc32cUpdateTable(quint32 crc32, const quint8 *buffer, uint length)
 {
     uint i;
-    quint32 crc32 = ~0L;
-    quint32 result;
-    quint8 byte0,byte1,byte2,byte3;
 
     for (i = 0; i < length; i++) {
         CRC32C(crc32, buffer[i]);
     }
 
+    return crc32;
+}
+
+quint32 crc32cFinal(quint32 crc32)
+{
+    quint32 result;
+    quint8 byte0,byte1,byte2,byte3;
+
     result = ~crc32;
 
     /*  result now holds the negated polynomial remainder;
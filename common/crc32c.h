@@ -19,5 +19,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <QtGlobal>
 
-quint32 checksumCrc32C(quint8 *buffer, uint length);
-
+// Portable CRC32C - use checksum.h instead of using these directly
+quint32 crc32cUpdateTable(quint32 crc32, const quint8 *buffer, uint length);
+quint32 crc32cFinal(quint32 crc32);
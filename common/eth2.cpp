@@ -186,3 +186,14 @@ bool Eth2Protocol::setFieldData(int index, const QVariant &value,
     }
     return isOk;
 }
+
+int Eth2Protocol::writeProtocolFrameValue(uchar *buf, int bufSize,
+        int /*streamIndex*/, bool /*forCksum*/) const
+{
+    if (bufSize < 2)
+        return -1;
+
+    qToBigEndian(quint16(data.is_override_type() ?
+                data.type() : payloadProtocolId(ProtocolIdEth)), buf);
+    return 2;
+}
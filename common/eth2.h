@@ -59,6 +59,11 @@ public:
                int streamIndex = 0) const;
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
+
+protected:
+    virtual int writeProtocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const;
+
 private:
     OstProto::Eth2    data;
 };
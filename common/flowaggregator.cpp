@@ -0,0 +1,476 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "flowaggregator.h"
+
+#include "hexdump.pb.h"
+#include "icmp.pb.h"
+#include "igmp.pb.h"
+#include "ip4.pb.h"
+#include "mld.pb.h"
+#include "tcp.pb.h"
+#include "udp.pb.h"
+
+#include <QString>
+#include <QtAlgorithms>
+#include <limits.h>
+#include <string>
+
+// Header fields that may vary from packet to packet within a flow
+enum Candidate {
+    kIp4Id,
+    kTcpSrcPort,
+    kTcpDstPort,
+    kTcpSeq,
+    kTcpAck,
+    kUdpSrcPort,
+    kUdpDstPort,
+    kIcmpId,
+    kIcmpSeq,
+    kCandidateCount
+};
+
+static const struct {
+    int protocolId;
+    int offset; // in protocol
+    OstProto::VariableField::Type type;
+} kCandidates[kCandidateCount] = {
+    { OstProto::Protocol::kIp4FieldNumber, 4,
+        OstProto::VariableField::kCounter16 },
+    { OstProto::Protocol::kTcpFieldNumber, 0,
+        OstProto::VariableField::kCounter16 },
+    { OstProto::Protocol::kTcpFieldNumber, 2,
+        OstProto::VariableField::kCounter16 },
+    { OstProto::Protocol::kTcpFieldNumber, 4,
+        OstProto::VariableField::kCounter32 },
+    { OstProto::Protocol::kTcpFieldNumber, 8,
+        OstProto::VariableField::kCounter32 },
+    { OstProto::Protocol::kUdpFieldNumber, 0,
+        OstProto::VariableField::kCounter16 },
+    { OstProto::Protocol::kUdpFieldNumber, 2,
+        OstProto::VariableField::kCounter16 },
+    { OstProto::Protocol::kIcmpFieldNumber, 4,
+        OstProto::VariableField::kCounter16 },
+    { OstProto::Protocol::kIcmpFieldNumber, 6,
+        OstProto::VariableField::kCounter16 },
+};
+
+// Packets further apart than this multiple of the median gap start a
+// new burst
+static const quint64 kBurstGapFactor = 8;
+static const quint64 kMinBurstGap = 1000; // nsec
+static const double kNsecsInSec = 1e9;
+
+static quint32 candidateValue(const OstProto::Protocol &proto, int candidate)
+{
+    switch (candidate) {
+    case kIp4Id: return proto.GetExtension(OstProto::ip4).id();
+    case kTcpSrcPort: return proto.GetExtension(OstProto::tcp).src_port();
+    case kTcpDstPort: return proto.GetExtension(OstProto::tcp).dst_port();
+    case kTcpSeq: return proto.GetExtension(OstProto::tcp).seq_num();
+    case kTcpAck: return proto.GetExtension(OstProto::tcp).ack_num();
+    case kUdpSrcPort: return proto.GetExtension(OstProto::udp).src_port();
+    case kUdpDstPort: return proto.GetExtension(OstProto::udp).dst_port();
+    case kIcmpId: return proto.GetExtension(OstProto::icmp).identifier();
+    case kIcmpSeq: return proto.GetExtension(OstProto::icmp).sequence();
+    default: break;
+    }
+    return 0;
+}
+
+static void clearCandidate(OstProto::Protocol *proto, int candidate)
+{
+    switch (candidate) {
+    case kIp4Id: proto->MutableExtension(OstProto::ip4)->set_id(0); break;
+    case kTcpSrcPort:
+        proto->MutableExtension(OstProto::tcp)->set_src_port(0);
+        break;
+    case kTcpDstPort:
+        proto->MutableExtension(OstProto::tcp)->set_dst_port(0);
+        break;
+    case kTcpSeq: proto->MutableExtension(OstProto::tcp)->set_seq_num(0); break;
+    case kTcpAck: proto->MutableExtension(OstProto::tcp)->set_ack_num(0); break;
+    case kUdpSrcPort:
+        proto->MutableExtension(OstProto::udp)->set_src_port(0);
+        break;
+    case kUdpDstPort:
+        proto->MutableExtension(OstProto::udp)->set_dst_port(0);
+        break;
+    case kIcmpId:
+        proto->MutableExtension(OstProto::icmp)->set_identifier(0);
+        break;
+    case kIcmpSeq:
+        proto->MutableExtension(OstProto::icmp)->set_sequence(0);
+        break;
+    default:
+        break;
+    }
+}
+
+static inline quint32 candidateMask(int candidate)
+{
+    return kCandidates[candidate].type == OstProto::VariableField::kCounter32 ?
+            0xFFFFFFFF : 0xFFFF;
+}
+
+//! Returns the magnitude of step (which is modulo the field size)
+static inline quint32 stepSize(int candidate, quint32 step)
+{
+    quint32 mask = candidateMask(candidate);
+
+    return step > (mask >> 1) ? (mask - step + 1) & mask : step;
+}
+
+FlowAggregator::FlowAggregator()
+{
+    packetCount_ = 0;
+}
+
+FlowAggregator::~FlowAggregator()
+{
+    qDeleteAll(currentRun_);
+    qDeleteAll(runList_);
+}
+
+/*!
+ * Adds the next packet of the capture - stream has the decoded protocols
+ * and frame length of the packet
+ */
+void FlowAggregator::addPacket(const OstProto::Stream &stream,
+                               quint64 timestamp)
+{
+    QList<Field> fields;
+    QByteArray key = flowKey(stream, &fields);
+    QVector<quint32> values(fields.size());
+    int flow;
+    Run *run;
+
+    for (int i = 0; i < fields.size(); i++)
+        values[i] = candidateValue(stream.protocol(fields.at(i).protocol),
+                                   fields.at(i).candidate);
+
+    flow = flowIndex_.value(key, -1);
+    if (flow < 0) {
+        flow = flowFields_.size();
+        flowIndex_.insert(key, flow);
+        flowFields_.append(fields);
+        currentRun_.append(NULL);
+    }
+
+    run = currentRun_.at(flow);
+    if (run && extendRun(run, values, timestamp)) {
+        packetCount_++;
+        return;
+    }
+
+    if (run)
+        finishRun(run);
+
+    run = new Run;
+    run->stream.CopyFrom(stream);
+    run->flow = flow;
+    run->firstPacket = packetCount_;
+    run->count = 1;
+    run->firstValue = run->lastValue = values;
+    run->step.fill(0, values.size());
+    run->firstTimestamp = run->lastTimestamp = timestamp;
+
+    currentRun_[flow] = run;
+    packetCount_++;
+}
+
+/*!
+ * Appends the aggregated streams - in the order of their first packet in
+ * the capture - to streams
+ */
+void FlowAggregator::finish(OstProto::StreamConfigList &streams)
+{
+    for (int i = 0; i < currentRun_.size(); i++) {
+        if (currentRun_.at(i))
+            finishRun(currentRun_.at(i));
+        currentRun_[i] = NULL;
+    }
+
+    qSort(runList_.begin(), runList_.end(), isEarlier);
+
+    qDebug("flow aggregation: %d packets, %d flows, %d streams",
+            packetCount_, flowFields_.size(), runList_.size());
+
+    for (int i = 0; i < runList_.size(); i++) {
+        OstProto::Stream *stream = streams.add_stream();
+
+        stream->CopyFrom(runList_.at(i)->stream);
+        stream->mutable_stream_id()->set_id(i+1);
+        stream->mutable_core()->set_is_enabled(true);
+    }
+
+    qDeleteAll(runList_);
+    runList_.clear();
+}
+
+int FlowAggregator::packetCount() const
+{
+    return packetCount_;
+}
+
+int FlowAggregator::flowCount() const
+{
+    return flowFields_.size();
+}
+
+//
+// Private methods
+//
+
+/*!
+ * Returns the flow key of the stream - its protocols and frame length
+ * except the candidate fields (returned in fields), checksums and the
+ * payload content
+ */
+QByteArray FlowAggregator::flowKey(const OstProto::Stream &stream,
+                                   QList<Field> *fields) const
+{
+    OstProto::Stream key;
+    std::string keyStr;
+    bool isPayload = false;
+
+    key.mutable_core()->set_frame_len(stream.core().frame_len());
+
+    for (int i = 0; i < stream.protocol_size(); i++) {
+        OstProto::Protocol *proto = key.add_protocol();
+        int id = stream.protocol(i).protocol_id().id();
+
+        proto->CopyFrom(stream.protocol(i));
+
+        for (int j = 0; j < kCandidateCount; j++) {
+            if (kCandidates[j].protocolId != id)
+                continue;
+
+            Field field = { i, j };
+            fields->append(field);
+            clearCandidate(proto, j);
+        }
+
+        switch (id) {
+        case OstProto::Protocol::kIp4FieldNumber:
+            proto->MutableExtension(OstProto::ip4)->set_cksum(0);
+            break;
+        case OstProto::Protocol::kTcpFieldNumber:
+            proto->MutableExtension(OstProto::tcp)->set_cksum(0);
+            isPayload = true;
+            break;
+        case OstProto::Protocol::kUdpFieldNumber:
+        {
+            // A zero UDP checksum (i.e. none) is retained as such
+            OstProto::Udp *udp = proto->MutableExtension(OstProto::udp);
+            udp->set_cksum(udp->cksum() ? 1 : 0);
+            isPayload = true;
+            break;
+        }
+        case OstProto::Protocol::kIcmpFieldNumber:
+            proto->MutableExtension(OstProto::icmp)->set_checksum(0);
+            isPayload = true;
+            break;
+        case OstProto::Protocol::kIgmpFieldNumber:
+            proto->MutableExtension(OstProto::igmp)->set_checksum(0);
+            isPayload = true;
+            break;
+        case OstProto::Protocol::kMldFieldNumber:
+            proto->MutableExtension(OstProto::mld)->set_checksum(0);
+            isPayload = true;
+            break;
+        case OstProto::Protocol::kHexDumpFieldNumber:
+            // Payload (and options) content doesn't matter, but content
+            // that could not be decoded does
+            if (isPayload) {
+                OstProto::HexDump *hexDump =
+                        proto->MutableExtension(OstProto::hexDump);
+                hexDump->set_content(
+                        std::string(hexDump->content().size(), '\0'));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    key.SerializePartialToString(&keyStr);
+
+    return QByteArray(keyStr.data(), int(keyStr.size()));
+}
+
+/*!
+ * Returns true if the packet with the given candidate field values is the
+ * next packet of the run (and adds it to the run)
+ */
+bool FlowAggregator::extendRun(Run *run, const QVector<quint32> &values,
+                               quint64 timestamp) const
+{
+    const QList<Field> &fields = flowFields_.at(run->flow);
+
+    if (run->count == 1) {
+        for (int i = 0; i < values.size(); i++)
+            run->step[i] = (values.at(i) - run->lastValue.at(i))
+                                & candidateMask(fields.at(i).candidate);
+    }
+    else {
+        for (int i = 0; i < values.size(); i++) {
+            int candidate = fields.at(i).candidate;
+
+            if (values.at(i) != ((run->lastValue.at(i) + run->step.at(i))
+                                    & candidateMask(candidate)))
+                return false;
+
+            // VariableField counters are computed as an int
+            if (quint64(run->count) * stepSize(candidate, run->step.at(i))
+                    >= quint64(INT_MAX))
+                return false;
+        }
+    }
+
+    run->lastValue = values;
+    run->count++;
+    run->gaps.append(timestamp > run->lastTimestamp ?
+                        timestamp - run->lastTimestamp : 0);
+    run->lastTimestamp = timestamp;
+
+    return true;
+}
+
+//! Converts the run to a stream with variable fields
+void FlowAggregator::finishRun(Run *run)
+{
+    const QList<Field> &fields = flowFields_.at(run->flow);
+    OstProto::Stream &stream = run->stream;
+    bool isVariable = false;
+
+    for (int i = 0; i < fields.size(); i++) {
+        int candidate = fields.at(i).candidate;
+        quint32 step = run->step.at(i);
+
+        if (!step)
+            continue;
+
+        OstProto::VariableField *vf = stream.mutable_protocol(
+                fields.at(i).protocol)->add_variable_field();
+
+        vf->set_type(kCandidates[candidate].type);
+        vf->set_offset(kCandidates[candidate].offset);
+        vf->set_value(run->firstValue.at(i));
+        vf->set_count(run->count);
+        vf->set_step(stepSize(candidate, step));
+        if (step != stepSize(candidate, step))
+            vf->set_mode(OstProto::VariableField::kDecrement);
+        isVariable = true;
+    }
+
+    // Checksums are different for each frame now
+    for (int i = 0; isVariable && (i < stream.protocol_size()); i++) {
+        OstProto::Protocol *proto = stream.mutable_protocol(i);
+
+        switch (proto->protocol_id().id()) {
+        case OstProto::Protocol::kIp4FieldNumber:
+            proto->MutableExtension(OstProto::ip4)->set_is_override_cksum(
+                    false);
+            break;
+        case OstProto::Protocol::kTcpFieldNumber:
+            proto->MutableExtension(OstProto::tcp)->set_is_override_cksum(
+                    false);
+            break;
+        case OstProto::Protocol::kUdpFieldNumber:
+            if (proto->GetExtension(OstProto::udp).cksum())
+                proto->MutableExtension(OstProto::udp)
+                    ->set_is_override_cksum(false);
+            break;
+        case OstProto::Protocol::kIcmpFieldNumber:
+            proto->MutableExtension(OstProto::icmp)
+                ->set_is_override_checksum(false);
+            break;
+        default:
+            break;
+        }
+    }
+
+    stream.mutable_core()->set_name(
+            QString("Flow %1").arg(run->flow + 1).toStdString());
+    setRate(run);
+
+    run->gaps = QVector<quint64>();
+    runList_.append(run);
+}
+
+/*!
+ * Sets up the stream to send the packets of the run at the rate seen in
+ * the capture - as bursts, if the packets arrived in equal sized bursts
+ */
+void FlowAggregator::setRate(Run *run) const
+{
+    OstProto::StreamControl *control = run->stream.mutable_control();
+    quint64 duration = run->lastTimestamp - run->firstTimestamp;
+    QVector<quint64> sortedGaps = run->gaps;
+    quint64 threshold, ts, lastBurstTs;
+    int burstSize = 0, burstCount = 1, start = 0;
+    int n = int(run->count);
+
+    control->Clear();
+    control->set_unit(OstProto::StreamControl::e_su_packets);
+    control->set_num_packets(n);
+
+    if (n < 2)
+        return;
+
+    qSort(sortedGaps);
+    threshold = sortedGaps.at(sortedGaps.size()/2) * kBurstGapFactor;
+    threshold = qMax(threshold, kMinBurstGap);
+
+    ts = lastBurstTs = run->firstTimestamp;
+    for (int i = 0; i < run->gaps.size(); i++) {
+        ts += run->gaps.at(i);
+        if (run->gaps.at(i) <= threshold)
+            continue;
+
+        // Gap i is between packets i and i+1
+        if (!burstSize)
+            burstSize = i + 1 - start;
+        else if (burstSize != i + 1 - start)
+            break;
+
+        start = i + 1;
+        burstCount++;
+        lastBurstTs = ts;
+    }
+
+    if ((burstCount > 1) && (burstSize > 1) && (n - start == burstSize)
+            && (lastBurstTs > run->firstTimestamp)) {
+        control->set_unit(OstProto::StreamControl::e_su_bursts);
+        control->set_num_bursts(burstCount);
+        control->set_packets_per_burst(burstSize);
+        control->set_bursts_per_sec((burstCount - 1) * kNsecsInSec
+                                        / (lastBurstTs - run->firstTimestamp));
+        return;
+    }
+
+    if (duration)
+        control->set_packets_per_sec((n - 1) * kNsecsInSec / duration);
+}
+
+bool FlowAggregator::isEarlier(const Run *run1, const Run *run2)
+{
+    return run1->firstPacket < run2->firstPacket;
+}
@@ -0,0 +1,98 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _FLOW_AGGREGATOR_H
+#define _FLOW_AGGREGATOR_H
+
+#include "protocol.pb.h"
+
+#include <QHash>
+#include <QList>
+#include <QVector>
+
+/*!
+ * Collapses imported packets into a few parametric streams
+ *
+ * Packets (decoded into streams by FrameDissector) that differ only in
+ * their IP ID, TCP/UDP ports, TCP sequence/ack numbers, ICMP id/sequence,
+ * checksums and payload content belong to the same flow. Within a flow, a
+ * run of packets in which each of these fields changes by a constant step
+ * from one packet to the next becomes a single stream with a VariableField
+ * counter for each field that changes - checksums are then computed
+ * instead of being overridden and the payload is that of the first packet
+ * of the run.
+ *
+ * The stream's rate is derived from the packet timestamps of the run -
+ * if the packets are seen to arrive in equal sized bursts, the stream is
+ * setup to send bursts instead of packets.
+ *
+ * The resulting streams are not byte exact copies of the capture, but
+ * replay an equivalent load - ideally with the port in interleaved mode
+ * since the flows in the capture would have been concurrent
+ */
+class FlowAggregator
+{
+public:
+    FlowAggregator();
+    ~FlowAggregator();
+
+    void addPacket(const OstProto::Stream &stream, quint64 timestamp);
+    void finish(OstProto::StreamConfigList &streams);
+
+    int packetCount() const;
+    int flowCount() const;
+
+private:
+    struct Field
+    {
+        int protocol;   // index in stream
+        int candidate;
+    };
+
+    struct Run
+    {
+        OstProto::Stream stream;    // of the first packet
+        int flow;
+        int firstPacket;
+        quint32 count;
+        QVector<quint32> firstValue;
+        QVector<quint32> lastValue;
+        QVector<quint32> step;
+        quint64 firstTimestamp;
+        quint64 lastTimestamp;
+        QVector<quint64> gaps;      // inter packet gaps (nsec)
+    };
+
+    QByteArray flowKey(const OstProto::Stream &stream,
+                       QList<Field> *fields) const;
+    bool extendRun(Run *run, const QVector<quint32> &values,
+                   quint64 timestamp) const;
+    void finishRun(Run *run);
+    void setRate(Run *run) const;
+
+    static bool isEarlier(const Run *run1, const Run *run2);
+
+    int packetCount_;
+    QHash<QByteArray, int> flowIndex_;
+    QList<QList<Field> > flowFields_;
+    QList<Run*> currentRun_;    // per flow
+    QList<Run*> runList_;       // finished runs
+};
+
+#endif
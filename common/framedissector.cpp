@@ -0,0 +1,689 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "framedissector.h"
+
+#include "arp.pb.h"
+#include "dot3.pb.h"
+#include "eth2.pb.h"
+#include "hexdump.pb.h"
+#include "icmp.pb.h"
+#include "icmphelper.h"
+#include "igmp.h"
+#include "igmp.pb.h"
+#include "ip4.pb.h"
+#include "ip6.pb.h"
+#include "mac.pb.h"
+#include "mld.h"
+#include "mld.pb.h"
+#include "svlan.pb.h"
+#include "tcp.pb.h"
+#include "udp.pb.h"
+#include "vlan.pb.h"
+
+#include <QtEndian>
+#include <limits.h>
+#include <string.h>
+
+static const quint16 kEthTypeIp4 = 0x0800;
+static const quint16 kEthTypeArp = 0x0806;
+static const quint16 kEthTypeIp6 = 0x86DD;
+static const quint16 kEthTypeVlan = 0x8100;
+static const quint16 kEthTypeSvlan = 0x88A8;
+static const quint16 kEthTypeQinQ = 0x9100;
+static const quint16 kEthTypeMin = 0x0600; // smaller values are 802.3 len
+
+static const quint8 kIpProtoIcmp = 1;
+static const quint8 kIpProtoIgmp = 2;
+static const quint8 kIpProtoTcp = 6;
+static const quint8 kIpProtoUdp = 17;
+static const quint8 kIpProtoIcmp6 = 58;
+
+static const quint8 kIgmpQuery = 0x11;
+static const quint8 kMldQuery = 0x82;
+
+static inline quint16 be16(const uchar *p)
+{
+    return qFromBigEndian<quint16>(p);
+}
+
+static inline quint32 be32(const uchar *p)
+{
+    return qFromBigEndian<quint32>(p);
+}
+
+static inline quint64 be48(const uchar *p)
+{
+    return (quint64(be16(p)) << 32) | be32(p+2);
+}
+
+static inline quint64 be64(const uchar *p)
+{
+    return qFromBigEndian<quint64>(p);
+}
+
+FrameDissector::FrameDissector()
+{
+    frame_ = NULL;
+    length_ = 0;
+    stream_ = NULL;
+    offset_ = layers_ = 0;
+    maxLayers_ = INT_MAX;
+}
+
+/*!
+ * Sets the protocols of stream to those decoded from frame (of length
+ * bytes, excluding FCS) - the stream's frame length should already be set
+ * to length + FCS
+ *
+ * Returns true if any header was decoded; false if the stream has only the
+ * frame content as a HexDump
+ */
+bool FrameDissector::dissect(const uchar *frame, int length,
+                             OstProto::Stream *stream)
+{
+    frame_ = frame;
+    length_ = length;
+    stream_ = stream;
+    maxLayers_ = INT_MAX;
+
+    decode();
+
+    // If the decoded headers don't render to the same bytes, retry with
+    // one header less every time till they do
+    while (layers_ && !verify()) {
+        qDebug("dissect: frame mismatch with %d headers decoded", layers_);
+        maxLayers_ = layers_ - 1;
+        decode();
+    }
+
+    return layers_ > 0;
+}
+
+//
+// Private methods
+//
+
+void FrameDissector::decode()
+{
+    stream_->clear_protocol();
+    offset_ = 0;
+    layers_ = 0;
+
+    decodeEthernet();
+
+    // Payload, trailer or whatever we didn't decode
+    addHexDump(offset_, length_);
+}
+
+//! Returns true if the next header of size bytes can be decoded
+bool FrameDissector::canDecode(int size, int end) const
+{
+    if (end < 0)
+        end = length_;
+
+    return (layers_ < maxLayers_) && (offset_ + size <= end);
+}
+
+OstProto::Protocol* FrameDissector::addProtocol(int protocolNumber)
+{
+    OstProto::Protocol *proto = stream_->add_protocol();
+
+    proto->mutable_protocol_id()->set_id(protocolNumber);
+    return proto;
+}
+
+void FrameDissector::addHexDump(int from, int to)
+{
+    if (to <= from)
+        return;
+
+    OstProto::HexDump *hexDump = addProtocol(
+            OstProto::Protocol::kHexDumpFieldNumber)
+                ->MutableExtension(OstProto::hexDump);
+
+    hexDump->set_content(frame_ + from, to - from);
+    hexDump->set_pad_until_end(false);
+}
+
+void FrameDissector::decodeEthernet()
+{
+    const uchar *p = frame_;
+    quint16 type;
+
+    if (!canDecode(14))
+        return;
+
+    OstProto::Mac *mac = addProtocol(OstProto::Protocol::kMacFieldNumber)
+                            ->MutableExtension(OstProto::mac);
+
+    mac->set_dst_mac(be48(p));
+    mac->set_src_mac(be48(p+6));
+    offset_ += 12;
+    layers_++;
+
+    type = be16(frame_ + offset_);
+    while (((type == kEthTypeVlan) || (type == kEthTypeSvlan)
+                || (type == kEthTypeQinQ)) && canDecode(4 + 2)) {
+        OstProto::Vlan *vlan;
+        p = frame_ + offset_;
+
+        if (type == kEthTypeSvlan)
+            vlan = addProtocol(OstProto::Protocol::kSvlanFieldNumber)
+                        ->MutableExtension(OstProto::svlan);
+        else
+            vlan = addProtocol(OstProto::Protocol::kVlanFieldNumber)
+                        ->MutableExtension(OstProto::vlan);
+
+        vlan->set_tpid(type);
+        vlan->set_is_override_tpid(true);
+        vlan->set_vlan_tag(be16(p+2));
+        offset_ += 4;
+        layers_++;
+
+        type = be16(frame_ + offset_);
+    }
+
+    if (!canDecode(2))
+        return;
+
+    if (type < kEthTypeMin) {
+        // 802.3 - LLC/SNAP etc. are left undecoded
+        OstProto::Dot3 *dot3 = addProtocol(
+                OstProto::Protocol::kDot3FieldNumber)
+                    ->MutableExtension(OstProto::dot3);
+
+        dot3->set_length(type);
+        dot3->set_is_override_length(true);
+        offset_ += 2;
+        layers_++;
+        return;
+    }
+
+    OstProto::Eth2 *eth2 = addProtocol(OstProto::Protocol::kEth2FieldNumber)
+                                ->MutableExtension(OstProto::eth2);
+
+    eth2->set_type(type);
+    eth2->set_is_override_type(true);
+    offset_ += 2;
+    layers_++;
+
+    switch (type) {
+    case kEthTypeIp4:
+        decodeIp4();
+        break;
+    case kEthTypeIp6:
+        decodeIp6();
+        break;
+    case kEthTypeArp:
+        decodeArp();
+        break;
+    default:
+        break;
+    }
+}
+
+void FrameDissector::decodeIp4()
+{
+    const uchar *p = frame_ + offset_;
+    int hdrLen, end;
+
+    if (!canDecode(20) || ((p[0] >> 4) != 4))
+        return;
+
+    hdrLen = (p[0] & 0x0F) * 4;
+    if ((hdrLen < 20) || !canDecode(hdrLen))
+        return;
+
+    OstProto::Ip4 *ip4 = addProtocol(OstProto::Protocol::kIp4FieldNumber)
+                            ->MutableExtension(OstProto::ip4);
+
+    ip4->set_is_override_ver(true);
+    ip4->set_is_override_hdrlen(true);
+    ip4->set_is_override_totlen(true);
+    ip4->set_is_override_proto(true);
+    ip4->set_is_override_cksum(true);
+
+    ip4->set_ver_hdrlen(p[0]);
+    ip4->set_tos(p[1]);
+    ip4->set_totlen(be16(p+2));
+    ip4->set_id(be16(p+4));
+    ip4->set_flags(p[6] >> 5);
+    ip4->set_frag_ofs(be16(p+6) & 0x1FFF);
+    ip4->set_ttl(p[8]);
+    ip4->set_proto(p[9]);
+    ip4->set_cksum(be16(p+10));
+    ip4->set_src_ip(be32(p+12));
+    ip4->set_dst_ip(be32(p+16));
+    if (hdrLen > 20)
+        ip4->set_options(p + 20, hdrLen - 20);
+
+    // Anything beyond the total length is ethernet padding/trailer
+    end = qBound(offset_ + hdrLen, offset_ + int(ip4->totlen()), length_);
+
+    offset_ += hdrLen;
+    layers_++;
+
+    // Non-first fragments don't have the transport header
+    if (ip4->frag_ofs() == 0)
+        decodeIpPayload(ip4->proto(), end, false);
+}
+
+void FrameDissector::decodeIp6()
+{
+    const uchar *p = frame_ + offset_;
+    quint32 verTcFl;
+    int end;
+
+    if (!canDecode(40) || ((p[0] >> 4) != 6))
+        return;
+
+    OstProto::Ip6 *ip6 = addProtocol(OstProto::Protocol::kIp6FieldNumber)
+                            ->MutableExtension(OstProto::ip6);
+
+    ip6->set_is_override_version(true);
+    ip6->set_is_override_payload_length(true);
+    ip6->set_is_override_next_header(true);
+
+    verTcFl = be32(p);
+    ip6->set_version(verTcFl >> 28);
+    ip6->set_traffic_class((verTcFl >> 20) & 0xFF);
+    ip6->set_flow_label(verTcFl & 0xFFFFF);
+    ip6->set_payload_length(be16(p+4));
+    ip6->set_next_header(p[6]);
+    ip6->set_hop_limit(p[7]);
+    ip6->set_src_addr_hi(be64(p+8));
+    ip6->set_src_addr_lo(be64(p+16));
+    ip6->set_dst_addr_hi(be64(p+24));
+    ip6->set_dst_addr_lo(be64(p+32));
+
+    end = qMin(offset_ + 40 + int(ip6->payload_length()), length_);
+
+    offset_ += 40;
+    layers_++;
+
+    // Extension headers are not decoded
+    decodeIpPayload(ip6->next_header(), end, true);
+}
+
+void FrameDissector::decodeIpPayload(int protocol, int end, bool isIp6)
+{
+    switch (protocol) {
+    case kIpProtoTcp:
+        decodeTcp(end);
+        break;
+    case kIpProtoUdp:
+        decodeUdp(end);
+        break;
+    case kIpProtoIcmp:
+        if (!isIp6)
+            decodeIcmp(false, end);
+        break;
+    case kIpProtoIgmp:
+        if (!isIp6)
+            decodeIgmp(end);
+        break;
+    case kIpProtoIcmp6:
+        if (isIp6 && canDecode(1, end)) {
+            quint8 type = frame_[offset_];
+
+            if (((type >= kMldV1Query) && (type <= kMldV1Done))
+                    || (type == kMldV2Report))
+                decodeMld(end);
+            else
+                decodeIcmp(true, end);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void FrameDissector::decodeArp()
+{
+    const uchar *p = frame_ + offset_;
+
+    // Only Ethernet/IPv4 ARP
+    if (!canDecode(28) || (p[4] != 6) || (p[5] != 4))
+        return;
+
+    OstProto::Arp *arp = addProtocol(OstProto::Protocol::kArpFieldNumber)
+                            ->MutableExtension(OstProto::arp);
+
+    arp->set_hw_type(be16(p));
+    arp->set_proto_type(be16(p+2));
+    arp->set_hw_addr_len(p[4]);
+    arp->set_proto_addr_len(p[5]);
+    arp->set_op_code(be16(p+6));
+    arp->set_sender_hw_addr(be48(p+8));
+    arp->set_sender_proto_addr(be32(p+14));
+    arp->set_target_hw_addr(be48(p+18));
+    arp->set_target_proto_addr(be32(p+24));
+
+    offset_ += 28;
+    layers_++;
+}
+
+void FrameDissector::decodeTcp(int end)
+{
+    const uchar *p = frame_ + offset_;
+    int hdrLen;
+
+    if (!canDecode(20, end))
+        return;
+
+    hdrLen = (p[12] >> 4) * 4;
+    if ((hdrLen < 20) || !canDecode(hdrLen, end))
+        return;
+
+    OstProto::Tcp *tcp = addProtocol(OstProto::Protocol::kTcpFieldNumber)
+                            ->MutableExtension(OstProto::tcp);
+
+    tcp->set_is_override_src_port(true);
+    tcp->set_is_override_dst_port(true);
+    tcp->set_is_override_hdrlen(true);
+    tcp->set_is_override_cksum(true);
+
+    tcp->set_src_port(be16(p));
+    tcp->set_dst_port(be16(p+2));
+    tcp->set_seq_num(be32(p+4));
+    tcp->set_ack_num(be32(p+8));
+    tcp->set_hdrlen_rsvd(p[12]);
+    tcp->set_flags(p[13]);
+    tcp->set_window(be16(p+14));
+    tcp->set_cksum(be16(p+16));
+    tcp->set_urg_ptr(be16(p+18));
+
+    offset_ += 20;
+    layers_++;
+
+    // Options as a separate HexDump (like the PDML import)
+    addHexDump(offset_, offset_ + hdrLen - 20);
+    offset_ += hdrLen - 20;
+}
+
+void FrameDissector::decodeUdp(int end)
+{
+    const uchar *p = frame_ + offset_;
+
+    if (!canDecode(8, end))
+        return;
+
+    OstProto::Udp *udp = addProtocol(OstProto::Protocol::kUdpFieldNumber)
+                            ->MutableExtension(OstProto::udp);
+
+    udp->set_is_override_src_port(true);
+    udp->set_is_override_dst_port(true);
+    udp->set_is_override_totlen(true);
+    udp->set_is_override_cksum(true);
+
+    udp->set_src_port(be16(p));
+    udp->set_dst_port(be16(p+2));
+    udp->set_totlen(be16(p+4));
+    udp->set_cksum(be16(p+6));
+
+    offset_ += 8;
+    layers_++;
+}
+
+void FrameDissector::decodeIcmp(bool isIcmp6, int end)
+{
+    const uchar *p = frame_ + offset_;
+    OstProto::Icmp::Version version = isIcmp6 ?
+            OstProto::Icmp::kIcmp6 : OstProto::Icmp::kIcmp4;
+    bool isIdSeq;
+
+    if (!canDecode(4, end))
+        return;
+
+    isIdSeq = isIdSeqType(version, p[0]);
+    if (isIdSeq && !canDecode(8, end))
+        return;
+
+    OstProto::Icmp *icmp = addProtocol(OstProto::Protocol::kIcmpFieldNumber)
+                            ->MutableExtension(OstProto::icmp);
+
+    icmp->set_icmp_version(version);
+    icmp->set_is_override_checksum(true);
+    icmp->set_type(p[0]);
+    icmp->set_code(p[1]);
+    icmp->set_checksum(be16(p+2));
+    if (isIdSeq) {
+        icmp->set_identifier(be16(p+4));
+        icmp->set_sequence(be16(p+6));
+    }
+
+    offset_ += isIdSeq ? 8 : 4;
+    layers_++;
+}
+
+void FrameDissector::decodeIgmp(int end)
+{
+    const uchar *p = frame_ + offset_;
+    int length = end - offset_;
+    int msgLen = 8;
+    uint type;
+
+    if (!canDecode(8, end))
+        return;
+
+    type = p[0];
+    switch (type) {
+    case kIgmpQuery:
+        // RFC 3376 Sec 7.1 - version is determined by the length and MRT
+        if (length >= 12)
+            type = kIgmpV3Query;
+        else if (p[1])
+            type = kIgmpV2Query;
+        else
+            type = kIgmpV1Query;
+        break;
+    case kIgmpV1Report:
+    case kIgmpV2Report:
+    case kIgmpV2Leave:
+    case kIgmpV3Report:
+        break;
+    default:
+        return;
+    }
+
+    OstProto::Gmp *igmp = addProtocol(OstProto::Protocol::kIgmpFieldNumber)
+                            ->MutableExtension(OstProto::igmp);
+
+    igmp->set_is_override_rsvd_code(true);
+    igmp->set_is_override_checksum(true);
+    igmp->set_is_override_source_count(true);
+    igmp->set_is_override_group_record_count(true);
+
+    igmp->set_type(type);
+    igmp->set_rsvd_code(p[1]);
+    igmp->set_max_response_time(p[1]);
+    igmp->set_checksum(be16(p+2));
+
+    if (type == kIgmpV3Report) {
+        igmp->set_group_record_count(be16(p+6));
+        if (!decodeGmpRecords(igmp, p + msgLen, igmp->group_record_count(),
+                              length - msgLen, false))
+            goto _undecoded;
+        msgLen = length;
+    }
+    else {
+        igmp->mutable_group_address()->set_v4(be32(p+4));
+        if (type == kIgmpV3Query) {
+            int count = be16(p+10);
+
+            msgLen = 12 + 4*count;
+            if (msgLen > length)
+                goto _undecoded;
+
+            igmp->set_s_flag(p[8] & 0x08);
+            igmp->set_qrv(p[8] & 0x07);
+            igmp->set_qqi(p[9]);
+            igmp->set_source_count(count);
+            for (int i = 0; i < count; i++)
+                igmp->add_sources()->set_v4(be32(p + 12 + 4*i));
+        }
+    }
+
+    offset_ += msgLen;
+    layers_++;
+    return;
+
+_undecoded:
+    stream_->mutable_protocol()->RemoveLast();
+}
+
+void FrameDissector::decodeMld(int end)
+{
+    const uchar *p = frame_ + offset_;
+    int length = end - offset_;
+    int msgLen = 8;
+    uint type;
+
+    if (!canDecode(8, end))
+        return;
+
+    type = p[0];
+    if ((type == kMldQuery) && (length >= 28))
+        type = kMldV2Query;
+
+    if ((type != kMldV2Report) && !canDecode(24, end))
+        return;
+
+    OstProto::Gmp *mld = addProtocol(OstProto::Protocol::kMldFieldNumber)
+                            ->MutableExtension(OstProto::mld);
+
+    mld->set_is_override_rsvd_code(true);
+    mld->set_is_override_checksum(true);
+    mld->set_is_override_source_count(true);
+    mld->set_is_override_group_record_count(true);
+
+    mld->set_type(type);
+    mld->set_rsvd_code(p[1]);
+    mld->set_checksum(be16(p+2));
+
+    if (type == kMldV2Report) {
+        mld->set_group_record_count(be16(p+6));
+        if (!decodeGmpRecords(mld, p + msgLen, mld->group_record_count(),
+                              length - msgLen, true))
+            goto _undecoded;
+        msgLen = length;
+    }
+    else {
+        msgLen = 24;
+        mld->set_max_response_time(be16(p+4));
+        mld->mutable_group_address()->set_v6_hi(be64(p+8));
+        mld->mutable_group_address()->set_v6_lo(be64(p+16));
+        if (type == kMldV2Query) {
+            int count = be16(p+26);
+
+            msgLen = 28 + 16*count;
+            if (msgLen > length)
+                goto _undecoded;
+
+            mld->set_s_flag(p[24] & 0x08);
+            mld->set_qrv(p[24] & 0x07);
+            mld->set_qqi(p[25]);
+            mld->set_source_count(count);
+            for (int i = 0; i < count; i++) {
+                OstProto::Gmp::IpAddress *ip = mld->add_sources();
+
+                ip->set_v6_hi(be64(p + 28 + 16*i));
+                ip->set_v6_lo(be64(p + 28 + 16*i + 8));
+            }
+        }
+    }
+
+    offset_ += msgLen;
+    layers_++;
+    return;
+
+_undecoded:
+    stream_->mutable_protocol()->RemoveLast();
+}
+
+/*!
+ * Decodes count IGMPv3/MLDv2 group records from p - the records must
+ * exactly fill length bytes (the rest of the message)
+ */
+bool FrameDissector::decodeGmpRecords(OstProto::Gmp *gmp, const uchar *p,
+        int count, int length, bool isIp6)
+{
+    int addrLen = isIp6 ? 16 : 4;
+    int ofs = 0;
+
+    for (int i = 0; i < count; i++) {
+        int srcCount, auxLen;
+
+        if (ofs + 4 + addrLen > length)
+            return false;
+
+        if (!OstProto::Gmp::GroupRecord::RecordType_IsValid(p[ofs]))
+            return false;
+
+        srcCount = be16(p + ofs + 2);
+        auxLen = p[ofs + 1] * 4;
+        if (ofs + 4 + addrLen*(1 + srcCount) + auxLen > length)
+            return false;
+
+        OstProto::Gmp::GroupRecord *rec = gmp->add_group_records();
+
+        rec->set_type(OstProto::Gmp::GroupRecord::RecordType(p[ofs]));
+        rec->set_is_override_source_count(true);
+        rec->set_source_count(srcCount);
+        rec->set_is_override_aux_data_length(true);
+        rec->set_aux_data_length(p[ofs + 1]);
+        ofs += 4;
+
+        for (int j = -1; j < srcCount; j++, ofs += addrLen) {
+            OstProto::Gmp::IpAddress *ip = (j < 0) ?
+                    rec->mutable_group_address() : rec->add_sources();
+
+            if (isIp6) {
+                ip->set_v6_hi(be64(p + ofs));
+                ip->set_v6_lo(be64(p + ofs + 8));
+            }
+            else
+                ip->set_v4(be32(p + ofs));
+        }
+
+        rec->set_aux_data(p + ofs, auxLen);
+        ofs += auxLen;
+    }
+
+    return ofs == length;
+}
+
+//! Returns true if the stream renders to the same bytes as the frame
+bool FrameDissector::verify()
+{
+    int len;
+
+    if (buf_.size() < length_)
+        buf_.resize(length_);
+
+    streamBase_.protoDataCopyFrom(*stream_);
+
+    len = streamBase_.frameValue((uchar*) buf_.data(), length_, 0);
+    if ((len != length_)
+            || (streamBase_.frameProtocolLength(0) != length_))
+        return false;
+
+    return memcmp(buf_.constData(), frame_, length_) == 0;
+}
@@ -0,0 +1,89 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _FRAME_DISSECTOR_H
+#define _FRAME_DISSECTOR_H
+
+#include "streambase.h"
+
+#include <QByteArray>
+
+namespace OstProto {
+    class Gmp;
+    class Protocol;
+    class Stream;
+}
+
+/*!
+ * Decodes an Ethernet frame into the stream's protocols
+ *
+ * Ethernet II/802.3, VLAN/SVLAN tags, ARP, IPv4, IPv6, TCP, UDP, ICMP,
+ * ICMPv6, IGMP and MLD headers are decoded into the corresponding
+ * protocols with all length and checksum fields overridden to the
+ * captured values (like the PDML import does); anything that is not
+ * decoded - payload, options, trailer - goes into HexDump protocols.
+ *
+ * The decoded stream is rendered and compared with the frame - if a
+ * header doesn't render back to the same bytes (e.g. unusual field
+ * values), decoding stops before that header and the rest of the frame
+ * is taken as is, so the imported frame is always byte exact.
+ *
+ * A dissector is not thread safe - use one per thread
+ */
+class FrameDissector
+{
+public:
+    FrameDissector();
+
+    bool dissect(const uchar *frame, int length, OstProto::Stream *stream);
+
+private:
+    void decode();
+    bool canDecode(int size, int end = -1) const;
+    OstProto::Protocol* addProtocol(int protocolNumber);
+    void addHexDump(int from, int to);
+
+    void decodeEthernet();
+    void decodeIp4();
+    void decodeIp6();
+    void decodeIpPayload(int protocol, int end, bool isIp6);
+    void decodeArp();
+    void decodeTcp(int end);
+    void decodeUdp(int end);
+    void decodeIcmp(bool isIcmp6, int end);
+    void decodeIgmp(int end);
+    void decodeMld(int end);
+    bool decodeGmpRecords(OstProto::Gmp *gmp, const uchar *p, int count,
+                          int length, bool isIp6);
+
+    bool verify();
+
+    const uchar *frame_;
+    int length_;
+    OstProto::Stream *stream_;
+
+    int offset_;    // of the next undecoded byte
+    int layers_;    // number of headers decoded
+    int maxLayers_;
+
+    StreamBase streamBase_; // for verify()
+    QByteArray buf_;
+};
+
+#endif
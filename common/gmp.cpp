@@ -18,10 +18,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
 #include "gmp.h"
+#include <QMutex>
 #include <QStringList>
 
 QHash<int, int> GmpProtocol::frameFieldCountMap;
 
+// Shared by all streams, which may be rendered in parallel (see
+// StreamBase::renderFrames()) or imported from multiple threads
+static QMutex frameFieldCountMapLock;
+
 GmpProtocol::GmpProtocol(StreamBase *stream, AbstractProtocol *parent)
     : AbstractProtocol(stream, parent)
 {
@@ -50,6 +55,8 @@ int GmpProtocol::frameFieldCount() const
     // frameFieldCountMap contains the frameFieldCounts for each
     // msgType - this is built on demand and cached for subsequent use
 
+    QMutexLocker locker(&frameFieldCountMapLock);
+
     // lookup if we have already cached ...
     if (frameFieldCountMap.contains(type))
         return frameFieldCountMap.value(type);
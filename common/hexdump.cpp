@@ -212,3 +212,9 @@ int HexDumpProtocol::protocolFrameSize(int streamIndex) const
     return len;
 }
 
+bool HexDumpProtocol::isProtocolFrameSizeVariable() const
+{
+    // Padding varies with the frame length
+    return data.pad_until_end() 
+        && (mpStream->lenMode() != StreamBase::e_fl_fixed);
+}
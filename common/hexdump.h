@@ -66,6 +66,7 @@ public:
             FieldAttrib attrib = FieldValue);
 
     virtual int protocolFrameSize(int streamIndex = 0) const;
+    virtual bool isProtocolFrameSizeVariable() const;
 
 private:
     OstProto::HexDump    data;
@@ -127,7 +127,8 @@ QVariant IgmpProtocol::fieldData(int index, FieldAttrib attrib,
                 data.group_prefix(),
                 ipUtils::AddrMode(data.group_mode()),
                 data.group_count(),
-                streamIndex);
+                streamIndex,
+                randomKey(kGroupAddress));
 
             switch(attrib)
             {
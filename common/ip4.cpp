@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
 #include "ip4.h"
+#include "prng.h"
 
 #include <QHostAddress>
 
@@ -409,36 +410,7 @@ QVariant Ip4Protocol::fieldData(int index, FieldAttrib attrib,
         }
         case ip4_srcAddr:
         {
-            int        u;
-            quint32    subnet, host, srcIp = 0;
-
-            switch(data.src_ip_mode())
-            {
-                case OstProto::Ip4::e_im_fixed:
-                    srcIp = data.src_ip();
-                    break;
-                case OstProto::Ip4::e_im_inc_host:
-                    u = streamIndex % data.src_ip_count();
-                    subnet = data.src_ip() & data.src_ip_mask();
-                    host = (((data.src_ip() & ~data.src_ip_mask()) + u) &
-                        ~data.src_ip_mask());
-                    srcIp = subnet | host;
-                    break;
-                case OstProto::Ip4::e_im_dec_host:
-                    u = streamIndex % data.src_ip_count();
-                    subnet = data.src_ip() & data.src_ip_mask();
-                    host = (((data.src_ip() & ~data.src_ip_mask()) - u) &
-                        ~data.src_ip_mask());
-                    srcIp = subnet | host;
-                    break;
-                case OstProto::Ip4::e_im_random_host:
-                    subnet = data.src_ip() & data.src_ip_mask();
-                    host = (qrand() & ~data.src_ip_mask());
-                    srcIp = subnet | host;
-                    break;
-                default:
-                    qWarning("Unhandled src_ip_mode = %d", data.src_ip_mode());
-            }
+            quint32 srcIp = srcIpAddress(streamIndex);
 
             switch(attrib)
             {
@@ -462,36 +434,7 @@ QVariant Ip4Protocol::fieldData(int index, FieldAttrib attrib,
         }
         case ip4_dstAddr:
         {
-            int        u;
-            quint32    subnet, host, dstIp = 0;
-
-            switch(data.dst_ip_mode())
-            {
-                case OstProto::Ip4::e_im_fixed:
-                    dstIp = data.dst_ip();
-                    break;
-                case OstProto::Ip4::e_im_inc_host:
-                    u = streamIndex % data.dst_ip_count();
-                    subnet = data.dst_ip() & data.dst_ip_mask();
-                    host = (((data.dst_ip() & ~data.dst_ip_mask()) + u) &
-                        ~data.dst_ip_mask());
-                    dstIp = subnet | host;
-                    break;
-                case OstProto::Ip4::e_im_dec_host:
-                    u = streamIndex % data.dst_ip_count();
-                    subnet = data.dst_ip() & data.dst_ip_mask();
-                    host = (((data.dst_ip() & ~data.dst_ip_mask()) - u) &
-                        ~data.dst_ip_mask());
-                    dstIp = subnet | host;
-                    break;
-                case OstProto::Ip4::e_im_random_host:
-                    subnet = data.dst_ip() & data.dst_ip_mask();
-                    host = (qrand() & ~data.dst_ip_mask());
-                    dstIp = subnet | host;
-                    break;
-                default:
-                    qWarning("Unhandled dst_ip_mode = %d", data.dst_ip_mode());
-            }
+            quint32 dstIp = dstIpAddress(streamIndex);
 
             switch(attrib)
             {
@@ -831,6 +774,13 @@ _exit:
     return isOk;
 }
 
+bool Ip4Protocol::isProtocolFrameValueRandom() const
+{
+    return (data.src_ip_mode() == OstProto::Ip4::e_im_random_host)
+        || (data.dst_ip_mode() == OstProto::Ip4::e_im_random_host)
+        || AbstractProtocol::isProtocolFrameValueRandom();
+}
+
 int Ip4Protocol::protocolFrameVariableCount() const
 {
     int count = AbstractProtocol::protocolFrameVariableCount();
@@ -852,8 +802,13 @@ quint32 Ip4Protocol::protocolFrameCksum(int streamIndex,
         case CksumIpPseudo:
         {
             quint32 sum = 0;
-            QByteArray fv = protocolFrameValue(streamIndex);
-            const quint8 *p = (quint8*) fv.constData();
+            quint16 hdr[30]; // max header length
+            const quint8 *p = (quint8*) hdr;
+
+            // cksum field is not needed, so skip computing it
+            if (protocolFrameValue((uchar*) hdr, sizeof(hdr), streamIndex,
+                        true) < 20)
+                return 0xFFFF;
 
             sum += *((quint16*)(p + 12)); // src-ip hi
             sum += *((quint16*)(p + 14)); // src-ip lo
@@ -874,3 +829,120 @@ quint32 Ip4Protocol::protocolFrameCksum(int streamIndex,
 
     return AbstractProtocol::protocolFrameCksum(streamIndex, cksumType);
 }
+
+int Ip4Protocol::writeProtocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    int ver, hdrlen, totlen;
+    quint16 cksum;
+
+    // Options are rare - leave them to the generic path
+    if (data.options().length() || (bufSize < 20))
+        return -1;
+
+    ver = data.is_override_ver() ? (data.ver_hdrlen() >> 4) & 0x0F : 4;
+    hdrlen = (data.is_override_hdrlen() ? data.ver_hdrlen() : 5) & 0x0F;
+    totlen = data.is_override_totlen() ? data.totlen() : 
+        (protocolFramePayloadSize(streamIndex) + 20);
+
+    buf[0] = (ver << 4) | hdrlen;
+    buf[1] = data.tos();
+    qToBigEndian(quint16(totlen), buf + 2);
+    qToBigEndian(quint16(data.id()), buf + 4);
+    qToBigEndian(quint16(((data.flags() & 0x7) << 13)
+                | (data.frag_ofs() & 0x1FFF)), buf + 6);
+    buf[8] = data.ttl();
+    buf[9] = data.is_override_proto() ?
+                data.proto() : payloadProtocolId(ProtocolIdIp);
+    qToBigEndian(srcIpAddress(streamIndex), buf + 12);
+    qToBigEndian(dstIpAddress(streamIndex), buf + 16);
+
+    // Variable fields are applied after we return, so with variable fields
+    // the checksum has to be computed over the final header
+    buf[10] = buf[11] = 0;
+    if (forCksum)
+        cksum = 0;
+    else if (data.is_override_cksum())
+        cksum = data.cksum();
+    else if (variableFieldCount())
+        cksum = protocolFrameCksum(streamIndex, CksumIp);
+    else
+        cksum = ipCksum(buf, 20);
+    qToBigEndian(cksum, buf + 10);
+
+    return 20;
+}
+
+quint32 Ip4Protocol::srcIpAddress(int streamIndex) const
+{
+    int        u;
+    quint32    subnet, host, srcIp = 0;
+
+    switch(data.src_ip_mode())
+    {
+        case OstProto::Ip4::e_im_fixed:
+            srcIp = data.src_ip();
+            break;
+        case OstProto::Ip4::e_im_inc_host:
+            u = streamIndex % data.src_ip_count();
+            subnet = data.src_ip() & data.src_ip_mask();
+            host = (((data.src_ip() & ~data.src_ip_mask()) + u) &
+                ~data.src_ip_mask());
+            srcIp = subnet | host;
+            break;
+        case OstProto::Ip4::e_im_dec_host:
+            u = streamIndex % data.src_ip_count();
+            subnet = data.src_ip() & data.src_ip_mask();
+            host = (((data.src_ip() & ~data.src_ip_mask()) - u) &
+                ~data.src_ip_mask());
+            srcIp = subnet | host;
+            break;
+        case OstProto::Ip4::e_im_random_host:
+            subnet = data.src_ip() & data.src_ip_mask();
+            host = (prng::value32(randomKey(ip4_srcAddr), streamIndex)
+                    & ~data.src_ip_mask());
+            srcIp = subnet | host;
+            break;
+        default:
+            qWarning("Unhandled src_ip_mode = %d", data.src_ip_mode());
+    }
+
+    return srcIp;
+}
+
+quint32 Ip4Protocol::dstIpAddress(int streamIndex) const
+{
+    int        u;
+    quint32    subnet, host, dstIp = 0;
+
+    switch(data.dst_ip_mode())
+    {
+        case OstProto::Ip4::e_im_fixed:
+            dstIp = data.dst_ip();
+            break;
+        case OstProto::Ip4::e_im_inc_host:
+            u = streamIndex % data.dst_ip_count();
+            subnet = data.dst_ip() & data.dst_ip_mask();
+            host = (((data.dst_ip() & ~data.dst_ip_mask()) + u) &
+                ~data.dst_ip_mask());
+            dstIp = subnet | host;
+            break;
+        case OstProto::Ip4::e_im_dec_host:
+            u = streamIndex % data.dst_ip_count();
+            subnet = data.dst_ip() & data.dst_ip_mask();
+            host = (((data.dst_ip() & ~data.dst_ip_mask()) - u) &
+                ~data.dst_ip_mask());
+            dstIp = subnet | host;
+            break;
+        case OstProto::Ip4::e_im_random_host:
+            subnet = data.dst_ip() & data.dst_ip_mask();
+            host = (prng::value32(randomKey(ip4_dstAddr), streamIndex)
+                    & ~data.dst_ip_mask());
+            dstIp = subnet | host;
+            break;
+        default:
+            qWarning("Unhandled dst_ip_mode = %d", data.dst_ip_mode());
+    }
+
+    return dstIp;
+}
@@ -86,12 +86,20 @@ public:
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
 
+    virtual bool isProtocolFrameValueRandom() const;
     virtual int protocolFrameVariableCount() const;
 
     virtual quint32 protocolFrameCksum(int streamIndex = 0,
         CksumType cksumType = CksumIp) const;
 
+protected:
+    virtual int writeProtocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const;
+
 private:
+    quint32 srcIpAddress(int streamIndex) const;
+    quint32 dstIpAddress(int streamIndex) const;
+
     OstProto::Ip4    data;
 };
 
@@ -100,11 +100,20 @@ public:
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
 
+    virtual bool isProtocolFrameValueRandom() const;
     virtual int protocolFrameVariableCount() const;
 
     virtual quint32 protocolFrameCksum(int streamIndex = 0,
             CksumType cksumType = CksumIp) const;
+
+protected:
+    virtual int writeProtocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const;
+
 private:
+    void srcAddress(int streamIndex, quint64 &srcHi, quint64 &srcLo) const;
+    void dstAddress(int streamIndex, quint64 &dstHi, quint64 &dstLo) const;
+
     OstProto::Ip6 data;
 };
 
@@ -20,6 +20,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _IP_UTILS_H
 #define _IP_UTILS_H
 
+#include "prng.h"
+
 namespace ipUtils {
 enum AddrMode {
     kFixed = 0,
@@ -28,8 +30,9 @@ enum AddrMode {
     kRandom = 3
 };
 
+// randomKey is used for kRandom - see AbstractProtocol::randomKey()
 quint32 inline ipAddress(quint32 baseIp, int prefix, AddrMode mode, int count, 
-                    int index)
+                    int index, quint64 randomKey = 0)
 {
     int u;
     quint32 mask = ((1<<prefix) - 1) << (32 - prefix);
@@ -56,7 +59,7 @@ quint32 inline ipAddress(quint32 baseIp, int prefix, AddrMode mode, int count,
         break;
     case kRandom:
         subnet = baseIp & mask;
-        host = (qrand() & ~mask);
+        host = (prng::value32(randomKey, index) & ~mask);
         ip = subnet | host;
         break;
     default:
@@ -68,7 +71,8 @@ quint32 inline ipAddress(quint32 baseIp, int prefix, AddrMode mode, int count,
 }
 
 void inline ipAddress(quint64 baseIpHi, quint64 baseIpLo, int prefix, 
-        AddrMode mode, int count, int index, quint64 &ipHi, quint64 &ipLo)
+        AddrMode mode, int count, int index, quint64 &ipHi, quint64 &ipLo,
+        quint64 randomKey = 0)
 {
     int u, p, q;
     quint64 maskHi = 0, maskLo = 0;
@@ -107,8 +111,8 @@ void inline ipAddress(quint64 baseIpHi, quint64 baseIpLo, int prefix,
                 hostLo = ((baseIpLo & ~maskLo) - u) & ~maskLo;
             } 
             else if (mode==kRandom) {
-                hostHi = qrand() & ~maskHi;
-                hostLo = qrand() & ~maskLo;
+                hostHi = prng::value(randomKey, 2*quint64(index)) & ~maskHi;
+                hostLo = prng::value(randomKey, 2*quint64(index) + 1) & ~maskLo;
             }
             ipHi = prefixHi | hostHi;
             ipLo = prefixLo | hostLo;
@@ -64,8 +64,18 @@ public:
             FieldAttrib attrib = FieldValue);
 
     virtual int protocolFrameVariableCount() const;
+    virtual bool isProtocolFrameValueThreadSafe() const;
+
+    bool isMacResolved() const;
+
+protected:
+    virtual int writeProtocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const;
 
 private:
+    quint64 dstMacAddress(int streamIndex) const;
+    quint64 srcMacAddress(int streamIndex) const;
+
     OstProto::Mac    data;
     mutable bool forResolve_;
 };
@@ -188,7 +188,8 @@ QVariant MldProtocol::fieldData(int index, FieldAttrib attrib,
                     data.group_count(),
                     streamIndex,
                     grpHi, 
-                    grpLo);
+                    grpLo,
+                    randomKey(kGroupAddress));
 
             switch(attrib)
             {
@@ -19,7 +19,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "nativefileformat.h"
 
-#include "crc32c.h"
+#include "checksum.h"
 
 #include <QApplication>
 #include <QFile>
@@ -57,15 +57,20 @@ NativeFileFormat::NativeFileFormat()
      */
     OstProto::FileMagic magic;
     OstProto::FileChecksum cksum;
+    OstProto::FileChunkHeader chunkHeader;
 
     magic.set_value(kFileMagicValue);
     cksum.set_value(quint32(0));
+    chunkHeader.set_type(OstProto::kEndChunk);
+    chunkHeader.set_length(0);
+    chunkHeader.set_checksum(0);
 
     // TODO: convert Q_ASSERT to something that will run in RELEASE mode also
     Q_ASSERT(magic.IsInitialized());
     Q_ASSERT(cksum.IsInitialized());
     Q_ASSERT(magic.ByteSize() == kFileMagicSize);
     Q_ASSERT(cksum.ByteSize() == kFileChecksumSize);
+    Q_ASSERT(chunkHeader.ByteSize() == kFileChunkHeaderSize);
 }
 
 bool NativeFileFormat::open(
@@ -73,12 +78,15 @@ bool NativeFileFormat::open(
         OstProto::FileType fileType,
         OstProto::FileMeta &meta,
         OstProto::FileContent &content,
-        QString &error)
+        QString &error,
+        const QList<QPair<int, uint> > *ports)
 {
     QFile file(fileName);
     QByteArray buf;
+    const uchar *data;
     int size, contentOffset, contentSize;
     quint32 calcCksum;
+    quint8 zeroCksumBuf[kFileChecksumSize];
     OstProto::FileMagic magic;
     OstProto::FileChecksum cksum, zeroCksum;
 
@@ -91,23 +99,22 @@ bool NativeFileFormat::open(
     if (file.size() < kFileMinSize)
         goto _checksum_missing;
 
-    buf.resize(file.size());
-    size = file.read(buf.data(), buf.size());
-    if (size < 0)
-        goto _read_fail;
-
-    Q_ASSERT(file.atEnd());
-    file.close();
-
-    qDebug("%s: file.size() = %lld", __FUNCTION__, file.size());
-    qDebug("%s: size = %d", __FUNCTION__, size);
+    // Map the file instead of reading it into memory, if we can
+    size = file.size();
+    data = file.map(0, size);
+    if (!data) {
+        buf.resize(size);
+        if (file.read(buf.data(), size) != size)
+            goto _read_fail;
+        data = (const uchar*) buf.constData();
+    }
 
-    //qDebug("Read %d bytes", buf.size());
-    //qDebug("%s", qPrintable(QString(buf.toHex())));
+    qDebug("%s: file.size() = %lld (%s)", __FUNCTION__, file.size(),
+            buf.isEmpty() ? "mapped" : "read");
 
     // Parse and verify magic
     if (!magic.ParseFromArray(
-                (void*)(buf.constData() + kFileMagicOffset),
+                (void*)(data + kFileMagicOffset),
                 kFileMagicSize))
     {
         goto _magic_parse_fail;
@@ -115,34 +122,11 @@ bool NativeFileFormat::open(
     if (magic.value() != kFileMagicValue)
         goto _magic_match_fail;
 
-    // Parse and verify checksum
-    if (!cksum.ParseFromArray(
-            (void*)(buf.constData() + size - kFileChecksumSize),
-            kFileChecksumSize))
-    {
-        goto _cksum_parse_fail;
-    }
-
-    zeroCksum.set_value(0);
-    if (!zeroCksum.SerializeToArray(
-                (void*) (buf.data() + size - kFileChecksumSize),
-                kFileChecksumSize))
-    {
-        goto _zero_cksum_serialize_fail;
-    }
-
-    calcCksum = checksumCrc32C((quint8*) buf.constData(), size);
-
-    qDebug("checksum \nExpected:%x Actual:%x",
-        calcCksum, cksum.value());
-
-    if (cksum.value() != calcCksum)
-        goto _cksum_verify_fail;
-
-    // Parse the metadata first before we parse the full contents
+    // Parse the metadata first before we parse the contents
+    contentOffset = kFileMetaDataOffset + fileMetaSize(data, size);
     if (!meta.ParseFromArray(
-                (void*)(buf.constData() + kFileMetaDataOffset),
-                fileMetaSize((quint8*)buf.constData(), size)))
+                (void*)(data + kFileMetaDataOffset),
+                contentOffset - kFileMetaDataOffset))
     {
         goto _metadata_parse_fail;
     }
@@ -167,7 +151,9 @@ bool NativeFileFormat::open(
         // assuming the native minor version
     }
 
-    if (meta.data().format_version_revision() > kFileFormatVersionRevision)
+    if ((meta.data().format_version_minor() == kFileFormatVersionMinor)
+            && (meta.data().format_version_revision()
+                    > kFileFormatVersionRevision))
     {
         error = QString(tr("%1 was created using a newer version of Ostinato."
            " New features/protocols will not be available.")).arg(fileName);
@@ -175,15 +161,41 @@ bool NativeFileFormat::open(
 
     Q_ASSERT(meta.data().format_version_major() == kFileFormatVersionMajor);
 
-    // ByteSize() does not include the Tag/Key, so we add 2 for that
-    contentOffset = kFileMetaDataOffset + meta.data().ByteSize() + 2;
+    if (meta.data().format_version_minor() >= kFileFormatChunkedVersionMinor)
+        return openChunks(fileName, data, size, contentOffset, content,
+                          ports, error);
+
+    // Pre-chunked file - parse and verify checksum (calculated with the
+    // checksum field zeroed) of the whole file
+    if (!cksum.ParseFromArray(
+            (void*)(data + size - kFileChecksumSize),
+            kFileChecksumSize))
+    {
+        goto _cksum_parse_fail;
+    }
+
+    zeroCksum.set_value(0);
+    if (!zeroCksum.SerializeToArray((void*) zeroCksumBuf, kFileChecksumSize))
+        goto _zero_cksum_serialize_fail;
+
+    calcCksum = checksumCrc32CUpdate(~0U, data, size - kFileChecksumSize);
+    calcCksum = checksumCrc32CUpdate(calcCksum, zeroCksumBuf,
+                                     kFileChecksumSize);
+    calcCksum = checksumCrc32CFinal(calcCksum);
+
+    qDebug("checksum \nExpected:%x Actual:%x",
+        calcCksum, cksum.value());
+
+    if (cksum.value() != calcCksum)
+        goto _cksum_verify_fail;
+
     contentSize = size - contentOffset - kFileChecksumSize;
     qDebug("%s: content offset/size = %d/%d", __FUNCTION__,
             contentOffset, contentSize);
 
     // Parse full contents
     if (!content.ParseFromArray(
-            (void*)(buf.constData() + contentOffset),
+            (void*)(data + contentOffset),
             contentSize))
     {
         goto _content_parse_fail;
@@ -266,19 +278,16 @@ bool NativeFileFormat::save(
 {
     OstProto::FileMagic magic;
     OstProto::FileMeta meta;
-    OstProto::FileChecksum cksum;
+    OstProto::FileChunkHeader endChunk;
+    quint32 contentCrc;
     QFile file(fileName);
-    int metaSize, contentSize;
-    int contentOffset, cksumOffset;
+    int metaSize;
     QByteArray buf;
-    quint32 calcCksum;
+    const OstProto::FileContentMatter &matter = content.matter();
 
     magic.set_value(kFileMagicValue);
     Q_ASSERT(magic.IsInitialized());
 
-    cksum.set_value(0);
-    Q_ASSERT(cksum.IsInitialized());
-
     initFileMetaData(*(meta.mutable_data()));
     meta.mutable_data()->set_file_type(fileType);
     Q_ASSERT(meta.IsInitialized());
@@ -289,15 +298,11 @@ bool NativeFileFormat::save(
     Q_ASSERT(content.IsInitialized());
 
     metaSize = meta.ByteSize();
-    contentSize = content.ByteSize();
-    contentOffset = kFileMetaDataOffset + metaSize;
-    cksumOffset = contentOffset + contentSize;
 
     Q_ASSERT(magic.ByteSize() == kFileMagicSize);
-    Q_ASSERT(cksum.ByteSize() == kFileChecksumSize);
-    buf.resize(kFileMagicSize + metaSize + contentSize + kFileChecksumSize);
+    buf.resize(kFileMagicSize + metaSize);
 
-    // Serialize everything
+    // Serialize magic and meta data
     if (!magic.SerializeToArray((void*) (buf.data() + kFileMagicOffset),
                 kFileMagicSize))
     {
@@ -310,40 +315,86 @@ bool NativeFileFormat::save(
         goto _meta_serialize_fail;
     }
 
-    if (!content.SerializeToArray((void*) (buf.data() + contentOffset),
-                contentSize))
-    {
-        goto _content_serialize_fail;
-    }
+    // The end chunk checksum covers the magic and meta data and the
+    // header of every chunk (see fileformat.proto)
+    contentCrc = checksumCrc32CUpdate(~0U, (const uchar*) buf.constData(),
+                                      buf.size());
 
-    if (!cksum.SerializeToArray((void*) (buf.data() + cksumOffset),
-                kFileChecksumSize))
-    {
-        goto _zero_cksum_serialize_fail;
-    }
+    // TODO: emit status("Writing to disk...");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        goto _open_fail;
 
-    // TODO: emit status("Calculating checksum...");
+    if (file.write(buf) < 0)
+        goto _write_fail;
 
-    // Calculate and write checksum
-    calcCksum = checksumCrc32C((quint8*)buf.constData(), buf.size());
-    cksum.set_value(calcCksum);
-    if (!cksum.SerializeToArray(
-                (void*) (buf.data() + cksumOffset),
-                kFileChecksumSize))
-    {
-        goto _cksum_serialize_fail;
+    // Write content one chunk at a time - a chunk for each stream and
+    // for each container of streams (w/o the streams)
+    if (matter.has_streams()) {
+        const OstProto::StreamConfigList &streams = matter.streams();
+        OstProto::StreamConfigList config;
+
+        config.CopyFrom(streams);
+        config.clear_stream();
+        if (!writeChunk(file, OstProto::kStreamConfigChunk, config, buf,
+                        contentCrc))
+            goto _write_fail;
+
+        for (int i = 0; i < streams.stream_size(); i++) {
+            if (!writeChunk(file, OstProto::kStreamChunk, streams.stream(i),
+                            buf, contentCrc))
+                goto _write_fail;
+        }
     }
 
-    qDebug("Writing %d bytes", buf.size());
-    //qDebug("%s", qPrintable(QString(buf.toHex())));
+    for (int i = 0; i < matter.session().port_groups_size(); i++) {
+        const OstProto::PortGroupContent &pgc =
+                matter.session().port_groups(i);
+        OstProto::PortGroupContent portGroup;
+
+        portGroup.CopyFrom(pgc);
+        portGroup.clear_ports();
+        if (!writeChunk(file, OstProto::kPortGroupChunk, portGroup, buf,
+                        contentCrc))
+            goto _write_fail;
+
+        for (int j = 0; j < pgc.ports_size(); j++) {
+            const OstProto::PortContent &pc = pgc.ports(j);
+            OstProto::PortContent port;
+
+            port.CopyFrom(pc);
+            port.clear_streams();
+            if (!writeChunk(file, OstProto::kPortChunk, port, buf,
+                            contentCrc))
+                goto _write_fail;
+
+            for (int k = 0; k < pc.streams_size(); k++) {
+                if (!writeChunk(file, OstProto::kStreamChunk, pc.streams(k),
+                                buf, contentCrc))
+                    goto _write_fail;
+            }
+        }
+    }
 
-    // TODO: emit status("Writing to disk...");
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
-        goto _open_fail;
+    buf.resize(kFileChunkHeaderSize);
+    endChunk.set_type(OstProto::kEndChunk);
+    endChunk.set_length(0);
+    endChunk.set_checksum(0);
+    if (!endChunk.SerializeToArray((void*) buf.data(), buf.size()))
+        goto _write_fail;
+
+    contentCrc = checksumCrc32CUpdate(contentCrc,
+            (const uchar*) buf.constData(), kFileChunkChecksumOffset);
+    endChunk.set_checksum(checksumCrc32CFinal(contentCrc));
+    if (!endChunk.SerializeToArray((void*) buf.data(), buf.size()))
+        goto _write_fail;
 
     if (file.write(buf) < 0)
         goto _write_fail;
 
+    if (!file.flush())
+        goto _write_fail;
+
+    qDebug("Wrote %lld bytes", file.size());
     file.close();
 
     return true;
@@ -356,24 +407,6 @@ _open_fail:
         .arg(fileName)
         .arg(file.error());
     goto _fail;
-_cksum_serialize_fail:
-    error = QString(tr("Internal Error: Checksum Serialize failed\n%1\n%2"))
-                .arg(QString().fromStdString(
-                            cksum.InitializationErrorString()))
-                .arg(QString().fromStdString(cksum.DebugString()));
-    goto _fail;
-_zero_cksum_serialize_fail:
-    error = QString(tr("Internal Eror: Zero Checksum Serialize failed\n%1\n%2"))
-                .arg(QString().fromStdString(
-                            cksum.InitializationErrorString()))
-                .arg(QString().fromStdString(cksum.DebugString()));
-    goto _fail;
-_content_serialize_fail:
-    error = QString(tr("Internal Error: Content Serialize failed\n%1\n%2"))
-                .arg(QString().fromStdString(
-                            content.InitializationErrorString()))
-                .arg(QString().fromStdString(content.DebugString()));
-    goto _fail;
 _meta_serialize_fail:
     error = QString(tr("Internal Error: Meta Data Serialize failed\n%1\n%2"))
                 .arg(QString().fromStdString(
@@ -494,6 +527,201 @@ int NativeFileFormat::fileMetaSize(const quint8* file, int size)
     return int(result+(i-kFileMetaDataOffset));
 }
 
+/*!
+ * Parses the chunked content (format version 0.3 onwards) of the file
+ *
+ * If ports is given (as a list of port group index and port id), streams
+ * of only those ports are parsed - the stream chunks of other ports are
+ * skipped without even verifying their checksum
+ */
+bool NativeFileFormat::openChunks(
+        const QString fileName,
+        const uchar *data, int size, int contentOffset,
+        OstProto::FileContent &content,
+        const QList<QPair<int, uint> > *ports,
+        QString &error)
+{
+    OstProto::FileChunkHeader header;
+    OstProto::StreamConfigList *streams = NULL;
+    OstProto::PortGroupContent *portGroup = NULL;
+    OstProto::PortContent *port = NULL;
+    bool skipStreams = false;
+    int offset = contentOffset;
+    int chunkCount = 0, skipCount = 0;
+    quint32 calcCksum = 0;
+    quint32 contentCrc = checksumCrc32CUpdate(~0U, data, contentOffset);
+
+    while (1) {
+        const uchar *chunk = data + offset;
+        const uchar *payload;
+        int length;
+
+        if ((size - offset) < kFileChunkHeaderSize)
+            goto _truncated;
+
+        if (!header.ParseFromArray((void*)(data + offset),
+                                   kFileChunkHeaderSize))
+            goto _header_parse_fail;
+
+        offset += kFileChunkHeaderSize;
+        if (header.length() > uint(size - offset))
+            goto _truncated;
+
+        payload = data + offset;
+        length = header.length();
+        offset += length;
+
+        // A missing or reordered chunk fails the end chunk checksum
+        if (header.type() == OstProto::kEndChunk) {
+            calcCksum = checksumCrc32CFinal(checksumCrc32CUpdate(contentCrc,
+                        chunk, kFileChunkChecksumOffset));
+            if (calcCksum != header.checksum())
+                goto _cksum_verify_fail;
+            break;
+        }
+        contentCrc = checksumCrc32CUpdate(contentCrc, chunk,
+                                          kFileChunkHeaderSize);
+
+        if ((header.type() == OstProto::kStreamChunk) && skipStreams) {
+            skipCount++;
+            continue;
+        }
+
+        calcCksum = chunkChecksum(chunk, payload, length);
+        if (calcCksum != header.checksum())
+            goto _cksum_verify_fail;
+
+        switch (header.type()) {
+        case OstProto::kStreamConfigChunk:
+            streams = content.mutable_matter()->mutable_streams();
+            if (!streams->ParseFromArray((void*) payload, length))
+                goto _chunk_parse_fail;
+            break;
+
+        case OstProto::kPortGroupChunk:
+            portGroup = content.mutable_matter()->mutable_session()
+                                ->add_port_groups();
+            port = NULL;
+            if (!portGroup->ParseFromArray((void*) payload, length))
+                goto _chunk_parse_fail;
+            break;
+
+        case OstProto::kPortChunk:
+            if (!portGroup)
+                goto _unexpected_chunk;
+            port = portGroup->add_ports();
+            if (!port->ParseFromArray((void*) payload, length))
+                goto _chunk_parse_fail;
+            skipStreams = ports && !ports->contains(qMakePair(
+                    content.matter().session().port_groups_size() - 1,
+                    uint(port->port_config().port_id().id())));
+            break;
+
+        case OstProto::kStreamChunk:
+            if (port) {
+                if (!port->add_streams()->ParseFromArray((void*) payload,
+                                                         length))
+                    goto _chunk_parse_fail;
+            }
+            else if (streams) {
+                if (!streams->add_stream()->ParseFromArray((void*) payload,
+                                                           length))
+                    goto _chunk_parse_fail;
+            }
+            else
+                goto _unexpected_chunk;
+            break;
+
+        default:
+            qWarning("%s: skipping unknown chunk type %u (%d bytes)",
+                    __FUNCTION__, header.type(), length);
+            break;
+        }
+        chunkCount++;
+    }
+
+    qDebug("%s: parsed %d chunks, skipped %d stream chunks", __FUNCTION__,
+            chunkCount, skipCount);
+
+    return true;
+
+_unexpected_chunk:
+    error = QString(tr("Failed parsing %1 contents - unexpected chunk %2 "
+                "at offset %3"))
+            .arg(fileName).arg(header.type()).arg(offset);
+    goto _fail;
+_chunk_parse_fail:
+    error = QString(tr("Failed parsing %1 contents - chunk %2 at offset %3"))
+            .arg(fileName).arg(header.type()).arg(offset);
+    goto _fail;
+_cksum_verify_fail:
+    error = QString(tr("%1 checksum validation failed at offset %2!\n"
+                "Expected:%3 Actual:%4"))
+                .arg(fileName)
+                .arg(offset)
+                .arg(calcCksum, 0, kBaseHex)
+                .arg(header.checksum(), 0, kBaseHex);
+    goto _fail;
+_header_parse_fail:
+    error = QString(tr("Failed parsing %1 chunk header at offset %2"))
+            .arg(fileName).arg(offset);
+    goto _fail;
+_truncated:
+    error = QString(tr("%1 is truncated")).arg(fileName);
+    goto _fail;
+_fail:
+    qDebug("%s", qPrintable(error));
+    return false;
+}
+
+/*!
+ * Returns the checksum of a chunk - calculated over the type and length
+ * fields of the (encoded) chunk header and the payload
+ */
+quint32 NativeFileFormat::chunkChecksum(const uchar *header,
+        const uchar *payload, int length)
+{
+    quint32 crc;
+
+    crc = checksumCrc32CUpdate(~0U, header, kFileChunkChecksumOffset);
+    crc = checksumCrc32CUpdate(crc, payload, length);
+
+    return checksumCrc32CFinal(crc);
+}
+
+//! Serializes payload into buf as a chunk and writes it to file
+bool NativeFileFormat::writeChunk(
+        QFile &file,
+        OstProto::FileChunkType type,
+        const ::google::protobuf::Message &payload,
+        QByteArray &buf, quint32 &contentCrc)
+{
+    OstProto::FileChunkHeader header;
+    int length = payload.ByteSize();
+
+    buf.resize(kFileChunkHeaderSize + length);
+    if (!payload.SerializeToArray(
+                (void*) (buf.data() + kFileChunkHeaderSize), length))
+        return false;
+
+    header.set_type(type);
+    header.set_length(length);
+    header.set_checksum(0);
+    if (!header.SerializeToArray((void*) buf.data(), kFileChunkHeaderSize))
+        return false;
+
+    header.set_checksum(chunkChecksum((const uchar*) buf.constData(),
+                (const uchar*) (buf.constData() + kFileChunkHeaderSize),
+                length));
+    if (!header.SerializeToArray((void*) buf.data(), kFileChunkHeaderSize))
+        return false;
+
+    contentCrc = checksumCrc32CUpdate(contentCrc,
+            (const uchar*) buf.constData(), kFileChunkHeaderSize);
+
+    return file.write(buf) == buf.size();
+}
+
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
 /*! Fixup content to what is expected in the native version */
 void NativeFileFormat::postParseFixup(OstProto::FileMetaData metaData,
@@ -517,6 +745,8 @@ void NativeFileFormat::postParseFixup(OstProto::FileMetaData metaData,
 
         // fall-through to next higher version until native version
     }
+    case 2:
+        // only the layout changed from 0.2 to 0.3 (chunked content)
     case kFileFormatVersionMinor: // native version
         break;
 
@@ -33,8 +33,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "fileformat.pb.h"
 
+#include <QList>
+#include <QPair>
 #include <QString>
 
+class QFile;
+
 class NativeFileFormat
 {
 public:
@@ -44,7 +48,8 @@ public:
               OstProto::FileType fileType,
               OstProto::FileMeta &meta,
               OstProto::FileContent &content,
-              QString &error);
+              QString &error,
+              const QList<QPair<int, uint> > *ports = NULL);
     bool save(OstProto::FileType fileType,
               const OstProto::FileContent &content,
               const QString fileName,
@@ -58,10 +63,22 @@ public:
 private:
     void initFileMetaData(OstProto::FileMetaData &metaData);
     int fileMetaSize(const quint8* file, int size);
+    bool openChunks(const QString fileName,
+                    const uchar *data, int size, int contentOffset,
+                    OstProto::FileContent &content,
+                    const QList<QPair<int, uint> > *ports,
+                    QString &error);
+    quint32 chunkChecksum(const uchar *header, const uchar *payload,
+                          int length);
+    bool writeChunk(QFile &file, OstProto::FileChunkType type,
+                    const ::google::protobuf::Message &payload,
+                    QByteArray &buf, quint32 &contentCrc);
 
     static const int kFileMagicSize = 12;
     static const int kFileChecksumSize = 5;
     static const int kFileMinSize = kFileMagicSize + kFileChecksumSize;
+    static const int kFileChunkHeaderSize = 15;
+    static const int kFileChunkChecksumOffset = 10;
 
     static const int kFileMagicOffset = 0;
     static const int kFileMetaDataOffset = kFileMagicSize;
@@ -70,8 +87,11 @@ private:
 
     // Native file format version
     static const uint kFileFormatVersionMajor = 0;
-    static const uint kFileFormatVersionMinor = 2;
-    static const uint kFileFormatVersionRevision = 4;
+    static const uint kFileFormatVersionMinor = 3;
+    static const uint kFileFormatVersionRevision = 0;
+
+    // Content is chunked from this minor version onwards
+    static const uint kFileFormatChunkedVersionMinor = 3;
 };
 
 #endif
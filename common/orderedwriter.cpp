@@ -0,0 +1,152 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "orderedwriter.h"
+
+#include <QIODevice>
+#include <QMutexLocker>
+
+OrderedWriter::OrderedWriter(QIODevice *device, int bufferSize,
+                             int maxPending)
+    : device_(device), bufferSize_(bufferSize),
+      maxPending_(qMax(maxPending, 1)), next_(0),
+      bytesWritten_(0), hasError_(false)
+{
+    buffer_.reserve(bufferSize_);
+}
+
+OrderedWriter::~OrderedWriter()
+{
+    flush();
+}
+
+/*!
+ * Writes the chunk with the given sequence number - immediately, if it is
+ * the next one due, otherwise once all the chunks before it are written
+ *
+ * Blocks if the chunk is not due and too many chunks are already pending
+ */
+void OrderedWriter::write(int sequence, const QByteArray &chunk)
+{
+    QMutexLocker locker(&lock_);
+
+    while ((sequence != next_) && (pending_.size() >= maxPending_))
+        isPendingFree_.wait(&lock_);
+
+    if (sequence != next_) {
+        Q_ASSERT(sequence > next_);
+        pending_.insert(sequence, chunk);
+        return;
+    }
+
+    append(chunk);
+    next_++;
+
+    // Write out the chunks that were waiting for this one
+    while (!pending_.isEmpty()) {
+        QHash<int, QByteArray>::iterator iter = pending_.find(next_);
+        if (iter == pending_.end())
+            break;
+        append(iter.value());
+        pending_.erase(iter);
+        next_++;
+    }
+    isPendingFree_.wakeAll();
+}
+
+/*!
+ * Writes out all buffered data to the device; returns false if there has
+ * been any write error
+ *
+ * Chunks still waiting for an earlier chunk are not written
+ */
+bool OrderedWriter::flush()
+{
+    QMutexLocker locker(&lock_);
+
+    if (!buffer_.isEmpty() && !hasError_) {
+        if (device_->write(buffer_) != buffer_.size()) {
+            qWarning("%s: write error - %s", __FUNCTION__,
+                    qPrintable(device_->errorString()));
+            hasError_ = true;
+        }
+    }
+    buffer_.resize(0); // unlike clear(), keeps the reserved capacity
+
+    return !hasError_;
+}
+
+/*!
+ * Returns the number of chunks waiting for an earlier chunk
+ */
+int OrderedWriter::pendingCount()
+{
+    QMutexLocker locker(&lock_);
+
+    return pending_.size();
+}
+
+/*!
+ * Returns the number of bytes (in chunks) written so far - includes the
+ * data buffered but not yet written to the device
+ */
+qint64 OrderedWriter::bytesWritten()
+{
+    QMutexLocker locker(&lock_);
+
+    return bytesWritten_;
+}
+
+bool OrderedWriter::hasError()
+{
+    QMutexLocker locker(&lock_);
+
+    return hasError_;
+}
+
+// Must be called with lock_ held
+void OrderedWriter::append(const QByteArray &chunk)
+{
+    bytesWritten_ += chunk.size();
+
+    if (hasError_)
+        return;
+
+    // Large chunks are written directly, instead of being copied first
+    if ((buffer_.size() + chunk.size()) > bufferSize_) {
+        if (!buffer_.isEmpty()) {
+            if (device_->write(buffer_) != buffer_.size())
+                goto _error;
+            buffer_.resize(0);
+        }
+        if (chunk.size() >= bufferSize_) {
+            if (device_->write(chunk) != chunk.size())
+                goto _error;
+            return;
+        }
+    }
+
+    buffer_.append(chunk);
+    return;
+
+_error:
+    qWarning("%s: write error - %s", __FUNCTION__,
+            qPrintable(device_->errorString()));
+    hasError_ = true;
+}
@@ -0,0 +1,78 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _ORDERED_WRITER_H
+#define _ORDERED_WRITER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QWaitCondition>
+
+class QIODevice;
+
+/*!
+ * Writes chunks of data to a device in the order of their sequence
+ * numbers, irrespective of the order in which they are handed over
+ *
+ * Chunks are typically produced in parallel by multiple threads - write()
+ * may be called concurrently from any of them. A chunk that arrives ahead
+ * of its turn is held till all the chunks before it have been written.
+ * Written data is accumulated and passed on to the device in large writes.
+ *
+ * To bound memory use, write() blocks once maxPending chunks are held -
+ * till the chunk due next arrives; the caller writing that chunk is never
+ * blocked, so producers must hand over chunks for all sequence numbers
+ * they have claimed (an empty chunk, if aborting)
+ *
+ * Sequence numbers start at 0 and must not have any gaps
+ */
+class OrderedWriter
+{
+public:
+    OrderedWriter(QIODevice *device, int bufferSize = kDefaultBufferSize,
+                  int maxPending = kDefaultMaxPending);
+    ~OrderedWriter();
+
+    void write(int sequence, const QByteArray &chunk);
+    bool flush();
+
+    int pendingCount();
+    qint64 bytesWritten();
+    bool hasError();
+
+private:
+    static const int kDefaultBufferSize = 1 << 20; // 1MB
+    static const int kDefaultMaxPending = 256; // chunks
+
+    void append(const QByteArray &chunk);
+
+    QMutex lock_; // protects all of the below
+    QIODevice *device_;
+    int bufferSize_;
+    QByteArray buffer_;
+    QHash<int, QByteArray> pending_;
+    int maxPending_;
+    QWaitCondition isPendingFree_;
+    int next_;
+    qint64 bytesWritten_;
+    bool hasError_;
+};
+
+#endif
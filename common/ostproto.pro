@@ -43,6 +43,7 @@ PROTOS += \
 
 HEADERS = \
     abstractprotocol.h    \
+    checksum.h \
     comboprotocol.h    \
     protocolmanager.h \
     protocollist.h \
@@ -83,6 +84,7 @@ HEADERS += \
 
 SOURCES = \
     abstractprotocol.cpp \
+    checksum.cpp \
     crc32c.cpp \
     protocolmanager.cpp \
     protocollist.cpp \
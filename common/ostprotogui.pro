@@ -3,7 +3,8 @@ CONFIG += qt staticlib
 QT += widgets network xml script
 INCLUDEPATH += "../extra/qhexedit2/src"
 LIBS += \
-    -lprotobuf
+    -lprotobuf \
+    -lz
 
 FORMS = \
     pcapfileimport.ui \
@@ -42,7 +43,11 @@ HEADERS = \
     nativefileformat.h \
     ossnfileformat.h \
     ostmfileformat.h \
+    flowaggregator.h \
+    framedissector.h \
+    orderedwriter.h \
     pcapfileformat.h \
+    pcapfilereader.h \
     pdmlfileformat.h \
     pythonfileformat.h \
     pdmlprotocol.h \
@@ -92,7 +97,11 @@ SOURCES += \
     nativefileformat.cpp \
     ossnfileformat.cpp \
     ostmfileformat.cpp \
+    flowaggregator.cpp \
+    framedissector.cpp \
+    orderedwriter.cpp \
     pcapfileformat.cpp \
+    pcapfilereader.cpp \
     pdmlfileformat.cpp \
     pythonfileformat.cpp \
     pdmlprotocol.cpp \
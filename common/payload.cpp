@@ -19,6 +19,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "payload.h"
 #include "streambase.h"
+#include "prng.h"
 
 PayloadProtocol::PayloadProtocol(StreamBase *stream, AbstractProtocol *parent)
     : AbstractProtocol(stream, parent)
@@ -147,9 +148,10 @@ QVariant PayloadProtocol::fieldData(int index, FieldAttrib attrib,
                                 fv[i] = 0xFF - (i % (0xFF + 1));
                             break;
                         case OstProto::Payload::e_dp_random:
-                            //! \todo (HIGH) cksum is incorrect for random pattern
-                            for (int i = 0; i < dataLen; i++)
-                                fv[i] =  qrand() % (0xFF + 1);
+                            // Same random data for a given streamIndex
+                            // every time - so that the cksum is correct
+                            prng::fill(randomKey(payload_dataPattern),
+                                    streamIndex, (uchar*)fv.data(), dataLen);
                             break;
                         default:
                             qWarning("Unhandled data pattern %d", 
@@ -253,3 +255,47 @@ int PayloadProtocol::protocolFrameVariableCount() const
 
     return count;
 }
+
+int PayloadProtocol::writeProtocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool /*forCksum*/) const
+{
+    int dataLen = protocolFrameSize(streamIndex);
+
+    // Same as fieldData() - see the hack there
+    if (dataLen <= 0)
+        dataLen = 1;
+
+    // Payload is the last protocol, so it is typically truncated
+    dataLen = qMin(dataLen, bufSize);
+
+    switch(data.pattern_mode())
+    {
+        case OstProto::Payload::e_dp_fixed_word:
+        {
+            uchar word[4];
+            int i;
+
+            qToBigEndian((quint32) data.pattern(), word);
+            for (i = 0; i + 4 <= dataLen; i += 4)
+                memcpy(buf + i, word, 4);
+            memcpy(buf + i, word, dataLen - i);
+            break;
+        }
+        case OstProto::Payload::e_dp_inc_byte:
+            for (int i = 0; i < dataLen; i++)
+                buf[i] = i % (0xFF + 1);
+            break;
+        case OstProto::Payload::e_dp_dec_byte:
+            for (int i = 0; i < dataLen; i++)
+                buf[i] = 0xFF - (i % (0xFF + 1));
+            break;
+        case OstProto::Payload::e_dp_random:
+            prng::fill(randomKey(payload_dataPattern), streamIndex, buf,
+                    dataLen);
+            break;
+        default:
+            return -1;
+    }
+
+    return dataLen;
+}
@@ -19,16 +19,22 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "pcapfileformat.h"
 
+#include "flowaggregator.h"
+#include "framedissector.h"
+#include "pcapfilereader.h"
 #include "pdmlreader.h"
 #include "ostprotolib.h"
 #include "streambase.h"
-#include "hexdump.pb.h"
 
 #include <QDataStream>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
 #include <QProcess>
 #include <QTemporaryFile>
+#include <QThread>
+#include <QVector>
+#include <QtEndian>
 #include <QtGlobal>
 
 const quint32 kPcapFileMagic = 0xa1b2c3d4;
@@ -38,8 +44,140 @@ const quint16 kPcapFileVersionMinor = 4;
 const quint32 kMaxSnapLen = 65535;
 const quint32 kDltEthernet = 1;
 
+// Packets are read in batches which are dissected in parallel
+const int kImportBatchSize = 4096;
+const int kMinPacketsPerDissectThread = 256;
+
+// Packets are rendered in batches in parallel for export
+const int kExportBatchSize = 4096;
+const int kPcapRecordHeaderSize = 16;
+
 PcapFileFormat pcapFileFormat;
 
+class PcapDissectThread : public QThread
+{
+public:
+    PcapDissectThread(FrameDissector *dissector,
+                      const QVector<PcapFileReader::Packet> &packets,
+                      const QVector<OstProto::Stream*> &streams,
+                      int first, int count)
+        : dissector_(dissector), packets_(packets), streams_(streams),
+          first_(first), count_(count)
+    {
+    }
+
+    static void dissect(FrameDissector *dissector,
+                        const QVector<PcapFileReader::Packet> &packets,
+                        const QVector<OstProto::Stream*> &streams,
+                        int first, int count)
+    {
+        for (int i = first; i < first + count; i++) {
+            const QByteArray &data = packets.at(i).data;
+
+            if (data.size())
+                dissector->dissect((const uchar*) data.constData(),
+                                   data.size(), streams.at(i));
+        }
+    }
+
+protected:
+    virtual void run()
+    {
+        dissect(dissector_, packets_, streams_, first_, count_);
+    }
+
+private:
+    FrameDissector *dissector_;
+    const QVector<PcapFileReader::Packet> &packets_;
+    const QVector<OstProto::Stream*> &streams_;
+    int first_;
+    int count_;
+};
+
+/*
+ * A batch of frames of a stream rendered in parallel - see
+ * StreamBase::renderFrames() - directly into pcap packet records, which
+ * are then gathered in frame order
+ */
+class PcapRecordBatch : public FrameSink
+{
+public:
+    PcapRecordBatch(const StreamBase *stream, int first, int count,
+                    quint64 timestamp, quint64 gap, quint32 snapLen)
+        : stream_(stream), first_(first), timestamp_(timestamp),
+          gap_(gap), snapLen_(snapLen)
+    {
+        records_.resize(count);
+
+        // frameRendered() is called from multiple threads - so use a raw
+        // pointer instead of the (detach checking) Qt accessors
+        recordsData_ = records_.data();
+
+        count_ = stream_->renderFrames(first, count, this);
+    }
+
+    //! Returns the number of frames rendered
+    int count() const
+    {
+        return count_;
+    }
+
+    //! Returns the packet records of all frames in frame order
+    QByteArray records() const
+    {
+        QByteArray buf;
+        int size = 0;
+
+        for (int i = 0; i < records_.size(); i++)
+            size += records_.at(i).size();
+
+        buf.reserve(size);
+        for (int i = 0; i < records_.size(); i++)
+            buf.append(records_.at(i));
+
+        return buf;
+    }
+
+    virtual void frameRendered(int frameIndex, const uchar *buf, int len)
+    {
+        QByteArray &record = recordsData_[frameIndex - first_];
+        quint64 ts = timestamp_ + (frameIndex - first_)*gap_;
+        int inclLen = qMin(stream_->frameProtocolLength(frameIndex), len);
+        uchar *p;
+
+        inclLen = qMin(quint32(inclLen), snapLen_);
+
+        record.resize(kPcapRecordHeaderSize + inclLen);
+        p = (uchar*) record.data();
+
+        qToBigEndian<quint32>(quint32(ts/1000000), p);
+        qToBigEndian<quint32>(quint32(ts%1000000), p + 4);
+        qToBigEndian<quint32>(quint32(inclLen), p + 8);
+        qToBigEndian<quint32>(quint32(len), p + 12);
+        memcpy(p + kPcapRecordHeaderSize, buf, inclLen);
+    }
+
+private:
+    const StreamBase *stream_;
+    int first_;
+    int count_;
+    quint64 timestamp_;
+    quint64 gap_;
+    quint32 snapLen_;
+    QVector<QByteArray> records_;
+    QByteArray *recordsData_;
+};
+
+static QString throughput(quint64 frames, qint64 bytes, qint64 msecs)
+{
+    if (msecs <= 0)
+        msecs = 1;
+
+    return QString("%1 pkts/s, %2 MB/s")
+        .arg(frames*1000/msecs)
+        .arg(double(bytes)*1000/msecs/(1 << 20), 0, 'f', 1);
+}
+
 PcapImportOptionsDialog::PcapImportOptionsDialog(QVariantMap *options)
     : QDialog(NULL)
 {
@@ -48,6 +186,7 @@ PcapImportOptionsDialog::PcapImportOptionsDialog(QVariantMap *options)
 
     viaPdml->setChecked(options_->value("ViaPdml").toBool());
     doDiff->setChecked(options_->value("DoDiff").toBool());
+    aggregateFlows->setChecked(options_->value("AggregateFlows").toBool());
 
     connect(buttonBox, SIGNAL(accepted()), this, SLOT(accept()));
 }
@@ -60,14 +199,16 @@ void PcapImportOptionsDialog::accept()
 {
     options_->insert("ViaPdml", viaPdml->isChecked());
     options_->insert("DoDiff", doDiff->isChecked());
+    options_->insert("AggregateFlows", aggregateFlows->isChecked());
 
     QDialog::accept();
 }
 
 PcapFileFormat::PcapFileFormat()
 {
-    importOptions_.insert("ViaPdml", true);
+    importOptions_.insert("ViaPdml", false);
     importOptions_.insert("DoDiff", true);
+    importOptions_.insert("AggregateFlows", false);
 
     importDialog_ = NULL;
 }
@@ -81,107 +222,33 @@ bool PcapFileFormat::open(const QString fileName,
             OstProto::StreamConfigList &streams, QString &error)
 {
     bool isOk = false;
-    QFile file(fileName);
-    QTemporaryFile file2;
-    quint32 magic;
-    uchar gzipMagic[2];
-    int len;
-    PcapFileHeader fileHdr;
-    PcapPacketHeader pktHdr;
+    PcapFileReader fileReader;
+    QVector<PcapFileReader::Packet> packets(kImportBatchSize);
+    QVector<OstProto::Stream*> packetStreams(kImportBatchSize);
+    QList<FrameDissector*> dissectors;
+    bool aggregate = importOptions_.value("AggregateFlows").toBool();
+    FlowAggregator aggregator;
+    OstProto::StreamConfigList batchStreams; // if aggregating
     OstProto::Stream *prevStream = NULL;
-    uint lastUsec = 0;
+    quint64 lastTimestamp = 0;
+    quint32 linkType = kDltEthernet;
     int pktCount;
-    qint64 byteCount = 0;
-    qint64 byteTotal;
-    QByteArray pktBuf;
-
-    if (!file.open(QIODevice::ReadOnly))
-        goto _err_open;
-
-    len = file.peek((char*)gzipMagic, sizeof(gzipMagic));
-    if (len < int(sizeof(gzipMagic)))
-        goto _err_reading_magic;
-
-    if ((gzipMagic[0] == 0x1f) && (gzipMagic[1] == 0x8b))
-    {
-        QProcess gzip;
-
-        emit status("Decompressing...");
-        emit target(0);
-
-        if (!file2.open())
-        {
-            error.append("Unable to open temporary file to uncompress .gz\n");
-            goto _err_unzip_fail;
-        }
-
-        qDebug("decompressing to %s", qPrintable(file2.fileName()));
-
-        gzip.setStandardOutputFile(file2.fileName());
-        gzip.start(OstProtoLib::gzipPath(), 
-                QStringList() 
-                << "-d" 
-                << "-c" 
-                << fileName);
-        if (!gzip.waitForStarted(-1))
-        {
-            error.append(QString("Unable to start gzip. Check path in Preferences.\n"));
-            goto _err_unzip_fail;
-        }
-
-        if (!gzip.waitForFinished(-1))
-        {
-            error.append(QString("Error running gzip\n"));
-            goto _err_unzip_fail;
-        }
-
-        file2.seek(0);
-
-        fd_.setDevice(&file2);
-    }
-    else
-    {
-        fd_.setDevice(&file);
-    }
-
-    byteTotal = fd_.device()->size() - sizeof(fileHdr);
 
     emit status("Reading File Header...");
     emit target(0);
 
-    fd_ >> magic;
+    if (!fileReader.open(fileName))
+        goto _err_reader;
 
-    qDebug("magic = %08x", magic);
+    qDebug("%s: %s%s", qPrintable(fileName),
+            fileReader.isPcapng() ? "pcapng" : "pcap",
+            fileReader.isCompressed() ? " (gzip)" : "");
 
-    if (magic == kPcapFileMagicSwapped)
-    {
-        // Toggle Byte order
-        if (fd_.byteOrder() == QDataStream::BigEndian)
-            fd_.setByteOrder(QDataStream::LittleEndian);
-        else
-            fd_.setByteOrder(QDataStream::BigEndian);
-    }
-    else if (magic != kPcapFileMagic)
-        goto _err_bad_magic;
-
-    fd_ >> fileHdr.versionMajor;
-    fd_ >> fileHdr.versionMinor;
-    fd_ >> fileHdr.thisZone;
-    fd_ >> fileHdr.sigfigs;
-    fd_ >> fileHdr.snapLen;
-    fd_ >> fileHdr.network;
-   
-    if ((fileHdr.versionMajor != kPcapFileVersionMajor) ||
-            (fileHdr.versionMinor != kPcapFileVersionMinor))
-        goto _err_unsupported_version;
-
-#if 1
     // XXX: we support only Ethernet, for now
-    if (fileHdr.network != kDltEthernet)
+    // (pcapng link types are per interface - checked per packet)
+    linkType = fileReader.linkType();
+    if (!fileReader.isPcapng() && (linkType != kDltEthernet))
         goto _err_unsupported_encap;
-#endif
-
-    pktBuf.resize(fileHdr.snapLen);
 
     if (importOptions_.value("ViaPdml").toBool())
     {
@@ -416,48 +483,97 @@ bool PcapFileFormat::open(const QString fileName,
 _non_pdml:
     emit status("Reading Packets...");
     emit target(100);  // in percentage
-    pktCount = 1;
-    while (!fd_.atEnd())
+
+    for (int i = 0; i < qMax(QThread::idealThreadCount(), 1); i++)
+        dissectors.append(new FrameDissector);
+
+    pktCount = 0;
+    while (!fileReader.atEnd())
     {
-        OstProto::Stream *stream = streams.add_stream();
-        OstProto::Protocol *proto = stream->add_protocol();
-        OstProto::HexDump *hexDump = proto->MutableExtension(OstProto::hexDump);
+        QList<PcapDissectThread*> threads;
+        int count = 0, numThreads, chunk;
 
-        proto->mutable_protocol_id()->set_id(
-                OstProto::Protocol::kHexDumpFieldNumber);
+        // Read a batch of packets and create their streams ...
+        while ((count < kImportBatchSize)
+                && fileReader.readPacket(packets[count]))
+        {
+            const PcapFileReader::Packet &pkt = packets.at(count);
+            OstProto::Stream *stream = aggregate ?
+                    batchStreams.add_stream() : streams.add_stream();
+
+            if (pkt.linkType != kDltEthernet) {
+                linkType = pkt.linkType;
+                goto _err_unsupported_encap;
+            }
+
+            pktCount++;
+            stream->mutable_stream_id()->set_id(pktCount);
+            stream->mutable_core()->set_is_enabled(true);
+            stream->mutable_core()->set_frame_len(pkt.data.size()+4); // FCS
+
+            packetStreams[count] = stream;
+
+            // setup packet rate to the timing in pcap (as close as possible)
+            // - the aggregator derives the rate of each flow itself
+            if (!aggregate) {
+                const double kNsecsInSec = 1e9;
+                quint64 delta = pkt.timestamp - lastTimestamp;
+
+                if ((pktCount != 1) && delta)
+                    stream->mutable_control()->set_packets_per_sec(
+                            kNsecsInSec/delta);
+
+                if (prevStream)
+                    prevStream->mutable_control()->CopyFrom(
+                            stream->control());
+
+                lastTimestamp = pkt.timestamp;
+                prevStream = stream;
+            }
+            count++;
+        }
 
-        readPacket(pktHdr, pktBuf);
+        if (!fileReader.errorString().isEmpty())
+            goto _err_reader;
+
+        // ... and dissect them into protocols across multiple threads;
+        // the calling thread dissects the first chunk itself
+        numThreads = qBound(1, count/kMinPacketsPerDissectThread,
+                            dissectors.size());
+        chunk = (count + numThreads - 1)/numThreads;
+
+        for (int i = 1; i < numThreads; i++) {
+            PcapDissectThread *thread = new PcapDissectThread(
+                    dissectors.at(i), packets, packetStreams,
+                    i*chunk, qMin(chunk, count - i*chunk));
+            thread->start();
+            threads.append(thread);
+        }
 
-        // validations on inclLen <= origLen && inclLen <= snapLen
-        Q_ASSERT(pktHdr.inclLen <= fileHdr.snapLen); // TODO: convert to if
+        PcapDissectThread::dissect(dissectors.at(0), packets, packetStreams,
+                                   0, qMin(chunk, count));
 
-        hexDump->set_content(pktBuf.data(), pktHdr.inclLen);
-        hexDump->set_pad_until_end(false);
+        foreach(PcapDissectThread *thread, threads) {
+            thread->wait();
+            delete thread;
+        }
 
-        stream->mutable_stream_id()->set_id(pktCount);
-        stream->mutable_core()->set_is_enabled(true);
-        stream->mutable_core()->set_frame_len(pktHdr.inclLen+4); // FCS
+        if (aggregate) {
+            for (int i = 0; i < count; i++)
+                aggregator.addPacket(*packetStreams.at(i),
+                                     packets.at(i).timestamp);
+            batchStreams.clear_stream();
+        }
 
-        // setup packet rate to the timing in pcap (as close as possible)
-        const uint kUsecsInSec = uint(1e6);
-        uint usec = (pktHdr.tsSec*kUsecsInSec + pktHdr.tsUsec);
-        uint delta = usec - lastUsec;
-        
-        if ((pktCount != 1) && delta)
-            stream->mutable_control()->set_packets_per_sec(kUsecsInSec/delta);
-
-        if (prevStream)
-            prevStream->mutable_control()->CopyFrom(stream->control());
-
-        lastUsec = usec;
-        prevStream = stream;
-        pktCount++;
-        qDebug("pktCount = %d", pktCount);
-        byteCount += pktHdr.inclLen + sizeof(pktHdr);
-        emit progress(int(byteCount*100/byteTotal)); // in percentage
+        if (fileReader.size())
+            emit progress(int(fileReader.pos()*100/fileReader.size()));
         if (stop_)
             goto _user_cancel;
     }
+    qDebug("imported %d packets", pktCount);
+
+    if (aggregate)
+        aggregator.finish(streams);
 
     isOk = true;
     goto _exit;
@@ -472,87 +588,36 @@ _diff_fail:
 _err_unsupported_encap:
     error = QString(tr("%1 has non-ethernet encapsulation (%2) which is "
                 "not supported - Sorry!"))
-            .arg(QFileInfo(fileName).fileName()).arg(fileHdr.network);
-    goto _exit;
-
-_err_unsupported_version:
-    error = QString(tr("%1 is in PCAP version %2.%3 format which is "
-                "not supported - Sorry!"))
-            .arg(fileName).arg(fileHdr.versionMajor).arg(fileHdr.versionMinor);
-    goto _exit;
-
-_err_bad_magic:
-    error = QString(tr("%1 is not a valid PCAP file")).arg(fileName);
-    goto _exit;
-
-#if 0
-_err_truncated:
-    error = QString(tr("%1 is too short")).arg(fileName);
+            .arg(QFileInfo(fileName).fileName()).arg(linkType);
     goto _exit;
-#endif 
 
-_err_unzip_fail:
-    goto _exit;
-
-_err_reading_magic:
-    error = QString(tr("Unable to read magic from %1")).arg(fileName);
-    goto _exit;
-
-_err_open:
-    error = QString(tr("Unable to open file: %1")).arg(fileName);
+_err_reader:
+    error = QString(tr("Error reading %1: %2"))
+            .arg(fileName).arg(fileReader.errorString());
     goto _exit;
 
 _exit:
-    file.close();
+    qDeleteAll(dissectors);
     return isOk;
 }
 
-/*!
-  Reads packet meta data into pktHdr and packet content into buf.
-
-  Returns true if packet is read successfully, false otherwise.
-*/
-bool PcapFileFormat::readPacket(PcapPacketHeader &pktHdr, QByteArray &pktBuf)
-{
-    quint32 len;
-
-    // TODO: chk fd_.status()
-
-    // read PcapPacketHeader
-    fd_ >> pktHdr.tsSec;
-    fd_ >> pktHdr.tsUsec;
-    fd_ >> pktHdr.inclLen;
-    fd_ >> pktHdr.origLen;
-
-    // TODO: chk fd_.status()
-
-    // XXX: should never be required, but we play safe
-    if (quint32(pktBuf.size()) < pktHdr.inclLen)
-        pktBuf.resize(pktHdr.inclLen);
-
-    // read Pkt contents
-    len = fd_.readRawData(pktBuf.data(), pktHdr.inclLen); // TODO: use while?
-
-    Q_ASSERT(len == pktHdr.inclLen); // TODO: remove assert
-    pktBuf.resize(len);
-
-    return true;
-}
-
 bool PcapFileFormat::save(const OstProto::StreamConfigList streams,
         const QString fileName, QString &error)
 {
     bool isOk = false;
     QFile file(fileName);
     PcapFileHeader fileHdr;
-    PcapPacketHeader pktHdr;
-    QByteArray pktBuf;
+    QByteArray hdrBuf;
+    QDataStream hdr(&hdrBuf, QIODevice::WriteOnly);
+    QList<StreamBase*> streamList;
+    quint64 totalFrames = 0, doneFrames = 0;
+    quint64 timestamp = 0; // usecs
+    QElapsedTimer timer;
+    qint64 lastReport = 0, bytesWritten = 0;
 
     if (!file.open(QIODevice::WriteOnly))
         goto _err_open;
 
-    fd_.setDevice(&file);
-
     fileHdr.magicNumber = kPcapFileMagic;
     fileHdr.versionMajor = kPcapFileVersionMajor;
     fileHdr.versionMinor = kPcapFileVersionMinor;
@@ -561,66 +626,99 @@ bool PcapFileFormat::save(const OstProto::StreamConfigList streams,
     fileHdr.snapLen = kMaxSnapLen;
     fileHdr.network = kDltEthernet; 
 
-    fd_ << fileHdr.magicNumber;
-    fd_ << fileHdr.versionMajor;
-    fd_ << fileHdr.versionMinor;
-    fd_ << fileHdr.thisZone;
-    fd_ << fileHdr.sigfigs;
-    fd_ << fileHdr.snapLen;
-    fd_ << fileHdr.network;
+    // Like the packet records, the file header is big endian
+    hdr << fileHdr.magicNumber;
+    hdr << fileHdr.versionMajor;
+    hdr << fileHdr.versionMinor;
+    hdr << fileHdr.thisZone;
+    hdr << fileHdr.sigfigs;
+    hdr << fileHdr.snapLen;
+    hdr << fileHdr.network;
 
-    pktBuf.resize(kMaxSnapLen);
-
-    emit status("Writing Packets...");
-    emit target(streams.stream_size());
+    if (file.write(hdrBuf) != hdrBuf.size())
+        goto _err_write;
+    bytesWritten += hdrBuf.size();
 
-    pktHdr.tsSec = 0;
-    pktHdr.tsUsec = 0;
     for (int i = 0; i < streams.stream_size(); i++)
     {
-        StreamBase s;
-        
-        s.setId(i);
-        s.protoDataCopyFrom(streams.stream(i));
-        // TODO: expand frameIndex for each stream
-        s.frameValue((uchar*)pktBuf.data(), pktBuf.size(), 0); 
-
-        pktHdr.inclLen = s.frameProtocolLength(0); // FIXME: stream index = 0
-        pktHdr.origLen = s.frameLen() - 4; // FCS; FIXME: Hardcoding
+        StreamBase *s = new StreamBase;
 
-        qDebug("savepcap i=%d, incl/orig len = %d/%d", i, 
-                pktHdr.inclLen, pktHdr.origLen);
-
-        if (pktHdr.inclLen > fileHdr.snapLen)
-            pktHdr.inclLen = fileHdr.snapLen;
+        s->setId(i);
+        s->protoDataCopyFrom(streams.stream(i));
+        streamList.append(s);
+        totalFrames += qMax(s->frameCount(), 0);
+    }
 
-        fd_ << pktHdr.tsSec;
-        fd_ << pktHdr.tsUsec;
-        fd_ << pktHdr.inclLen;
-        fd_ << pktHdr.origLen;
-        fd_.writeRawData(pktBuf.data(), pktHdr.inclLen);
+    emit status("Writing Packets...");
+    emit target(100); // in percentage
 
-        if (s.packetRate())
-            pktHdr.tsUsec += quint32(1e6/s.packetRate());
-        if (pktHdr.tsUsec >= 1000000)
+    timer.start();
+    for (int i = 0; i < streamList.size(); i++)
+    {
+        const StreamBase *s = streamList.at(i);
+        int frameCount = s->frameCount();
+        quint64 gap = s->packetRate() ? quint64(1e6/s->packetRate()) : 0;
+
+        // Frames are rendered in parallel straight into pcap records, a
+        // batch at a time; batches are produced (and so written) in order
+        // by this thread, so each goes out to the file as is
+        for (int first = 0; first < frameCount; first += kExportBatchSize)
         {
-            pktHdr.tsSec++;
-            pktHdr.tsUsec -= 1000000;
+            PcapRecordBatch batch(s, first,
+                    qMin(kExportBatchSize, frameCount - first),
+                    timestamp + first*gap, gap, fileHdr.snapLen);
+
+            if (file.write(batch.records()) != batch.records().size())
+                goto _err_write;
+            bytesWritten += batch.records().size();
+
+            doneFrames += batch.count();
+            emit progress(int(doneFrames*100/totalFrames));
+
+            if (timer.elapsed() - lastReport >= 1000) {
+                lastReport = timer.elapsed();
+                emit status(QString("Writing Packets... %1")
+                        .arg(throughput(doneFrames, bytesWritten,
+                                        lastReport)));
+            }
+
+            if (stop_)
+                goto _user_cancel;
         }
-
-        emit progress(i);
+        timestamp += quint64(frameCount)*gap;
     }
 
+    if (!file.flush())
+        goto _err_write;
+
+    qDebug("exported %llu packets, %lld bytes in %lld ms (%s)",
+            doneFrames, bytesWritten, timer.elapsed(),
+            qPrintable(throughput(doneFrames, bytesWritten,
+                                  timer.elapsed())));
+    emit status(QString("Wrote %1 packets (%2)")
+            .arg(doneFrames)
+            .arg(throughput(doneFrames, bytesWritten, timer.elapsed())));
+
     file.close();
 
     isOk = true;
     goto _exit;
 
+_user_cancel:
+    isOk = true;
+    goto _exit;
+
+_err_write:
+    error = QString(tr("Error writing %1: %2"))
+        .arg(fileName).arg(file.errorString());
+    goto _exit;
+
 _err_open:
     error = QString(tr("Unable to open file: %1")).arg(fileName);
     goto _exit;
 
 _exit:
+    qDeleteAll(streamList);
     return isOk;
 }
 
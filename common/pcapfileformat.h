@@ -75,8 +75,6 @@ private:
         quint32 origLen;       /* actual length of packet */
     } PcapPacketHeader;
 
-    bool readPacket(PcapPacketHeader &pktHdr, QByteArray &pktBuf);
-
     QDataStream fd_;
     QVariantMap importOptions_;
     PcapImportOptionsDialog *importDialog_;
@@ -0,0 +1,612 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "pcapfilereader.h"
+
+#include <QtEndian>
+
+#include <string.h>
+#include <zlib.h>
+
+static const quint32 kPcapMagic = 0xa1b2c3d4;
+static const quint32 kPcapMagicNsec = 0xa1b23c4d;
+static const quint16 kPcapVersionMajor = 2;
+
+static const quint32 kPcapngSectionHeader = 0x0A0D0D0A;
+static const quint32 kPcapngInterface = 0x00000001;
+static const quint32 kPcapngPacket = 0x00000002;  // obsolete
+static const quint32 kPcapngSimplePacket = 0x00000003;
+static const quint32 kPcapngEnhancedPacket = 0x00000006;
+static const quint32 kPcapngByteOrderMagic = 0x1A2B3C4D;
+static const quint16 kPcapngVersionMajor = 1;
+static const quint16 kPcapngOptEnd = 0;
+static const quint16 kPcapngOptTsResol = 9;
+
+// Sanity limits to detect corrupted files before allocating memory
+static const quint32 kMaxPacketSize = 16 << 20;
+static const quint32 kMaxBlockSize = 32 << 20;
+
+static const int kBufferSize = 256 << 10;
+static const quint64 kNsecsInSec = Q_UINT64_C(1000000000);
+
+PcapFileReader::PcapFileReader()
+{
+    zstream_ = NULL;
+    isZStreamEnd_ = false;
+    bufPos_ = bufLen_ = 0;
+    isAtEnd_ = true;
+    isPcapng_ = false;
+    isBigEndian_ = false;
+    isNsecTs_ = false;
+    linkType_ = 0;
+    snapLen_ = 0;
+}
+
+PcapFileReader::~PcapFileReader()
+{
+    close();
+}
+
+/*!
+ * Opens the capture file and reads its file/section header - the file may
+ * be gzip compressed
+ *
+ * Returns false if the file can't be opened or is not a supported capture
+ * file; errorString() has the details
+ */
+bool PcapFileReader::open(const QString &fileName)
+{
+    uchar magic[4];
+
+    close();
+    error_.clear();
+
+    file_.setFileName(fileName);
+    if (!file_.open(QIODevice::ReadOnly))
+        return setError(file_.errorString());
+
+    if ((file_.peek((char*)magic, 2) == 2)
+            && (magic[0] == 0x1f) && (magic[1] == 0x8b)) {
+        zstream_ = new z_stream;
+        memset(zstream_, 0, sizeof(*zstream_));
+        // windowBits + 16 => gzip header and trailer
+        if (inflateInit2(zstream_, 16 + MAX_WBITS) != Z_OK) {
+            delete zstream_;
+            zstream_ = NULL;
+            return setError("unable to initialize gzip decompression");
+        }
+        zbuf_.resize(kBufferSize);
+    }
+
+    buf_.resize(kBufferSize);
+    bufPos_ = bufLen_ = 0;
+    isAtEnd_ = false;
+
+    if (!read(magic, sizeof(magic)))
+        return setError("file too short");
+
+    if (qFromBigEndian<quint32>(magic) == kPcapngSectionHeader)
+        return openPcapng();
+
+    return openPcap(qFromBigEndian<quint32>(magic));
+}
+
+void PcapFileReader::close()
+{
+    if (zstream_) {
+        inflateEnd(zstream_);
+        delete zstream_;
+        zstream_ = NULL;
+    }
+    isZStreamEnd_ = false;
+    zbuf_.clear();
+    buf_.clear();
+    bufPos_ = bufLen_ = 0;
+    interfaceList_.clear();
+    isAtEnd_ = true;
+    file_.close();
+}
+
+/*!
+ * Reads the next packet into packet
+ *
+ * Returns false at the end of the file or on an error - a truncated last
+ * packet is treated as the end of the file (as capture tools do)
+ */
+bool PcapFileReader::readPacket(Packet &packet)
+{
+    if (isAtEnd_)
+        return false;
+
+    if (isPcapng_ ? readPcapngPacket(packet) : readPcapPacket(packet))
+        return true;
+
+    isAtEnd_ = true;
+    return false;
+}
+
+bool PcapFileReader::atEnd() const
+{
+    return isAtEnd_;
+}
+
+bool PcapFileReader::isPcapng() const
+{
+    return isPcapng_;
+}
+
+bool PcapFileReader::isCompressed() const
+{
+    return zstream_ != NULL;
+}
+
+//! Returns the link type of the file (pcap) or the last packet (pcapng)
+quint32 PcapFileReader::linkType() const
+{
+    return linkType_;
+}
+
+//! Returns the position in the file on disk, for progress
+qint64 PcapFileReader::pos() const
+{
+    return file_.pos();
+}
+
+//! Returns the size of the file on disk (compressed, if so), for progress
+qint64 PcapFileReader::size() const
+{
+    return file_.size();
+}
+
+QString PcapFileReader::errorString() const
+{
+    return error_;
+}
+
+//
+// Private methods
+//
+
+/*!
+ * Reads len bytes from the (decompressed) file - returns false if the
+ * file has less than len bytes left
+ */
+bool PcapFileReader::read(void *buf, int len)
+{
+    char *p = (char*) buf;
+
+    while (len) {
+        if ((bufPos_ == bufLen_) && !fill())
+            return false;
+
+        int n = qMin(len, bufLen_ - bufPos_);
+
+        if (p) {
+            memcpy(p, buf_.constData() + bufPos_, n);
+            p += n;
+        }
+        bufPos_ += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+bool PcapFileReader::fill()
+{
+    bufPos_ = bufLen_ = 0;
+
+    if (!zstream_) {
+        qint64 len = file_.read(buf_.data(), buf_.size());
+
+        if (len < 0)
+            return setError(file_.errorString());
+
+        bufLen_ = int(len);
+        return bufLen_ > 0;
+    }
+
+    zstream_->next_out = (Bytef*) buf_.data();
+    zstream_->avail_out = buf_.size();
+
+    while (zstream_->avail_out == uint(buf_.size())) {
+        int ret;
+
+        if (!zstream_->avail_in) {
+            qint64 len = file_.read(zbuf_.data(), zbuf_.size());
+
+            if (len < 0)
+                return setError(file_.errorString());
+            if (len == 0)
+                break;
+
+            zstream_->next_in = (Bytef*) zbuf_.data();
+            zstream_->avail_in = uint(len);
+        }
+
+        if (isZStreamEnd_) {
+            // Restart for the next member of concatenated gzip files;
+            // trailing garbage is ignored (as gzip does)
+            if ((zstream_->avail_in < 2)
+                    || (zstream_->next_in[0] != 0x1f)
+                    || (zstream_->next_in[1] != 0x8b)) {
+                qDebug("gzip: ignoring trailing data");
+                zstream_->avail_in = 0;
+                file_.seek(file_.size());
+                break;
+            }
+            inflateReset(zstream_);
+            isZStreamEnd_ = false;
+        }
+
+        ret = inflate(zstream_, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            isZStreamEnd_ = true;
+        }
+        else if ((ret != Z_OK) && (ret != Z_BUF_ERROR)) {
+            setError(QString("gzip: %1").arg(zstream_->msg ?
+                            zstream_->msg : "corrupted data"));
+            zstream_->avail_in = 0;
+            file_.seek(file_.size());
+            break;
+        }
+    }
+
+    bufLen_ = buf_.size() - zstream_->avail_out;
+    return bufLen_ > 0;
+}
+
+bool PcapFileReader::openPcap(quint32 magic)
+{
+    uchar hdr[20];
+
+    if ((magic == kPcapMagic) || (magic == kPcapMagicNsec)) {
+        isBigEndian_ = true;
+    }
+    else {
+        magic = qbswap(magic);
+        if ((magic != kPcapMagic) && (magic != kPcapMagicNsec))
+            return setError("not a pcap or pcapng file");
+        isBigEndian_ = false;
+    }
+    isNsecTs_ = (magic == kPcapMagicNsec);
+    isPcapng_ = false;
+
+    if (!read(hdr, sizeof(hdr)))
+        return setError("truncated pcap file header");
+
+    if (get16(hdr) != kPcapVersionMajor)
+        return setError(QString("unsupported pcap version %1.%2")
+                            .arg(get16(hdr)).arg(get16(hdr+2)));
+
+    snapLen_ = get32(hdr+12);
+    // The upper bits have FCS information, if at all
+    linkType_ = get32(hdr+16) & 0xFFFF;
+
+    qDebug("pcap: %s endian, %s timestamps, snapLen %u, linkType %u",
+            isBigEndian_ ? "big" : "little", isNsecTs_ ? "nsec" : "usec",
+            snapLen_, linkType_);
+
+    return true;
+}
+
+bool PcapFileReader::openPcapng()
+{
+    uchar hdr[8];
+    quint32 length;
+    QByteArray body;
+
+    isPcapng_ = true;
+
+    // Byte order magic is the first field after the block length
+    if (!read(hdr, sizeof(hdr)))
+        return setError("truncated pcapng section header");
+
+    if (qFromBigEndian<quint32>(hdr+4) == kPcapngByteOrderMagic)
+        isBigEndian_ = true;
+    else if (qFromLittleEndian<quint32>(hdr+4) == kPcapngByteOrderMagic)
+        isBigEndian_ = false;
+    else
+        return setError("bad pcapng byte order magic");
+
+    length = get32(hdr);
+    if ((length < 28) || (length > kMaxBlockSize) || (length % 4))
+        return setError("bad pcapng section header length");
+
+    body.resize(length - 8);
+    memcpy(body.data(), hdr+4, 4);
+    if (!read(body.data()+4, body.size()-4))
+        return setError("truncated pcapng section header");
+    body.resize(body.size()-4); // trailing block length
+
+    return readSectionHeader(body);
+}
+
+bool PcapFileReader::readPcapPacket(Packet &packet)
+{
+    uchar hdr[16];
+    quint32 capLen;
+
+    if ((bufPos_ == bufLen_) && !fill())
+        return false;
+
+    if (!read(hdr, sizeof(hdr))) {
+        qWarning("pcap: truncated packet header at end of file");
+        return false;
+    }
+
+    capLen = get32(hdr+8);
+    if (capLen > kMaxPacketSize)
+        return setError(QString("bad packet length %1").arg(capLen));
+
+    packet.timestamp = get32(hdr)*kNsecsInSec
+                        + (isNsecTs_ ? get32(hdr+4) : get32(hdr+4)*1000ULL);
+    packet.origLen = get32(hdr+12);
+    packet.linkType = linkType_;
+    packet.data.resize(capLen);
+
+    if (!read(packet.data.data(), capLen)) {
+        qWarning("pcap: truncated packet at end of file");
+        return false;
+    }
+
+    return true;
+}
+
+bool PcapFileReader::readPcapngPacket(Packet &packet)
+{
+    quint32 type;
+    QByteArray body;
+
+    while (readPcapngBlock(type, body)) {
+        const uchar *p = (const uchar*) body.constData();
+        quint32 ifId, capLen, dataOfs;
+        quint64 ts;
+
+        switch (type) {
+        case kPcapngSectionHeader:
+            if (!readSectionHeader(body))
+                return false;
+            continue;
+
+        case kPcapngInterface:
+            if (!readInterface(body))
+                return false;
+            continue;
+
+        case kPcapngEnhancedPacket:
+            if (body.size() < 20)
+                return setError("bad pcapng enhanced packet block");
+            ifId = get32(p);
+            ts = (quint64(get32(p+4)) << 32) | get32(p+8);
+            capLen = get32(p+12);
+            packet.origLen = get32(p+16);
+            dataOfs = 20;
+            break;
+
+        case kPcapngPacket:
+            if (body.size() < 20)
+                return setError("bad pcapng packet block");
+            ifId = get16(p);
+            ts = (quint64(get32(p+4)) << 32) | get32(p+8);
+            capLen = get32(p+12);
+            packet.origLen = get32(p+16);
+            dataOfs = 20;
+            break;
+
+        case kPcapngSimplePacket:
+            if (body.size() < 4)
+                return setError("bad pcapng simple packet block");
+            ifId = 0;
+            ts = 0; // not available
+            packet.origLen = get32(p);
+            capLen = qMin(packet.origLen, quint32(body.size() - 4));
+            if (interfaceList_.size() && interfaceList_.at(0).snapLen)
+                capLen = qMin(capLen, interfaceList_.at(0).snapLen);
+            dataOfs = 4;
+            break;
+
+        default:
+            // Name resolution, statistics, custom blocks etc.
+            continue;
+        }
+
+        if (ifId >= quint32(interfaceList_.size()))
+            return setError(QString("packet for undefined interface %1")
+                                .arg(ifId));
+        if (capLen > body.size() - dataOfs)
+            return setError(QString("bad packet length %1").arg(capLen));
+
+        const Interface &intf = interfaceList_.at(ifId);
+
+        packet.timestamp = timestamp(intf, ts);
+        packet.linkType = linkType_ = intf.linkType;
+        packet.data = body.mid(dataOfs, capLen);
+
+        return true;
+    }
+
+    return false;
+}
+
+/*!
+ * Reads the next block - body is everything between the block length
+ * fields; returns false at the end of the file or on an error
+ */
+bool PcapFileReader::readPcapngBlock(quint32 &type, QByteArray &body)
+{
+    uchar hdr[8];
+    quint32 length;
+
+    if ((bufPos_ == bufLen_) && !fill())
+        return false;
+
+    if (!read(hdr, sizeof(hdr))) {
+        qWarning("pcapng: truncated block header at end of file");
+        return false;
+    }
+
+    type = get32(hdr);
+    if (type == kPcapngSectionHeader) {
+        // A new section may have a different byte order
+        uchar bom[4];
+
+        if (!read(bom, sizeof(bom)))
+            return false;
+
+        if (qFromBigEndian<quint32>(bom) == kPcapngByteOrderMagic)
+            isBigEndian_ = true;
+        else if (qFromLittleEndian<quint32>(bom) == kPcapngByteOrderMagic)
+            isBigEndian_ = false;
+        else
+            return setError("bad pcapng byte order magic");
+
+        length = get32(hdr+4);
+        if ((length < 28) || (length > kMaxBlockSize))
+            return setError("bad pcapng section header length");
+
+        body.resize(length - 8);
+        memcpy(body.data(), bom, sizeof(bom));
+        if (!read(body.data() + 4, body.size() - 4))
+            return false;
+        body.resize(body.size() - 4);
+        return true;
+    }
+
+    length = get32(hdr+4);
+    if ((length < 12) || (length > kMaxBlockSize))
+        return setError(QString("bad pcapng block length %1").arg(length));
+
+    // Block length is supposed to be a multiple of 4, but isn't always
+    body.resize(length - 8);
+    if (!read(body.data(), body.size())) {
+        qWarning("pcapng: truncated block at end of file");
+        return false;
+    }
+    body.resize(body.size() - 4); // trailing block length
+
+    return true;
+}
+
+bool PcapFileReader::readSectionHeader(const QByteArray &body)
+{
+    const uchar *p = (const uchar*) body.constData();
+
+    if (body.size() < 16)
+        return setError("bad pcapng section header");
+
+    if (get16(p+4) != kPcapngVersionMajor)
+        return setError(QString("unsupported pcapng version %1.%2")
+                            .arg(get16(p+4)).arg(get16(p+6)));
+
+    // Interface ids are per section
+    interfaceList_.clear();
+
+    qDebug("pcapng: new section, %s endian",
+            isBigEndian_ ? "big" : "little");
+    return true;
+}
+
+bool PcapFileReader::readInterface(const QByteArray &body)
+{
+    const uchar *p = (const uchar*) body.constData();
+    int ofs = 8;
+    Interface intf;
+
+    if (body.size() < 8)
+        return setError("bad pcapng interface description block");
+
+    intf.linkType = get16(p);
+    intf.snapLen = get32(p+4);
+    intf.isTsPowerOf2 = false;
+    intf.tsResolution = 6; // default - usec
+
+    // Options: code(2), length(2), value padded to 32 bits
+    while (ofs + 4 <= body.size()) {
+        quint16 code = get16(p+ofs);
+        quint16 len = get16(p+ofs+2);
+
+        if ((code == kPcapngOptEnd) || (ofs + 4 + len > body.size()))
+            break;
+
+        if ((code == kPcapngOptTsResol) && (len >= 1)) {
+            intf.isTsPowerOf2 = p[ofs+4] & 0x80;
+            intf.tsResolution = p[ofs+4] & 0x7F;
+        }
+
+        ofs += 4 + ((len + 3) & ~3);
+    }
+
+    qDebug("pcapng: interface %d, linkType %u, snapLen %u, tsresol %s%d",
+            interfaceList_.size(), intf.linkType, intf.snapLen,
+            intf.isTsPowerOf2 ? "2^-" : "10^-", intf.tsResolution);
+
+    interfaceList_.append(intf);
+    if (interfaceList_.size() == 1)
+        linkType_ = intf.linkType;
+
+    return true;
+}
+
+quint16 PcapFileReader::get16(const uchar *p) const
+{
+    return isBigEndian_ ? qFromBigEndian<quint16>(p)
+                        : qFromLittleEndian<quint16>(p);
+}
+
+quint32 PcapFileReader::get32(const uchar *p) const
+{
+    return isBigEndian_ ? qFromBigEndian<quint32>(p)
+                        : qFromLittleEndian<quint32>(p);
+}
+
+//! Converts a pcapng timestamp in interface units to nanoseconds
+quint64 PcapFileReader::timestamp(const Interface &intf, quint64 ts) const
+{
+    int n = intf.tsResolution;
+
+    if (!intf.isTsPowerOf2) {
+        quint64 scale = 1;
+
+        for (int i = 0; i < qAbs(9 - n); i++)
+            scale *= 10;
+        return n <= 9 ? ts * scale : ts / scale;
+    }
+
+    if (n >= 64)
+        return 0;
+
+    // Split into seconds and fraction to avoid overflow
+    quint64 sec = ts >> n;
+    quint64 frac = ts & ((Q_UINT64_C(1) << n) - 1);
+
+    if (n > 34) {
+        frac >>= n - 34;
+        n = 34;
+    }
+    return sec * kNsecsInSec + ((frac * kNsecsInSec) >> n);
+}
+
+bool PcapFileReader::setError(const QString &error)
+{
+    if (error_.isEmpty())
+        error_ = error;
+    qWarning("%s: %s", qPrintable(file_.fileName()), qPrintable(error));
+    return false;
+}
@@ -0,0 +1,114 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _PCAP_FILE_READER_H
+#define _PCAP_FILE_READER_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QString>
+
+struct z_stream_s;
+
+/*!
+ * Sequential reader for packet capture files
+ *
+ * Reads classic pcap (either byte order, micro or nano second timestamps)
+ * and pcapng files - optionally gzip compressed, which is decompressed
+ * in-process as the file is read - and returns the packets one at a time
+ * with their timestamps normalized to nanoseconds
+ */
+class PcapFileReader
+{
+public:
+    struct Packet
+    {
+        quint64 timestamp;  // nanoseconds
+        quint32 origLen;    // length on the wire
+        quint32 linkType;   // DLT_xxx/LINKTYPE_xxx
+        QByteArray data;    // captured bytes
+    };
+
+    PcapFileReader();
+    ~PcapFileReader();
+
+    bool open(const QString &fileName);
+    void close();
+
+    bool readPacket(Packet &packet);
+    bool atEnd() const;
+
+    bool isPcapng() const;
+    bool isCompressed() const;
+    quint32 linkType() const;
+
+    qint64 pos() const;
+    qint64 size() const;
+
+    QString errorString() const;
+
+private:
+    struct Interface
+    {
+        quint32 linkType;
+        quint32 snapLen;
+        bool isTsPowerOf2;  // if_tsresol is 2^-n (vs. 10^-n)
+        int tsResolution;   // n
+    };
+
+    bool read(void *buf, int len);
+    bool fill();
+
+    bool openPcap(quint32 magic);
+    bool openPcapng();
+    bool readPcapPacket(Packet &packet);
+    bool readPcapngPacket(Packet &packet);
+    bool readPcapngBlock(quint32 &type, QByteArray &body);
+    bool readSectionHeader(const QByteArray &body);
+    bool readInterface(const QByteArray &body);
+
+    quint16 get16(const uchar *p) const;
+    quint32 get32(const uchar *p) const;
+    quint64 timestamp(const Interface &intf, quint64 ts) const;
+    bool setError(const QString &error);
+
+    QFile file_;
+    bool isAtEnd_;
+    QString error_;
+
+    // gzip decompression
+    z_stream_s *zstream_;
+    QByteArray zbuf_;
+    bool isZStreamEnd_; // at the end of a gzip member
+
+    // buffered (decompressed) bytes from the file
+    QByteArray buf_;
+    int bufPos_;
+    int bufLen_;
+
+    bool isPcapng_;
+    bool isBigEndian_;
+    bool isNsecTs_;
+    quint32 linkType_;
+    quint32 snapLen_;
+    QList<Interface> interfaceList_;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _PRNG_H
+#define _PRNG_H
+
+#include <QtGlobal>
+#include <qendian.h>
+#include <string.h>
+
+/*
+ * Counter based pseudo random number generator
+ *
+ * Unlike qrand(), there's no state - a random value is a pure function
+ * of a key and a counter (typically the frame index), so the random
+ * value for any frame can be computed in O(1), in any order, from any
+ * thread and is the same across runs and builds.
+ *
+ * The mixing function is the SplitMix64 finalizer - SplitMix64's n-th
+ * output for a seed is value(seed, n) below. Keys for independent
+ * sequences (e.g. a field in a stream) are derived using key()
+ */
+namespace prng {
+
+const quint64 kGamma = Q_UINT64_C(0x9e3779b97f4a7c15);
+
+inline quint64 mix64(quint64 z)
+{
+    z = (z ^ (z >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+//! Returns the key for the sequence identified by (seed, stream)
+inline quint64 key(quint64 seed, quint64 stream)
+{
+    return mix64(mix64(seed + kGamma) ^ (stream * kGamma));
+}
+
+//! Returns the counter-th 64-bit random value of the sequence
+inline quint64 value(quint64 key, quint64 counter)
+{
+    return mix64(key + (counter + 1) * kGamma);
+}
+
+inline quint32 value32(quint64 key, quint64 counter)
+{
+    return quint32(value(key, counter) >> 32);
+}
+
+//! Returns a random value in the range [0, range) - range should be > 0
+inline quint32 uniform(quint64 key, quint64 counter, quint32 range)
+{
+    // Multiply-shift instead of modulo - faster and without the modulo bias
+    return quint32((quint64(value32(key, counter)) * range) >> 32);
+}
+
+/*!
+ * Fills buf with len random bytes - the bytes are a function of key and
+ * counter, independent of other counters, and are the same irrespective
+ * of host byte order
+ *
+ * Each 8 byte block is computed independently of the others, so the
+ * main loop is unrolled 4-way for the compiler to overlap (or vectorize,
+ * where 64-bit multiplies are available) the multiplies
+ */
+inline void fill(quint64 key, quint64 counter, uchar *buf, int len)
+{
+    quint64 blockKey = value(key, counter);
+    uchar tail[sizeof(quint64)];
+    int i = 0, n = 0;
+
+    for (; i + 32 <= len; i += 32, n += 4) {
+        qToLittleEndian(value(blockKey, n    ), buf + i);
+        qToLittleEndian(value(blockKey, n + 1), buf + i + 8);
+        qToLittleEndian(value(blockKey, n + 2), buf + i + 16);
+        qToLittleEndian(value(blockKey, n + 3), buf + i + 24);
+    }
+
+    for (; i + 8 <= len; i += 8, n++)
+        qToLittleEndian(value(blockKey, n), buf + i);
+
+    if (i < len) {
+        qToLittleEndian(value(blockKey, n), tail);
+        memcpy(buf + i, tail, len - i);
+    }
+}
+
+} // namespace prng
+#endif
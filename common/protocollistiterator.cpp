@@ -20,10 +20,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "protocollistiterator.h"
 #include "protocollist.h"
 #include "abstractprotocol.h"
+#include "streambase.h"
 
-ProtocolListIterator::ProtocolListIterator(ProtocolList &list)
+ProtocolListIterator::ProtocolListIterator(ProtocolList &list,
+        const StreamBase *stream)
 {
     _iter = new QMutableLinkedListIterator<AbstractProtocol*>(list);
+    _stream = stream;
 }
 
 ProtocolListIterator::~ProtocolListIterator()
@@ -70,6 +73,9 @@ void ProtocolListIterator::insert(AbstractProtocol* value)
         value->next = NULL;
 
     _iter->insert(const_cast<AbstractProtocol*>(value));
+
+    if (_stream)
+        _stream->invalidateFrameLayout();
 }
 
 AbstractProtocol* ProtocolListIterator::next()
@@ -99,6 +105,9 @@ void ProtocolListIterator::remove()
     if (_iter->value()->next)
         _iter->value()->next->prev = _iter->value()->prev;
     _iter->remove();
+
+    if (_stream)
+        _stream->invalidateFrameLayout();
 }
 
 void ProtocolListIterator::setValue(AbstractProtocol* value) const
@@ -110,6 +119,9 @@ void ProtocolListIterator::setValue(AbstractProtocol* value) const
     value->prev = _iter->value()->prev;
     value->next = _iter->value()->next;
     _iter->setValue(const_cast<AbstractProtocol*>(value));
+
+    if (_stream)
+        _stream->invalidateFrameLayout();
 }
 
 void ProtocolListIterator::toBack()
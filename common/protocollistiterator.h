@@ -21,14 +21,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 class AbstractProtocol;
 class ProtocolList;
+class StreamBase;
 
 class ProtocolListIterator 
 {
 private:
     QMutableLinkedListIterator<AbstractProtocol*> *_iter;
+    const StreamBase *_stream;
 
 public:
-    ProtocolListIterator(ProtocolList &list);
+    ProtocolListIterator(ProtocolList &list, const StreamBase *stream = NULL);
     ~ProtocolListIterator();
     bool findNext(const AbstractProtocol* value) const;
     bool findPrevious(const AbstractProtocol* value);
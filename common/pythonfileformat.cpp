@@ -19,10 +19,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "pythonfileformat.h"
 
+#include "orderedwriter.h"
+
 #include <google/protobuf/descriptor.h>
 
+#include <QAtomicInt>
 #include <QFile>
+#include <QRunnable>
+#include <QSemaphore>
 #include <QSet>
+#include <QThreadPool>
 
 #include <cctype>
 #include <vector>
@@ -36,6 +42,63 @@ PythonFileFormat pythonFileFormat;
 extern char *version;
 extern char *revision;
 
+// Fewer streams than this are not worth the cost of an extra thread
+static const int kMinStreamsPerThread = 16;
+
+/*
+ * Generates the code for the next unclaimed stream till there are none
+ * left and hands it over to the writer - the sequence number for stream i
+ * is i+1 (0 is the code before the streams); releases finished when done
+ */
+class PythonStreamTask : public QRunnable
+{
+public:
+    PythonStreamTask(PythonFileFormat *format,
+                     const OstProto::StreamConfigList &streams,
+                     QAtomicInt *nextStream, QAtomicInt *doneCount,
+                     QSemaphore *finished, OrderedWriter *writer,
+                     const bool *stop)
+        : format_(format), streams_(streams), nextStream_(nextStream),
+          doneCount_(doneCount), finished_(finished), writer_(writer),
+          stop_(stop)
+    {
+    }
+
+protected:
+    virtual void run()
+    {
+        int i;
+
+        while ((i = nextStream_->fetchAndAddOrdered(1))
+                    < streams_.stream_size()) {
+            QString code;
+            QTextStream out(&code);
+
+            // The writer waits for every claimed stream, so hand over an
+            // empty chunk instead of just bailing out
+            if (*stop_) {
+                writer_->write(i + 1, QByteArray());
+                continue;
+            }
+
+            format_->writeStreamConfig(out, streams_.stream(i));
+            out.flush();
+            writer_->write(i + 1, code.toLocal8Bit());
+            doneCount_->fetchAndAddOrdered(1);
+        }
+        finished_->release();
+    }
+
+private:
+    PythonFileFormat *format_;
+    const OstProto::StreamConfigList &streams_;
+    QAtomicInt *nextStream_;
+    QAtomicInt *doneCount_;
+    QSemaphore *finished_;
+    OrderedWriter *writer_;
+    const bool *stop_;
+};
+
 PythonFileFormat::PythonFileFormat()
 {
     // Nothing to do
@@ -57,12 +120,20 @@ bool PythonFileFormat::save(const OstProto::StreamConfigList streams,
         const QString fileName, QString &error)
 {
     QFile file(fileName);
-    QTextStream out(&file);
+    QString header;
+    QTextStream out(&header);
     QSet<QString> imports;
+    QAtomicInt nextStream(0), doneCount(0);
+    QSemaphore finished;
+    int numThreads;
+    bool isOk = false;
 
     if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
         goto _open_fail;
 
+    {
+    OrderedWriter writer(&file);
+
     // import standard modules
     emit status("Writing imports ...");
     emit target(0);
@@ -139,90 +210,71 @@ bool PythonFileFormat::save(const OstProto::StreamConfigList streams,
     out << "    drone.addStream(stream_id)\n";
     out << "\n";
 
-    // Configure streams with actual values
-    emit status("Writing stream configuration ...");
-    emit target(streams.stream_size());
     out << "    # ------------------#\n";
     out << "    # configure streams #\n";
     out << "    # ------------------#\n";
     out << "    stream_cfg = ost_pb.StreamConfigList()\n";
     out << "    stream_cfg.port_id.id = tx_port_number\n";
-    for (int i = 0; i < streams.stream_size(); i++) {
-        const OstProto::Stream &stream = streams.stream(i);
-        const Reflection *refl;
-        std::vector<const FieldDescriptor*> fields;
+    out.flush();
 
-        out << "\n";
-        out << "    # stream " << stream.stream_id().id() << " " 
-            << stream.core().name().c_str() << "\n";
-        out << "    s = stream_cfg.stream.add()\n";
-        out << "    s.stream_id.id = " 
-            << stream.stream_id().id() << "\n";
-
-        // Stream Core values
-        refl = stream.core().GetReflection();
-        refl->ListFields(stream.core(), &fields);
-        for (uint j = 0; j < fields.size(); j++) {
-            writeFieldAssignment(out, QString("    s.core.")
-                                        .append(fields.at(j)->name().c_str()),
-                    stream.core(), refl, fields.at(j));
-        }
-         
-        // Stream Control values
-        refl = stream.control().GetReflection();
-        refl->ListFields(stream.control(), &fields);
-        for (uint j = 0; j < fields.size(); j++) {
-            writeFieldAssignment(out, QString("    s.control.")
-                                        .append(fields.at(j)->name().c_str()),
-                    stream.control(), refl, fields.at(j));
-        }
+    // Everything upto here is chunk 0; stream i is chunk i+1 and the
+    // epilogue is the last chunk
+    writer.write(0, header.toLocal8Bit());
 
-        // Protocols
-        for (int j = 0 ; j < stream.protocol_size(); j++) {
-            const OstProto::Protocol &protocol = stream.protocol(j);
+    // Configure streams with actual values - each stream's code is
+    // generated independently, so streams are spread across the tasks
+    // of the global thread pool
+    emit status("Writing stream configuration ...");
+    emit target(streams.stream_size());
 
-            out << "\n"
-                << "    p = s.protocol.add()\n"
-                << "    p.protocol_id.id = "
-                << QString(OstProto::Protocol_k_descriptor()
-                            ->FindValueByNumber(protocol.protocol_id().id())
-                                ->full_name().c_str())
-                        .replace("OstProto", "ost_pb");
-            out << "\n";
-            refl = protocol.GetReflection();
-            refl->ListFields(protocol, &fields);
+    numThreads = qBound(1, streams.stream_size()/kMinStreamsPerThread,
+                        QThreadPool::globalInstance()->maxThreadCount());
+    for (int i = 0; i < numThreads; i++)
+        QThreadPool::globalInstance()->start(new PythonStreamTask(this,
+                streams, &nextStream, &doneCount, &finished, &writer,
+                &stop_));
 
-            for (uint k = 0; k < fields.size(); k++) {
-                // skip protocol_id field
-                if (fields.at(k)->number() == 
-                        OstProto::Protocol::kProtocolIdFieldNumber)
-                    continue;
-                QString pfx("    p.Extensions[X]");
-                pfx.replace(fields.at(k)->is_extension()? "X": "Extensions[X]",
-                        fields.at(k)->name().c_str());
-                writeFieldAssignment(out, pfx, protocol,
-                        refl, fields.at(k));
-            }
-        }
-        emit progress(i);
+    while (!finished.tryAcquire(numThreads, 100))
+        emit progress(doneCount.load());
+    emit progress(doneCount.load());
+
+    if (stop_) {
+        isOk = true;
+        goto _exit;
     }
-    out << "\n";
-    out << "    drone.modifyStream(stream_cfg)\n";
 
     // end of script - transmit streams, disconnect from drone etc.
     emit status("Writing epilogue ...");
     emit target(0);
+    header.clear();
+    out << "\n";
+    out << "    drone.modifyStream(stream_cfg)\n";
     writeEpilogue(out);
-
     out.flush();
+    writer.write(streams.stream_size() + 1, header.toLocal8Bit());
+
+    if (!writer.flush())
+        goto _write_fail;
+    }
+
     file.close();
-    return true;
+    isOk = true;
+    goto _exit;
+
+_write_fail:
+    error = QString(tr("Error writing %1 (%2)"))
+        .arg(fileName)
+        .arg(file.errorString());
+    goto _exit;
 
 _open_fail:
     error = QString(tr("Error opening %1 (Error Code = %2)"))
         .arg(fileName)
         .arg(file.error());
-    return false;
+    goto _exit;
+
+_exit:
+    return isOk;
 }
 
 bool PythonFileFormat::isMyFileFormat(const QString /*fileName*/)
@@ -337,6 +389,66 @@ void PythonFileFormat::writeEpilogue(QTextStream &out)
     out << "    sys.exit(1)\n";
 }
 
+void PythonFileFormat::writeStreamConfig(QTextStream &out,
+        const OstProto::Stream &stream)
+{
+    const Reflection *refl;
+    std::vector<const FieldDescriptor*> fields;
+
+    out << "\n";
+    out << "    # stream " << stream.stream_id().id() << " " 
+        << stream.core().name().c_str() << "\n";
+    out << "    s = stream_cfg.stream.add()\n";
+    out << "    s.stream_id.id = " 
+        << stream.stream_id().id() << "\n";
+
+    // Stream Core values
+    refl = stream.core().GetReflection();
+    refl->ListFields(stream.core(), &fields);
+    for (uint j = 0; j < fields.size(); j++) {
+        writeFieldAssignment(out, QString("    s.core.")
+                                    .append(fields.at(j)->name().c_str()),
+                stream.core(), refl, fields.at(j));
+    }
+     
+    // Stream Control values
+    refl = stream.control().GetReflection();
+    refl->ListFields(stream.control(), &fields);
+    for (uint j = 0; j < fields.size(); j++) {
+        writeFieldAssignment(out, QString("    s.control.")
+                                    .append(fields.at(j)->name().c_str()),
+                stream.control(), refl, fields.at(j));
+    }
+
+    // Protocols
+    for (int j = 0 ; j < stream.protocol_size(); j++) {
+        const OstProto::Protocol &protocol = stream.protocol(j);
+
+        out << "\n"
+            << "    p = s.protocol.add()\n"
+            << "    p.protocol_id.id = "
+            << QString(OstProto::Protocol_k_descriptor()
+                        ->FindValueByNumber(protocol.protocol_id().id())
+                            ->full_name().c_str())
+                    .replace("OstProto", "ost_pb");
+        out << "\n";
+        refl = protocol.GetReflection();
+        refl->ListFields(protocol, &fields);
+
+        for (uint k = 0; k < fields.size(); k++) {
+            // skip protocol_id field
+            if (fields.at(k)->number() == 
+                    OstProto::Protocol::kProtocolIdFieldNumber)
+                continue;
+            QString pfx("    p.Extensions[X]");
+            pfx.replace(fields.at(k)->is_extension()? "X": "Extensions[X]",
+                    fields.at(k)->name().c_str());
+            writeFieldAssignment(out, pfx, protocol,
+                    refl, fields.at(k));
+        }
+    }
+}
+
 void PythonFileFormat::writeFieldAssignment(
         QTextStream &out, 
         QString fieldName,
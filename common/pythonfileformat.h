@@ -42,6 +42,8 @@ private:
     void writeStandardImports(QTextStream &out);
     void writePrologue(QTextStream &out);
     void writeEpilogue(QTextStream &out);
+    void writeStreamConfig(QTextStream &out,
+            const OstProto::Stream &stream);
     void writeFieldAssignment(QTextStream &out, 
             QString fieldName,
             const google::protobuf::Message &msg,
@@ -51,6 +53,8 @@ private:
     QString singularize(QString plural);
     QString escapeString(QString str);
     bool useDecimalBase(QString fieldName);
+
+    friend class PythonStreamTask;
 };
 
 extern PythonFileFormat pythonFileFormat;
@@ -217,3 +217,21 @@ bool SignProtocol::packetGuid(const uchar *pkt, int pktLen, uint *guid)
     }
     return false;
 }
+
+int SignProtocol::writeProtocolFrameValue(uchar *buf, int bufSize,
+        int /*streamIndex*/, bool /*forCksum*/) const
+{
+    quint32 guid = data.stream_guid() & 0xFFFFFF;
+
+    if (bufSize < 9)
+        return -1;
+
+    buf[0] = kTypeLenEnd;
+    buf[1] = (guid >> 16) & 0xff;
+    buf[2] = (guid >>  8) & 0xff;
+    buf[3] = (guid >>  0) & 0xff;
+    buf[4] = kTypeLenGuid;
+    qToBigEndian(kSignMagic, buf + 5);
+
+    return 9;
+}
@@ -19,19 +19,111 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "streambase.h"
 #include "abstractprotocol.h"
+#include "mac.h"
 #include "protocollist.h"
 #include "protocollistiterator.h"
 #include "protocolmanager.h"
+#include "prng.h"
+
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
 
 extern ProtocolManager *OstProtocolManager;
 extern quint64 getDeviceMacAddress(int portId, int streamId, int frameIndex);
 extern quint64 getNeighborMacAddress(int portId, int streamId, int frameIndex);
 
-StreamBase::StreamBase(int portId) :
+// Render buffer size - larger than the max frameLen()
+static const int kRenderBufferSize = 65536;
+
+// Ranges smaller than this are not worth the cost of an extra thread
+static const int kMinFramesPerRenderThread = 256;
+
+/*
+ * A renderFrames() call - its range is split into chunks which are claimed
+ * and rendered by the calling thread and the pool tasks alike, so the call
+ * completes even if the pool is busy and its tasks start late (or after
+ * the call returns - the job is refcounted for that reason)
+ */
+class FrameRenderJob
+{
+public:
+    FrameRenderJob(const StreamBase *stream, int first, int count,
+                   int chunk, FrameSink *sink, int refCount)
+        : stream_(stream), first_(first), count_(count), chunk_(chunk),
+          sink_(sink), nextChunk_(0), renderedCount_(0), refCount_(refCount)
+    {
+        chunkCount_ = (count + chunk - 1)/chunk;
+    }
+
+    //! Renders chunks until there are none left to claim
+    void render()
+    {
+        int i;
+
+        while ((i = nextChunk_.fetchAndAddOrdered(1)) < chunkCount_) {
+            int start = i*chunk_;
+
+            renderedCount_.fetchAndAddOrdered(stream_->renderFrameRange(
+                        first_ + start, qMin(chunk_, count_ - start), sink_));
+            doneChunks_.release();
+        }
+    }
+
+    //! Waits for all chunks to be rendered; returns the rendered count
+    int wait()
+    {
+        doneChunks_.acquire(chunkCount_);
+        return renderedCount_.load();
+    }
+
+    void release()
+    {
+        if (!refCount_.deref())
+            delete this;
+    }
+
+private:
+    const StreamBase *stream_;
+    int first_;
+    int count_;
+    int chunk_;
+    int chunkCount_;
+    FrameSink *sink_;
+    QAtomicInt nextChunk_;
+    QAtomicInt renderedCount_;
+    QAtomicInt refCount_;
+    QSemaphore doneChunks_;
+};
+
+class FrameRenderTask : public QRunnable
+{
+public:
+    FrameRenderTask(FrameRenderJob *job)
+        : job_(job)
+    {
+    }
+
+protected:
+    virtual void run()
+    {
+        job_->render();
+        job_->release();
+    }
+
+private:
+    FrameRenderJob *job_;
+};
+
+StreamBase::StreamBase(int portId, bool withDefaultProtocols) :
     portId_(portId),
     mStreamId(new OstProto::StreamId),
     mCore(new OstProto::StreamCore),
-    mControl(new OstProto::StreamControl)
+    mControl(new OstProto::StreamControl),
+    isLayoutValid_(false),
+    isLayoutUpdating_(false),
+    layoutGeneration_(0)
 {
     AbstractProtocol *proto;
     ProtocolListIterator *iter;
@@ -40,6 +132,10 @@ StreamBase::StreamBase(int portId) :
 
     currentFrameProtocols = new ProtocolList;
 
+    // Not needed if the protocols are going to be replaced anyway
+    if (!withDefaultProtocols)
+        return;
+
     iter = createProtocolListIterator();
     // By default newly created streams have the mac and payload protocols
     proto = OstProtocolManager->createProtocol(
@@ -90,6 +186,7 @@ void StreamBase::protoDataCopyFrom(const OstProto::Stream &stream)
     mCore->CopyFrom(stream.core());
     mControl->CopyFrom(stream.control());
 
+    invalidateFrameLayout();
     currentFrameProtocols->destroy();
     iter = createProtocolListIterator();
     for (int i=0; i < stream.protocol_size(); i++)
@@ -108,6 +205,8 @@ void StreamBase::protoDataCopyFrom(const OstProto::Stream &stream)
     }
 
     delete iter;
+
+    updateFrameLayout();
 }
 
 void StreamBase::protoDataCopyInto(OstProto::Stream &stream) const
@@ -127,6 +226,17 @@ void StreamBase::protoDataCopyInto(OstProto::Stream &stream) const
     }
 }
 
+/*!
+ Same as protoDataCopyInto() but without the protocols
+*/
+void StreamBase::summaryCopyInto(OstProto::Stream &stream) const
+{
+    stream.mutable_stream_id()->CopyFrom(*mStreamId);
+    stream.mutable_core()->CopyFrom(*mCore);
+    stream.mutable_control()->CopyFrom(*mControl);
+    stream.clear_protocol();
+}
+
 #if 0
 ProtocolList StreamBase::frameProtocol()
 {
@@ -151,7 +261,7 @@ bool StreamBase::hasProtocol(quint32 protocolNumber)
 
 ProtocolListIterator*  StreamBase::createProtocolListIterator() const
 {
-    return new ProtocolListIterator(*currentFrameProtocols);
+    return new ProtocolListIterator(*currentFrameProtocols, this);
 }
 
 quint32 StreamBase::id() const
@@ -162,6 +272,7 @@ quint32 StreamBase::id() const
 bool StreamBase::setId(quint32 id)
 {
     mStreamId->set_id(id);
+    invalidateFrameLayout(); // random keys depend on the id
     return true;
 }
 
@@ -206,6 +317,7 @@ StreamBase::FrameLengthMode    StreamBase::lenMode() const
 bool StreamBase::setLenMode(FrameLengthMode    lenMode)
 {
     mCore->set_len_mode((OstProto::StreamCore::FrameLengthMode) lenMode); 
+    invalidateFrameLayout();
     return true;
 }
 
@@ -228,13 +340,8 @@ quint16    StreamBase::frameLen(int streamIndex) const
                 (frameLenMax() - frameLenMin() + 1));
             break;
         case OstProto::StreamCore::e_fl_random:
-            //! \todo (MED) This 'random' sequence is same across iterations
-            pktLen = 64; // to avoid the 'maybe used uninitialized' warning
-            qsrand(reinterpret_cast<ulong>(this));
-            for (int i = 0; i <= streamIndex; i++)
-                pktLen = qrand();
-            pktLen = frameLenMin() + (pktLen %
-                (frameLenMax() - frameLenMin() + 1));
+            pktLen = frameLenMin() + prng::uniform(randomKey(0), streamIndex,
+                frameLenMax() - frameLenMin() + 1);
             break;
         default:
             qWarning("Unhandled len mode %d. Using default 64", 
@@ -249,6 +356,7 @@ quint16    StreamBase::frameLen(int streamIndex) const
 bool StreamBase::setFrameLen(quint16 frameLen)
 {
     mCore->set_frame_len(frameLen);  
+    invalidateFrameLayout();
     return true;
 }
 
@@ -260,6 +368,7 @@ quint16    StreamBase::frameLenMin() const
 bool StreamBase::setFrameLenMin(quint16 frameLenMin)
 {
     mCore->set_frame_len_min(frameLenMin);  
+    invalidateFrameLayout();
     return true;
 }
 
@@ -271,6 +380,7 @@ quint16    StreamBase::frameLenMax() const
 bool StreamBase::setFrameLenMax(quint16 frameLenMax)
 {
     mCore->set_frame_len_max(frameLenMax);  
+    invalidateFrameLayout();
     return true;
 }
 
@@ -287,6 +397,40 @@ quint16 StreamBase::frameLenAvg() const
     return avgFrameLen;
 }
 
+quint64 StreamBase::randomSeed() const
+{
+    return mCore->random_seed();
+}
+
+bool StreamBase::setRandomSeed(quint64 seed)
+{
+    mCore->set_random_seed(seed);
+    invalidateFrameLayout(); // random keys depend on the seed
+    return true;
+}
+
+/*!
+ * Returns the key of the random sequence identified by domain (e.g. a
+ * field of a protocol) for this stream - use with the prng:: functions
+ * and the frame index as counter
+ *
+ * Domain 0 is used for the frame length
+ */
+quint64 StreamBase::randomKey(quint32 domain) const
+{
+    return prng::key(randomSeed(), (quint64(id()) << 32) | domain);
+}
+
+/*!
+ * Returns a number that changes whenever the frame layout is invalidated
+ * i.e. on any change to the stream or its protocols - protocols use it to
+ * validate caches derived from the stream (see AbstractProtocol::randomKey)
+ */
+quint32 StreamBase::layoutGeneration() const
+{
+    return layoutGeneration_;
+}
+
 StreamBase::SendUnit StreamBase::sendUnit() const
 {
     return (StreamBase::SendUnit) mControl->unit();
@@ -295,6 +439,7 @@ StreamBase::SendUnit StreamBase::sendUnit() const
 bool StreamBase::setSendUnit(SendUnit sendUnit)
 {
     mControl->set_unit((OstProto::StreamControl::SendUnit) sendUnit); 
+    invalidateFrameLayout();
     return true;
 }
 
@@ -329,6 +474,7 @@ quint32 StreamBase::numPackets() const
 bool StreamBase::setNumPackets(quint32 numPackets)
 {
     mControl->set_num_packets(numPackets); 
+    invalidateFrameLayout();
     return true;
 }
 
@@ -340,6 +486,7 @@ quint32 StreamBase::numBursts() const
 bool StreamBase::setNumBursts(quint32 numBursts)
 {
     mControl->set_num_bursts(numBursts); 
+    invalidateFrameLayout();
     return true;
 }
 
@@ -351,6 +498,7 @@ quint32 StreamBase::burstSize() const
 bool StreamBase::setBurstSize(quint32 packetsPerBurst)
 {
     mControl->set_packets_per_burst(packetsPerBurst); 
+    invalidateFrameLayout();
     return true;
 }
 
@@ -373,6 +521,7 @@ double StreamBase::burstRate() const
 bool StreamBase::setBurstRate(double burstsPerSec)
 {
     mControl->set_bursts_per_sec(burstsPerSec); 
+    invalidateFrameLayout();
     return true;
 }
 
@@ -416,44 +565,18 @@ bool StreamBase::setAveragePacketRate(double packetsPerSec)
 
 bool StreamBase::isFrameVariable() const
 {
-    ProtocolListIterator    *iter;
-
-    iter = createProtocolListIterator();
-    while (iter->hasNext())
-    {
-        AbstractProtocol    *proto;
-
-        proto = iter->next();
-        if (proto->isProtocolFrameValueVariable())
-            goto _exit;
-    }
-    delete iter;
-    return false;
+    if (!isLayoutValid_)
+        updateFrameLayout();
 
-_exit:
-    delete iter;
-    return true;
+    return isFrameVariable_;
 }
 
 bool StreamBase::isFrameSizeVariable() const
 {
-    ProtocolListIterator    *iter;
-
-    iter = createProtocolListIterator();
-    while (iter->hasNext())
-    {
-        AbstractProtocol    *proto;
-
-        proto = iter->next();
-        if (proto->isProtocolFrameSizeVariable())
-            goto _exit;
-    }
-    delete iter;
-    return false;
+    if (!isLayoutValid_)
+        updateFrameLayout();
 
-_exit:
-    delete iter;
-    return true;
+    return isFrameSizeVariable_;
 }
 
 int StreamBase::frameSizeVariableCount() const
@@ -479,27 +602,85 @@ int StreamBase::frameSizeVariableCount() const
 
 int StreamBase::frameVariableCount() const
 {
-    ProtocolListIterator    *iter;
+    if (!isLayoutValid_)
+        updateFrameLayout();
+
+    return frameVariableCount_;
+}
+
+/*!
+  Returns the number of unique values of the first headerLen bytes of the
+  frames of this stream
+
+  Unlike frameVariableCount(), variable fields of protocols that start
+  beyond headerLen bytes and frame length variations are not considered -
+  so this is useful when only the (say, upto L3) headers are of interest
+*/
+int StreamBase::frameHeaderVariableCount(int headerLen) const
+{
     quint64 frameCount = 1;
 
-    iter = createProtocolListIterator();
-    while (iter->hasNext())
+    if (!isLayoutValid_)
+        updateFrameLayout();
+
+    // Protocols with a variable offset (i.e. following a variable sized
+    // protocol) may start within headerLen for some frames, so they are
+    // always considered
+    for (int i = 0; i < protocolLayout_.size(); i++)
     {
-        AbstractProtocol    *proto;
-        int count;
+        const ProtocolLayout &layout = protocolLayout_.at(i);
 
-        proto = iter->next();
-        count = proto->protocolFrameVariableCount();
+        if (layout.offset >= headerLen)
+            break;
 
-        // correct count for mis-behaving protocols
-        if (count <= 0)
-            count = 1;
+        frameCount = AbstractProtocol::lcm(frameCount, layout.variableCount);
+    }
+
+    return frameCount;
+}
 
-        frameCount = AbstractProtocol::lcm(frameCount, count);
+/*!
+  Returns true if any of the protocols that (may) start within the first
+  headerLen bytes of the frame has random fields - such a header doesn't
+  repeat every frameHeaderVariableCount() frames
+*/
+bool StreamBase::isFrameHeaderRandom(int headerLen) const
+{
+    if (!isLayoutValid_)
+        updateFrameLayout();
+
+    for (int i = 0; i < protocolLayout_.size(); i++)
+    {
+        const ProtocolLayout &layout = protocolLayout_.at(i);
+
+        if (layout.offset >= headerLen)
+            break;
+
+        if (layout.isRandom)
+            return true;
+    }
+
+    return false;
+}
+
+/*!
+  Returns true if the stream's MACs are resolved - its frames then depend
+  on the port's device neighbors as well
+*/
+bool StreamBase::isMacResolved() const
+{
+    ProtocolList::const_iterator iter;
+
+    for (iter = currentFrameProtocols->constBegin();
+            iter != currentFrameProtocols->constEnd(); ++iter)
+    {
+        if (((*iter)->protocolNumber()
+                    == OstProto::Protocol::kMacFieldNumber)
+                && static_cast<const MacProtocol*>(*iter)->isMacResolved())
+            return true;
     }
-    delete iter;
 
-    return AbstractProtocol::lcm(frameCount, frameSizeVariableCount());
+    return false;
 }
 
 // frameProtocolLength() returns the sum of all the individual protocol sizes
@@ -507,15 +688,17 @@ int StreamBase::frameVariableCount() const
 int StreamBase::frameProtocolLength(int frameIndex) const
 {
     int len = 0;
-    ProtocolListIterator *iter = createProtocolListIterator();
+    ProtocolList::const_iterator iter;
 
-    while (iter->hasNext())
-    {
-        AbstractProtocol *proto = iter->next();
+    if (!isLayoutValid_)
+        updateFrameLayout();
 
-        len += proto->protocolFrameSize(frameIndex);
-    }
-    delete iter;
+    if (frameProtocolLength_ >= 0)
+        return frameProtocolLength_;
+
+    for (iter = currentFrameProtocols->constBegin();
+            iter != currentFrameProtocols->constEnd(); ++iter)
+        len += (*iter)->protocolFrameSize(frameIndex);
 
     return len;
 }
@@ -550,25 +733,18 @@ int StreamBase::frameValue(uchar *buf, int bufMaxSize, int frameIndex) const
 
     maxSize = qMin(pktLen, bufMaxSize);
 
-    ProtocolListIterator    *iter;
-
-    iter = createProtocolListIterator();
-    while (iter->hasNext())
+    // Walk the list directly instead of using a (heap allocated)
+    // ProtocolListIterator - this is called for every frame
+    for (ProtocolList::const_iterator iter =
+                currentFrameProtocols->constBegin();
+            iter != currentFrameProtocols->constEnd(); ++iter)
     {
-        AbstractProtocol    *proto;
-        QByteArray            ba;
-
-        proto = iter->next();
-        ba = proto->protocolFrameValue(frameIndex);
-
-        size = qMin(ba.size(), maxSize-len);
-        memcpy(buf+len, ba.constData(), size);
+        size = (*iter)->protocolFrameValue(buf+len, maxSize-len, frameIndex);
         len += size;
 
         if (len == maxSize)
             break;
     }
-    delete iter;
 
     // Pad with zero, if required and if we have space
     if (len < maxSize) {
@@ -580,6 +756,201 @@ int StreamBase::frameValue(uchar *buf, int bufMaxSize, int frameIndex) const
     return len;
 }
 
+/*!
+  Renders the frames [first, first+count) and passes each of them to sink
+  (zero length frames are skipped); returns the number of frames rendered
+
+  The range is split across the calling thread and the global thread pool
+  (upto its max thread count), so sink is called concurrently and in no
+  particular order across threads (within a chunk, frames are in order).
+  Streams with protocols that are not thread safe (see
+  AbstractProtocol::isProtocolFrameValueThreadSafe()) are rendered in the
+  calling thread. The stream must not be modified while this is in progress
+*/
+int StreamBase::renderFrames(int first, int count, FrameSink *sink) const
+{
+    QThreadPool *pool = QThreadPool::globalInstance();
+    FrameRenderJob *job;
+    ProtocolList::const_iterator iter;
+    int numThreads = 1;
+    int rendered, chunk;
+
+    if (count <= 0)
+        return 0;
+
+    // Compute all lazy caches upfront, so that the render threads only
+    // read them
+    if (!isLayoutValid_)
+        updateFrameLayout();
+    for (iter = currentFrameProtocols->constBegin();
+            iter != currentFrameProtocols->constEnd(); ++iter)
+        (*iter)->primeCaches();
+
+    if (isFrameThreadSafe_)
+        numThreads = qMin(pool->maxThreadCount(),
+                          count/kMinFramesPerRenderThread);
+    numThreads = qMax(numThreads, 1);
+    chunk = (count + numThreads - 1)/numThreads;
+
+    if (numThreads == 1)
+        return renderFrameRange(first, count, sink);
+
+    // The calling thread renders too - one ref for it, one per task
+    job = new FrameRenderJob(this, first, count, chunk, sink, numThreads);
+    for (int i = 1; i < numThreads; i++)
+        pool->start(new FrameRenderTask(job));
+
+    job->render();
+    rendered = job->wait();
+    job->release();
+
+    return rendered;
+}
+
+int StreamBase::renderFrameRange(int first, int count, FrameSink *sink) const
+{
+    // Per thread scratch buffer
+    QByteArray buf(kRenderBufferSize, 0);
+    uchar *p = (uchar*) buf.data();
+    int rendered = 0;
+
+    for (int i = first; i < first + count; i++) {
+        int len = frameValue(p, buf.size(), i);
+
+        if (len <= 0)
+            continue;
+
+        sink->frameRendered(i, p, len);
+        rendered++;
+    }
+
+    return rendered;
+}
+
+/*!
+  Returns the (cached) byte offset of the given protocol in the frame or -1
+  if the offset varies across frames or the protocol is not a top level 
+  protocol of this stream
+*/
+int StreamBase::protocolFrameOffset(const AbstractProtocol *protocol) const
+{
+    int index;
+
+    // Protocols query their offset while we compute the layout
+    if (isLayoutUpdating_)
+        return -1;
+
+    if (!isLayoutValid_)
+        updateFrameLayout();
+
+    index = protocolLayoutIndex_.value(protocol, -1);
+    return index < 0 ? -1 : protocolLayout_.at(index).offset;
+}
+
+/*!
+  Returns the (cached) size of the protocols following the given protocol
+  in the frame or -1 if the size varies across frames or the protocol is not
+  a top level protocol of this stream
+*/
+int StreamBase::protocolFramePayloadSize(const AbstractProtocol *protocol) const
+{
+    int index;
+
+    if (isLayoutUpdating_)
+        return -1;
+
+    if (!isLayoutValid_)
+        updateFrameLayout();
+
+    index = protocolLayoutIndex_.value(protocol, -1);
+    return index < 0 ? -1 : protocolLayout_.at(index).payloadSize;
+}
+
+/*!
+  Marks the frame layout cache as stale - to be called when the protocols,
+  their configuration or the stream length/control parameters are modified
+
+  Protocol list changes via a ProtocolListIterator, variable field changes
+  and the StreamBase setters do this automatically; callers that modify a
+  protocol's fields directly (e.g. using setFieldData()) need to call this
+*/
+void StreamBase::invalidateFrameLayout() const
+{
+    isLayoutValid_ = false;
+    layoutGeneration_++;
+}
+
+void StreamBase::updateFrameLayout() const
+{
+    ProtocolListIterator *iter;
+    quint64 frameCount = 1;
+    int offset = 0, payloadSize = 0;
+
+    isLayoutUpdating_ = true;
+
+    protocolLayout_.clear();
+    protocolLayoutIndex_.clear();
+    isFrameVariable_ = false;
+    isFrameSizeVariable_ = false;
+    isFrameThreadSafe_ = true;
+
+    iter = createProtocolListIterator();
+    while (iter->hasNext())
+    {
+        AbstractProtocol *proto = iter->next();
+        bool isSizeVariable = proto->isProtocolFrameSizeVariable();
+        ProtocolLayout layout;
+
+        // A protocol following a variable sized one may pad up to the
+        // frame length (e.g. payload), so its size is variable too
+        layout.offset = offset;
+        layout.size = (isSizeVariable || (offset < 0)) ?
+                            -1 : proto->protocolFrameSize();
+        layout.payloadSize = -1;
+        layout.variableCount = proto->protocolFrameVariableCount();
+        layout.isRandom = proto->isProtocolFrameValueRandom();
+
+        // correct count for mis-behaving protocols
+        if (layout.variableCount <= 0)
+            layout.variableCount = 1;
+
+        if ((offset >= 0) && (layout.size >= 0))
+            offset += layout.size;
+        else
+            offset = -1;
+
+        if (proto->isProtocolFrameValueVariable())
+            isFrameVariable_ = true;
+        if (isSizeVariable)
+            isFrameSizeVariable_ = true;
+        if (!proto->isProtocolFrameValueThreadSafe())
+            isFrameThreadSafe_ = false;
+        frameCount = AbstractProtocol::lcm(frameCount, layout.variableCount);
+
+        protocolLayoutIndex_.insert(proto, protocolLayout_.size());
+        protocolLayout_.append(layout);
+    }
+    delete iter;
+
+    for (int i = protocolLayout_.size() - 1; i >= 0; i--)
+    {
+        ProtocolLayout &layout = protocolLayout_[i];
+
+        layout.payloadSize = payloadSize;
+        if ((payloadSize >= 0) && (layout.size >= 0))
+            payloadSize += layout.size;
+        else
+            payloadSize = -1;
+    }
+
+    frameVariableCount_ = AbstractProtocol::lcm(frameCount,
+                                                frameSizeVariableCount());
+    frameProtocolLength_ = offset;
+
+    isLayoutUpdating_ = false;
+    isLayoutValid_ = true;
+}
+
 quint64 StreamBase::deviceMacAddress(int frameIndex) const
 {
     return getDeviceMacAddress(portId_, int(mStreamId->id()), frameIndex);
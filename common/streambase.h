@@ -20,8 +20,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _STREAM_BASE_H
 #define _STREAM_BASE_H
 
+#include <QHash>
 #include <QString>
 #include <QLinkedList>
+#include <QVector>
 
 #include "protocol.pb.h"
 
@@ -31,14 +33,28 @@ class AbstractProtocol;
 class ProtocolList;
 class ProtocolListIterator;
 
+/*!
+  Receiver of the frames rendered by StreamBase::renderFrames()
+
+  frameRendered() is called concurrently from multiple threads; buf is
+  valid only for the duration of the call
+*/
+class FrameSink
+{
+public:
+    virtual ~FrameSink() {}
+    virtual void frameRendered(int frameIndex, const uchar *buf, int len) = 0;
+};
+
 class StreamBase
 {
 public:
-    StreamBase(int portId = -1);
+    StreamBase(int portId = -1, bool withDefaultProtocols = true);
     ~StreamBase();
 
     void protoDataCopyFrom(const OstProto::Stream &stream);
     void protoDataCopyInto(OstProto::Stream &stream) const;
+    void summaryCopyInto(OstProto::Stream &stream) const;
 
     bool hasProtocol(quint32 protocolNumber);
     ProtocolListIterator* createProtocolListIterator() const;
@@ -103,6 +119,11 @@ public:
 
     quint16 frameLenAvg() const;
 
+    quint64 randomSeed() const;
+    bool setRandomSeed(quint64 seed);
+    quint64 randomKey(quint32 domain) const;
+    quint32 layoutGeneration() const;
+
     SendUnit sendUnit() const;
     bool setSendUnit(SendUnit sendUnit);
 
@@ -134,9 +155,17 @@ public:
     bool isFrameSizeVariable() const;
     int frameSizeVariableCount() const;
     int frameVariableCount() const;
+    int frameHeaderVariableCount(int headerLen) const;
+    bool isFrameHeaderRandom(int headerLen) const;
+    bool isMacResolved() const;
     int frameProtocolLength(int frameIndex) const;
     int frameCount() const;
     int frameValue(uchar *buf, int bufMaxSize, int frameIndex) const;
+    int renderFrames(int first, int count, FrameSink *sink) const;
+
+    int protocolFrameOffset(const AbstractProtocol *protocol) const;
+    int protocolFramePayloadSize(const AbstractProtocol *protocol) const;
+    void invalidateFrameLayout() const;
 
     quint64 deviceMacAddress(int frameIndex) const;
     quint64 neighborMacAddress(int frameIndex) const;
@@ -146,6 +175,21 @@ public:
     static bool StreamLessThan(StreamBase* stream1, StreamBase* stream2);
 
 private:
+    //! Per protocol entry of the frame layout cache; -1 means variable
+    struct ProtocolLayout
+    {
+        int offset;
+        int size;
+        int payloadSize;
+        int variableCount;
+        bool isRandom;
+    };
+
+    void updateFrameLayout() const;
+    int renderFrameRange(int first, int count, FrameSink *sink) const;
+
+    friend class FrameRenderJob;
+
     int portId_;
 
     OstProto::StreamId      *mStreamId;
@@ -153,6 +197,19 @@ private:
     OstProto::StreamControl *mControl;
 
     ProtocolList *currentFrameProtocols;
+
+    // Frame layout cache - derived from the protocols and the stream
+    // core/control; computed on first use after invalidateFrameLayout()
+    mutable bool isLayoutValid_;
+    mutable bool isLayoutUpdating_;
+    mutable quint32 layoutGeneration_; // bumped on every invalidation
+    mutable QVector<ProtocolLayout> protocolLayout_;
+    mutable QHash<const AbstractProtocol*, int> protocolLayoutIndex_;
+    mutable bool isFrameVariable_;
+    mutable bool isFrameSizeVariable_;
+    mutable bool isFrameThreadSafe_;
+    mutable int frameVariableCount_;
+    mutable int frameProtocolLength_;
 };
 
 #endif
@@ -598,3 +598,36 @@ int TcpProtocol::protocolFrameVariableCount() const
     return count;
 }
 
+int TcpProtocol::writeProtocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    quint8 hdrlen;
+    quint16 cksum;
+
+    if (bufSize < 20)
+        return -1;
+
+    hdrlen = data.is_override_hdrlen() ? (data.hdrlen_rsvd() >> 4) & 0x0F : 5;
+
+    qToBigEndian(quint16(data.is_override_src_port() ? 
+                data.src_port() : payloadProtocolId(ProtocolIdTcpUdp)), buf);
+    qToBigEndian(quint16(data.is_override_dst_port() ? 
+                data.dst_port() : payloadProtocolId(ProtocolIdTcpUdp)),
+            buf + 2);
+    qToBigEndian(quint32(data.seq_num()), buf + 4);
+    qToBigEndian(quint32(data.ack_num()), buf + 8);
+    buf[12] = (hdrlen << 4) | (data.hdrlen_rsvd() & 0x0F);
+    buf[13] = data.flags() & 0x3F;
+    qToBigEndian(quint16(data.window()), buf + 14);
+    qToBigEndian(quint16(data.urg_ptr()), buf + 18);
+
+    if (forCksum)
+        cksum = 0;
+    else if (data.is_override_cksum())
+        cksum = data.cksum();
+    else
+        cksum = protocolFrameCksum(streamIndex, CksumTcpUdp);
+    qToBigEndian(cksum, buf + 16);
+
+    return 20;
+}
@@ -431,3 +431,34 @@ int UdpProtocol::protocolFrameVariableCount() const
 
     return count;
 }
+
+int UdpProtocol::writeProtocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const
+{
+    quint16 cksum;
+
+    if (bufSize < 8)
+        return -1;
+
+    qToBigEndian(quint16(data.is_override_src_port() ? 
+                data.src_port() : payloadProtocolId(ProtocolIdTcpUdp)), buf);
+    qToBigEndian(quint16(data.is_override_dst_port() ? 
+                data.dst_port() : payloadProtocolId(ProtocolIdTcpUdp)),
+            buf + 2);
+    qToBigEndian(quint16(data.is_override_totlen() ? 
+                data.totlen() : (protocolFramePayloadSize(streamIndex) + 8)),
+            buf + 4);
+
+    if (forCksum)
+        cksum = 0;
+    else if (data.is_override_cksum())
+        cksum = data.cksum();
+    else {
+        cksum = protocolFrameCksum(streamIndex, CksumTcpUdp);
+        if (cksum == 0)
+            cksum = 0xFFFF;
+    }
+    qToBigEndian(cksum, buf + 6);
+
+    return 8;
+}
@@ -67,6 +67,10 @@ public:
 
     virtual int protocolFrameVariableCount() const;
 
+protected:
+    virtual int writeProtocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const;
+
 private:
     OstProto::Udp    data;
 };
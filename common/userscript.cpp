@@ -19,26 +19,108 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "userscript.h"
 
+#include <QList>
+#include <QMutexLocker>
+#include <QThread>
+#include <QThreadStorage>
+
+/*
+ * Script runtimes of a thread (other than the protocol's own thread)
+ * keyed by protocol serial number; deleted when the thread exits
+ *
+ * A protocol being deleted moves its runtime to the orphans, which are
+ * deleted by the thread itself (a script engine must be deleted in its
+ * own thread) the next time it looks up a runtime or when it exits
+ */
+class ThreadRuntimeList
+{
+public:
+    ~ThreadRuntimeList();
+
+    QMutex lock; // protects all of the below
+    QHash<quint32, UserScriptRuntime*> runtimes;
+    QList<UserScriptRuntime*> orphans;
+};
+
+static QThreadStorage<ThreadRuntimeList*> threadRuntimeList;
+
+// Threads having a runtime of a protocol (Key: protocol serial number) -
+// lock order is runtimeRegistryLock followed by ThreadRuntimeList::lock
+static QMutex runtimeRegistryLock;
+static QHash<quint32, QList<ThreadRuntimeList*> > runtimeRegistry;
+
+static QMutex serialLock;
+static quint32 serial = 0;
+
+ThreadRuntimeList::~ThreadRuntimeList()
+{
+    QMutexLocker registryLocker(&runtimeRegistryLock);
+    QMutexLocker locker(&lock);
+
+    foreach(quint32 protocolSerial, runtimes.keys()) {
+        QList<ThreadRuntimeList*> &threads = runtimeRegistry[protocolSerial];
+
+        threads.removeOne(this);
+        if (threads.isEmpty())
+            runtimeRegistry.remove(protocolSerial);
+    }
+
+    qDeleteAll(runtimes);
+    qDeleteAll(orphans);
+}
+
+// Cached frame values/sizes per protocol - the cache is flushed when full
+static const int kMaxCachedFrames = 1024;
+
+/*
+ * Converts a protocolFrameValue() return value to bytes - an array of
+ * byte values or a string with one byte per character (e.g. built using
+ * String.fromCharCode()); a string is converted in one go and is faster
+ * for large values
+ */
+static QByteArray scriptValueToByteArray(const QScriptValue &value)
+{
+    QByteArray fv;
+    char *p;
+    int len;
+
+    if (value.isString())
+        return value.toString().toLatin1();
+
+    // Index the array directly - qScriptValueToSequence() converts to an
+    // intermediate QList via QVariant for each element
+    len = value.property("length").toInt32();
+    fv.resize(len);
+    p = fv.data();
+    for (int i = 0; i < len; i++)
+        p[i] = value.property(quint32(i)).toInt32() & 0xFF;
+
+    return fv;
+}
+
 //
 // -------------------- UserScriptProtocol --------------------
 //
 
 UserScriptProtocol::UserScriptProtocol(StreamBase *stream, AbstractProtocol *parent)
     : AbstractProtocol(stream, parent),
-        userProtocol_(this)
+        runtime_(this)
 {
+    serial_ = nextSerial();
     isScriptValid_ = false;
     errorLineNumber_ = 0;
-
-    userProtocolScriptValue_ = engine_.newQObject(&userProtocol_);
-    engine_.globalObject().setProperty("protocol", userProtocolScriptValue_);
-
-    QScriptValue meta = engine_.newQMetaObject(userProtocol_.metaObject());
-    engine_.globalObject().setProperty("Protocol", meta);
 }
 
 UserScriptProtocol::~UserScriptProtocol()
 {
+    QMutexLocker registryLocker(&runtimeRegistryLock);
+
+    // Runtimes of other threads are deleted by those threads
+    foreach(ThreadRuntimeList *runtimeList, runtimeRegistry.take(serial_)) {
+        QMutexLocker locker(&runtimeList->lock);
+
+        runtimeList->orphans.append(runtimeList->runtimes.take(serial_));
+    }
 }
 
 AbstractProtocol* UserScriptProtocol::createInstance(StreamBase *stream,
@@ -69,31 +151,30 @@ void UserScriptProtocol::protoDataCopyFrom(const OstProto::Protocol &protocol)
 
 QString UserScriptProtocol::name() const
 {
-    return QString("%1:{UserScript} [EXPERIMENTAL]").arg(userProtocol_.name());
+    return QString("%1:{UserScript} [EXPERIMENTAL]").arg(
+            runtime_.userProtocol.name());
 }
 
 QString UserScriptProtocol::shortName() const
 {
-    return QString("%1:{Script} [EXPERIMENTAL]").arg(userProtocol_.name());
+    return QString("%1:{Script} [EXPERIMENTAL]").arg(
+            runtime_.userProtocol.name());
 }
 
 quint32 UserScriptProtocol::protocolId(ProtocolIdType type) const
 {
-    QScriptValue userFunction;
+    UserScriptRuntime *rt;
     QScriptValue userValue;
 
     if (!isScriptValid_)
         goto _do_default;
 
-    userFunction = userProtocolScriptValue_.property("protocolId");
-
-    if (!userFunction.isValid())
+    rt = runtime();
+    if (!rt->protocolIdFunction.isFunction())
         goto _do_default;
 
-    Q_ASSERT(userFunction.isFunction());
-
-    userValue = userFunction.call(QScriptValue(),
-        QScriptValueList() << QScriptValue(&engine_, type));
+    userValue = rt->protocolIdFunction.call(QScriptValue(),
+        QScriptValueList() << QScriptValue(&rt->engine, type));
 
     Q_ASSERT(userValue.isValid());
     Q_ASSERT(userValue.isNumber());
@@ -127,29 +208,41 @@ QVariant UserScriptProtocol::fieldData(int index, FieldAttrib attrib,
 
         case FieldFrameValue:
         {
+            UserScriptRuntime *rt;
+            QScriptValue userValue;
+            QByteArray fv;
+            int key;
+
             if (!isScriptValid_)
                 return QByteArray();
 
-            QScriptValue userFunction = userProtocolScriptValue_.property(
-                    "protocolFrameValue");
-
-            Q_ASSERT(userFunction.isValid());
-            Q_ASSERT(userFunction.isFunction());
+            key = frameCacheKey(streamIndex);
+            if (key >= 0) {
+                QMutexLocker locker(&frameCacheLock_);
+                QHash<int, QByteArray>::const_iterator iter =
+                        frameValueCache_.constFind(key);
+                if (iter != frameValueCache_.constEnd())
+                    return iter.value();
+            }
+
+            rt = runtime();
+            if (!rt->frameValueFunction.isFunction())
+                return QByteArray();
 
-            QScriptValue userValue = userFunction.call(QScriptValue(),
-                QScriptValueList() << QScriptValue(&engine_, streamIndex));
+            userValue = rt->frameValueFunction.call(QScriptValue(),
+                QScriptValueList() << QScriptValue(&rt->engine, streamIndex));
 
             Q_ASSERT(userValue.isValid());
-            Q_ASSERT(userValue.isArray());
+            Q_ASSERT(userValue.isArray() || userValue.isString());
 
-            QByteArray fv;
-            QList<int> pktBuf;
-               
-            qScriptValueToSequence(userValue, pktBuf); 
+            fv = scriptValueToByteArray(userValue);
 
-            fv.resize(pktBuf.size());
-            for (int i = 0; i < pktBuf.size(); i++)
-                fv[i] = pktBuf.at(i) & 0xFF;
+            if (key >= 0) {
+                QMutexLocker locker(&frameCacheLock_);
+                if (frameValueCache_.size() >= kMaxCachedFrames)
+                    frameValueCache_.clear();
+                frameValueCache_.insert(key, fv);
+            }
 
             return fv;
         }
@@ -195,57 +288,71 @@ _exit:
 
 int UserScriptProtocol::protocolFrameSize(int streamIndex) const
 {
+    UserScriptRuntime *rt;
+    QScriptValue userValue;
+    int size;
+    int key;
+
     if (!isScriptValid_)
         return 0;
 
-    QScriptValue userFunction = userProtocolScriptValue_.property(
-            "protocolFrameSize");
+    key = frameCacheKey(streamIndex);
+    if (key >= 0) {
+        QMutexLocker locker(&frameCacheLock_);
+        QHash<int, int>::const_iterator iter = frameSizeCache_.constFind(key);
+        if (iter != frameSizeCache_.constEnd())
+            return iter.value();
+    }
 
-    Q_ASSERT(userFunction.isValid());
-    Q_ASSERT(userFunction.isFunction());
+    rt = runtime();
+    if (!rt->frameSizeFunction.isFunction())
+        return 0;
 
-    QScriptValue userValue = userFunction.call(QScriptValue(), 
-            QScriptValueList() << QScriptValue(&engine_, streamIndex));
+    userValue = rt->frameSizeFunction.call(QScriptValue(), 
+            QScriptValueList() << QScriptValue(&rt->engine, streamIndex));
 
     Q_ASSERT(userValue.isNumber());
 
-    return userValue.toInt32();
+    size = userValue.toInt32();
+
+    if (key >= 0) {
+        QMutexLocker locker(&frameCacheLock_);
+        if (frameSizeCache_.size() >= kMaxCachedFrames)
+            frameSizeCache_.clear();
+        frameSizeCache_.insert(key, size);
+    }
+
+    return size;
 }
 
 bool UserScriptProtocol::isProtocolFrameSizeVariable() const
 {
-    return userProtocol_.isProtocolFrameSizeVariable();
+    return runtime_.userProtocol.isProtocolFrameSizeVariable();
 }
 
 int UserScriptProtocol::protocolFrameVariableCount() const
 {
     return AbstractProtocol::lcm(
             AbstractProtocol::protocolFrameVariableCount(),
-            userProtocol_.protocolFrameVariableCount());
+            runtime_.userProtocol.protocolFrameVariableCount());
 }
 
 quint32 UserScriptProtocol::protocolFrameCksum(int streamIndex,
         CksumType cksumType) const
 {
-    QScriptValue userFunction;
+    UserScriptRuntime *rt;
     QScriptValue userValue;
 
     if (!isScriptValid_)
         goto _do_default;
 
-    userFunction = userProtocolScriptValue_.property("protocolFrameCksum");
-
-    qDebug("userscript protoFrameCksum(): isValid:%d/isFunc:%d",
-        userFunction.isValid(), userFunction.isFunction());
-
-    if (!userFunction.isValid())
+    rt = runtime();
+    if (!rt->frameCksumFunction.isFunction())
         goto _do_default;
 
-    Q_ASSERT(userFunction.isFunction());
-
-    userValue = userFunction.call(QScriptValue(),
-            QScriptValueList() << QScriptValue(&engine_, streamIndex)
-            << QScriptValue(&engine_, cksumType));
+    userValue = rt->frameCksumFunction.call(QScriptValue(),
+            QScriptValueList() << QScriptValue(&rt->engine, streamIndex)
+            << QScriptValue(&rt->engine, cksumType));
 
     Q_ASSERT(userValue.isValid());
     Q_ASSERT(userValue.isNumber());
@@ -265,20 +372,25 @@ void UserScriptProtocol::evaluateUserScript() const
     isScriptValid_ = false;
     errorLineNumber_ = userScriptLineCount();
 
+    // Runtimes of other threads are re-evaluated on their next use
+    runtime_.generation = nextSerial();
+
+    frameCacheLock_.lock();
+    frameValueCache_.clear();
+    frameSizeCache_.clear();
+    frameCacheLock_.unlock();
+
     // Reset all properties including the dynamic ones
-    userProtocol_.reset();
-    userProtocolScriptValue_.setProperty("protocolFrameValue", QScriptValue());
-    userProtocolScriptValue_.setProperty("protocolFrameSize", QScriptValue());
-    userProtocolScriptValue_.setProperty("protocolFrameCksum", QScriptValue());
-    userProtocolScriptValue_.setProperty("protocolId", QScriptValue());
-
-    engine_.evaluate(fieldData(userScript_program, FieldValue).toString());
-    if (engine_.hasUncaughtException())
+    runtime_.reset();
+
+    runtime_.engine.evaluate(
+            fieldData(userScript_program, FieldValue).toString());
+    if (runtime_.engine.hasUncaughtException())
         goto _error_exception;
 
     // Validate protocolFrameValue()
     property = QString("protocolFrameValue");
-    userFunction = userProtocolScriptValue_.property(property);
+    userFunction = runtime_.userProtocolScriptValue.property(property);
 
     qDebug("userscript property %s: isValid:%d/isFunc:%d", 
             qPrintable(property),
@@ -297,22 +409,22 @@ void UserScriptProtocol::evaluateUserScript() const
     }
 
     userValue = userFunction.call();
-    if (engine_.hasUncaughtException())
+    if (runtime_.engine.hasUncaughtException())
         goto _error_exception;
 
     qDebug("userscript property %s return value: isValid:%d/isArray:%d",
             qPrintable(property),
             userValue.isValid(), userValue.isArray());
 
-    if (!userValue.isArray())
+    if (!userValue.isArray() && !userValue.isString())
     {
-        errorText_ = property + QString(" does not return an array");
+        errorText_ = property + QString(" does not return an array or string");
         goto _error_exit;
     }
 
     // Validate protocolFrameSize()
     property = QString("protocolFrameSize");
-    userFunction = userProtocolScriptValue_.property(property);
+    userFunction = runtime_.userProtocolScriptValue.property(property);
 
     qDebug("userscript property %s: isValid:%d/isFunc:%d", 
             qPrintable(property),
@@ -331,7 +443,7 @@ void UserScriptProtocol::evaluateUserScript() const
     }
 
     userValue = userFunction.call();
-    if (engine_.hasUncaughtException())
+    if (runtime_.engine.hasUncaughtException())
         goto _error_exception;
 
     qDebug("userscript property %s return value: isValid:%d/isNumber:%d",
@@ -346,7 +458,7 @@ void UserScriptProtocol::evaluateUserScript() const
 
     // Validate protocolFrameCksum() [optional]
     property = QString("protocolFrameCksum");
-    userFunction = userProtocolScriptValue_.property(property);
+    userFunction = runtime_.userProtocolScriptValue.property(property);
 
     qDebug("userscript property %s: isValid:%d/isFunc:%d", 
             qPrintable(property),
@@ -362,7 +474,7 @@ void UserScriptProtocol::evaluateUserScript() const
     }
 
     userValue = userFunction.call();
-    if (engine_.hasUncaughtException())
+    if (runtime_.engine.hasUncaughtException())
         goto _error_exception;
 
     qDebug("userscript property %s return value: isValid:%d/isNumber:%d",
@@ -379,7 +491,7 @@ void UserScriptProtocol::evaluateUserScript() const
 _skip_cksum:
     // Validate protocolId() [optional]
     property = QString("protocolId");
-    userFunction = userProtocolScriptValue_.property(property);
+    userFunction = runtime_.userProtocolScriptValue.property(property);
 
     qDebug("userscript property %s: isValid:%d/isFunc:%d", 
             qPrintable(property),
@@ -395,7 +507,7 @@ _skip_cksum:
     }
 
     userValue = userFunction.call();
-    if (engine_.hasUncaughtException())
+    if (runtime_.engine.hasUncaughtException())
         goto _error_exception;
 
     qDebug("userscript property %s return value: isValid:%d/isNumber:%d",
@@ -410,16 +522,17 @@ _skip_cksum:
 
 
 _skip_protocol_id:
+    runtime_.lookupFunctions();
     errorText_ = QString("");
     isScriptValid_ = true;
     return;
 
 _error_exception:
-    errorLineNumber_ = engine_.uncaughtExceptionLineNumber();
-    errorText_ = engine_.uncaughtException().toString();
+    errorLineNumber_ = runtime_.engine.uncaughtExceptionLineNumber();
+    errorText_ = runtime_.engine.uncaughtException().toString();
 
 _error_exit:
-    userProtocol_.reset();
+    runtime_.userProtocol.reset();
     return;
 }
 
@@ -444,6 +557,136 @@ int UserScriptProtocol::userScriptLineCount() const
             QChar('\n')) + 1;
 }
 
+/*
+ * Returns the script runtime to be used by the calling thread
+ *
+ * The protocol's own runtime is used from the thread that created the
+ * protocol; any other thread (e.g. a frame render worker) gets a runtime
+ * of its own, which is evaluated on first use after the script changes.
+ * As with other protocols, the script must not be modified while other
+ * threads are using the protocol
+ */
+UserScriptRuntime* UserScriptProtocol::runtime() const
+{
+    ThreadRuntimeList *runtimeList;
+    UserScriptRuntime *rt;
+
+    if (QThread::currentThread() == runtime_.engine.thread())
+        return &runtime_;
+
+    if (!threadRuntimeList.hasLocalData())
+        threadRuntimeList.setLocalData(new ThreadRuntimeList);
+    runtimeList = threadRuntimeList.localData();
+
+    runtimeList->lock.lock();
+    qDeleteAll(runtimeList->orphans);
+    runtimeList->orphans.clear();
+    rt = runtimeList->runtimes.value(serial_);
+    runtimeList->lock.unlock();
+
+    if (!rt) {
+        rt = new UserScriptRuntime(const_cast<UserScriptProtocol*>(this));
+
+        QMutexLocker registryLocker(&runtimeRegistryLock);
+        QMutexLocker locker(&runtimeList->lock);
+
+        runtimeList->runtimes.insert(serial_, rt);
+        runtimeRegistry[serial_].append(runtimeList);
+    }
+
+    if (rt->generation != runtime_.generation) {
+        rt->evaluate(fieldData(userScript_program, FieldValue).toString());
+        rt->generation = runtime_.generation;
+    }
+
+    return rt;
+}
+
+/*
+ * Returns the key to cache the frame value and size of streamIndex or
+ * -1 if the frame is not to be cached
+ *
+ * A script marks its frames cacheable by setting
+ * protocol.protocolFrameCacheable - it then promises that the frame value
+ * and size are a function of streamIndex alone and repeat every
+ * protocolFrameVariableCount frames
+ */
+int UserScriptProtocol::frameCacheKey(int streamIndex) const
+{
+    int count = runtime_.userProtocol.protocolFrameVariableCount();
+
+    if (!runtime_.userProtocol.isProtocolFrameCacheable())
+        return -1;
+
+    return count > 0 ? streamIndex % count : streamIndex;
+}
+
+quint32 UserScriptProtocol::nextSerial()
+{
+    QMutexLocker locker(&serialLock);
+
+    return ++serial;
+}
+
+//
+// -------------------- UserScriptRuntime --------------------
+//
+
+UserScriptRuntime::UserScriptRuntime(AbstractProtocol *parent)
+    : userProtocol(parent)
+{
+    generation = 0;
+
+    userProtocolScriptValue = engine.newQObject(&userProtocol);
+    engine.globalObject().setProperty("protocol", userProtocolScriptValue);
+
+    QScriptValue meta = engine.newQMetaObject(userProtocol.metaObject());
+    engine.globalObject().setProperty("Protocol", meta);
+}
+
+//! Resets all protocol properties including the dynamic (function) ones
+void UserScriptRuntime::reset()
+{
+    userProtocol.reset();
+    userProtocolScriptValue.setProperty("protocolFrameValue", QScriptValue());
+    userProtocolScriptValue.setProperty("protocolFrameSize", QScriptValue());
+    userProtocolScriptValue.setProperty("protocolFrameCksum", QScriptValue());
+    userProtocolScriptValue.setProperty("protocolId", QScriptValue());
+
+    frameValueFunction = QScriptValue();
+    frameSizeFunction = QScriptValue();
+    frameCksumFunction = QScriptValue();
+    protocolIdFunction = QScriptValue();
+}
+
+/*
+ * Evaluates an (already validated) program - unlike
+ * UserScriptProtocol::evaluateUserScript(), no validation is done
+ */
+void UserScriptRuntime::evaluate(const QString &program)
+{
+    reset();
+
+    engine.evaluate(program);
+    if (engine.hasUncaughtException()) {
+        qWarning("userscript evaluation failed at line %d: %s",
+                engine.uncaughtExceptionLineNumber(),
+                qPrintable(engine.uncaughtException().toString()));
+        reset();
+        return;
+    }
+
+    lookupFunctions();
+}
+
+void UserScriptRuntime::lookupFunctions()
+{
+    frameValueFunction = userProtocolScriptValue.property("protocolFrameValue");
+    frameSizeFunction = userProtocolScriptValue.property("protocolFrameSize");
+    frameCksumFunction = userProtocolScriptValue.property("protocolFrameCksum");
+    protocolIdFunction = userProtocolScriptValue.property("protocolId");
+}
+
 //
 // -------------------- UserProtocol --------------------
 //
@@ -459,6 +702,7 @@ void UserProtocol::reset()
     name_ = QString();
     protocolFrameSizeVariable_ = false;
     protocolFrameVariableCount_ = 1;
+    protocolFrameCacheable_ = false;
 }
 
 QString UserProtocol::name() const
@@ -491,6 +735,16 @@ void UserProtocol::setProtocolFrameVariableCount(int count)
     protocolFrameVariableCount_ = count;
 }
 
+bool UserProtocol::isProtocolFrameCacheable() const
+{
+    return protocolFrameCacheable_;
+}
+
+void UserProtocol::setProtocolFrameCacheable(bool cacheable)
+{
+    protocolFrameCacheable_ = cacheable;
+}
+
 quint32 UserProtocol::payloadProtocolId(UserProtocol::ProtocolIdType type) const
 {
     return parent_->payloadProtocolId(
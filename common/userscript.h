@@ -23,6 +23,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "abstractprotocol.h"
 #include "userscript.pb.h"
 
+#include <QHash>
+#include <QMutex>
 #include <QScriptEngine>
 #include <QScriptValue>
 
@@ -41,6 +43,9 @@ class UserProtocol : public QObject
     Q_PROPERTY(int protocolFrameVariableCount
             READ protocolFrameVariableCount
             WRITE setProtocolFrameVariableCount);
+    Q_PROPERTY(bool protocolFrameCacheable
+            READ isProtocolFrameCacheable
+            WRITE setProtocolFrameCacheable);
     
 public:
     enum ProtocolIdType
@@ -70,6 +75,8 @@ public slots:
     void setProtocolFrameSizeVariable(bool variable);
     int protocolFrameVariableCount() const;
     void setProtocolFrameVariableCount(int count);
+    bool isProtocolFrameCacheable() const;
+    void setProtocolFrameCacheable(bool cacheable);
 
     quint32 payloadProtocolId(UserProtocol::ProtocolIdType type) const;
     int protocolFrameOffset(int streamIndex = 0) const;
@@ -90,6 +97,36 @@ private:
     QString name_;
     bool protocolFrameSizeVariable_;
     int protocolFrameVariableCount_;
+    bool protocolFrameCacheable_;
+};
+
+/*
+ * A script engine with the user script evaluated in it
+ *
+ * The script functions are looked up once after evaluation instead of
+ * on every call. A QScriptEngine can be used only from the thread that
+ * created it, so other threads get their own runtime - see
+ * UserScriptProtocol::runtime()
+ */
+class UserScriptRuntime
+{
+public:
+    UserScriptRuntime(AbstractProtocol *parent);
+
+    void reset();
+    void evaluate(const QString &program);
+    void lookupFunctions();
+
+    QScriptEngine   engine;
+    UserProtocol    userProtocol;
+    QScriptValue    userProtocolScriptValue;
+
+    QScriptValue    frameValueFunction;
+    QScriptValue    frameSizeFunction;
+    QScriptValue    frameCksumFunction;
+    QScriptValue    protocolIdFunction;
+
+    quint32         generation;
 };
 
 class UserScriptProtocol : public AbstractProtocol
@@ -140,12 +177,19 @@ public:
 
 private:
     int userScriptLineCount() const;
+    UserScriptRuntime* runtime() const;
+    int frameCacheKey(int streamIndex) const;
+
+    static quint32 nextSerial();
 
     OstProto::UserScript    data;
 
-    mutable QScriptEngine   engine_;
-    mutable UserProtocol    userProtocol_;
-    mutable QScriptValue    userProtocolScriptValue_;
+    quint32                 serial_;
+    mutable UserScriptRuntime runtime_;
+
+    mutable QMutex          frameCacheLock_;
+    mutable QHash<int, QByteArray> frameValueCache_;
+    mutable QHash<int, int> frameSizeCache_;
 
     mutable bool            isScriptValid_;
     mutable int             errorLineNumber_;
@@ -268,3 +268,16 @@ bool VlanProtocol::setFieldData(int index, const QVariant &value,
 _exit:
     return isOk;
 }
+
+int VlanProtocol::writeProtocolFrameValue(uchar *buf, int bufSize,
+        int /*streamIndex*/, bool /*forCksum*/) const
+{
+    if (bufSize < 4)
+        return -1;
+
+    // tag is prio (3) + cfi/dei (1) + vlan-id (12)
+    qToBigEndian(quint16(data.is_override_tpid() ? data.tpid() : 0x8100),
+            buf);
+    qToBigEndian(quint16(data.vlan_tag() & 0xFFFF), buf + 2);
+    return 4;
+}
@@ -61,6 +61,9 @@ public:
             FieldAttrib attrib = FieldValue);
 
 protected:
+    virtual int writeProtocolFrameValue(uchar *buf, int bufSize,
+        int streamIndex, bool forCksum) const;
+
     OstProto::Vlan    data;
 };
 
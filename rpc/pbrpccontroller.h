@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <google/protobuf/service.h>
 
 class QIODevice;
+class QObject;
 
 /*!
 PbRpcController takes ownership of the 'request' and 'response' messages and
@@ -36,6 +37,7 @@ public:
             ::google::protobuf::Message *response) { 
         request_ = request;
         response_ = response;
+        connection_ = NULL;
         Reset(); 
     }
     ~PbRpcController() { delete request_; delete response_; }
@@ -82,11 +84,17 @@ public:
     QIODevice* binaryBlob() { return blob; };
     void setBinaryBlob(QIODevice *binaryBlob) { blob = binaryBlob; };
 
+    // Server side - the connection on which the RPC was received; can be
+    // used to send notifications to only that client later
+    QObject* connection() const { return connection_; }
+    void setConnection(QObject *connection) { connection_ = connection; }
+
 private:
     bool failed;
     bool disconnect;
     bool notif;
     QIODevice *blob;
+    QObject *connection_;
     QString errStr;
     ::google::protobuf::Message *request_;
     ::google::protobuf::Message *response_;
@@ -201,9 +201,31 @@ _exit:
 
 void RpcConnection::sendNotification(int notifType,
         SharedProtobufMessage notifData)
+{
+    writeNotification(notifType, notifData, false);
+}
+
+/*!
+ * Sends the notification only if this is one of the given connections
+ *
+ * If quiet is set, the notification contents are not logged (meant for
+ * periodic ones like stats)
+ */
+void RpcConnection::sendNotification(QList<QObject*> connections,
+        int notifType, SharedProtobufMessage notifData, bool quiet)
+{
+    if (!connections.contains(this))
+        return;
+
+    writeNotification(notifType, notifData, quiet);
+}
+
+void RpcConnection::writeNotification(int notifType,
+        SharedProtobufMessage notifData, bool quiet)
 {
     char msgBuf[PB_HDR_SIZE];
     char* const msg = &msgBuf[0];
+    QByteArray data;
     int len;
 
     if (!isCompatCheckDone)
@@ -223,18 +245,21 @@ void RpcConnection::sendNotification(int notifType,
         return;
     }
 
-    len = notifData->ByteSize();
+    // Serialized only once for all the clients it is sent to
+    data = notifData.serialized();
+    len = data.size();
     writeHeader(msg, PB_MSG_TYPE_NOTIFY, notifType, len);
 
     qDebug("Server(%s): sending %d bytes to client <----",
         __FUNCTION__, len + PB_HDR_SIZE);
     BUFDUMP(msg, 8);
-    qDebug("notif = %d\ndata = \n%s---->", 
-        notifType, notifData->DebugString().c_str());
+    if (!quiet) {
+        qDebug("notif = %d\ndata = \n%s---->", 
+            notifType, notifData->DebugString().c_str());
+    }
 
     clientSock->write(msg, PB_HDR_SIZE);
-    notifData->SerializeToZeroCopyStream(outStream);
-    outStream->Flush();
+    clientSock->write(data);
 }
 
 void RpcConnection::on_clientSock_disconnected()
@@ -374,6 +399,7 @@ void RpcConnection::on_clientSock_dataAvail()
     }
 
     controller = new PbRpcController(req, resp);
+    controller->setConnection(this);
 
     //qDebug("before service->callmethod()");
 
@@ -23,6 +23,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "sharedprotobufmessage.h"
 
 #include <QAbstractSocket>
+#include <QList>
 
 // forward declarations
 class PbRpcController;
@@ -53,12 +54,16 @@ private:
     void writeHeader(char* header, quint16 type, quint16 method, 
                      quint32 length);
     void sendRpcReply(PbRpcController *controller);
+    void writeNotification(int notifType, SharedProtobufMessage notifData,
+                           bool quiet);
 
 signals:
     void closed();
 
 public slots:
     void sendNotification(int notifType, SharedProtobufMessage notifData);
+    void sendNotification(QList<QObject*> connections, int notifType,
+                          SharedProtobufMessage notifData, bool quiet);
 
 private slots:
     void start();
@@ -80,6 +80,12 @@ void RpcServer::incomingConnection(qintptr socketDescriptor)
 
     connect(this, SIGNAL(notifyClients(int, SharedProtobufMessage)),
             conn, SLOT(sendNotification(int, SharedProtobufMessage)));
+    connect(this,
+            SIGNAL(notifyClients(QList<QObject*>, int, SharedProtobufMessage,
+                                 bool)),
+            conn,
+            SLOT(sendNotification(QList<QObject*>, int, SharedProtobufMessage,
+                                  bool)));
 
     thread->start();
 }
@@ -22,6 +22,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "sharedprotobufmessage.h"
 
+#include <QList>
 #include <QTcpServer>
 
 // forward declaration
@@ -45,6 +46,8 @@ public:
 
 signals:
     void notifyClients(int notifType, SharedProtobufMessage notifData);
+    void notifyClients(QList<QObject*> connections, int notifType,
+                       SharedProtobufMessage notifData, bool quiet);
 
 protected:
     void incomingConnection(qintptr socketDescriptor);
@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define _SHARED_PROTOBUF_MESSAGE_H
 
 #include <google/protobuf/message.h>
+#include <QByteArray>
 #include <QMutex>
 
 // TODO: Use QSharedPointer instead once the minimum Qt version becomes >= 4.5
@@ -35,6 +36,7 @@ public:
         mutex_ = new QMutex();
         refCnt_ = new unsigned int;
         *refCnt_ = 1;
+        serialized_ = new QByteArray();
         qDebug("sharedptr %p(constr) refcnt %p(%u)", this, refCnt_, *refCnt_);
     }
 
@@ -46,6 +48,7 @@ public:
         if (*refCnt_ == 0) {
             delete ptr_;
             delete refCnt_;
+            delete serialized_;
 
             mutex_->unlock();
             delete mutex_;
@@ -62,6 +65,7 @@ public:
         ptr_ = other.ptr_;
         refCnt_ = other.refCnt_;
         mutex_ = other.mutex_;
+        serialized_ = other.serialized_;
 
         mutex_->lock();
         (*refCnt_)++;
@@ -74,12 +78,33 @@ public:
         return ptr_;
     }
 
+    /*!
+     * Returns the serialized message - the message is serialized only
+     * once and shared by all copies of the pointer, so a message sent to
+     * many clients is not serialized for each of them
+     *
+     * The message must not be modified after this is called
+     */
+    QByteArray serialized() const
+    {
+        QMutexLocker locker(mutex_);
+
+        if (serialized_->isEmpty() && ptr_) {
+            serialized_->resize(ptr_->ByteSize());
+            ptr_->SerializeWithCachedSizesToArray(
+                    (::google::protobuf::uint8*) serialized_->data());
+        }
+
+        return *serialized_; // implicitly shared, so no copy
+    }
+
 protected:
     T *ptr_;
 
     // use uint+mutex to simulate a QAtomicInt
     unsigned int *refCnt_;
     QMutex *mutex_;
+    QByteArray *serialized_;
 };
 
 typedef class SharedPointer< ::google::protobuf::Message> SharedProtobufMessage;
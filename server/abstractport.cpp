@@ -20,15 +20,165 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "abstractport.h"
 
 #include "../common/abstractprotocol.h"
+#include "../common/protocollistiterator.h"
 #include "../common/streambase.h"
 #include "devicemanager.h"
+#include "framepatchtable.h"
 #include "packetbuffer.h"
+#include "settings.h"
+#include "statsseries.h"
 
+#include <QDateTime>
 #include <QString>
 #include <QIODevice>
+#include <QMutexLocker>
+#include <QVector>
 
 #include <limits.h>
 #include <math.h>
+#include <string.h>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+// Max memory used to render frames ahead of adding them to the packet list
+static const int kMaxFrameBatchBytes = 8 << 20;
+
+// Packet list memory per frame over and above the frame itself - for the
+// pcap_pkthdr etc.; used only to estimate the packet list memory
+static const int kPacketListFrameOverhead = 32;
+
+// Frames added to the packet list between progress updates
+static const quint64 kPacketListProgressInterval = 4096;
+
+QMutex AbstractPort::globalPacketListLock_;
+quint64 AbstractPort::globalPacketListMemory_ = 0;
+
+//! Returns the largest frame size of the stream
+static int frameSizeMax(const StreamBase *stream)
+{
+    return stream->lenMode() == StreamBase::e_fl_fixed ?
+                stream->frameLen() : stream->frameLenMax();
+}
+
+//! Returns the physical memory size in bytes or 0 if not known
+static quint64 physicalMemorySize()
+{
+#if defined(Q_OS_UNIX) && defined(_SC_PHYS_PAGES)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+
+    if ((pages > 0) && (pageSize > 0))
+        return quint64(pages) * quint64(pageSize);
+#endif
+    return 0;
+}
+
+/*
+ * Frames of a stream rendered ahead in parallel, a batch at a time - see
+ * StreamBase::renderFrames() - for the packet list to be built in order
+ */
+class FrameBatch : public FrameSink
+{
+public:
+    FrameBatch(const StreamBase *stream, int frameCount, int maxFrameSize)
+        : stream_(stream), frameCount_(frameCount), slotSize_(maxFrameSize),
+          first_(0), count_(0)
+    {
+        int batchSize = qMax(1, qMin(kMaxFrameBatchBytes/slotSize_,
+                                     frameCount_));
+
+        buf_.resize(batchSize*slotSize_);
+        len_.resize(batchSize);
+
+        // frameRendered() is called from multiple threads - so use raw
+        // pointers instead of the (detach checking) Qt accessors
+        bufData_ = buf_.data();
+        lenData_ = len_.data();
+    }
+
+    //! Returns the length of the frame and sets frame to its contents
+    int frameValue(int frameIndex, const uchar **frame)
+    {
+        if ((frameIndex < first_) || (frameIndex >= first_ + count_)) {
+            first_ = frameIndex;
+            count_ = qMin(len_.size(), frameCount_ - frameIndex);
+            len_.fill(0);
+            stream_->renderFrames(first_, count_, this);
+        }
+
+        *frame = bufData_ + (frameIndex - first_)*slotSize_;
+        return lenData_[frameIndex - first_];
+    }
+
+    virtual void frameRendered(int frameIndex, const uchar *buf, int len)
+    {
+        int slot = frameIndex - first_;
+
+        len = qMin(len, slotSize_);
+        memcpy(bufData_ + slot*slotSize_, buf, len);
+        lenData_[slot] = len;
+    }
+
+private:
+    const StreamBase *stream_;
+    int frameCount_;
+    int slotSize_;
+    int first_;
+    int count_;
+    QVector<uchar> buf_;
+    QVector<int> len_;
+    uchar *bufData_;
+    int *lenData_;
+};
+
+/*
+ * Rendered frames of a stream, packed one after the other - frames are
+ * appended in frame index order
+ */
+class FrameCache
+{
+public:
+    // Takes ownership of patches (the ones the frames were rendered with)
+    FrameCache(const QByteArray &key, int frameCount, int maxFrameSize,
+               FramePatchTable *patches)
+        : key_(key), patches_(patches)
+    {
+        frames_.reserve(frameCount*maxFrameSize);
+        offset_.reserve(frameCount + 1);
+        offset_.append(0);
+    }
+    ~FrameCache() { delete patches_; }
+
+    const QByteArray& key() const { return key_; }
+    const FramePatchTable* patches() const { return patches_; }
+    int frameCount() const { return offset_.size() - 1; }
+    quint64 size() const { return frames_.capacity(); }
+
+    //! Returns the length of the frame and sets frame to its contents
+    int frameValue(int frameIndex, const uchar **frame) const
+    {
+        *frame = (const uchar*) frames_.constData() + offset_.at(frameIndex);
+        return offset_.at(frameIndex + 1) - offset_.at(frameIndex);
+    }
+
+    void appendFrame(const uchar *frame, int len)
+    {
+        if (len > 0)
+            frames_.append((const char*) frame, len);
+        offset_.append(frames_.size());
+    }
+
+    void squeeze() { frames_.squeeze(); offset_.squeeze(); }
+
+private:
+    Q_DISABLE_COPY(FrameCache)
+
+    QByteArray key_;
+    FramePatchTable *patches_;
+    QByteArray frames_;
+    QVector<int> offset_;
+};
 
 AbstractPort::AbstractPort(int id, const char *device)
 {
@@ -42,19 +192,41 @@ AbstractPort::AbstractPort(int id, const char *device)
     data_.set_is_exclusive_control(false);
 
     isSendQueueDirty_ = false;
+    resolvedMacCacheGeneration_ = 0;
     rateAccuracy_ = kHighAccuracy;
     linkState_ = OstProto::LinkStateUnknown;
     minPacketSetSize_ = 1;
 
     deviceManager_ = new DeviceManager(this);
 
+    packetListInfo_.isBuilding = false;
+    packetListInfo_.framesBuilt = 0;
+    packetListInfo_.framesEstimate = 0;
+    packetListInfo_.memoryUsed = 0;
+    packetListInfo_.memoryBudget = appSettings->value(
+            kPacketListPortMemoryBudgetKey,
+            kPacketListPortMemoryBudgetDefaultValue).toULongLong() << 20;
+
+    // QByteArray (used by the cache) is limited to 2GB
+    frameCacheSize_ = 0;
+    maxFrameCacheSize_ = qMin(appSettings->value(kPacketListFrameCacheSizeKey,
+            kPacketListFrameCacheSizeDefaultValue).toULongLong() << 20,
+            quint64(INT_MAX));
+
     maxStatsValue_ = ULLONG_MAX; // assume 64-bit stats
     memset((void*) &stats_, 0, sizeof(stats_));
     resetStats();
+
+    statsSeries_ = new StatsSeries(this, streamStats_, streamStatsLock_);
+    statsRequestTime_ = 0;
 }
 
 AbstractPort::~AbstractPort()
 {
+    delete statsSeries_;
+    qDeleteAll(frameCache_);
+    releaseFrameCacheMemory(frameCacheSize_);
+    releasePacketListMemory();
     delete deviceManager_;
 }    
 
@@ -152,6 +324,8 @@ bool AbstractPort::deleteStream(int streamId)
             stream = streamList_.takeAt(i);
             delete stream;
             
+            resolvedMacCache_.remove(streamId);
+            removeFrameCache(streamId);
             isSendQueueDirty_ = true;
             return true;
         }
@@ -196,26 +370,93 @@ bool AbstractPort::setRateAccuracy(Accuracy accuracy)
     return true;
 }
 
-void AbstractPort::updatePacketList()
+/*!
+ * Frames of the stream appended to the packet list after this call will
+ * have the variable fields in patches patched at transmit time - NULL
+ * ends patching. Takes ownership of patches (even on failure)
+ *
+ * Returns false if the port does not support patching (the default) in
+ * which case all unique frames of the stream should be built as usual
+ */
+bool AbstractPort::setPacketListPatches(FramePatchTable *patches)
 {
+    delete patches;
+    return false;
+}
+
+/*!
+ * Builds the packet list from the streams
+ *
+ * Returns false if the packet list would exceed its memory budget (or the
+ * global one) - the packet list is left empty and the port dirty in that
+ * case; packetListInfo() has the reason
+ */
+bool AbstractPort::updatePacketList()
+{
+    bool isOk = false;
+
+    // Stream contents may have changed since the last build, so start
+    // afresh - resolved macs will be cached again during this build
+    resolvedMacCache_.clear();
+    releasePacketListMemory();
+
+    packetListInfoLock_.lock();
+    packetListInfo_.isBuilding = true;
+    packetListInfo_.framesBuilt = 0;
+    packetListInfo_.framesEstimate = packetListFrameEstimate();
+    packetListInfo_.error.clear();
+    packetListInfoLock_.unlock();
+
     switch(data_.transmit_mode())
     {
     case OstProto::kSequentialTransmit:
-        updatePacketListSequential();
+        isOk = updatePacketListSequential();
         break;
     case OstProto::kInterleavedTransmit:
-        updatePacketListInterleaved();
+        isOk = updatePacketListInterleaved();
         break;
     default:
         Q_ASSERT(false); // Unreachable!!!
         break;
     }
+
+    packetListInfoLock_.lock();
+    packetListInfo_.isBuilding = false;
+    if (isOk)
+        packetListInfo_.framesEstimate = packetListInfo_.framesBuilt;
+    packetListInfoLock_.unlock();
+
+    return isOk;
 }
 
-void AbstractPort::updatePacketListSequential()
+/*!
+ * Returns the packet list build progress and memory usage - this does not
+ * need the port lock, so can be used while the packet list is being built
+ */
+void AbstractPort::packetListInfo(PacketListInfo *info)
+{
+    QMutexLocker locker(&packetListInfoLock_);
+
+    *info = packetListInfo_;
+}
+
+/*!
+ * Returns the memory reserved by the packet lists of all ports and the
+ * budget for the same (0 means unlimited)
+ */
+void AbstractPort::globalPacketListMemory(quint64 *used, quint64 *budget)
+{
+    QMutexLocker locker(&globalPacketListLock_);
+
+    *used = globalPacketListMemory_;
+    *budget = globalPacketListMemoryBudget();
+}
+
+bool AbstractPort::updatePacketListSequential()
 {
     long    sec = 0; 
     long    nsec = 0;
+    quint64 framesBuilt = 0;
 
     qDebug("In %s", __FUNCTION__);
 
@@ -229,6 +470,7 @@ void AbstractPort::updatePacketListSequential()
         if (streamList_[i]->isEnabled())
         {
             int len = 0;
+            int maxFrameLen;
             ulong n, x, y;
             ulong burstSize;
             double ibg = 0;
@@ -240,6 +482,38 @@ void AbstractPort::updatePacketListSequential()
             quint64 npy1 = 0, npy2 = 0;
             quint64 loopDelay;
             ulong frameVariableCount = streamList_[i]->frameVariableCount();
+            QByteArray cacheKey = frameCacheKey(streamList_[i]);
+            FrameCache *cache = frameCache_.value(streamList_[i]->id());
+            FramePatchTable *patches;
+            FramePatchTable *cachePatches = NULL;
+
+            if (cache && (cache->key() != cacheKey)) {
+                removeFrameCache(streamList_[i]->id());
+                cache = NULL;
+            }
+
+            // Variable fields patched at transmit time need not be built -
+            // an unchanged stream has the same patches as last time
+            if (cache)
+                patches = cache->patches() ?
+                    new FramePatchTable(*cache->patches()) : NULL;
+            else
+                patches = FramePatchTable::build(streamList_[i]);
+            if (patches)
+            {
+                ulong baseFrameCount = patches->baseFrameCount();
+
+                cachePatches = new FramePatchTable(*patches);
+                if (setPacketListPatches(patches)) // takes ownership
+                    frameVariableCount = baseFrameCount;
+                else
+                {
+                    delete cachePatches;
+                    cachePatches = NULL;
+                }
+            }
+            maxFrameLen = qBound(1, frameSizeMax(streamList_[i]),
+                                 int(sizeof(pktBuf_)));
 
             // We derive n, x, y such that
             // n * x + y = total number of packets to be sent
@@ -266,6 +540,12 @@ void AbstractPort::updatePacketListSequential()
                 n = 2;
                 while (x < minPacketSetSize_) 
                     x = frameVariableCount*n++;
+                // A larger packet set only cuts down the looping overhead
+                // - it is dropped (not refused) if over the memory budget
+                if ((x > frameVariableCount)
+                        && !isPacketListMemoryAvailable(2*quint64(x)
+                            * (maxFrameLen + kPacketListFrameOverhead)))
+                    x = frameVariableCount;
                 n = streamList_[i]->numPackets() / x;
                 y = streamList_[i]->numPackets() % x;
                 burstSize = x + y;
@@ -284,6 +564,8 @@ void AbstractPort::updatePacketListSequential()
             default:
                 qWarning("Unhandled stream control unit %d",
                     streamList_[i]->sendUnit());
+                setPacketListPatches(NULL);
+                delete cachePatches;
                 continue;
             }
 
@@ -305,18 +587,58 @@ void AbstractPort::updatePacketListSequential()
             qDebug("npx2 = %llu", npx2);
             qDebug("npy2 = %llu\n", npy2);
 
+            if (n == 0)
+                x = 0;
+
+            // The frame cache (except this stream's) is dropped if the
+            // memory is needed for the packet list
+            if (!reservePacketListMemory(quint64(x + y)
+                        * (maxFrameLen + kPacketListFrameOverhead))
+                    && !(trimFrameCache(streamList_[i]->id())
+                        && reservePacketListMemory(quint64(x + y)
+                            * (maxFrameLen + kPacketListFrameOverhead)))) {
+                delete cachePatches;
+                goto _over_budget;
+            }
+
             if (n > 1)
                 loopNextPacketSet(x, n, 0, loopDelay);
-            else if (n == 0)
-                x = 0;
+
+            // Frames of a stream that hasn't changed since it was last
+            // rendered are taken from the frame cache
+            int renderCount = frameVariableCount > 1 ? int(x+y) : 1;
+            quint64 cacheReserved = quint64(renderCount) * maxFrameLen;
+            FrameCache *newCache = NULL;
+
+            if (cache && (cache->frameCount() < renderCount)) {
+                removeFrameCache(streamList_[i]->id());
+                cache = NULL;
+            }
+            if (!cache && reserveFrameCacheMemory(cacheReserved)) {
+                newCache = new FrameCache(cacheKey, renderCount, maxFrameLen,
+                                          cachePatches);
+                cachePatches = NULL;
+            }
+            delete cachePatches;
+
+            // Otherwise frames are rendered in parallel a batch at a time
+            FrameBatch frameBatch(streamList_[i], cache ? 1 : renderCount,
+                                  maxFrameLen);
+            const uchar *pkt = NULL;
 
             for (uint j = 0; j < (x+y); j++)
             {
                 
                 if (j == 0 || frameVariableCount > 1)
                 {
-                    len = streamList_[i]->frameValue(
-                            pktBuf_, sizeof(pktBuf_), j);
+                    if (cache)
+                        len = cache->frameValue(j, &pkt);
+                    else
+                    {
+                        len = frameBatch.frameValue(j, &pkt);
+                        if (newCache)
+                            newCache->appendFrame(pkt, len);
+                    }
                 }
                 if (len <= 0)
                     continue;
@@ -324,7 +646,10 @@ void AbstractPort::updatePacketListSequential()
                 qDebug("q(%d, %d) sec = %lu nsec = %lu",
                         i, j, sec, nsec);
 
-                appendToPacketList(sec, nsec, pktBuf_, len); 
+                appendToPacketList(sec, nsec, pkt, len); 
+
+                if ((++framesBuilt % kPacketListProgressInterval) == 0)
+                    setPacketListProgress(framesBuilt);
 
                 if ((j > 0) && (((j+1) % burstSize) == 0))
                 {
@@ -350,6 +675,16 @@ void AbstractPort::updatePacketListSequential()
                 }
             }
 
+            if (newCache)
+            {
+                newCache->squeeze();
+                frameCache_.insert(streamList_[i]->id(), newCache);
+                releaseFrameCacheMemory(cacheReserved
+                        - qMin(cacheReserved, newCache->size()));
+            }
+
+            setPacketListPatches(NULL);
+
             switch(streamList_[i]->nextWhat())
             {
                 case ::OstProto::StreamControl::e_nw_stop:
@@ -386,12 +721,21 @@ void AbstractPort::updatePacketListSequential()
     } // for (numStreams)
 
 _stop_no_more_pkts:
+    setPacketListProgress(framesBuilt);
     isSendQueueDirty_ = false;
+    return true;
+
+_over_budget:
+    clearPacketList();
+    releasePacketListMemory();
+    return false;
 }
 
-void AbstractPort::updatePacketListInterleaved()
+bool AbstractPort::updatePacketListInterleaved()
 {
     int numStreams = 0;
+    quint64 framesBuilt = 0;
+    double packetListBytes = 0;
     quint64 minGap = ULLONG_MAX;
     quint64 duration = quint64(1e9);
     QList<quint64> ibg1, ibg2;
@@ -419,7 +763,7 @@ void AbstractPort::updatePacketListInterleaved()
     if (activeStreamCount == 0)
     {
         isSendQueueDirty_ = false;
-        return;
+        return true;
     }
 
     // First sort the streams by ordinalValue
@@ -487,6 +831,10 @@ void AbstractPort::updatePacketListInterleaved()
         qDebug("np2  = %llu\n", _np2);
 
 
+        // One second worth of frames
+        packetListBytes += (numBursts + numPackets) * double(_burstSize)
+            * (frameSizeMax(streamList_[i]) + kPacketListFrameOverhead);
+
         if (_ibg2 && (_ibg2 < minGap))
             minGap = _ibg2;
 
@@ -548,6 +896,14 @@ void AbstractPort::updatePacketListInterleaved()
     qDebug("minGap   = %llu", minGap);
     qDebug("duration = %llu", duration);
 
+    if (!reservePacketListMemory(packetListBytes < double(ULLONG_MAX) ?
+                quint64(packetListBytes) : ULLONG_MAX))
+    {
+        clearPacketList();
+        releasePacketListMemory();
+        return false;
+    }
+
     uchar* buf;
     int len;
     quint64 durSec = duration/ulong(1e9);
@@ -583,6 +939,8 @@ void AbstractPort::updatePacketListInterleaved()
 
                 qDebug("q(%d) sec = %llu nsec = %llu", i, sec, nsec);
                 appendToPacketList(sec, nsec, buf, len); 
+                if ((++framesBuilt % kPacketListProgressInterval) == 0)
+                    setPacketListProgress(framesBuilt);
                 lastPktTxSec = sec;
                 lastPktTxNsec = nsec;
 
@@ -623,7 +981,284 @@ void AbstractPort::updatePacketListInterleaved()
     }
     qDebug("loop Delay = %lld/%lld", delaySec, delayNsec);
     setPacketListLoopMode(true, delaySec, delayNsec); 
+    setPacketListProgress(framesBuilt);
     isSendQueueDirty_ = false;
+    return true;
+}
+
+/*!
+ * Reserves bytes of memory for the packet list being built - to be called
+ * before adding the corresponding frames to the packet list
+ *
+ * Returns false (and sets the packet list error) if that would exceed the
+ * port's packet list memory budget or the global one
+ */
+bool AbstractPort::reservePacketListMemory(quint64 bytes)
+{
+    QMutexLocker infoLocker(&packetListInfoLock_);
+    QMutexLocker globalLocker(&globalPacketListLock_);
+    quint64 portBudget = packetListInfo_.memoryBudget;
+    quint64 globalBudget = globalPacketListMemoryBudget();
+    quint64 portUsed = packetListInfo_.memoryUsed + frameCacheSize_;
+
+    if (portBudget && ((bytes > portBudget)
+                || (portUsed + bytes > portBudget))) {
+        packetListInfo_.error = QString("Packet list needs more than the "
+                "port's packet list memory budget of %1 MB")
+                    .arg(portBudget >> 20);
+        goto _over_budget;
+    }
+
+    if (globalBudget && ((bytes > globalBudget)
+                || (globalPacketListMemory_ + bytes > globalBudget))) {
+        packetListInfo_.error = QString("Packet list needs more than the "
+                "remaining %1 MB of the packet list memory budget of %2 MB "
+                "for all ports")
+                    .arg((globalBudget - qMin(globalBudget,
+                                    globalPacketListMemory_)) >> 20)
+                    .arg(globalBudget >> 20);
+        goto _over_budget;
+    }
+
+    packetListInfo_.memoryUsed += bytes;
+    globalPacketListMemory_ += bytes;
+    return true;
+
+_over_budget:
+    qWarning("port %d: %s", id(), qPrintable(packetListInfo_.error));
+    return false;
+}
+
+/*
+ * Returns true if bytes can be reserved for the packet list within the
+ * budgets (without reserving them) - for optional uses of memory
+ */
+bool AbstractPort::isPacketListMemoryAvailable(quint64 bytes)
+{
+    QMutexLocker infoLocker(&packetListInfoLock_);
+    QMutexLocker globalLocker(&globalPacketListLock_);
+    quint64 portBudget = packetListInfo_.memoryBudget;
+    quint64 globalBudget = globalPacketListMemoryBudget();
+
+    if (portBudget && (packetListInfo_.memoryUsed + frameCacheSize_ + bytes
+                            > portBudget))
+        return false;
+
+    if (globalBudget && (globalPacketListMemory_ + bytes > globalBudget))
+        return false;
+
+    return true;
+}
+
+//! Updates the number of frames added to the packet list being built
+void AbstractPort::setPacketListProgress(quint64 framesBuilt)
+{
+    QMutexLocker locker(&packetListInfoLock_);
+
+    packetListInfo_.framesBuilt = framesBuilt;
+}
+
+/*
+ * Returns the frame cache key for the stream - the frames of a stream are
+ * a function of its protocols and core config (except the non-frame ones
+ * like name, enable, ordinal) and for resolved MACs, the device neighbors
+ */
+QByteArray AbstractPort::frameCacheKey(const StreamBase *stream)
+{
+    OstProto::Stream s;
+    std::string key;
+    quint32 generation;
+
+    stream->protoDataCopyInto(s);
+    s.clear_control();
+    s.mutable_core()->clear_name();
+    s.mutable_core()->clear_is_enabled();
+    s.mutable_core()->clear_ordinal();
+    s.SerializeToString(&key);
+
+    // Frames of streams that resolve MACs depend on the device neighbors
+    if (stream->isMacResolved()) {
+        generation = deviceManager_->neighborGeneration();
+        key.append((const char*) &generation, sizeof(generation));
+    }
+
+    return QByteArray(key.data(), int(key.size()));
+}
+
+void AbstractPort::removeFrameCache(uint streamId)
+{
+    FrameCache *cache = frameCache_.take(streamId);
+
+    if (!cache)
+        return;
+
+    releaseFrameCacheMemory(cache->size());
+    delete cache;
+}
+
+/*
+ * Removes the frame cache of all streams except keepStreamId to free up
+ * memory for the packet list - returns false if there was none to remove
+ */
+bool AbstractPort::trimFrameCache(uint keepStreamId)
+{
+    bool removed = false;
+
+    foreach(uint streamId, frameCache_.keys()) {
+        if (streamId == keepStreamId)
+            continue;
+        removeFrameCache(streamId);
+        removed = true;
+    }
+
+    return removed;
+}
+
+/*
+ * Charges bytes of frame cache to the port's and the global packet list
+ * memory budgets - returns false (and charges nothing) if that would
+ * exceed either or the port's frame cache size
+ */
+bool AbstractPort::reserveFrameCacheMemory(quint64 bytes)
+{
+    QMutexLocker infoLocker(&packetListInfoLock_);
+    QMutexLocker globalLocker(&globalPacketListLock_);
+    quint64 portBudget = packetListInfo_.memoryBudget;
+    quint64 globalBudget = globalPacketListMemoryBudget();
+
+    if (frameCacheSize_ + bytes > maxFrameCacheSize_)
+        return false;
+
+    if (portBudget && (packetListInfo_.memoryUsed + frameCacheSize_ + bytes
+                            > portBudget))
+        return false;
+
+    if (globalBudget && (globalPacketListMemory_ + bytes > globalBudget))
+        return false;
+
+    frameCacheSize_ += bytes;
+    globalPacketListMemory_ += bytes;
+    return true;
+}
+
+void AbstractPort::releaseFrameCacheMemory(quint64 bytes)
+{
+    QMutexLocker infoLocker(&packetListInfoLock_);
+    QMutexLocker globalLocker(&globalPacketListLock_);
+
+    bytes = qMin(bytes, frameCacheSize_);
+    frameCacheSize_ -= bytes;
+    globalPacketListMemory_ -= qMin(globalPacketListMemory_, bytes);
+}
+
+/*
+ * Returns the (upper bound) estimate of the number of frames in the packet
+ * list for the current streams - transmit time patching of variable fields
+ * and the next-what of streams are not considered
+ */
+quint64 AbstractPort::packetListFrameEstimate()
+{
+    quint64 frames = 0;
+
+    for (int i = 0; i < streamList_.size(); i++)
+    {
+        StreamBase *stream = streamList_.at(i);
+        quint64 total = 0, x = 1;
+
+        if (!stream->isEnabled())
+            continue;
+
+        switch (stream->sendUnit())
+        {
+        case OstProto::StreamControl::e_su_bursts:
+            if (data_.transmit_mode() == OstProto::kInterleavedTransmit) {
+                frames += quint64(stream->burstRate()) * stream->burstSize();
+                continue;
+            }
+            total = quint64(stream->burstSize()) * stream->numBursts();
+            x = AbstractProtocol::lcm(stream->frameVariableCount(),
+                                      stream->burstSize());
+            break;
+        case OstProto::StreamControl::e_su_packets:
+            if (data_.transmit_mode() == OstProto::kInterleavedTransmit) {
+                frames += quint64(stream->packetRate());
+                continue;
+            }
+            total = stream->numPackets();
+            x = stream->frameVariableCount();
+            while (x < minPacketSetSize_)
+                x += stream->frameVariableCount();
+            break;
+        default:
+            continue;
+        }
+
+        // See updatePacketListSequential() for x
+        frames += (x && (total >= x)) ? x + total % x : total;
+    }
+
+    return frames;
+}
+
+void AbstractPort::releasePacketListMemory()
+{
+    QMutexLocker infoLocker(&packetListInfoLock_);
+    QMutexLocker globalLocker(&globalPacketListLock_);
+
+    globalPacketListMemory_ -= qMin(globalPacketListMemory_,
+                                    packetListInfo_.memoryUsed);
+    packetListInfo_.memoryUsed = 0;
+}
+
+/*
+ * Returns the packet list memory budget for all ports put together (read
+ * from the settings on first use) - caller should hold globalPacketListLock_
+ */
+quint64 AbstractPort::globalPacketListMemoryBudget()
+{
+    static bool isInit = false;
+    static quint64 budget = 0;
+
+    if (!isInit) {
+        budget = appSettings->value(kPacketListMemoryBudgetKey,
+                kPacketListMemoryBudgetDefaultValue).toULongLong() << 20;
+        if (!budget)
+            budget = physicalMemorySize()/2;
+        isInit = true;
+    }
+
+    return budget;
+}
+
+/*!
+ * Marks the port stats as being in use by a client - to be called when
+ * a client asks for them
+ */
+void AbstractPort::markStatsActive()
+{
+    statsRequestTime_ = QDateTime::currentMSecsSinceEpoch();
+}
+
+/*!
+ * Returns true if the port stats are in use - i.e. a client has asked for
+ * them recently, the port is transmitting/capturing or its stats series
+ * is sampling them
+ *
+ * Port implementations may refresh the stats of ports not in use less
+ * often (see LinuxPort)
+ */
+bool AbstractPort::isStatsActive()
+{
+    if (isTransmitOn() || isCaptureOn())
+        return true;
+
+    // The series samples at (or finer than) the refresh interval - stale
+    // counters would show up as steps in the series
+    if (statsSeries_->isRunning())
+        return true;
+
+    return (QDateTime::currentMSecsSinceEpoch() - statsRequestTime_)
+                < kStatsActiveTimeout*1000;
 }
 
 void AbstractPort::stats(PortStats *stats)
@@ -662,6 +1297,8 @@ void AbstractPort::stats(PortStats *stats)
 
 void AbstractPort::streamStats(uint guid, OstProto::StreamStatsList *stats)
 {
+    QMutexLocker locker(&streamStatsLock_);
+
     if (streamStats_.contains(guid))
     {
         StreamStatsTuple sst = streamStats_.value(guid);
@@ -681,6 +1318,7 @@ void AbstractPort::streamStatsAll(OstProto::StreamStatsList *stats)
 {
     // FIXME: change input param to a non-OstProto type and/or have
     // a getFirst/Next like API?
+    QMutexLocker locker(&streamStatsLock_);
     StreamStatsIterator i(streamStats_);
     while (i.hasNext())
     {
@@ -700,17 +1338,34 @@ void AbstractPort::streamStatsAll(OstProto::StreamStatsList *stats)
 
 void AbstractPort::resetStreamStats(uint guid)
 {
+    QMutexLocker locker(&streamStatsLock_);
+
     streamStats_.remove(guid);
 }
 
 void AbstractPort::resetStreamStatsAll()
 {
+    QMutexLocker locker(&streamStatsLock_);
+
     streamStats_.clear();
 }
 
+void AbstractPort::startStatsSeries()
+{
+    statsSeries_->start();
+}
+
+void AbstractPort::statsSeries(const OstProto::StatsSeriesQuery &query,
+                               OstProto::StatsSeries *series)
+{
+    series->mutable_port_id()->set_id(id());
+    statsSeries_->query(query, series);
+}
+
 void AbstractPort::clearDeviceNeighbors()
 {
     deviceManager_->clearDeviceNeighbors();
+    resolvedMacCache_.clear();
     isSendQueueDirty_ = true;
 }
 
@@ -728,24 +1383,34 @@ void AbstractPort::resolveDeviceNeighbors()
     // So, to get the behaviour we want, let's clear all unresolved neighbors
     // before calling resolve
     deviceManager_->clearDeviceNeighbors(Device::kUnresolvedNeighbors);
+    resolvedMacCache_.clear();
 
     // Resolve gateway for each device first ...
     deviceManager_->resolveDeviceGateways();
 
-    // ... then resolve neighbor for each unique frame of each stream
+    // ... then resolve neighbor for each unique L3 header of each stream
     // NOTE:
     // 1. All the frames may have the same destination ip,but may have
     // different source ip so may belong to a different emulated device;
     // so we cannot optimize and send only one ARP
     // 2. For a unidirectional stream, at egress, this will create ARP
     // entries on the DUT for each of the source addresses
-    //
-    // TODO(optimization): Identify if stream does not vary in srcIp or dstIp
-    // - in which case resolve for only one frame of the stream
+    // 3. Only the variable fields uptil the L3 header matter here, so
+    // we look at (typically a lot) fewer frames than frameVariableCount()
+    // which also accounts for frame length and L4/payload variations
+    // 4. The above only queues the ARP/NDP requests - duplicates (same
+    // device, same neighbor) are filtered out while queueing
+    // 5. Random header fields don't repeat, so for such streams we can
+    // only sample frames - we look at upto kMaxRandomResolveFrames of them
+    // (random values are drawn from the field's count, so a small set of
+    // destinations is covered well before that); neighbors seen only in
+    // later frames are not resolved
     for (int i = 0; i < streamList_.size(); i++)
     {
         const StreamBase *stream = streamList_.at(i);
-        int frameCount = stream->frameVariableCount();
+        int frameCount = stream->isFrameHeaderRandom(kMaxL3PktSize) ?
+                qMin(stream->frameCount(), int(kMaxRandomResolveFrames)) :
+                stream->frameHeaderVariableCount(kMaxL3PktSize);
 
         for (int j = 0; j < frameCount; j++) {
             // we need the packet contents only uptil the L3 header
@@ -756,33 +1421,106 @@ void AbstractPort::resolveDeviceNeighbors()
             }
         }
     }
+
+    // ... and finally start sending out the queued requests - these are
+    // sent in paced batches from the emulation transceiver thread, so we
+    // don't wait for them (with the port lock held) here
+    deviceManager_->sendQueuedNeighborRequests();
+
     isSendQueueDirty_ = true;
 }
 
 quint64 AbstractPort::deviceMacAddress(int streamId, int frameIndex)
 {
-    // we need the packet contents only uptil the L3 header
-    StreamBase *s = stream(streamId);
-    int pktLen = s->frameValue(pktBuf_, kMaxL3PktSize, frameIndex);
+    quint64 deviceMac, neighborMac;
 
-    if (pktLen) {
-        PacketBuffer pktBuf(pktBuf_, pktLen);
-        return deviceManager_->deviceMacAddress(&pktBuf);
-    }
+    if (resolveMacAddresses(streamId, frameIndex, &deviceMac, &neighborMac))
+        return deviceMac;
 
     return 0;
 }
 
 quint64 AbstractPort::neighborMacAddress(int streamId, int frameIndex)
 {
+    quint64 deviceMac, neighborMac;
+
+    if (resolveMacAddresses(streamId, frameIndex, &deviceMac, &neighborMac))
+        return neighborMac;
+
+    return 0;
+}
+
+// Find the device and neighbor mac addresses for the given frame of the
+// stream. Both of these depend only on the frame contents uptil the L3
+// header, so instead of rendering the frame for every lookup (the lookup
+// itself happens while rendering the frame!), we render it once per unique
+// L3 header and cache the results. The cache is discarded whenever the
+// stream contents or any device neighbors change
+bool AbstractPort::resolveMacAddresses(int streamId, int frameIndex,
+        quint64 *deviceMac, quint64 *neighborMac)
+{
+    quint32 generation = deviceManager_->neighborGeneration();
+    QHash<int, ResolvedMacList>::iterator iter;
+    int index = frameIndex;
+    StreamBase *s;
+
+    if (generation != resolvedMacCacheGeneration_) {
+        resolvedMacCache_.clear();
+        resolvedMacCacheGeneration_ = generation;
+    }
+
+    iter = resolvedMacCache_.find(streamId);
+    if (iter == resolvedMacCache_.end()) {
+        ResolvedMacList macList;
+
+        s = stream(streamId);
+        if (!s)
+            return false;
+
+        // Don't cache if the list is too large or the headers don't
+        // repeat (random fields) - just lookup every time
+        int count = s->frameHeaderVariableCount(kMaxL3PktSize);
+        if ((count <= kMaxResolvedMacListSize)
+                && !s->isFrameHeaderRandom(kMaxL3PktSize)) {
+            macList.deviceMac.resize(count);
+            macList.neighborMac.resize(count);
+            macList.isResolved.resize(count);
+        }
+        iter = resolvedMacCache_.insert(streamId, macList);
+    }
+
+    ResolvedMacList &macList = iter.value();
+    int size = macList.isResolved.size();
+
+    if (size) {
+        index = frameIndex % size;
+        if (macList.isResolved.testBit(index)) {
+            *deviceMac = macList.deviceMac.at(index);
+            *neighborMac = macList.neighborMac.at(index);
+            return true;
+        }
+    }
+
     // we need the packet contents only uptil the L3 header
-    StreamBase *s = stream(streamId);
-    int pktLen = s->frameValue(pktBuf_, kMaxL3PktSize, frameIndex);
+    s = stream(streamId);
+    if (!s)
+        return false;
 
-    if (pktLen) {
-        PacketBuffer pktBuf(pktBuf_, pktLen);
-        return deviceManager_->neighborMacAddress(&pktBuf);
+    int pktLen = s->frameValue(pktBuf_, kMaxL3PktSize, frameIndex);
+    if (!pktLen)
+        return false;
+
+    // DeviceManager may modify pktBuf, so use separate copies
+    PacketBuffer pktBuf1(pktBuf_, pktLen);
+    *deviceMac = deviceManager_->deviceMacAddress(&pktBuf1);
+    PacketBuffer pktBuf2(pktBuf_, pktLen);
+    *neighborMac = deviceManager_->neighborMacAddress(&pktBuf2);
+
+    if (size) {
+        macList.deviceMac[index] = *deviceMac;
+        macList.neighborMac[index] = *neighborMac;
+        macList.isResolved.setBit(index);
     }
 
-    return 0;
+    return true;
 }
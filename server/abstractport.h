@@ -22,15 +22,23 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "streamstats.h"
 
+#include <QBitArray>
+#include <QHash>
 #include <QList>
+#include <QMutex>
+#include <QString>
+#include <QVector>
 #include <QtGlobal>
 
 #include "../common/protocol.pb.h"
 
 class DeviceManager;
+class FrameCache;
+class FramePatchTable;
 class StreamBase;
 class PacketBuffer;
 class QIODevice;
+class StatsSeries;
 
 // TODO: send notification back to client(s)
 #define Xnotify qWarning
@@ -56,6 +64,16 @@ public:
         quint64    txBps;
     };
 
+    struct PacketListInfo
+    {
+        bool       isBuilding;
+        quint64    framesBuilt;
+        quint64    framesEstimate;
+        quint64    memoryUsed;      // bytes reserved for the packet list
+        quint64    memoryBudget;    // 0 means unlimited
+        QString    error;           // why the last build failed, if it did
+    };
+
     enum Accuracy
     {
         kHighAccuracy,
@@ -88,7 +106,7 @@ public:
     bool deleteStream(int streamId);
 
     bool isDirty() { return isSendQueueDirty_; }
-    void setDirty() { isSendQueueDirty_ = true; }
+    void setDirty() { isSendQueueDirty_ = true; resolvedMacCache_.clear(); }
 
     virtual bool setTrackStreamStats(bool enable);
 
@@ -102,7 +120,11 @@ public:
             int length) = 0;
     virtual void setPacketListLoopMode(bool loop, 
             quint64 secDelay, quint64 nsecDelay) = 0;
-    void updatePacketList();
+    virtual bool setPacketListPatches(FramePatchTable *patches);
+    bool updatePacketList();
+
+    void packetListInfo(PacketListInfo *info);
+    static void globalPacketListMemory(quint64 *used, quint64 *budget);
 
     virtual void startTransmit() = 0;
     virtual void stopTransmit() = 0;
@@ -116,15 +138,23 @@ public:
     void stats(PortStats *stats);
     void resetStats() { epochStats_ = stats_; }
 
+    void markStatsActive();
+    bool isStatsActive();
+
     // FIXME: combine single and All calls?
     void streamStats(uint guid, OstProto::StreamStatsList *stats);
     void streamStatsAll(OstProto::StreamStatsList *stats);
     void resetStreamStats(uint guid);
     void resetStreamStatsAll();
 
+    void startStatsSeries();
+    void statsSeries(const OstProto::StatsSeriesQuery &query,
+                     OstProto::StatsSeries *series);
+
     DeviceManager* deviceManager();
     virtual void startDeviceEmulation() = 0;
     virtual void stopDeviceEmulation() = 0;
+    virtual void updateDeviceEmulation() = 0;
     virtual int sendEmulationPacket(PacketBuffer *pktBuf) = 0;
 
     void clearDeviceNeighbors();
@@ -137,8 +167,12 @@ protected:
 
     void addNote(QString note);
 
-    void updatePacketListSequential();
-    void updatePacketListInterleaved();
+    bool updatePacketListSequential();
+    bool updatePacketListInterleaved();
+
+    bool reservePacketListMemory(quint64 bytes);
+    bool isPacketListMemoryAvailable(quint64 bytes);
+    void setPacketListProgress(quint64 framesBuilt);
 
     bool isUsable_;
     OstProto::Port          data_;
@@ -149,11 +183,25 @@ protected:
     quint64 maxStatsValue_;
     struct PortStats    stats_;
     StreamStats streamStats_;
+    QMutex streamStatsLock_; // for streamStats_ (updated by other threads)
     //! \todo Need lock for stats access/update
 
     DeviceManager *deviceManager_;
 
 private:
+    bool resolveMacAddresses(int streamId, int frameIndex,
+            quint64 *deviceMac, quint64 *neighborMac);
+
+    QByteArray frameCacheKey(const StreamBase *stream);
+    void removeFrameCache(uint streamId);
+    bool trimFrameCache(uint keepStreamId);
+    bool reserveFrameCacheMemory(quint64 bytes);
+    void releaseFrameCacheMemory(quint64 bytes);
+
+    quint64 packetListFrameEstimate();
+    void releasePacketListMemory();
+    static quint64 globalPacketListMemoryBudget();
+
     bool    isSendQueueDirty_;
 
     static const int kMaxPktSize = 16384;
@@ -165,11 +213,49 @@ private:
     // let's round it up to 80 bytes
     static const int kMaxL3PktSize = 80;
 
+    // Frames looked at to find the neighbors of a stream with random
+    // header fields (see resolveDeviceNeighbors())
+    static const int kMaxRandomResolveFrames = 1 << 16;
+
     /*! \note StreamBase::id() and index into streamList[] are NOT same! */
     QList<StreamBase*>  streamList_;
 
+    // Resolved device/neighbor mac addresses of a stream - one entry per
+    // unique L3 header i.e. indexed by frameIndex modulo the number of
+    // unique headers (see resolveMacAddresses())
+    struct ResolvedMacList {
+        QVector<quint64> deviceMac;
+        QVector<quint64> neighborMac;
+        QBitArray isResolved;
+    };
+    static const int kMaxResolvedMacListSize = 1 << 20;
+    QHash<int, ResolvedMacList> resolvedMacCache_; // Key: streamId
+    quint32 resolvedMacCacheGeneration_;
+
     struct PortStats    epochStats_;
 
+    // Samples stats_ and streamStats_ periodically
+    StatsSeries *statsSeries_;
+
+    // When (msecs since epoch) a client last asked for the stats
+    volatile qint64 statsRequestTime_;
+    static const int kStatsActiveTimeout = 30; // secs
+
+    // Rendered frames of the streams (Key: streamId) - see frameCacheKey()
+    // The cache is charged to the packet list memory budgets; its size is
+    // updated with packetListInfoLock_ and globalPacketListLock_ held
+    QHash<uint, FrameCache*> frameCache_;
+    quint64 frameCacheSize_;
+    quint64 maxFrameCacheSize_;
+
+    // Packet list info is read without the port lock (which is held while
+    // the packet list is built), so it has its own lock
+    QMutex packetListInfoLock_;
+    PacketListInfo packetListInfo_;
+
+    static QMutex globalPacketListLock_;
+    static quint64 globalPacketListMemory_; // reserved by all ports
+
 };
 
 #endif
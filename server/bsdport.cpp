@@ -21,6 +21,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #ifdef Q_OS_BSD4
 
+#include "statsseries.h"
+
 #include <QByteArray>
 #include <QHash>
 #include <QTime>
@@ -138,6 +140,8 @@ bool BsdPort::setExclusiveControl(bool /*exclusive*/)
 BsdPort::StatsMonitor::StatsMonitor()
     : QThread()
 {
+    placement_ = ThreadPlacement::forDevice();
+    refreshInterval_ = StatsSeries::counterRefreshInterval();
     stop_ = false;
     setupDone_ = false;
 }
@@ -155,6 +159,8 @@ void BsdPort::StatsMonitor::run()
     int count;
     struct ifreq ifr;
 
+    placement_->placeCurrentThread(ThreadPlacement::kStatsThread);
+
     //
     // We first setup stuff before we start polling for stats
     //
@@ -298,24 +304,24 @@ void BsdPort::StatsMonitor::run()
                     ((in_packets >= stats->rxPkts) ?
                          in_packets - stats->rxPkts :
                          in_packets + (kMaxValue32 - stats->rxPkts))
-                     / kRefreshFreq_;
+                     * 1000 / refreshInterval_;
                 stats->rxBps  = 
                     ((ifd->ifi_ibytes >= stats->rxBytes) ?
                          ifd->ifi_ibytes - stats->rxBytes :
                          ifd->ifi_ibytes + (kMaxValue32 - stats->rxBytes))
-                     / kRefreshFreq_;
+                     * 1000 / refreshInterval_;
                 stats->rxPkts  = in_packets;
                 stats->rxBytes = ifd->ifi_ibytes;
                 stats->txPps  = 
                     ((ifd->ifi_opackets >= stats->txPkts) ?
                          ifd->ifi_opackets - stats->txPkts :
                          ifd->ifi_opackets + (kMaxValue32 - stats->txPkts))
-                     / kRefreshFreq_;
+                     * 1000 / refreshInterval_;
                 stats->txBps  = 
                     ((ifd->ifi_obytes >= stats->txBytes) ?
                          ifd->ifi_obytes - stats->txBytes :
                          ifd->ifi_obytes + (kMaxValue32 - stats->txBytes))
-                     / kRefreshFreq_;
+                     * 1000 / refreshInterval_;
                 stats->txPkts  = ifd->ifi_opackets;
                 stats->txBytes = ifd->ifi_obytes;
 
@@ -326,7 +332,7 @@ _next:
             p += ifm->ifm_msglen;
         }
 _try_later:
-        QThread::sleep(kRefreshFreq_);
+        QThread::msleep(refreshInterval_);
     }
 
     portStats.clear();
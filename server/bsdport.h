@@ -46,7 +46,8 @@ protected:
         void stop();
         bool waitForSetupFinished(int msecs = 10000);
     private:
-        static const int kRefreshFreq_ = 1; // in seconds
+        int refreshInterval_; // in msecs
+        const ThreadPlacement *placement_; // not port specific
         bool stop_;
         bool setupDone_;
     };
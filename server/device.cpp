@@ -24,6 +24,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "packetbuffer.h"
 
 #include <QHostAddress>
+#include <QList>
+#include <QReadLocker>
+#include <QWriteLocker>
 #include <qendian.h>
 
 const int kBaseHex = 16;
@@ -70,6 +73,9 @@ Device::Device(DeviceManager *deviceManager)
     hasIp4_ = false;
     hasIp6_ = false;
 
+    memset(&counters_, 0, sizeof(counters_));
+    neighborGeneration_ = 0;
+
     clearKey();
 }
 
@@ -149,6 +155,21 @@ void Device::getConfig(OstEmul::Device *deviceConfig)
         deviceConfig->mutable_ip6_default_gateway()->set_hi(ip6Gateway_.hi64());
         deviceConfig->mutable_ip6_default_gateway()->set_lo(ip6Gateway_.lo64());
     }
+
+    OstEmul::DeviceCounters *counters = deviceConfig->mutable_counters();
+    QReadLocker locker(deviceManager_->neighborLock());
+    counters->set_arp_request_rx(counters_.arpRequestRx);
+    counters->set_arp_reply_rx(counters_.arpReplyRx);
+    counters->set_arp_request_tx(counters_.arpRequestTx);
+    counters->set_arp_reply_tx(counters_.arpReplyTx);
+    counters->set_ndp_solicit_rx(counters_.ndpSolicitRx);
+    counters->set_ndp_advert_rx(counters_.ndpAdvertRx);
+    counters->set_ndp_solicit_tx(counters_.ndpSolicitTx);
+    counters->set_ndp_advert_tx(counters_.ndpAdvertTx);
+    counters->set_icmp4_echo_rx(counters_.icmp4EchoRx);
+    counters->set_icmp4_echo_reply_tx(counters_.icmp4EchoReplyTx);
+    counters->set_icmp6_echo_rx(counters_.icmp6EchoRx);
+    counters->set_icmp6_echo_reply_tx(counters_.icmp6EchoReplyTx);
 }
 
 QString Device::config()
@@ -265,19 +286,24 @@ void Device::transmitPacket(PacketBuffer *pktBuf)
     deviceManager_->transmitPacket(pktBuf);
 }
 
+// Gateway resolution requests are only queued here - these are sent out
+// (along with other neighbor requests) by the DeviceManager
 void Device::resolveGateway()
 {
     if (hasIp4_)
-        sendArpRequest(ip4Gateway_);
+        deviceManager_->queueNeighborRequest(this, false,
+                                             UInt128(0, ip4Gateway_));
 
     if (hasIp6_)
-        sendNeighborSolicit(ip6Gateway_);
+        deviceManager_->queueNeighborRequest(this, true, ip6Gateway_);
 }
 
 void Device::clearNeighbors(Device::NeighborSet set)
 {
-    QMutableHashIterator<quint32, quint64> arpIter(arpTable_);
-    QMutableHashIterator<UInt128, quint64> ndpIter(ndpTable_);
+    QWriteLocker locker(deviceManager_->neighborLock());
+    QMutableHashIterator<quint32, NeighborEntry> arpIter(arpTable_);
+    QMutableHashIterator<UInt128, NeighborEntry> ndpIter(ndpTable_);
+    int count = arpTable_.size() + ndpTable_.size();
 
     switch (set) {
     case kAllNeighbors:
@@ -288,22 +314,26 @@ void Device::clearNeighbors(Device::NeighborSet set)
     case kUnresolvedNeighbors:
         while (arpIter.hasNext()) {
             arpIter.next();
-            if (arpIter.value() == 0)
+            if (arpIter.value().mac == 0)
                 arpIter.remove();
         }
 
         while (ndpIter.hasNext()) {
             ndpIter.next();
-            if (ndpIter.value() == 0)
+            if (ndpIter.value().mac == 0)
                 ndpIter.remove();
         }
         break;
     default:
         Q_ASSERT(false); // Unreachable!
     }
+
+    if (count != (arpTable_.size() + ndpTable_.size()))
+        notifyNeighborChange();
 }
 
 // Resolve the Neighbor IP address for this to-be-transmitted pktBuf
+// The request is only queued (see resolveGateway())
 // We expect pktBuf to point to EthType on entry
 void Device::resolveNeighbor(PacketBuffer *pktBuf)
 {
@@ -316,12 +346,12 @@ void Device::resolveNeighbor(PacketBuffer *pktBuf)
     {
     case kEthTypeIp4: // IPv4
         if (hasIp4_)
-            sendArpRequest(pktBuf);
+            queueArpRequest(pktBuf);
         break;
 
     case kEthTypeIp6: // IPv6
         if (hasIp6_)
-            sendNeighborSolicit(pktBuf);
+            queueNeighborSolicit(pktBuf);
         break;
 
     default:
@@ -334,27 +364,165 @@ void Device::resolveNeighbor(PacketBuffer *pktBuf)
 // Append this device's neighbors to the list
 void Device::getNeighbors(OstEmul::DeviceNeighborList *neighbors)
 {
-    QList<quint32> ip4List = arpTable_.keys();
-    QList<UInt128> ip6List = ndpTable_.keys();
-    QList<quint64> macList;
-
-    macList = arpTable_.values();
-    Q_ASSERT(ip4List.size() == macList.size());
+    QReadLocker locker(deviceManager_->neighborLock());
+    QHash<quint32, NeighborEntry>::const_iterator arpIter;
+    QHash<UInt128, NeighborEntry>::const_iterator ndpIter;
 
-    for (int i = 0; i < ip4List.size(); i++) {
+    neighbors->mutable_arp()->Reserve(arpTable_.size());
+    for (arpIter = arpTable_.constBegin(); arpIter != arpTable_.constEnd();
+            arpIter++) {
         OstEmul::ArpEntry *arp = neighbors->add_arp();
-        arp->set_ip4(ip4List.at(i));
-        arp->set_mac(macList.at(i));
+        arp->set_ip4(arpIter.key());
+        arp->set_mac(arpIter.value().mac);
     }
 
-    macList = ndpTable_.values();
-    Q_ASSERT(ip6List.size() == macList.size());
-
-    for (int i = 0; i < ip6List.size(); i++) {
+    neighbors->mutable_ndp()->Reserve(ndpTable_.size());
+    for (ndpIter = ndpTable_.constBegin(); ndpIter != ndpTable_.constEnd();
+            ndpIter++) {
         OstEmul::NdpEntry *ndp = neighbors->add_ndp();
-        ndp->mutable_ip6()->set_hi(ip6List.at(i).hi64());
-        ndp->mutable_ip6()->set_lo(ip6List.at(i).lo64());
-        ndp->set_mac(macList.at(i));
+        ndp->mutable_ip6()->set_hi(ndpIter.key().hi64());
+        ndp->mutable_ip6()->set_lo(ndpIter.key().lo64());
+        ndp->set_mac(ndpIter.value().mac);
+    }
+}
+
+quint32 Device::neighborGeneration()
+{
+    return neighborGeneration_;
+}
+
+// Remove neighbor entries that have not been updated for agingTime secs
+// and send refresh requests for resolved entries older than refreshTime
+// secs - but not more than maxRefresh of them, the rest will be picked up
+// on the next call; returns the number of refresh requests sent
+int Device::refreshNeighbors(quint32 now, quint32 agingTime,
+                             quint32 refreshTime, int maxRefresh)
+{
+    QReadWriteLock *lock = deviceManager_->neighborLock();
+    QList<quint32> arpRefresh, arpFailed;
+    QList<UInt128> ndpRefresh, ndpFailed;
+    bool isChanged = false;
+    int count = 0;
+
+    // Age out entries and pick the ones to refresh under the lock ...
+    lock->lockForWrite();
+
+    QMutableHashIterator<quint32, NeighborEntry> arpIter(arpTable_);
+    while (arpIter.hasNext()) {
+        NeighborEntry &entry = arpIter.next().value();
+        quint32 age = now - entry.timestamp;
+
+        if (age >= agingTime) {
+            arpIter.remove();
+            isChanged = true;
+        }
+        else if ((entry.state == kReachable) && (age >= refreshTime)
+                && (count < maxRefresh)) {
+            arpRefresh.append(arpIter.key());
+            entry.state = kStale;
+            count++;
+        }
+    }
+
+    QMutableHashIterator<UInt128, NeighborEntry> ndpIter(ndpTable_);
+    while (ndpIter.hasNext()) {
+        NeighborEntry &entry = ndpIter.next().value();
+        quint32 age = now - entry.timestamp;
+
+        if (age >= agingTime) {
+            ndpIter.remove();
+            isChanged = true;
+        }
+        else if ((entry.state == kReachable) && (age >= refreshTime)
+                && (count < maxRefresh)) {
+            ndpRefresh.append(ndpIter.key());
+            entry.state = kStale;
+            count++;
+        }
+    }
+
+    if (isChanged)
+        notifyNeighborChange();
+
+    lock->unlock();
+
+    // ... but build and send the requests without it
+    for (int i = 0; i < arpRefresh.size(); i++) {
+        if (!transmitArpRequest(arpRefresh.at(i)))
+            arpFailed.append(arpRefresh.at(i));
+    }
+    for (int i = 0; i < ndpRefresh.size(); i++) {
+        if (!transmitNeighborSolicit(ndpRefresh.at(i)))
+            ndpFailed.append(ndpRefresh.at(i));
+    }
+
+    if (arpFailed.isEmpty() && ndpFailed.isEmpty())
+        return count;
+
+    // Not sent - retry on the next call, unless the entry has since been
+    // updated or removed
+    lock->lockForWrite();
+    for (int i = 0; i < arpFailed.size(); i++) {
+        QHash<quint32, NeighborEntry>::iterator iter =
+                arpTable_.find(arpFailed.at(i));
+        if ((iter != arpTable_.end()) && (iter->state == kStale))
+            iter->state = kReachable;
+    }
+    for (int i = 0; i < ndpFailed.size(); i++) {
+        QHash<UInt128, NeighborEntry>::iterator iter =
+                ndpTable_.find(ndpFailed.at(i));
+        if ((iter != ndpTable_.end()) && (iter->state == kStale))
+            iter->state = kReachable;
+    }
+    lock->unlock();
+
+    return count - arpFailed.size() - ndpFailed.size();
+}
+
+bool Device::isNeighborResolved(bool isIp6, UInt128 ip)
+{
+    if (isIp6)
+        return ndpMac(ip) != 0;
+
+    return arpMac(quint32(ip.lo64())) != 0;
+}
+
+// Send (or re-send) a ARP/NDP request for the given neighbor, unless
+// it is already resolved
+void Device::sendNeighborRequest(bool isIp6, UInt128 ip)
+{
+    QReadWriteLock *lock = deviceManager_->neighborLock();
+
+    if (isIp6) {
+        if (!hasIp6_)
+            return;
+
+        // Remove unresolved entry, if any, so that the request is resent
+        lock->lockForWrite();
+        if (ndpTable_.value(ip).mac) {
+            lock->unlock();
+            return;
+        }
+        ndpTable_.remove(ip);
+        lock->unlock();
+
+        sendNeighborSolicit(ip);
+    }
+    else {
+        quint32 ip4 = quint32(ip.lo64());
+
+        if (!hasIp4_)
+            return;
+
+        lock->lockForWrite();
+        if (arpTable_.value(ip4).mac) {
+            lock->unlock();
+            return;
+        }
+        arpTable_.remove(ip4);
+        lock->unlock();
+
+        sendArpRequest(ip4);
     }
 }
 
@@ -429,7 +597,7 @@ quint64 Device::neighborMac(const PacketBuffer *pktBuf)
         }
         tgtIp = ((dstIp & ip4Mask_) == ip4Subnet_) ? dstIp : ip4Gateway_;
 
-        return arpTable_.value(tgtIp);
+        return arpMac(tgtIp);
     }
     else if ((ethType == kEthTypeIp6) && hasIp6_) { // IPv6
         UInt128 dstIp, tgtIp;
@@ -448,7 +616,7 @@ quint64 Device::neighborMac(const PacketBuffer *pktBuf)
         }
         tgtIp = ((dstIp & ip6Mask_) == ip6Subnet_) ? dstIp : ip6Gateway_;
 
-        return ndpTable_.value(tgtIp);
+        return ndpMac(tgtIp);
     }
 
     return false;
@@ -522,7 +690,8 @@ void Device::receiveArp(PacketBuffer *pktBuf)
     switch (opCode)
     {
     case 1:  // ARP Request
-        arpTable_.insert(srcIp, srcMac);
+        countPacket(counters_.arpRequestRx);
+        updateArpEntry(srcIp, srcMac);
 
         rspPkt = new PacketBuffer;
         rspPkt->reserve(encapSize());
@@ -544,13 +713,15 @@ void Device::receiveArp(PacketBuffer *pktBuf)
 
         encap(rspPkt, srcMac, kEthTypeArp);
         transmitPacket(rspPkt);
+        countPacket(counters_.arpReplyTx);
 
         qDebug("Sent ARP Reply for srcIp/tgtIp=%s/%s",
                 qPrintable(QHostAddress(srcIp).toString()),
                 qPrintable(QHostAddress(tgtIp).toString()));
         break;
     case 2: // ARP Response
-        arpTable_.insert(srcIp, srcMac);
+        countPacket(counters_.arpReplyRx);
+        updateArpEntry(srcIp, srcMac);
         break;
 
     default:
@@ -564,9 +735,28 @@ _invalid_exit:
     return;
 }
 
-// Send ARP request for the IPv4 packet in pktBuf
+// Learn (or refresh) a resolved ARP entry - only a change in the mac
+// is notified, a refresh just restarts aging
+void Device::updateArpEntry(quint32 ip, quint64 mac)
+{
+    if (!mac)
+        return;
+
+    QWriteLocker locker(deviceManager_->neighborLock());
+    NeighborEntry &entry = arpTable_[ip];
+    bool isChanged = (entry.mac != mac);
+
+    entry.mac = mac;
+    entry.state = kReachable;
+    entry.timestamp = deviceManager_->neighborClock();
+
+    if (isChanged)
+        notifyNeighborChange();
+}
+
+// Queue ARP request for the IPv4 packet in pktBuf
 // pktBuf points to start of IP header
-void Device::sendArpRequest(PacketBuffer *pktBuf)
+void Device::queueArpRequest(PacketBuffer *pktBuf)
 {
     uchar *pktData = pktBuf->data();
     int ipHdrLen = (pktData[0] & 0x0F) << 2;
@@ -582,29 +772,43 @@ void Device::sendArpRequest(PacketBuffer *pktBuf)
 
     tgtIp = ((dstIp & ip4Mask_) == ip4Subnet_) ? dstIp : ip4Gateway_;
 
-    sendArpRequest(tgtIp);
-
+    deviceManager_->queueNeighborRequest(this, false, UInt128(0, tgtIp));
 }
 
 void Device::sendArpRequest(quint32 tgtIp)
 {
-    quint32 srcIp = ip4_;
-    PacketBuffer *reqPkt;
-    uchar *pktData;
+    QReadWriteLock *lock = deviceManager_->neighborLock();
+    bool isKnown;
 
     // Validate target IP
     if (!tgtIp)
         return;
 
-    // This function will be called once per unique stream - which
-    // may all have the same dst IP; even if dst IP are different the
-    // gateway for the different dst IP may all be same. However,
-    // we don't want to send duplicate ARP requests, so we check
+    // DeviceManager already de-duplicates the queued requests, but
+    // we still don't want to send duplicate ARP requests, so we check
     // if the tgtIP is already in the cache (resolved or unresolved)
-    // and if so, we don't resend it
-    if (arpTable_.contains(tgtIp))
+    // and if so, we don't resend it - callers that want to resend
+    // (see sendNeighborRequest()) remove the unresolved entry first
+    lock->lockForRead();
+    isKnown = arpTable_.contains(tgtIp);
+    lock->unlock();
+
+    if (isKnown || !transmitArpRequest(tgtIp))
         return;
 
+    lock->lockForWrite();
+    arpTable_.insert(tgtIp, NeighborEntry(0, deviceManager_->neighborClock()));
+    lock->unlock();
+    notifyNeighborChange();
+}
+
+// Build and send an ARP request for tgtIp without touching the ARP table
+bool Device::transmitArpRequest(quint32 tgtIp)
+{
+    quint32 srcIp = ip4_;
+    PacketBuffer *reqPkt;
+    uchar *pktData;
+
     reqPkt = new PacketBuffer;
     reqPkt->reserve(encapSize());
     pktData = reqPkt->put(28);
@@ -625,11 +829,13 @@ void Device::sendArpRequest(quint32 tgtIp)
 
     encap(reqPkt, kBcastMac, kEthTypeArp);
     transmitPacket(reqPkt);
-    arpTable_.insert(tgtIp, 0);
+    countPacket(counters_.arpRequestTx);
 
     qDebug("Sent ARP Request for srcIp/tgtIp=%s/%s",
             qPrintable(QHostAddress(srcIp).toString()),
             qPrintable(QHostAddress(tgtIp).toString()));
+
+    return true;
 }
 
 void Device::receiveIp4(PacketBuffer *pktBuf)
@@ -679,12 +885,13 @@ _invalid_exit:
 // ingress packet for egress; in other words, it assumes the
 // original IP header is intact and will just reuse it after
 // minimal modifications
-void Device::sendIp4Reply(PacketBuffer *pktBuf)
+bool Device::sendIp4Reply(PacketBuffer *pktBuf)
 {
     uchar *pktData = pktBuf->push(20);
     uchar origTtl = pktData[8];
     uchar ipProto = pktData[9];
     quint32 srcIp, dstIp, tgtIp;
+    quint64 dstMac;
     quint32 sum;
 
     // Swap src/dst IP addresses
@@ -693,10 +900,11 @@ void Device::sendIp4Reply(PacketBuffer *pktBuf)
 
     tgtIp = ((dstIp & ip4Mask_) == ip4Subnet_) ? dstIp : ip4Gateway_;
 
-    if (!arpTable_.contains(tgtIp)) {
+    dstMac = arpMac(tgtIp);
+    if (!dstMac) {
         qWarning("%s: mac not found for %s; unable to send IPv4 packet",
                 __FUNCTION__, qPrintable(QHostAddress(tgtIp).toString()));
-        return;
+        return false;
     }
 
     *(quint32*)(pktData + 12) = qToBigEndian(srcIp);
@@ -714,8 +922,10 @@ void Device::sendIp4Reply(PacketBuffer *pktBuf)
         sum = (sum & 0xFFFF) + (sum >> 16);
     *(quint16*)(pktData + 10) = qToBigEndian(quint16(~sum));
 
-    encap(pktBuf, arpTable_.value(tgtIp), kEthTypeIp4);
+    encap(pktBuf, dstMac, kEthTypeIp4);
     transmitPacket(pktBuf);
+
+    return true;
 }
 
 void Device::receiveIcmp4(PacketBuffer *pktBuf)
@@ -731,6 +941,7 @@ void Device::receiveIcmp4(PacketBuffer *pktBuf)
         return;
     }
 
+    countPacket(counters_.icmp4EchoRx);
     pktData[0] = 0; // Echo Reply
 
     // Incremental checksum update (RFC 1624 [Eqn.3])
@@ -742,8 +953,10 @@ void Device::receiveIcmp4(PacketBuffer *pktBuf)
         sum = (sum & 0xFFFF) + (sum >> 16);
     *(quint16*)(pktData + 2) = qToBigEndian(quint16(~sum));
 
-    sendIp4Reply(pktBuf);
-    qDebug("Sent ICMP Echo Reply");
+    if (sendIp4Reply(pktBuf)) {
+        countPacket(counters_.icmp4EchoReplyTx);
+        qDebug("Sent ICMP Echo Reply");
+    }
 }
 
 /*
@@ -811,7 +1024,7 @@ bool Device::sendIp6(PacketBuffer *pktBuf, UInt128 dstIp, quint8 protocol)
         dstMac = (quint64(0x3333) << 32) | (dstIp.lo64() & 0xffffffff);
     else {
         UInt128 tgtIp = ((dstIp & ip6Mask_) == ip6Subnet_)? dstIp : ip6Gateway_;
-        dstMac = ndpTable_.value(tgtIp);
+        dstMac = ndpMac(tgtIp);
     }
 
     if (!dstMac) {
@@ -844,21 +1057,23 @@ _error_exit:
 // ingress packet for egress; in other words, it assumes the
 // original IP header is intact and will just reuse it after
 // minimal modifications
-void Device::sendIp6Reply(PacketBuffer *pktBuf)
+bool Device::sendIp6Reply(PacketBuffer *pktBuf)
 {
     uchar *pktData = pktBuf->push(kIp6HdrLen);
     UInt128 srcIp, dstIp, tgtIp;
+    quint64 dstMac;
 
     // Swap src/dst IP addresses
     dstIp = qFromBigEndian<UInt128>(pktData +  8); // srcIp in original pkt
     srcIp = qFromBigEndian<UInt128>(pktData + 24); // dstIp in original pkt
 
     tgtIp = ((dstIp & ip6Mask_) == ip6Subnet_) ? dstIp : ip6Gateway_;
-    if (!ndpTable_.contains(tgtIp)) {
+    dstMac = ndpMac(tgtIp);
+    if (!dstMac) {
         qWarning("%s: mac not found for %s; unable to send IPv6 packet",
                 __FUNCTION__,
                 qPrintable(QHostAddress(tgtIp.toArray()).toString()));
-        return;
+        return false;
     }
 
     memcpy(pktData +  8, srcIp.toArray(), 16); // Source IP
@@ -867,8 +1082,10 @@ void Device::sendIp6Reply(PacketBuffer *pktBuf)
     // Reset TTL
     pktData[7] = 64;
 
-    encap(pktBuf, ndpTable_.value(tgtIp), kEthTypeIp6);
+    encap(pktBuf, dstMac, kEthTypeIp6);
     transmitPacket(pktBuf);
+
+    return true;
 }
 
 void Device::receiveIcmp6(PacketBuffer *pktBuf)
@@ -881,6 +1098,7 @@ void Device::receiveIcmp6(PacketBuffer *pktBuf)
 
     switch (type) {
         case 128: // ICMPv6 Echo Request
+            countPacket(counters_.icmp6EchoRx);
             pktData[0] = 129; // Echo Reply
 
             // Incremental checksum update (RFC 1624 [Eqn.3])
@@ -892,8 +1110,10 @@ void Device::receiveIcmp6(PacketBuffer *pktBuf)
                 sum = (sum & 0xFFFF) + (sum >> 16);
             *(quint16*)(pktData + 2) = qToBigEndian(quint16(~sum));
 
-            sendIp6Reply(pktBuf);
-            qDebug("Sent ICMPv6 Echo Reply");
+            if (sendIp6Reply(pktBuf)) {
+                countPacket(counters_.icmp6EchoReplyTx);
+                qDebug("Sent ICMPv6 Echo Reply");
+            }
             break;
 
         case 135: // Neigh Solicit
@@ -921,6 +1141,7 @@ void Device::receiveNdp(PacketBuffer *pktBuf)
     switch (type)
     {
         case 135: { // Neigh Solicit
+            countPacket(counters_.ndpSolicitRx);
             // TODO: Validation as per RFC 4861
             sendNeighborAdvertisement(pktBuf);
             break;
@@ -930,7 +1151,9 @@ void Device::receiveNdp(PacketBuffer *pktBuf)
             const quint8 kSFlag = 0x40;
             const quint8 kOFlag = 0x20;
             UInt128 tgtIp = qFromBigEndian<UInt128>(pktData + 8);
-            quint64 mac = ndpTable_.value(tgtIp);
+            quint64 mac = ndpMac(tgtIp);
+
+            countPacket(counters_.ndpAdvertRx);
 
             // Update NDP table only for solicited responses
             if (!(flags & kSFlag))
@@ -942,8 +1165,8 @@ void Device::receiveNdp(PacketBuffer *pktBuf)
                     goto _invalid_exit;
                 mac = qFromBigEndian<quint32>(pktData + 26);
                 mac = (mac << 16) | qFromBigEndian<quint16>(pktData + 30);
-                ndpTable_.insert(tgtIp, mac);
             }
+            updateNdpEntry(tgtIp, mac);
             break;
         }
     }
@@ -951,10 +1174,28 @@ _invalid_exit:
     return;
 }
 
-// Send NS for the IPv6 packet in pktBuf
+// Learn (or refresh) a resolved NDP entry (see updateArpEntry())
+void Device::updateNdpEntry(UInt128 ip, quint64 mac)
+{
+    if (!mac)
+        return;
+
+    QWriteLocker locker(deviceManager_->neighborLock());
+    NeighborEntry &entry = ndpTable_[ip];
+    bool isChanged = (entry.mac != mac);
+
+    entry.mac = mac;
+    entry.state = kReachable;
+    entry.timestamp = deviceManager_->neighborClock();
+
+    if (isChanged)
+        notifyNeighborChange();
+}
+
+// Queue NS for the IPv6 packet in pktBuf
 // caller is responsible to check that pktBuf originates from this device
 // pktBuf should point to start of IP header
-void Device::sendNeighborSolicit(PacketBuffer *pktBuf)
+void Device::queueNeighborSolicit(PacketBuffer *pktBuf)
 {
     uchar *pktData = pktBuf->data();
     UInt128 dstIp, tgtIp;
@@ -969,14 +1210,13 @@ void Device::sendNeighborSolicit(PacketBuffer *pktBuf)
 
     tgtIp = ((dstIp & ip6Mask_) == ip6Subnet_) ? dstIp : ip6Gateway_;
 
-    sendNeighborSolicit(tgtIp);
+    deviceManager_->queueNeighborRequest(this, true, tgtIp);
 }
 
 void Device::sendNeighborSolicit(UInt128 tgtIp)
 {
-    UInt128 dstIp, srcIp = ip6_;
-    PacketBuffer *reqPkt;
-    uchar *pktData;
+    QReadWriteLock *lock = deviceManager_->neighborLock();
+    bool isKnown;
 
     // Validate target IP
     if (tgtIp == UInt128(0, 0))
@@ -984,9 +1224,26 @@ void Device::sendNeighborSolicit(UInt128 tgtIp)
 
     // Do we already have a NDP entry (resolved or unresolved)?
     // If so, don't resend (see note in sendArpRequest())
-    if (ndpTable_.contains(tgtIp))
+    lock->lockForRead();
+    isKnown = ndpTable_.contains(tgtIp);
+    lock->unlock();
+
+    if (isKnown || !transmitNeighborSolicit(tgtIp))
         return;
 
+    lock->lockForWrite();
+    ndpTable_.insert(tgtIp, NeighborEntry(0, deviceManager_->neighborClock()));
+    lock->unlock();
+    notifyNeighborChange();
+}
+
+// Build and send a NS for tgtIp without touching the NDP table
+bool Device::transmitNeighborSolicit(UInt128 tgtIp)
+{
+    UInt128 dstIp, srcIp = ip6_;
+    PacketBuffer *reqPkt;
+    uchar *pktData;
+
     // Form the solicited node address to be used as dstIp
     // ff02::1:ffXX:XXXX/104
     dstIp = UInt128((quint64(0xff02) << 48),
@@ -1026,13 +1283,15 @@ void Device::sendNeighborSolicit(UInt128 tgtIp)
     }
 
     if (!sendIp6(reqPkt, dstIp , kIpProtoIcmp6))
-        return;
+        return false;
 
-    ndpTable_.insert(tgtIp, 0);
+    countPacket(counters_.ndpSolicitTx);
 
     qDebug("Sent NDP Request for srcIp/tgtIp=%s/%s",
             qPrintable(QHostAddress(srcIp.toArray()).toString()),
             qPrintable(QHostAddress(tgtIp.toArray()).toString()));
+
+    return true;
 }
 
 // Send NA for the NS packet in pktBuf
@@ -1068,7 +1327,7 @@ void Device::sendNeighborAdvertisement(PacketBuffer *pktBuf)
             quint64 mac;
             mac = qFromBigEndian<quint32>(pktData + 26);
             mac = (mac << 16) | qFromBigEndian<quint16>(pktData + 30);
-            ndpTable_.insert(srcIp, mac);
+            updateNdpEntry(srcIp, mac);
         }
     }
 
@@ -1108,11 +1367,43 @@ void Device::sendNeighborAdvertisement(PacketBuffer *pktBuf)
     if (!sendIp6(naPkt, srcIp , kIpProtoIcmp6))
         return;
 
+    countPacket(counters_.ndpAdvertTx);
     qDebug("Sent Neigh Advt to dstIp for tgtIp=%s/%s",
             qPrintable(QHostAddress(srcIp.toArray()).toString()),
             qPrintable(QHostAddress(tgtIp.toArray()).toString()));
 }
 
+// Record a change in this device's neighbor table - besides the
+// port-wide notification, this lets a delta export skip unchanged devices
+// Resolved mac of the neighbor, if any, else 0
+quint64 Device::arpMac(quint32 ip)
+{
+    QReadLocker locker(deviceManager_->neighborLock());
+
+    return arpTable_.value(ip).mac;
+}
+
+quint64 Device::ndpMac(UInt128 ip)
+{
+    QReadLocker locker(deviceManager_->neighborLock());
+
+    return ndpTable_.value(ip).mac;
+}
+
+// Counters are updated from the emulation thread and read from the RPC
+// thread, so they are accessed under the neighbor lock - callers must not
+// hold it already
+void Device::countPacket(quint64 &counter)
+{
+    QWriteLocker locker(deviceManager_->neighborLock());
+    counter++;
+}
+
+void Device::notifyNeighborChange()
+{
+    neighborGeneration_ = deviceManager_->notifyNeighborChange();
+}
+
 bool operator<(const DeviceKey &a1, const DeviceKey &a2)
 {
     int i = 0;
@@ -45,6 +45,12 @@ public:
         kUnresolvedNeighbors
     };
 
+    enum NeighborState {
+        kIncomplete,    // request sent, awaiting reply
+        kReachable,     // resolved
+        kStale          // resolved, refresh request sent before expiry
+    };
+
 public:
     Device(DeviceManager *deviceManager);
 
@@ -70,31 +76,46 @@ public:
     void clearNeighbors(Device::NeighborSet set);
     void resolveNeighbor(PacketBuffer *pktBuf);
     void getNeighbors(OstEmul::DeviceNeighborList *neighbors);
+    quint32 neighborGeneration();
+    int refreshNeighbors(quint32 now, quint32 agingTime, quint32 refreshTime,
+                         int maxRefresh);
+
+    bool isNeighborResolved(bool isIp6, UInt128 ip);
+    void sendNeighborRequest(bool isIp6, UInt128 ip);
 
     bool isOrigin(const PacketBuffer *pktBuf);
     quint64 neighborMac(const PacketBuffer *pktBuf);
 
 private: // methods
     void receiveArp(PacketBuffer *pktBuf);
-    void sendArpRequest(PacketBuffer *pktBuf);
+    void updateArpEntry(quint32 ip, quint64 mac);
+    void queueArpRequest(PacketBuffer *pktBuf);
     void sendArpRequest(quint32 tgtIp);
+    bool transmitArpRequest(quint32 tgtIp);
 
     void receiveIp4(PacketBuffer *pktBuf);
-    void sendIp4Reply(PacketBuffer *pktBuf);
+    bool sendIp4Reply(PacketBuffer *pktBuf);
 
     void receiveIcmp4(PacketBuffer *pktBuf);
 
     void receiveIp6(PacketBuffer *pktBuf);
     bool sendIp6(PacketBuffer *pktBuf, UInt128 dstIp, quint8 protocol);
-    void sendIp6Reply(PacketBuffer *pktBuf);
+    bool sendIp6Reply(PacketBuffer *pktBuf);
 
     void receiveIcmp6(PacketBuffer *pktBuf);
 
     void receiveNdp(PacketBuffer *pktBuf);
-    void sendNeighborSolicit(PacketBuffer *pktBuf);
+    void updateNdpEntry(UInt128 ip, quint64 mac);
+    void queueNeighborSolicit(PacketBuffer *pktBuf);
     void sendNeighborSolicit(UInt128 tgtIp);
+    bool transmitNeighborSolicit(UInt128 tgtIp);
     void sendNeighborAdvertisement(PacketBuffer *pktBuf);
 
+    quint64 arpMac(quint32 ip);
+    quint64 ndpMac(UInt128 ip);
+    void countPacket(quint64 &counter);
+    void notifyNeighborChange();
+
 private: // data
     static const int kMaxVlan = 4;
 
@@ -120,8 +141,43 @@ private: // data
 
     DeviceKey key_;
 
-    QHash<quint32, quint64> arpTable_;
-    QHash<UInt128, quint64> ndpTable_;
+    // Protocol packet counters - access only under
+    // DeviceManager::neighborLock() (see countPacket())
+    struct {
+        quint64 arpRequestRx;
+        quint64 arpReplyRx;
+        quint64 arpRequestTx;
+        quint64 arpReplyTx;
+
+        quint64 ndpSolicitRx;
+        quint64 ndpAdvertRx;
+        quint64 ndpSolicitTx;
+        quint64 ndpAdvertTx;
+
+        quint64 icmp4EchoRx;
+        quint64 icmp4EchoReplyTx;
+        quint64 icmp6EchoRx;
+        quint64 icmp6EchoReplyTx;
+    } counters_;
+
+    // Neighbor table entry - kept compact as there may be a large number
+    // of devices with a few neighbors each; mac is 0 till resolved
+    struct NeighborEntry {
+        NeighborEntry(quint64 m = 0, quint32 t = 0)
+            : mac(m), state(m ? kReachable : kIncomplete), timestamp(t) {}
+
+        quint64 mac : 48;
+        quint64 state : 2;
+        quint32 timestamp; // secs, as per DeviceManager::neighborClock()
+    };
+
+    // Access only under DeviceManager::neighborLock()
+    QHash<quint32, NeighborEntry> arpTable_;
+    QHash<UInt128, NeighborEntry> ndpTable_;
+
+    // Neighbor generation (see DeviceManager) when this device's
+    // neighbor table was last modified
+    quint32 neighborGeneration_;
 };
 
 bool operator<(const DeviceKey &a1, const DeviceKey &a2);
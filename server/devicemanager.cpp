@@ -25,8 +25,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "packetbuffer.h"
 
 #include "../common/emulproto.pb.h"
+#include "settings.h"
 
+#include <QMutex>
 #include <qendian.h>
+#include <limits.h>
 
 const quint64 kBcastMac = 0xffffffffffffULL;
 
@@ -46,7 +49,45 @@ inline bool isMacMcast(quint64 mac)
 
 DeviceManager::DeviceManager(AbstractPort *parent)
 {
+    int batchSize = appSettings->value(kNeighborResolveBatchSizeKey,
+                        kNeighborResolveBatchSizeDefaultValue).toInt();
+    int batchInterval = appSettings->value(kNeighborResolveBatchIntervalKey,
+                        kNeighborResolveBatchIntervalDefaultValue).toInt();
+    int agingTime = appSettings->value(kNeighborResolveAgingTimeKey,
+                        kNeighborResolveAgingTimeDefaultValue).toInt();
+    int refreshAhead = appSettings->value(kNeighborResolveRefreshAheadKey,
+                        kNeighborResolveRefreshAheadDefaultValue).toInt();
+
+    resolveBatchSize_ = batchSize;
+    resolveBatchInterval_ = qMax(batchInterval, 0);
+    resolveRetries_ = qMax(appSettings->value(kNeighborResolveRetriesKey,
+                        kNeighborResolveRetriesDefaultValue).toInt(), 0);
+    resolveTimeout_ = qMax(appSettings->value(kNeighborResolveTimeoutKey,
+                        kNeighborResolveTimeoutDefaultValue).toInt(), 0);
+    resolveTotal_ = 0;
+    resolveAttempt_ = 0;
+    resolveNextIndex_ = 0;
+    resolveNextTime_ = 0;
+
     port_ = parent;
+    neighborGeneration_.store(0);
+    deviceListGeneration_ = 0;
+
+    // Settings are read here once as refresh is done from another thread
+    neighborAgingTime_ = qMax(agingTime, 0);
+    if ((refreshAhead > 0) && (refreshAhead < agingTime))
+        neighborRefreshTime_ = agingTime - refreshAhead;
+    else
+        neighborRefreshTime_ = neighborAgingTime_/2;
+
+    // Pace refresh requests same as resolve requests (per sec)
+    if ((batchSize > 0) && (batchInterval > 0))
+        maxNeighborRefresh_ = qMax(batchSize*1000/batchInterval, batchSize);
+    else
+        maxNeighborRefresh_ = INT_MAX;
+
+    lastNeighborRefresh_ = 0;
+    neighborClock_.start();
 }
 
 DeviceManager::~DeviceManager()
@@ -100,6 +141,9 @@ bool DeviceManager::addDeviceGroup(uint deviceGroupId)
     if ((deviceCount() == 1) && port_)
         port_->startDeviceEmulation();
 
+    if (port_)
+        port_->updateDeviceEmulation();
+
     return true;
 }
 
@@ -120,6 +164,9 @@ bool DeviceManager::deleteDeviceGroup(uint deviceGroupId)
     if ((deviceCount() == 0) && port_)
         port_->stopDeviceEmulation();
 
+    if (port_)
+        port_->updateDeviceEmulation();
+
     return true;
 }
 
@@ -147,6 +194,9 @@ bool DeviceManager::modifyDeviceGroup(const OstProto::DeviceGroup *deviceGroup)
 
     enumerateDevices(myDeviceGroup, kAdd);
 
+    if (port_)
+        port_->updateDeviceEmulation();
+
     return true;
 }
 
@@ -165,6 +215,27 @@ void DeviceManager::getDeviceList(
     }
 }
 
+// List of TPIDs used by all the devices
+QList<quint16> DeviceManager::tpidList()
+{
+    return tpidList_.keys();
+}
+
+// Max number of vlan tags used by any device
+int DeviceManager::vlanDepth()
+{
+    int depth = 0;
+
+    foreach(OstProto::DeviceGroup *devGrp, deviceGroupList_) {
+        int numTags = devGrp->encap().GetExtension(OstEmul::vlan)
+                                        .stack_size();
+        if (numTags > depth)
+            depth = numTags;
+    }
+
+    return depth;
+}
+
 void DeviceManager::receivePacket(PacketBuffer *pktBuf)
 {
     uchar *pktData = pktBuf->data();
@@ -257,23 +328,94 @@ void DeviceManager::resolveDeviceGateways()
 
 void DeviceManager::clearDeviceNeighbors(Device::NeighborSet set)
 {
+    QMutexLocker locker(&refreshLock_);
+
     foreach(Device *device, deviceList_)
         device->clearNeighbors(set);
+
+    if (set == Device::kAllNeighbors)
+        notifyNeighborChange();
 }
 
+// Append neighbors of (upto) count devices starting at startIndex - a
+// negative count means all devices; for a delta, only devices with
+// neighbor changes after sinceGeneration are appended
 void DeviceManager::getDeviceNeighbors(
-        OstProto::PortNeighborList *neighborList)
+        OstProto::PortNeighborList *neighborList,
+        int startIndex, int count,
+        bool isDelta, quint32 sinceGeneration)
 {
-    int count = 0;
+    // Take the generation before we start so that any change while we
+    // are building the list is (re)sent on the next delta
+    quint32 generation = neighborGeneration();
+    QMap<DeviceKey, Device*>::const_iterator iter;
+    int index = 0;
+
+    if (isDelta && (qint32(sinceGeneration - deviceListGeneration_) < 0))
+        isDelta = false;
+
+    neighborList->set_generation(generation);
+    neighborList->set_is_delta(isDelta);
+    neighborList->set_device_count(sortedDeviceList_.size());
+
+    refreshLock_.lock();
+    neighborList->set_is_resolving(!resolvePending_.isEmpty());
+    neighborList->set_resolve_total(resolveTotal_);
+    neighborList->set_resolve_pending(resolvePending_.size());
+    refreshLock_.unlock();
+
+    if (count < 0)
+        count = sortedDeviceList_.size();
+
+    for (iter = sortedDeviceList_.constBegin();
+            (iter != sortedDeviceList_.constEnd()) && count;
+            iter++, index++) {
+        Device *device = iter.value();
+
+        if (index < startIndex)
+            continue;
+        count--;
+
+        if (isDelta
+                && (qint32(device->neighborGeneration() - sinceGeneration) <= 0))
+            continue;
 
-    foreach(Device *device, sortedDeviceList_) {
         OstEmul::DeviceNeighborList *neighList =
             neighborList->AddExtension(OstEmul::device_neighbor);
-        neighList->set_device_index(count++);
+        neighList->set_device_index(index);
         device->getNeighbors(neighList);
     }
 }
 
+// Age out stale neighbors and refresh the ones about to expire - this is
+// called periodically from the emulation transceiver thread (so that
+// refresh requests and replies are handled by the same thread), but does
+// actual work only once a sec
+void DeviceManager::refreshDeviceNeighbors()
+{
+    quint32 now = neighborClock();
+    int budget = maxNeighborRefresh_;
+
+    if (!neighborAgingTime_ || (now == lastNeighborRefresh_))
+        return;
+
+    // Skip this round if the device list is being changed
+    if (!refreshLock_.tryLock())
+        return;
+
+    lastNeighborRefresh_ = now;
+    foreach(Device *device, deviceList_) {
+        budget -= device->refreshNeighbors(now, neighborAgingTime_,
+                                           neighborRefreshTime_, budget);
+    }
+
+    refreshLock_.unlock();
+
+    if (budget < maxNeighborRefresh_)
+        qDebug("%s: port %s: sent %d refresh requests", __FUNCTION__,
+                port_->name(), maxNeighborRefresh_ - budget);
+}
+
 void DeviceManager::resolveDeviceNeighbor(PacketBuffer *pktBuf)
 {
     Device *device = originDevice(pktBuf);
@@ -282,6 +424,125 @@ void DeviceManager::resolveDeviceNeighbor(PacketBuffer *pktBuf)
         device->resolveNeighbor(pktBuf);
 }
 
+// Queue a ARP/NDP request for the given neighbor of device - requests are
+// sent out only when sendQueuedNeighborRequests() is called
+void DeviceManager::queueNeighborRequest(Device *device, bool isIp6,
+                                         UInt128 ip)
+{
+    NeighborRequest request;
+    QByteArray key;
+
+    // Validate target IP
+    if (ip == UInt128(0, 0))
+        return;
+
+    if (device->isNeighborResolved(isIp6, ip))
+        return;
+
+    key = device->key();
+    key.append(char(isIp6));
+    key.append((const char*)ip.toArray(), 16);
+
+    if (neighborRequestKeys_.contains(key))
+        return;
+    neighborRequestKeys_.insert(key);
+
+    request.device = device;
+    request.isIp6 = isIp6;
+    request.ip = ip;
+    neighborRequestQueue_.append(request);
+}
+
+// Start resolving the queued ARP/NDP requests - replaces the requests of
+// any previous resolve still in progress; the requests are actually sent
+// (paced) from the emulation transceiver thread, see
+// processNeighborRequests(), so that we don't block the caller
+void DeviceManager::sendQueuedNeighborRequests()
+{
+    QMutexLocker locker(&refreshLock_);
+
+    resolvePending_ = neighborRequestQueue_;
+    resolveTotal_ = resolvePending_.size();
+    resolveAttempt_ = 0;
+    resolveNextIndex_ = 0;
+    resolveNextTime_ = neighborClock_.elapsed();
+
+    neighborRequestQueue_.clear();
+    neighborRequestKeys_.clear();
+}
+
+// Send the pending ARP/NDP requests in batches of resolveBatchSize_, a
+// batch every resolveBatchInterval_ msecs; requests that remain
+// unresolved after resolveTimeout_ msecs (doubled on every retry) are
+// retried upto resolveRetries_ times - this is called periodically from
+// the emulation transceiver thread
+void DeviceManager::processNeighborRequests()
+{
+    qint64 now = neighborClock_.elapsed();
+    int count;
+
+    if (now < resolveNextTime_)
+        return;
+
+    // Skip this round if the device list is being changed
+    if (!refreshLock_.tryLock())
+        return;
+
+    if (resolvePending_.isEmpty())
+        goto _exit;
+
+    // Send the next batch of this attempt ...
+    if (resolveNextIndex_ < resolvePending_.size()) {
+        count = resolvePending_.size() - resolveNextIndex_;
+        if (resolveBatchSize_ > 0)
+            count = qMin(count, resolveBatchSize_);
+
+        for (int i = resolveNextIndex_; i < resolveNextIndex_ + count; i++) {
+            const NeighborRequest &request = resolvePending_.at(i);
+            request.device->sendNeighborRequest(request.isIp6, request.ip);
+        }
+        resolveNextIndex_ += count;
+
+        if (resolveNextIndex_ < resolvePending_.size())
+            resolveNextTime_ = now + resolveBatchInterval_;
+        else
+            resolveNextTime_ = now + (qint64(resolveTimeout_)
+                                        << resolveAttempt_);
+        goto _exit;
+    }
+
+    // ... or, once the replies are due, drop the resolved ones and retry
+    // the rest
+    {
+        QMutableListIterator<NeighborRequest> iter(resolvePending_);
+        while (iter.hasNext()) {
+            const NeighborRequest &request = iter.next();
+            if (request.device->isNeighborResolved(request.isIp6,
+                                                   request.ip))
+                iter.remove();
+        }
+    }
+
+    qDebug("%s: port %s attempt %d: %d/%d neighbors resolved",
+            __FUNCTION__, port_->name(), resolveAttempt_ + 1,
+            resolveTotal_ - resolvePending_.size(), resolveTotal_);
+
+    if (resolveAttempt_ >= resolveRetries_) {
+        if (!resolvePending_.isEmpty())
+            qWarning("port %s: %d/%d neighbors could not be resolved",
+                    port_->name(), resolvePending_.size(), resolveTotal_);
+        resolvePending_.clear();
+        goto _exit;
+    }
+
+    resolveAttempt_++;
+    resolveNextIndex_ = 0;
+    resolveNextTime_ = now;
+
+_exit:
+    refreshLock_.unlock();
+}
+
 quint64 DeviceManager::deviceMacAddress(PacketBuffer *pktBuf)
 {
     Device *device = originDevice(pktBuf);
@@ -296,6 +557,28 @@ quint64 DeviceManager::neighborMacAddress(PacketBuffer *pktBuf)
     return device ? device->neighborMac(pktBuf) : 0;
 }
 
+quint32 DeviceManager::neighborGeneration()
+{
+    return quint32(neighborGeneration_.loadAcquire());
+}
+
+// NOTE: may be called from the emulation receive thread as well
+quint32 DeviceManager::notifyNeighborChange()
+{
+    return quint32(neighborGeneration_.fetchAndAddOrdered(1)) + 1;
+}
+
+// Secs since the DeviceManager was created - used to timestamp neighbors
+quint32 DeviceManager::neighborClock()
+{
+    return quint32(neighborClock_.elapsed()/1000);
+}
+
+QReadWriteLock* DeviceManager::neighborLock()
+{
+    return &neighborLock_;
+}
+
 // ------------------------------------ //
 // Private Methods
 // ------------------------------------ //
@@ -342,10 +625,24 @@ _eth_type:
     return NULL;
 }
 
+// Drop the pending ARP/NDP requests of device - called with refreshLock_
+// held, before the device is deleted
+void DeviceManager::removeNeighborRequests(Device *device)
+{
+    QMutableListIterator<NeighborRequest> iter(resolvePending_);
+
+    while (iter.hasNext()) {
+        if (iter.next().device == device)
+            iter.remove();
+    }
+    resolveNextIndex_ = qMin(resolveNextIndex_, resolvePending_.size());
+}
+
 void DeviceManager::enumerateDevices(
     const OstProto::DeviceGroup *deviceGroup,
     Operation oper)
 {
+    QMutexLocker locker(&refreshLock_);
     Device dk(this);
     OstEmul::VlanEmulation pbVlan = deviceGroup->encap()
                                         .GetExtension(OstEmul::vlan);
@@ -420,6 +717,10 @@ void DeviceManager::enumerateDevices(
         }
     }
 
+    // Devices are used for mac resolution, so this is as good as a change
+    // in neighbors
+    deviceListGeneration_ = notifyNeighborChange();
+
     QHash<quint16, uint>::const_iterator iter = tpidList_.constBegin();
     qDebug("Port %s TPID List:", port_->name());
     while (iter != tpidList_.constEnd()) {
@@ -476,6 +777,7 @@ void DeviceManager::enumerateDevices(
                         break;
                     }
                     qDebug("enumerate(del): %s", qPrintable(device->config()));
+                    removeNeighborRequests(device);
                     delete device;
                     sortedDeviceList_.take(dk.key()); // already freed above
 
@@ -22,9 +22,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "device.h"
 
+#include <QAtomicInt>
+#include <QElapsedTimer>
 #include <QHash>
 #include <QMap>
 #include <QMultiHash>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QSet>
 #include <QtGlobal>
 
 class AbstractPort;
@@ -50,6 +55,9 @@ public:
     int deviceCount();
     void getDeviceList(OstProto::PortDeviceList *deviceList);
 
+    QList<quint16> tpidList();
+    int vlanDepth();
+
     void receivePacket(PacketBuffer *pktBuf);
     void transmitPacket(PacketBuffer *pktBuf);
 
@@ -57,15 +65,34 @@ public:
 
     void clearDeviceNeighbors(Device::NeighborSet set = Device::kAllNeighbors);
     void resolveDeviceNeighbor(PacketBuffer *pktBuf);
-    void getDeviceNeighbors(OstProto::PortNeighborList *neighborList);
+    void getDeviceNeighbors(OstProto::PortNeighborList *neighborList,
+            int startIndex = 0, int count = -1,
+            bool isDelta = false, quint32 sinceGeneration = 0);
+    void refreshDeviceNeighbors();
+
+    void queueNeighborRequest(Device *device, bool isIp6, UInt128 ip);
+    void sendQueuedNeighborRequests();
+    void processNeighborRequests();
 
     quint64 deviceMacAddress(PacketBuffer *pktBuf);
     quint64 neighborMacAddress(PacketBuffer *pktBuf);
 
+    quint32 neighborGeneration();
+    quint32 notifyNeighborChange();
+    quint32 neighborClock();
+    QReadWriteLock* neighborLock();
+
 private:
     enum Operation { kAdd, kDelete };
 
+    struct NeighborRequest {
+        Device *device;
+        bool isIp6;
+        UInt128 ip;
+    };
+
     Device* originDevice(PacketBuffer *pktBuf);
+    void removeNeighborRequests(Device *device);
     void enumerateDevices(
             const OstProto::DeviceGroup *deviceGroup,
             Operation oper);
@@ -76,6 +103,50 @@ private:
     QMap<DeviceKey, Device*> sortedDeviceList_; // sorted access to devices
     QMultiHash<DeviceKey, Device*> bcastList_;
     QHash<quint16, uint> tpidList_; // Key: TPID, Value: RefCount
+
+    // Incremented on any change in a resolved neighbor (or device) so that
+    // users can invalidate any neighbor information they have cached;
+    // changes come from the emulation, RPC and device threads
+    QAtomicInt neighborGeneration_;
+
+    // Neighbor generation when the device list was last changed - device
+    // indices change with the device list, so neighbor deltas since an
+    // older generation are not possible
+    quint32 deviceListGeneration_;
+
+    // Neighbor aging/refresh - timestamps are in secs since neighborClock_
+    // was started; refresh is done from the emulation transceiver thread,
+    // so changes to the device list or a clear are done under refreshLock_
+    QElapsedTimer neighborClock_;
+    quint32 neighborAgingTime_;
+    quint32 neighborRefreshTime_;
+    int maxNeighborRefresh_;
+    quint32 lastNeighborRefresh_;
+    QMutex refreshLock_;
+
+    // The neighbor tables of all devices are updated from the rx and
+    // emulation transceiver threads and read (for packet list builds)
+    // from RPC threads - so all neighbor table access is under this lock;
+    // one lock for all devices as there may be a large number of them
+    QReadWriteLock neighborLock_;
+
+    // Pending (not yet sent) ARP/NDP requests - neighborRequestKeys_ is used to
+    // avoid queueing the same (device, neighbor) more than once
+    QList<NeighborRequest> neighborRequestQueue_;
+    QSet<QByteArray> neighborRequestKeys_;
+
+    // Requests of the current resolve being sent out (paced) by
+    // processNeighborRequests() - under refreshLock_ as these refer to
+    // devices; times are in msecs as per neighborClock_
+    QList<NeighborRequest> resolvePending_;
+    int resolveTotal_;
+    int resolveAttempt_;
+    int resolveNextIndex_;
+    qint64 resolveNextTime_;
+    int resolveBatchSize_;
+    int resolveBatchInterval_;
+    int resolveRetries_;
+    int resolveTimeout_;
 };
 
 #endif
@@ -59,6 +59,7 @@ bool Drone::init()
     Q_ASSERT(rpcServer);
 
     qRegisterMetaType<SharedProtobufMessage>("SharedProtobufMessage");
+    qRegisterMetaType<QList<QObject*> >("QList<QObject*>");
 
     if (address.isNull()) {
         qWarning("Invalid RpcServer Address <%s> specified. Using 'Any'",
@@ -74,6 +75,12 @@ bool Drone::init()
 
     connect(service, SIGNAL(notification(int, SharedProtobufMessage)), 
             rpcServer, SIGNAL(notifyClients(int, SharedProtobufMessage)));
+    connect(service,
+            SIGNAL(notification(QList<QObject*>, int, SharedProtobufMessage,
+                                bool)),
+            rpcServer,
+            SIGNAL(notifyClients(QList<QObject*>, int, SharedProtobufMessage,
+                                 bool)));
 
     return true;
 }
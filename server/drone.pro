@@ -41,11 +41,15 @@ SOURCES += \
     drone.cpp \
     portmanager.cpp \
     abstractport.cpp \
+    framepatchtable.cpp \
     pcapport.cpp \
     pcaptransmitter.cpp \
     pcaprxstats.cpp \
     pcaptxstats.cpp \
     pcaptxthread.cpp \
+    sendqueuearena.cpp \
+    statsseries.cpp \
+    threadplacement.cpp \
     bsdport.cpp \
     linuxport.cpp \
     winpcapport.cpp 
@@ -0,0 +1,513 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "framepatchtable.h"
+
+#include "../common/abstractprotocol.h"
+#include "../common/protocollistiterator.h"
+#include "../common/prng.h"
+#include "../common/streambase.h"
+
+#include <qendian.h>
+#include <limits.h>
+#include <string.h>
+
+// Render buffer size - larger than the max frameLen()
+static const int kFrameBufferSize = 65536;
+
+// Patching costs some cpu per packet at transmit, so counters alone are
+// patched only if that saves building at least these many frames
+static const int kMinSavedFrameCount = 1024;
+
+// Number of fully rendered frames the table is verified against
+static const int kVerifyFrameCount = 128;
+
+// Ones' complement arithmetic is modulo 0xFFFF
+static const quint32 kCksumModulo = 0xFFFF;
+
+static inline quint32 cksumFold(quint32 sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
+static inline quint32 readValue(const uchar *p, int size)
+{
+    switch (size) {
+    case 1: return *p;
+    case 2: return qFromBigEndian<quint16>(p);
+    case 4: return qFromBigEndian<quint32>(p);
+    default: Q_ASSERT(false); // Unreachable!
+    }
+    return 0;
+}
+
+static inline void writeValue(uchar *p, int size, quint32 value)
+{
+    switch (size) {
+    case 1: *p = value; break;
+    case 2: qToBigEndian<quint16>(value, p); break;
+    case 4: qToBigEndian<quint32>(value, p); break;
+    default: Q_ASSERT(false); // Unreachable!
+    }
+}
+
+FramePatchTable::FramePatchTable()
+{
+    baseFrameCount_ = 1;
+}
+
+/*!
+ * Builds and returns the patch table for the stream or NULL if none of its
+ * variable fields can be patched at transmit time or if doing so isn't
+ * worth it (i.e. there are no random fields and not many fewer frames need
+ * to be built)
+ *
+ * The stream's variable fields are modified temporarily while building,
+ * but are restored before returning
+ */
+FramePatchTable* FramePatchTable::build(StreamBase *stream)
+{
+    FramePatchTable *table = new FramePatchTable;
+    ProtocolListIterator *iter;
+    QList<Cksum> cksumList;
+    QByteArray frame;
+    int frameCount = stream->frameVariableCount();
+    int minLen, len;
+    bool hasRandom = false;
+
+    // Resolved MACs depend on the (patched) L3 header
+    if (stream->isMacResolved())
+        goto _not_patchable;
+
+    minLen = (stream->lenMode() == StreamBase::e_fl_fixed ?
+                stream->frameLen() : stream->frameLenMin()) - kFcsSize;
+
+    // Find the checksums and the candidate fields - only user variable
+    // fields of top level protocols (so that the offset is known) - the
+    // guid of the signature protocol is used for stream stats, so it is
+    // left alone
+    iter = stream->createProtocolListIterator();
+    while (iter->hasNext()) {
+        AbstractProtocol *proto = iter->next();
+        int offset = stream->protocolFrameOffset(proto);
+
+        if (offset < 0)
+            continue;
+
+        for (int i = 0; i < proto->fieldCount(); i++) {
+            Cksum cksum;
+            int bitOffset;
+
+            if (!proto->fieldFlags(i).testFlag(AbstractProtocol::CksumField))
+                continue;
+
+            bitOffset = proto->fieldFrameBitOffset(i);
+            if ((bitOffset % 8) || (proto->fieldData(i,
+                        AbstractProtocol::FieldBitSize).toInt() != 16))
+                continue;
+
+            cksum.offset = offset + bitOffset/8;
+            cksum.parity = 0;
+            cksum.zeroIsOnes = (proto->protocolNumber()
+                                    == OstProto::Protocol::kUdpFieldNumber);
+            cksumList.append(cksum);
+        }
+
+        if (proto->protocolNumber() == OstProto::Protocol::kSignFieldNumber)
+            continue;
+
+        for (int i = 0; i < proto->variableFieldCount(); i++) {
+            const OstProto::VariableField &vf = proto->variableField(i);
+            Field field;
+
+            // A random field with count 1 is already random per frame,
+            // but only within the built frames
+            if ((vf.count() <= 1)
+                    && (vf.mode() != OstProto::VariableField::kRandom))
+                continue;
+
+            switch (vf.type()) {
+            case OstProto::VariableField::kCounter8: field.size = 1; break;
+            case OstProto::VariableField::kCounter16: field.size = 2; break;
+            case OstProto::VariableField::kCounter32: field.size = 4; break;
+            default: continue;
+            }
+
+            field.offset = offset + vf.offset();
+            if (field.offset + field.size > minLen)
+                continue;
+
+            field.mask = vf.mask();
+            field.value = vf.value();
+            field.step = vf.step();
+            field.count = vf.count();
+            field.isDecrement =
+                (vf.mode() == OstProto::VariableField::kDecrement);
+            field.isRandom = (vf.mode() == OstProto::VariableField::kRandom);
+            field.randomKey = proto->variableFieldRandomKey(i);
+
+            table->fieldList_.append(field);
+            table->protocolList_.append(proto);
+            table->variableFieldList_.append(i);
+        }
+    }
+    delete iter;
+
+    // Fields overlapping each other or a checksum are not independent
+    for (int i = table->fieldList_.size() - 1; i >= 0; i--) {
+        const Field &f1 = table->fieldList_.at(i);
+        bool overlaps = false;
+
+        for (int j = 0; j < table->fieldList_.size(); j++) {
+            const Field &f2 = table->fieldList_.at(j);
+            if ((i != j) && (f1.offset < f2.offset + f2.size)
+                    && (f2.offset < f1.offset + f1.size))
+                overlaps = true;
+        }
+        foreach(const Cksum &cksum, cksumList) {
+            if ((f1.offset < cksum.offset + 2)
+                    && (cksum.offset < f1.offset + f1.size))
+                overlaps = true;
+        }
+
+        if (overlaps) {
+            table->fieldList_.removeAt(i);
+            table->protocolList_.removeAt(i);
+            table->variableFieldList_.removeAt(i);
+        }
+    }
+
+    if (table->fieldList_.isEmpty())
+        goto _not_patchable;
+
+    // Random fields are worth patching even if the same number of frames
+    // are built - they don't repeat then
+    foreach(const Field &field, table->fieldList_)
+        hasRandom = hasRandom || field.isRandom;
+
+    // Finding the checksums and verifying needs frames to be rendered -
+    // skip that if patching all the candidates won't be worth it anyway
+    if (!hasRandom && (table->computeBaseFrameCount(stream)
+                            + kMinSavedFrameCount > frameCount))
+        goto _not_patchable;
+
+    frame.resize(kFrameBufferSize);
+    len = stream->frameValue((uchar*) frame.data(), frame.size(), 0);
+    for (int i = table->fieldList_.size() - 1; i >= 0; i--) {
+        if (!table->findCksums(stream, i, cksumList, frame, len)) {
+            table->fieldList_.removeAt(i);
+            table->protocolList_.removeAt(i);
+            table->variableFieldList_.removeAt(i);
+        }
+    }
+
+    if (table->fieldList_.isEmpty())
+        goto _not_patchable;
+
+    // The frames to be built are the ones without the patched fields
+    table->baseFrameCount_ = table->computeBaseFrameCount(stream);
+
+    table->protocolList_.clear();
+    table->variableFieldList_.clear();
+
+    hasRandom = false;
+    foreach(const Field &field, table->fieldList_)
+        hasRandom = hasRandom || field.isRandom;
+
+    if ((table->baseFrameCount_ + kMinSavedFrameCount > frameCount)
+            && !hasRandom)
+        goto _not_patchable;
+
+    // Frames beyond frameCount repeat, except for random fields
+    if (!table->verify(stream, hasRandom ? INT_MAX : frameCount)) {
+        qWarning("stream %u: patched frames don't match - not patching",
+                stream->id());
+        goto _not_patchable;
+    }
+
+    qDebug("stream %u: %d fields patched at transmit, frames %d -> %d",
+            stream->id(), table->fieldList_.size(), frameCount,
+            table->baseFrameCount_);
+    return table;
+
+_not_patchable:
+    delete table;
+    return NULL;
+}
+
+/*!
+ * Returns the number of unique frames of the stream without the fields of
+ * fieldList_ - valid only during build(); the stream's variable fields are
+ * modified temporarily for this
+ */
+int FramePatchTable::computeBaseFrameCount(StreamBase *stream)
+{
+    QList<OstProto::VariableField> savedList;
+    int count;
+
+    for (int i = 0; i < fieldList_.size(); i++) {
+        AbstractProtocol *proto = protocolList_.at(i);
+        int index = variableFieldList_.at(i);
+
+        savedList.append(proto->variableField(index));
+        proto->mutableVariableField(index)->set_count(1);
+    }
+
+    count = stream->frameVariableCount();
+
+    for (int i = 0; i < fieldList_.size(); i++) {
+        protocolList_.at(i)->mutableVariableField(
+                variableFieldList_.at(i))->CopyFrom(savedList.at(i));
+    }
+
+    return count;
+}
+
+//! Returns the number of unique frames to be built for the stream
+int FramePatchTable::baseFrameCount() const
+{
+    return baseFrameCount_;
+}
+
+//! Returns the number of fields patched at transmit time
+int FramePatchTable::fieldCount() const
+{
+    return fieldList_.size();
+}
+
+/*!
+ * Patches the frame - one of the built frames - to be the stream's frame
+ * at frameIndex, which can be beyond StreamBase::frameVariableCount()
+ */
+void FramePatchTable::apply(uchar *frame, int length,
+        quint64 frameIndex) const
+{
+    for (int i = 0; i < fieldList_.size(); i++) {
+        const Field &field = fieldList_.at(i);
+        quint32 x, oldValue, newValue, oldSum[2], newSum[2];
+
+        if (field.offset + field.size > length)
+            continue;
+
+        if (field.isRandom)
+            x = quint32(prng::value(field.randomKey, frameIndex));
+        else
+            x = quint32(frameIndex % field.count) * field.step;
+        oldValue = readValue(frame + field.offset, field.size);
+        newValue = (oldValue & ~field.mask)
+            | ((field.isDecrement ? field.value - x : field.value + x)
+                    & field.mask);
+        if (field.size < 4)
+            newValue &= (1U << (8*field.size)) - 1;
+
+        if (newValue == oldValue)
+            continue;
+
+        for (int p = 0; p < 2; p++)
+            oldSum[p] = byteSum(frame, field.offset, field.size, p);
+        writeValue(frame + field.offset, field.size, newValue);
+        for (int p = 0; p < 2; p++)
+            newSum[p] = byteSum(frame, field.offset, field.size, p);
+
+        // HC' = ~(~HC + ~m + m') - RFC 1624 Eqn. 3
+        for (int j = 0; j < field.cksumList.size(); j++) {
+            const Cksum &cksum = field.cksumList.at(j);
+            quint32 sum;
+
+            if (cksum.offset + 2 > length)
+                continue;
+
+            sum = quint16(~qFromBigEndian<quint16>(frame + cksum.offset));
+            sum += 0xFFFF - cksumFold(oldSum[cksum.parity]);
+            sum += cksumFold(newSum[cksum.parity]);
+            sum = quint16(~cksumFold(sum));
+            if ((sum == 0) && cksum.zeroIsOnes)
+                sum = 0xFFFF;
+
+            qToBigEndian<quint16>(sum, frame + cksum.offset);
+        }
+    }
+}
+
+//
+// Private methods
+//
+
+/*
+ * Finds the checksums affected by the field at index by changing its value
+ * and comparing the rendered frame with the original frame; returns false
+ * if anything other than the field and checksums changed or if the change
+ * in a checksum is not what a change in the field bytes would cause
+ *
+ * For each affected checksum, it also finds whether the field bytes are
+ * at even or odd positions w.r.t. the 16-bit checksum words
+ */
+bool FramePatchTable::findCksums(StreamBase *stream, int index,
+        const QList<Cksum> &cksumList, const QByteArray &frame, int length)
+{
+    Field &field = fieldList_[index];
+    AbstractProtocol *proto = protocolList_.at(index);
+    int vfIndex = variableFieldList_.at(index);
+    OstProto::VariableField saved = proto->variableField(vfIndex);
+    const uchar *frame0 = (const uchar*) frame.constData();
+    quint32 lsb = field.mask & (~field.mask + 1);
+    QByteArray buf(kFrameBufferSize, 0);
+    const uchar *frame1 = (const uchar*) buf.constData();
+    QList<int> parities;
+    QList<bool> isAffected;
+    bool isOk = true;
+
+    for (int i = 0; i < cksumList.size(); i++) {
+        parities.append(0x3); // bitmap of possible parities
+        isAffected.append(false);
+    }
+
+    if (!lsb)
+        return false;
+
+    // Two different changes - so that a checksum that is unaffected by
+    // one change by coincidence is still found
+    for (int n = 1; n <= 3; n += 2) {
+        int len;
+
+        proto->mutableVariableField(vfIndex)->set_value(
+                saved.value() + n*lsb);
+        len = stream->frameValue((uchar*) buf.data(), buf.size(), 0);
+        proto->mutableVariableField(vfIndex)->CopyFrom(saved);
+
+        if (len != length) {
+            isOk = false;
+            break;
+        }
+
+        for (int q = 0; q < length; q++) {
+            bool isExpected = false;
+
+            if (frame0[q] == frame1[q])
+                continue;
+
+            if ((q >= field.offset) && (q < field.offset + field.size))
+                continue;
+
+            for (int i = 0; i < cksumList.size(); i++) {
+                if ((q == cksumList.at(i).offset)
+                        || (q == cksumList.at(i).offset + 1)) {
+                    isAffected[i] = true;
+                    isExpected = true;
+                }
+            }
+
+            if (!isExpected) {
+                isOk = false;
+                break;
+            }
+        }
+        if (!isOk)
+            break;
+
+        // Change in a checksum (in ones' complement) should be the change
+        // in the field bytes (as per parity) - or zero if not affected
+        for (int i = 0; i < cksumList.size(); i++) {
+            int offset = cksumList.at(i).offset;
+            quint32 s0 = quint16(~qFromBigEndian<quint16>(frame0 + offset));
+            quint32 s1 = quint16(~qFromBigEndian<quint16>(frame1 + offset));
+            quint32 delta = (s1 % kCksumModulo + kCksumModulo
+                                - s0 % kCksumModulo) % kCksumModulo;
+
+            for (int p = 0; p < 2; p++) {
+                quint32 f0 = byteSum(frame0, field.offset, field.size, p);
+                quint32 f1 = byteSum(frame1, field.offset, field.size, p);
+                quint32 fieldDelta = (f1 % kCksumModulo + kCksumModulo
+                                        - f0 % kCksumModulo) % kCksumModulo;
+
+                if (fieldDelta != delta)
+                    parities[i] &= ~(1 << p);
+            }
+        }
+    }
+
+    if (!isOk)
+        return false;
+
+    for (int i = 0; i < cksumList.size(); i++) {
+        Cksum cksum = cksumList.at(i);
+
+        if (!isAffected.at(i))
+            continue;
+
+        if (!parities.at(i))
+            return false;
+
+        cksum.parity = (parities.at(i) & 0x1) ? 0 : 1;
+        field.cksumList.append(cksum);
+    }
+
+    return true;
+}
+
+/*
+ * Verifies that the patched frames are the same as the fully rendered ones
+ * for a sample of frames with index less than frameCount
+ */
+bool FramePatchTable::verify(const StreamBase *stream, int frameCount) const
+{
+    QByteArray buf1(kFrameBufferSize, 0), buf2(kFrameBufferSize, 0);
+    uchar *frame1 = (uchar*) buf1.data();
+    uchar *frame2 = (uchar*) buf2.data();
+
+    for (int k = 0; k < kVerifyFrameCount; k++) {
+        int frameIndex, len1, len2;
+
+        // Half right after the built frames, the rest spread across
+        if (k < kVerifyFrameCount/2)
+            frameIndex = (baseFrameCount_ + k) % frameCount;
+        else
+            frameIndex = int((quint64(frameCount) * k)/kVerifyFrameCount
+                                + k) % frameCount;
+
+        len1 = stream->frameValue(frame1, buf1.size(),
+                                  frameIndex % baseFrameCount_);
+        len2 = stream->frameValue(frame2, buf2.size(), frameIndex);
+        apply(frame1, len1, frameIndex);
+
+        if ((len1 != len2) || memcmp(frame1, frame2, len1)) {
+            qDebug("frame %d: patched frame mismatch", frameIndex);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Returns the (unfolded) ones' complement sum of the bytes at offset - with
+ * parity 0, bytes at even offsets are the MSB of a 16-bit word
+ */
+quint32 FramePatchTable::byteSum(const uchar *frame, int offset, int size,
+        int parity)
+{
+    quint32 sum = 0;
+
+    for (int q = offset; q < offset + size; q++)
+        sum += ((q + parity) & 0x1) ? frame[q] : (frame[q] << 8);
+
+    return sum;
+}
@@ -0,0 +1,111 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SERVER_FRAME_PATCH_TABLE_H
+#define _SERVER_FRAME_PATCH_TABLE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QtGlobal>
+
+class AbstractProtocol;
+class StreamBase;
+
+/*!
+ * Variable fields of a stream that are patched into its frames at
+ * transmit time
+ *
+ * A stream's frames repeat every StreamBase::frameVariableCount() frames
+ * which is the LCM of the counts of all its variable fields - so two
+ * variable fields with counts 1000 and 1001 need 1001000 unique frames
+ * to be built. Instead, the variable fields that cycle independently are
+ * taken out and patched into each frame just before it is sent, so only
+ * baseFrameCount() frames (the LCM of the remaining counts) need to be
+ * built; the value of a patched field is a function of frameIndex modulo
+ * its count - or, for random fields, a prng function of frameIndex.
+ * The frames on the wire are exactly the same as before, except that
+ * patched random fields don't repeat every frameVariableCount() frames.
+ *
+ * Sequence numbers (e.g. TCP seq, IPv4 id) are just counter variable fields
+ * for the patch table. There is no transmit time timestamp field - it
+ * would need a new kind of variable field.
+ *
+ * Frames are patched in place - the value of a patched field in the frame
+ * is irrelevant, so a frame can be patched again (in the next repeat of
+ * the packet list) for another frameIndex.
+ *
+ * Checksums covering a patched field are updated incrementally (RFC 1624).
+ * Which checksums are affected by a field (and how) is found out by
+ * rendering frames with the field modified, and the table as a whole is
+ * verified against a sample of fully rendered frames - if anything does
+ * not match, build() returns NULL and the stream is built as usual
+ */
+class FramePatchTable
+{
+public:
+    static FramePatchTable* build(StreamBase *stream);
+
+    int baseFrameCount() const;
+    int fieldCount() const;
+
+    void apply(uchar *frame, int length, quint64 frameIndex) const;
+
+private:
+    struct Cksum
+    {
+        int offset;         // frame offset of the 16-bit checksum
+        int parity;         // 0 if even offsets are the checksum word MSB
+        bool zeroIsOnes;    // computed 0 is sent as 0xFFFF (UDP)
+    };
+
+    struct Field
+    {
+        int offset;         // frame offset
+        int size;           // 1, 2 or 4 bytes
+        quint32 mask;
+        quint32 value;
+        quint32 step;
+        quint32 count;
+        bool isDecrement;
+        bool isRandom;
+        quint64 randomKey;
+        QList<Cksum> cksumList;
+    };
+
+    FramePatchTable();
+
+    int computeBaseFrameCount(StreamBase *stream);
+    bool findCksums(StreamBase *stream, int index,
+                    const QList<Cksum> &cksumList,
+                    const QByteArray &frame, int length);
+    bool verify(const StreamBase *stream, int frameCount) const;
+
+    static quint32 byteSum(const uchar *frame, int offset, int size,
+                           int parity);
+
+    int baseFrameCount_;
+    QList<Field> fieldList_;
+
+    // Protocol and variable field index of each entry of fieldList_;
+    // valid only during build()
+    QList<AbstractProtocol*> protocolList_;
+    QList<int> variableFieldList_;
+};
+
+#endif
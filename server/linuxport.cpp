@@ -21,13 +21,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #ifdef Q_OS_LINUX
 
+#include "statsseries.h"
+
 #include <QByteArray>
+#include <QElapsedTimer>
 #include <QHash>
 #include <QTime>
 
 #include <errno.h>
 #include <fcntl.h>
 #include <net/if.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -36,6 +40,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <linux/rtnetlink.h>
 
+extern void notifyLinkStateChanged(const QList<int> &portIds);
+
 QList<LinuxPort*> LinuxPort::allPorts_;
 LinuxPort::StatsMonitor *LinuxPort::monitor_;
 
@@ -146,6 +152,8 @@ bool LinuxPort::setExclusiveControl(bool /*exclusive*/)
 LinuxPort::StatsMonitor::StatsMonitor()
     : QThread()
 {
+    placement_ = ThreadPlacement::forDevice();
+    refreshInterval_ = StatsSeries::counterRefreshInterval();
     stop_ = false;
     setupDone_ = false;
     ioctlSocket_ = socket(AF_INET, SOCK_DGRAM, 0);
@@ -159,6 +167,8 @@ LinuxPort::StatsMonitor::~StatsMonitor()
 
 void LinuxPort::StatsMonitor::run()
 {
+    placement_->placeCurrentThread(ThreadPlacement::kStatsThread);
+
     if (netlinkStats() < 0)
     {
         qDebug("netlink stats not available - using /proc stats");
@@ -351,24 +361,24 @@ void LinuxPort::StatsMonitor::procStats()
                         ((rxPkts >= stats->rxPkts) ? 
                                 rxPkts - stats->rxPkts : 
                                 rxPkts + (kMaxValue32 - stats->rxPkts))
-                        / kRefreshFreq_;
+                        * 1000 / refreshInterval_;
                     stats->rxBps = 
                         ((rxBytes >= stats->rxBytes) ? 
                                 rxBytes - stats->rxBytes : 
                                 rxBytes + (kMaxValue32 - stats->rxBytes))
-                        / kRefreshFreq_;
+                        * 1000 / refreshInterval_;
                     stats->rxPkts  = rxPkts;
                     stats->rxBytes = rxBytes;
                     stats->txPps = 
                         ((txPkts >= stats->txPkts) ? 
                                 txPkts - stats->txPkts : 
                                 txPkts + (kMaxValue32 - stats->txPkts))
-                        / kRefreshFreq_;
+                        * 1000 / refreshInterval_;
                     stats->txBps = 
                         ((txBytes >= stats->txBytes) ? 
                                 txBytes - stats->txBytes : 
                                 txBytes + (kMaxValue32 - stats->txBytes))
-                        / kRefreshFreq_;
+                        * 1000 / refreshInterval_;
                     stats->txPkts  = txPkts;
                     stats->txBytes = txBytes;
 
@@ -384,18 +394,97 @@ void LinuxPort::StatsMonitor::procStats()
             p++;
             index++;
         }
-        QThread::sleep(kRefreshFreq_);
+        QThread::msleep(refreshInterval_);
     }
 
     free(portStats);
 }
 
+/*!
+ * Updates the port stats from the interface stats - rates are computed
+ * over refreshInterval (msecs) i.e. the time since the previous update
+ */
+static void updateStats(AbstractPort::PortStats *stats,
+        quint64 *maxStatsValue, const x_rtnl_link_stats *rtnlStats,
+        int refreshInterval)
+{
+    if (rtnlStats->rx_packets >= stats->rxPkts) {
+        stats->rxPps = (rtnlStats->rx_packets - stats->rxPkts)
+                            * 1000 / refreshInterval;
+    }
+    else {
+        if (*maxStatsValue == 0) {
+            *maxStatsValue = stats->rxPkts > kMaxValue32 ?
+                kMaxValue64 : kMaxValue32;
+        }
+        stats->rxPps = ((*maxStatsValue - stats->rxPkts)
+                            + rtnlStats->rx_packets)
+                        * 1000 / refreshInterval;
+    }
+
+    if (rtnlStats->rx_bytes >= stats->rxBytes) {
+        stats->rxBps = (rtnlStats->rx_bytes - stats->rxBytes)
+                            * 1000 / refreshInterval;
+    }
+    else {
+        if (*maxStatsValue == 0) {
+            *maxStatsValue = stats->rxBytes > kMaxValue32 ?
+                kMaxValue64 : kMaxValue32;
+        }
+        stats->rxBps = ((*maxStatsValue - stats->rxBytes)
+                            + rtnlStats->rx_bytes)
+                        * 1000 / refreshInterval;
+    }
+
+    stats->rxPkts  = rtnlStats->rx_packets;
+    stats->rxBytes = rtnlStats->rx_bytes;
+
+    if (rtnlStats->tx_packets >= stats->txPkts) {
+        stats->txPps = (rtnlStats->tx_packets - stats->txPkts)
+                            * 1000 / refreshInterval;
+    }
+    else {
+        if (*maxStatsValue == 0) {
+            *maxStatsValue = stats->txPkts > kMaxValue32 ?
+                kMaxValue64 : kMaxValue32;
+        }
+        stats->txPps = ((*maxStatsValue - stats->txPkts)
+                            + rtnlStats->tx_packets)
+                        * 1000 / refreshInterval;
+    }
+
+    if (rtnlStats->tx_bytes >= stats->txBytes) {
+        stats->txBps = (rtnlStats->tx_bytes - stats->txBytes)
+                            * 1000 / refreshInterval;
+    }
+    else {
+        if (*maxStatsValue == 0) {
+            *maxStatsValue = stats->txBytes > kMaxValue32 ?
+                kMaxValue64 : kMaxValue32;
+        }
+        stats->txBps = ((*maxStatsValue - stats->txBytes)
+                            + rtnlStats->tx_bytes)
+                        * 1000 / refreshInterval;
+    }
+
+    stats->txPkts  = rtnlStats->tx_packets;
+    stats->txBytes = rtnlStats->tx_bytes;
+
+    // TODO: export detailed error stats
+    stats->rxDrops =   rtnlStats->rx_dropped 
+                     + rtnlStats->rx_missed_errors;
+    stats->rxErrors = rtnlStats->rx_errors;
+    stats->rxFifoErrors = rtnlStats->rx_fifo_errors;
+    stats->rxFrameErrors =   rtnlStats->rx_crc_errors
+                           + rtnlStats->rx_length_errors
+                           + rtnlStats->rx_over_errors
+                           + rtnlStats->rx_frame_errors;
+}
+
 int LinuxPort::StatsMonitor::netlinkStats()
 {
-    QHash<uint, PortStats*> portStats;
-    QHash<uint, quint64*> portMaxStatsValue;
-    QHash<uint, OstProto::LinkState*> linkState;
-    int fd;
+    QHash<uint, LinuxPort*> ports; // Key: ifindex
+    int fd, eventFd;
     struct sockaddr_nl local;
     struct sockaddr_nl kernel;
     QByteArray buf;
@@ -404,6 +493,14 @@ int LinuxPort::StatsMonitor::netlinkStats()
         struct nlmsghdr nlh;
         struct rtgenmsg rtg;
     } ifListReq;
+    struct {
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifi;
+    } linkReq;
+    QByteArray eventBuf;
+    QElapsedTimer timer;
+    QHash<uint, qint64> lastRefresh; // Key: ifindex
+    qint64 nextIdleRefresh = 0;
     struct iovec iov;
     struct msghdr msg;
     struct nlmsghdr *nlm;
@@ -570,10 +667,7 @@ _retry:
         {
             if (strcmp(port->name(), ifname) == 0)
             {
-                portStats[uint(ifi->ifi_index)] = &(port->stats_);
-                portMaxStatsValue[uint(ifi->ifi_index)] = 
-                        &(port->maxStatsValue_);
-                linkState[uint(ifi->ifi_index)] = &(port->linkState_);
+                ports[uint(ifi->ifi_index)] = port;
 
                 if (setPromisc(port->name()))
                     port->clearPromisc_ = true;
@@ -600,171 +694,226 @@ _retry:
     qDebug("stats for %d ports setup", count);
     setupDone_ = true;
 
+    // Listen for link events so that link state changes are seen (and
+    // notified to clients) as they happen instead of at the next refresh
+    eventFd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (eventFd >= 0)
+    {
+        memset(&local, 0, sizeof(local));
+        local.nl_family = AF_NETLINK;
+        local.nl_groups = RTMGRP_LINK;
+
+        if (bind(eventFd, (struct sockaddr*) &local, sizeof(local)) < 0)
+        {
+            qWarning("Unable to bind netlink link events socket (errno %d)"
+                     " - link state will be updated on refresh only", errno);
+            close(eventFd);
+            eventFd = -1;
+        }
+    }
+
+    // A single link message can be quite large (e.g. with VF info)
+    if (buf.size() < kMinLinkMsgBufSize_)
+        buf.resize(kMinLinkMsgBufSize_);
+    eventBuf.resize(buf.size());
+
+    memset(&linkReq, 0, sizeof(linkReq));
+    linkReq.nlh.nlmsg_len = sizeof(linkReq);
+    linkReq.nlh.nlmsg_type = RTM_GETLINK;
+    linkReq.nlh.nlmsg_flags = NLM_F_REQUEST;
+    linkReq.ifi.ifi_family = AF_UNSPEC;
+
     //
     // We are all set - Let's start polling for stats!
     //
+    // Instead of dumping all interfaces, we request the stats of only
+    // our ports - and of these, only those in use are refreshed every
+    // refreshInterval_; the others every kIdleRefreshInterval_
+    //
+    timer.start();
     while (!stop_)
     {
-        if (send(fd, (void*)&ifListReq, sizeof(ifListReq), 0) < 0)
+        QList<int> changedPorts;
+        qint64 nextRefresh = timer.elapsed() + refreshInterval_;
+        bool refreshIdle = timer.elapsed() >= nextIdleRefresh;
+
+        if (refreshIdle)
+            nextIdleRefresh = timer.elapsed() + kIdleRefreshInterval_;
+
+        // One request at a time - a burst of requests for many ports
+        // could overrun the socket receive buffer
+        QHashIterator<uint, LinuxPort*> i(ports);
+        while (i.hasNext())
         {
-            qWarning("Unable to send GETLINK request (errno %d)", errno);
-            goto _try_later;
-        }
+            LinuxPort *port;
+            qint64 now, interval;
+
+            i.next();
+            port = i.value();
+            if (!refreshIdle && !port->isStatsActive())
+                continue;
 
-        done = false;
+            linkReq.nlh.nlmsg_seq++;
+            linkReq.ifi.ifi_index = i.key();
+            if (send(fd, (void*)&linkReq, sizeof(linkReq), 0) < 0)
+            {
+                qWarning("Unable to send GETLINK request (errno %d)", errno);
+                continue;
+            }
 
 _retry_recv:
-        msg.msg_flags = 0;
-        len = recvmsg(fd, &msg, 0);
+            len = recv(fd, buf.data(), buf.size(), 0);
+            if (len < 0)
+            {
+                if (errno == EINTR || errno == EAGAIN)
+                    goto _retry_recv;
+                qWarning("netlink recv error %d", errno);
+                goto _exit;
+            }
+            else if (len == 0)
+            {
+                qWarning("netlink socket closed unexpectedly");
+                goto _exit;
+            }
 
-        if (len < 0)
-        {
-            if (errno == EINTR || errno == EAGAIN)
+            nlm = (struct nlmsghdr*) buf.data();
+            if (!NLMSG_OK(nlm, (uint)len))
+                continue;
+
+            // Skip any stale reply to an earlier request
+            if (nlm->nlmsg_seq != linkReq.nlh.nlmsg_seq)
                 goto _retry_recv;
-            qWarning("netlink recv error %d", errno);
-            break;
-        }
-        else if (len == 0)
-        {
-            qWarning("netlink socket closed unexpectedly");
-            break;
+
+            if (nlm->nlmsg_type == NLMSG_ERROR)
+            {
+                struct nlmsgerr *err = (struct nlmsgerr*) NLMSG_DATA(nlm);
+                qDebug("RTNETLINK error: %s", strerror(-err->error));
+                continue;
+            }
+
+            if (nlm->nlmsg_type != RTM_NEWLINK)
+                continue;
+
+            // Idle ports are refreshed less often - so compute their
+            // rates over the actual time since the last refresh
+            now = timer.elapsed();
+            interval = lastRefresh.contains(i.key()) ?
+                        now - lastRefresh.value(i.key()) : refreshInterval_;
+            lastRefresh.insert(i.key(), now);
+
+            if (updatePort(port, nlm, int(qMax(interval, qint64(1)))))
+                changedPorts.append(port->id());
         }
 
-        nlm = (struct nlmsghdr*) buf.data();
-        while (NLMSG_OK(nlm, (uint)len))
+        // Wait for link events till it is time for the next refresh
+        while (!stop_)
         {
-            struct ifinfomsg *ifi;
-            struct rtattr *rta;
-            int rtaLen;
+            qint64 timeout = nextRefresh - timer.elapsed();
+            struct pollfd pfd;
 
-            if (nlm->nlmsg_type == NLMSG_DONE) 
-            {
-                done = true;
+            if (timeout <= 0)
                 break;
-            }
 
-            if (nlm->nlmsg_type == NLMSG_ERROR)
+            if (eventFd < 0)
             {
-                struct nlmsgerr *err = (struct nlmsgerr*) NLMSG_DATA(nlm);
-                qDebug("RTNETLINK error: %s", strerror(-err->error));
-                done = true;
+                QThread::msleep(timeout);
                 break;
             }
 
-            Q_ASSERT(nlm->nlmsg_type == RTM_NEWLINK);
+            pfd.fd = eventFd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, int(timeout)) <= 0)
+                continue;
 
-            ifi = (struct ifinfomsg*) NLMSG_DATA(nlm);
-            rta = IFLA_RTA(ifi);
-            rtaLen = len - NLMSG_LENGTH(sizeof(*ifi));
-            while (RTA_OK(rta, rtaLen))
+            len = recv(eventFd, eventBuf.data(), eventBuf.size(), MSG_DONTWAIT);
+            if (len <= 0)
             {
-                if (rta->rta_type == X_IFLA_STATS)
-                {
-                    x_rtnl_link_stats *rtnlStats = 
-                            (x_rtnl_link_stats*) RTA_DATA(rta);
-                    AbstractPort::PortStats *stats = portStats[ifi->ifi_index];
-                    quint64 *maxStatsValue = portMaxStatsValue[ifi->ifi_index];
-                    OstProto::LinkState *state = linkState[ifi->ifi_index];
-
-                    if (!stats)
-                        break;
-
-                    if (rtnlStats->rx_packets >= stats->rxPkts) {
-                        stats->rxPps = (rtnlStats->rx_packets - stats->rxPkts)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->rxPkts > kMaxValue32 ?
-                                kMaxValue64 : kMaxValue32;
-                        }
-                        stats->rxPps = ((*maxStatsValue - stats->rxPkts)
-                                            + rtnlStats->rx_packets)
-                                        / kRefreshFreq_;
-                    }
-
-                    if (rtnlStats->rx_bytes >= stats->rxBytes) {
-                        stats->rxBps = (rtnlStats->rx_bytes - stats->rxBytes)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->rxBytes > kMaxValue32 ?
-                                kMaxValue64 : kMaxValue32;
-                        }
-                        stats->rxBps = ((*maxStatsValue - stats->rxBytes)
-                                            + rtnlStats->rx_bytes)
-                                        / kRefreshFreq_;
-                    }
-
-                    stats->rxPkts  = rtnlStats->rx_packets;
-                    stats->rxBytes = rtnlStats->rx_bytes;
-
-                    if (rtnlStats->tx_packets >= stats->txPkts) {
-                        stats->txPps = (rtnlStats->tx_packets - stats->txPkts)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->txPkts > kMaxValue32 ?
-                                kMaxValue64 : kMaxValue32;
-                        }
-                        stats->txPps = ((*maxStatsValue - stats->txPkts)
-                                            + rtnlStats->tx_packets)
-                                        / kRefreshFreq_;
-                    }
-
-                    if (rtnlStats->tx_bytes >= stats->txBytes) {
-                        stats->txBps = (rtnlStats->tx_bytes - stats->txBytes)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->txBytes > kMaxValue32 ?
-                                kMaxValue64 : kMaxValue32;
-                        }
-                        stats->txBps = ((*maxStatsValue - stats->txBytes)
-                                            + rtnlStats->tx_bytes)
-                                        / kRefreshFreq_;
-                    }
-
-                    stats->txPkts  = rtnlStats->tx_packets;
-                    stats->txBytes = rtnlStats->tx_bytes;
-
-                    // TODO: export detailed error stats
-                    stats->rxDrops =   rtnlStats->rx_dropped 
-                                     + rtnlStats->rx_missed_errors;
-                    stats->rxErrors = rtnlStats->rx_errors;
-                    stats->rxFifoErrors = rtnlStats->rx_fifo_errors;
-                    stats->rxFrameErrors =   rtnlStats->rx_crc_errors
-                                           + rtnlStats->rx_length_errors
-                                           + rtnlStats->rx_over_errors
-                                           + rtnlStats->rx_frame_errors;
-
-                    Q_ASSERT(state);  
-                    *state = ifi->ifi_flags & IFF_RUNNING ?
-                        OstProto::LinkStateUp : OstProto::LinkStateDown;
+                // ENOBUFS: we missed some events; the next refresh of
+                // each port will set its link state right
+                if (errno == ENOBUFS)
+                    qDebug("netlink link events overrun");
+                continue;
+            }
 
-                    break;
+            nlm = (struct nlmsghdr*) eventBuf.data();
+            while (NLMSG_OK(nlm, (uint)len))
+            {
+                if ((nlm->nlmsg_type == RTM_NEWLINK)
+                        || (nlm->nlmsg_type == RTM_DELLINK))
+                {
+                    struct ifinfomsg *ifi =
+                            (struct ifinfomsg*) NLMSG_DATA(nlm);
+                    LinuxPort *port = ports.value(ifi->ifi_index);
+
+                    // Stats in link events are not at refresh boundaries
+                    // and would skew the rates - so use only link state
+                    if (port && updatePort(port, nlm, 0)
+                            && !changedPorts.contains(port->id()))
+                        changedPorts.append(port->id());
                 }
-                rta = RTA_NEXT(rta, rtaLen);
+                nlm = NLMSG_NEXT(nlm, len);
             }
-            nlm = NLMSG_NEXT(nlm, len);
-        }
 
-        if (!done)
-            goto _retry_recv;
+            if (changedPorts.size())
+            {
+                notifyLinkStateChanged(changedPorts);
+                changedPorts.clear();
+            }
+        }
 
-_try_later:
-        QThread::sleep(kRefreshFreq_);
+        if (changedPorts.size())
+            notifyLinkStateChanged(changedPorts);
     }
 
-    portStats.clear();
-    linkState.clear();
+_exit:
+    if (eventFd >= 0)
+        close(eventFd);
+    close(fd);
+    ports.clear();
+    lastRefresh.clear();
 
     return 0;
 }
 
+/*!
+ * Updates the port from a RTM_NEWLINK/RTM_DELLINK message - the port
+ * stats are updated too if statsInterval (msecs since the stats were
+ * last updated) is non-zero
+ *
+ * Returns true if the link state of the port changed
+ */
+bool LinuxPort::StatsMonitor::updatePort(LinuxPort *port,
+        struct nlmsghdr *nlm, int statsInterval)
+{
+    struct ifinfomsg *ifi = (struct ifinfomsg*) NLMSG_DATA(nlm);
+    OstProto::LinkState oldState = port->linkState_;
+
+    if (statsInterval)
+    {
+        struct rtattr *rta = IFLA_RTA(ifi);
+        int rtaLen = IFLA_PAYLOAD(nlm);
+
+        while (RTA_OK(rta, rtaLen))
+        {
+            if (rta->rta_type == X_IFLA_STATS)
+            {
+                updateStats(&port->stats_, &port->maxStatsValue_,
+                            (x_rtnl_link_stats*) RTA_DATA(rta),
+                            statsInterval);
+                break;
+            }
+            rta = RTA_NEXT(rta, rtaLen);
+        }
+    }
+
+    port->linkState_ = (nlm->nlmsg_type == RTM_NEWLINK)
+                            && (ifi->ifi_flags & IFF_RUNNING) ?
+                        OstProto::LinkStateUp : OstProto::LinkStateDown;
+
+    return port->linkState_ != oldState;
+}
+
 int LinuxPort::StatsMonitor::setPromisc(const char * portName)
 { 
     struct ifreq ifr;
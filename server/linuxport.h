@@ -26,6 +26,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "pcapport.h"
 
+struct nlmsghdr;
+
 class LinuxPort : public PcapPort
 {
 public:
@@ -51,8 +53,13 @@ protected:
         int netlinkStats();
         void procStats();
         int setPromisc(const char* portName);
+        bool updatePort(LinuxPort *port, struct nlmsghdr *nlm,
+                        int statsInterval);
 
-        static const int kRefreshFreq_ = 1; // in seconds
+        int refreshInterval_; // in msecs
+        static const int kIdleRefreshInterval_ = 10000; // in msecs
+        static const int kMinLinkMsgBufSize_ = 32768;
+        const ThreadPlacement *placement_; // not port specific
         bool stop_;
         bool setupDone_;
         int ioctlSocket_;
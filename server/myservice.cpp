@@ -37,7 +37,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "devicemanager.h"
 #include "portmanager.h"
 
+#include <QDateTime>
+#include <QMutexLocker>
 #include <QStringList>
+#include <QTimer>
 
 
 extern Drone *drone;
@@ -56,6 +59,11 @@ MyService::MyService()
         portLock.append(new QReadWriteLock());
 #endif
     }
+
+    // Started when there's a subscription, stopped when there's none
+    statsPushTimer_ = new QTimer(this);
+    statsPushTimer_->setInterval(kMinStatsPushInterval);
+    connect(statsPushTimer_, SIGNAL(timeout()), this, SLOT(pushStats()));
 }
 
 MyService::~MyService()
@@ -114,13 +122,14 @@ void MyService::getPortConfig(::google::protobuf::RpcController* /*controller*/,
     done->Run();
 }
 
-void MyService::modifyPort(::google::protobuf::RpcController* /*controller*/,
+void MyService::modifyPort(::google::protobuf::RpcController* controller,
     const ::OstProto::PortConfigList* request,
     ::OstProto::Ack* /*response*/,
     ::google::protobuf::Closure* done)
 {
     // notification needs to be on heap because signal/slot is across threads!
     OstProto::Notification *notif = new OstProto::Notification;
+    QString error;
 
     qDebug("In %s", __PRETTY_FUNCTION__);
 
@@ -142,8 +151,15 @@ void MyService::modifyPort(::google::protobuf::RpcController* /*controller*/,
 
             portLock[id]->lockForWrite();
             portInfo[id]->modify(port);
-            if (dirty)
-                portInfo[id]->updatePacketList();
+            if (dirty && !portInfo[id]->updatePacketList()) {
+                AbstractPort::PacketListInfo info;
+
+                // The port is modified all the same - only its packet
+                // list is not built
+                portInfo[id]->packetListInfo(&info);
+                error.append(QString("Port %1: %2\n")
+                        .arg(id).arg(info.error));
+            }
             portLock[id]->unlock();
 
 
@@ -151,6 +167,9 @@ void MyService::modifyPort(::google::protobuf::RpcController* /*controller*/,
         }
     }
 
+    if (!error.isEmpty())
+        controller->SetFailed(error.toStdString());
+
     //! \todo (LOW): fill-in response "Ack"????
     done->Run();
 
@@ -322,6 +341,7 @@ void MyService::modifyStream(::google::protobuf::RpcController* controller,
     ::google::protobuf::Closure* done)
 {
     int    portId;
+    AbstractPort::PacketListInfo info;
 
     qDebug("In %s", __PRETTY_FUNCTION__);
 
@@ -345,8 +365,14 @@ void MyService::modifyStream(::google::protobuf::RpcController* controller,
         }
     }
 
-    if (portInfo[portId]->isDirty())
-        portInfo[portId]->updatePacketList();
+    // The streams are modified all the same - only the packet list is
+    // not built
+    if (portInfo[portId]->isDirty()
+            && !portInfo[portId]->updatePacketList()) {
+        portInfo[portId]->packetListInfo(&info);
+        portLock[portId]->unlock();
+        goto _packet_list_fail;
+    }
     portLock[portId]->unlock();
 
     //! \todo(LOW): fill-in response "Ack"????
@@ -354,6 +380,10 @@ void MyService::modifyStream(::google::protobuf::RpcController* controller,
     done->Run();
     return;
 
+_packet_list_fail:
+    controller->SetFailed(QString("Port %1: %2")
+            .arg(portId).arg(info.error).toStdString());
+    goto _exit;
 _port_busy:
     controller->SetFailed("Port Busy");
     goto _exit;
@@ -363,11 +393,13 @@ _exit:
     done->Run();
 }
 
-void MyService::startTransmit(::google::protobuf::RpcController* /*controller*/,
+void MyService::startTransmit(::google::protobuf::RpcController* controller,
     const ::OstProto::PortIdList* request,
     ::OstProto::Ack* /*response*/,
     ::google::protobuf::Closure* done)
 {
+    QString error;
+
     qDebug("In %s", __PRETTY_FUNCTION__);
 
     for (int i = 0; i < request->port_id_size(); i++)
@@ -379,12 +411,23 @@ void MyService::startTransmit(::google::protobuf::RpcController* /*controller*/,
             continue;     //! \todo (LOW): partial RPC?
 
         portLock[portId]->lockForWrite();
-        if (portInfo[portId]->isDirty())
-            portInfo[portId]->updatePacketList();
+        if (portInfo[portId]->isDirty()
+                && !portInfo[portId]->updatePacketList()) {
+            AbstractPort::PacketListInfo info;
+
+            portInfo[portId]->packetListInfo(&info);
+            error.append(QString("Port %1: %2\n")
+                    .arg(portId).arg(info.error));
+            portLock[portId]->unlock();
+            continue;
+        }
         portInfo[portId]->startTransmit();
         portLock[portId]->unlock();
     }
 
+    if (!error.isEmpty())
+        controller->SetFailed(error.toStdString());
+
     //! \todo (LOW): fill-in response "Ack"????
 
     done->Run();
@@ -512,6 +555,8 @@ void MyService::getStats(::google::protobuf::RpcController* /*controller*/,
         s = response->add_port_stats();
         s->mutable_port_id()->set_id(request->port_id(i).id());
 
+        portInfo[portId]->markStatsActive();
+
         st = s->mutable_state(); 
         portLock[portId]->lockForRead();
         st->set_link_state(portInfo[portId]->linkState()); 
@@ -586,6 +631,8 @@ void MyService::getStreamStats(
         if ((portId < 0) || (portId >= portInfo.size()))
             continue;     //! \todo(LOW): partial rpc?
 
+        portInfo[portId]->markStatsActive();
+
         portLock[portId]->lockForRead();
         if (request->stream_guid_size())
             for (int j = 0; j < request->stream_guid_size(); j++)
@@ -1000,6 +1047,293 @@ _invalid_port:
     done->Run();
 }
 
+void MyService::getDeviceNeighborUpdates(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::PortNeighborQuery* request,
+    ::OstProto::PortNeighborList* response,
+    ::google::protobuf::Closure* done)
+{
+    DeviceManager *devMgr;
+    int portId;
+    int count;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    portId = request->port_id().id();
+    if ((portId < 0) || (portId >= portInfo.size()))
+        goto _invalid_port;
+
+    devMgr = portInfo[portId]->deviceManager();
+    count = request->device_count() ? int(request->device_count()) : -1;
+
+    response->mutable_port_id()->set_id(portId);
+    portLock[portId]->lockForRead();
+    devMgr->getDeviceNeighbors(response, request->device_index(), count,
+                               request->has_since_generation(),
+                               request->since_generation());
+    portLock[portId]->unlock();
+
+    done->Run();
+    return;
+
+_invalid_port:
+    controller->SetFailed("Invalid Port Id");
+    done->Run();
+}
+
+void MyService::getPacketListInfo(
+    ::google::protobuf::RpcController* /*controller*/,
+    const ::OstProto::PortIdList* request,
+    ::OstProto::PacketListInfoList* response,
+    ::google::protobuf::Closure* done)
+{
+    quint64 memoryUsed, memoryBudget;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    for (int i = 0; i < request->port_id_size(); i++)
+    {
+        AbstractPort::PacketListInfo info;
+        OstProto::PacketListInfo *pli;
+        int portId;
+
+        portId = request->port_id(i).id();
+        if ((portId < 0) || (portId >= portInfo.size()))
+            continue;     //! \todo(LOW): partial rpc?
+
+        // No port lock - it is held while the packet list is built
+        portInfo[portId]->packetListInfo(&info);
+
+        pli = response->add_packet_list_info();
+        pli->mutable_port_id()->set_id(portId);
+        pli->set_is_building(info.isBuilding);
+        pli->set_frames_built(info.framesBuilt);
+        pli->set_frames_total(info.framesEstimate);
+        pli->set_memory_used(info.memoryUsed);
+        pli->set_memory_budget(info.memoryBudget);
+        if (!info.error.isEmpty())
+            pli->set_error(info.error.toStdString());
+    }
+
+    AbstractPort::globalPacketListMemory(&memoryUsed, &memoryBudget);
+    response->set_memory_used(memoryUsed);
+    response->set_memory_budget(memoryBudget);
+
+    done->Run();
+}
+
+void MyService::getStatsSeries(
+    ::google::protobuf::RpcController* /*controller*/,
+    const ::OstProto::StatsSeriesQuery* request,
+    ::OstProto::StatsSeriesList* response,
+    ::google::protobuf::Closure* done)
+{
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    for (int i = 0; i < request->port_id_list().port_id_size(); i++)
+    {
+        int portId;
+
+        portId = request->port_id_list().port_id(i).id();
+        if ((portId < 0) || (portId >= portInfo.size()))
+            continue;     //! \todo(LOW): partial rpc?
+
+        portInfo[portId]->markStatsActive();
+
+        // No port lock - the series has its own lock
+        portInfo[portId]->statsSeries(*request,
+                                      response->add_stats_series());
+    }
+
+    done->Run();
+}
+
+void MyService::subscribeStats(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::StatsSubscription* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    QObject *client = static_cast<PbRpcController*>(controller)->connection();
+    StatsSubscription subscription;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    if (!client)
+        goto _error_exit;
+
+    for (int i = 0; i < request->port_id_list().port_id_size(); i++)
+    {
+        int portId = request->port_id_list().port_id(i).id();
+
+        if ((portId < 0) || (portId >= portInfo.size()))
+            goto _invalid_port;
+    }
+
+    statsSubscriptionLock_.lock();
+    if (request->interval()) {
+        subscription.request.CopyFrom(*request);
+        subscription.request.set_interval(qMax(request->interval(),
+                                          uint(kMinStatsPushInterval)));
+        subscription.due = QDateTime::currentMSecsSinceEpoch();
+        statsSubscriptions_.insert(client, subscription);
+
+        // The connection object is destroyed in its own thread, so
+        // we need a direct connection to not be left with a stale key
+        connect(client, SIGNAL(destroyed(QObject*)),
+                this, SLOT(removeStatsSubscription(QObject*)),
+                Qt::ConnectionType(Qt::DirectConnection
+                                    | Qt::UniqueConnection));
+    }
+    else
+        statsSubscriptions_.remove(client);
+    statsSubscriptionLock_.unlock();
+
+    // We are not in the timer's thread, so can't start it directly
+    if (request->interval())
+        QMetaObject::invokeMethod(statsPushTimer_, "start",
+                                  Qt::QueuedConnection);
+
+    done->Run();
+    return;
+
+_invalid_port:
+    controller->SetFailed("invalid portid");
+    done->Run();
+    return;
+
+_error_exit:
+    controller->SetFailed("no client connection to push stats to");
+    done->Run();
+}
+
+void MyService::getStreamSummaryList(
+    ::google::protobuf::RpcController* controller,
+    const ::OstProto::StreamSummaryQuery* request,
+    ::OstProto::StreamSummaryList* response,
+    ::google::protobuf::Closure* done)
+{
+    int portId;
+    int first, last;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    portId = request->port_id().id();
+    if ((portId < 0) || (portId >= portInfo.size()))
+        goto _invalid_port;
+
+    response->mutable_port_id()->set_id(portId);
+    portLock[portId]->lockForRead();
+
+    response->set_total_streams(portInfo[portId]->streamCount());
+
+    // Clamp the (client supplied) range as unsigned before using it as
+    // an index, so that large values don't wrap around
+    last = portInfo[portId]->streamCount();
+    first = int(qMin(request->stream_index(), quint32(last)));
+    if (request->stream_count()
+            && (quint32(last - first) > request->stream_count()))
+        last = first + int(request->stream_count());
+
+    for (int i = first; i < last; i++)
+        portInfo[portId]->streamAtIndex(i)->summaryCopyInto(
+                *response->add_stream());
+
+    portLock[portId]->unlock();
+
+    done->Run();
+    return;
+
+_invalid_port:
+    controller->SetFailed("invalid portid");
+    done->Run();
+}
+
+/*!
+ * Pushes stats to the clients whose subscriptions are due
+ *
+ * Clients with the same subscription (except for the interval) get the
+ * same notification - so it is built and serialized only once
+ */
+void MyService::pushStats()
+{
+    QHash<QByteArray, QList<QObject*> > clients;
+    QHash<QByteArray, OstProto::StatsSubscription> requests;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    statsSubscriptionLock_.lock();
+
+    if (statsSubscriptions_.isEmpty())
+        statsPushTimer_->stop();
+
+    QMutableHashIterator<QObject*, StatsSubscription> i(statsSubscriptions_);
+    while (i.hasNext())
+    {
+        i.next();
+        StatsSubscription &subscription = i.value();
+
+        if (subscription.due > now)
+            continue;
+
+        subscription.due += subscription.request.interval();
+        if (subscription.due <= now) // fell behind - don't bunch up
+            subscription.due = now + subscription.request.interval();
+
+        OstProto::StatsSubscription request = subscription.request;
+        request.clear_interval();
+        std::string serialized = request.SerializePartialAsString();
+        QByteArray key(serialized.data(), int(serialized.size()));
+
+        clients[key].append(i.key());
+        requests.insert(key, request);
+    }
+
+    statsSubscriptionLock_.unlock();
+
+    // The clients may disconnect meanwhile, but we only use the client
+    // (pointer) to select the connection to send to
+    QHashIterator<QByteArray, QList<QObject*> > j(clients);
+    while (j.hasNext())
+    {
+        j.next();
+        const OstProto::StatsSubscription &request = requests[j.key()];
+
+        // notification needs to be on heap because signal/slot is across
+        // threads!
+        OstProto::Notification *notif = new OstProto::Notification;
+        notif->set_notif_type(OstProto::portStatsUpdate);
+
+        getStats(NULL, &request.port_id_list(),
+                 notif->mutable_port_stats_list(),
+                 ::google::protobuf::NewCallback(
+                        &::google::protobuf::DoNothing));
+
+        if (request.with_stream_stats()) {
+            OstProto::StreamGuidList guidList;
+
+            guidList.mutable_port_id_list()->CopyFrom(
+                    request.port_id_list());
+            guidList.mutable_stream_guid()->CopyFrom(request.stream_guid());
+            getStreamStats(NULL, &guidList,
+                           notif->mutable_stream_stats_list(),
+                           ::google::protobuf::NewCallback(
+                                &::google::protobuf::DoNothing));
+        }
+
+        // One signal for all the clients of the group - each connection
+        // picks it up only if it is one of them
+        emit notification(j.value(), notif->notif_type(),
+                          SharedProtobufMessage(notif), true);
+    }
+}
+
+void MyService::removeStatsSubscription(QObject *client)
+{
+    QMutexLocker locker(&statsSubscriptionLock_);
+
+    statsSubscriptions_.remove(client);
+}
+
 /*
  * ===================================================================
  * Friends
@@ -1062,3 +1396,27 @@ quint64 getNeighborMacAddress(int portId, int streamId, int frameIndex)
 
     return mac;
 }
+
+/*!
+ * Notifies all clients that the link state of these ports has changed
+ *
+ * Called by the port stats monitors (in their own threads) as soon as they
+ * see a link state change; the notification is queued to the RPC server
+ */
+void notifyLinkStateChanged(const QList<int> &portIds)
+{
+    MyService *service = drone ? drone->rpcService() : NULL;
+    OstProto::Notification *notif;
+
+    if (!service || portIds.isEmpty())
+        return;
+
+    // notification needs to be on heap because signal/slot is across threads!
+    notif = new OstProto::Notification;
+    notif->set_notif_type(OstProto::portLinkStateChanged);
+    foreach(int portId, portIds)
+        notif->mutable_port_id_list()->add_port_id()->set_id(portId);
+
+    emit service->notification(notif->notif_type(),
+                               SharedProtobufMessage(notif));
+}
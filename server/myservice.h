@@ -23,7 +23,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "../common/protocol.pb.h"
 #include "../rpc/sharedprotobufmessage.h"
 
+#include <QHash>
 #include <QList>
+#include <QMutex>
 #include <QObject>
 #include <QReadWriteLock>
 
@@ -31,6 +33,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define MAX_STREAM_NAME_SIZE        64
 
 class AbstractPort;
+class QTimer;
 
 class MyService: public QObject, public OstProto::OstService
 {
@@ -163,13 +166,53 @@ public:
         const ::OstProto::PortId* request,
         ::OstProto::PortNeighborList* response,
         ::google::protobuf::Closure* done);
+    virtual void getDeviceNeighborUpdates(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::PortNeighborQuery* request,
+        ::OstProto::PortNeighborList* response,
+        ::google::protobuf::Closure* done);
+
+    // Packet List
+    virtual void getPacketListInfo(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::PortIdList* request,
+        ::OstProto::PacketListInfoList* response,
+        ::google::protobuf::Closure* done);
+
+    // Stats Series
+    virtual void getStatsSeries(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::StatsSeriesQuery* request,
+        ::OstProto::StatsSeriesList* response,
+        ::google::protobuf::Closure* done);
+
+    // Stats Subscription
+    virtual void subscribeStats(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::StatsSubscription* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+
+    // Stream Summary
+    virtual void getStreamSummaryList(
+        ::google::protobuf::RpcController* controller,
+        const ::OstProto::StreamSummaryQuery* request,
+        ::OstProto::StreamSummaryList* response,
+        ::google::protobuf::Closure* done);
 
     friend quint64 getDeviceMacAddress(
             int portId, int streamId, int frameIndex);
     friend quint64 getNeighborMacAddress(
             int portId, int streamId, int frameIndex);
+    friend void notifyLinkStateChanged(const QList<int> &portIds);
 signals:
     void notification(int notifType, SharedProtobufMessage notifData);
+    void notification(QList<QObject*> clients, int notifType,
+                      SharedProtobufMessage notifData, bool quiet);
+
+private slots:
+    void pushStats();
+    void removeStatsSubscription(QObject *client);
 
 private:
     /* 
@@ -185,6 +228,18 @@ private:
     QList<AbstractPort*>    portInfo;
     QList<QReadWriteLock*>  portLock;
 
+    // Stats subscriptions (Key: client connection) - accessed by the
+    // connection threads as well as the main thread (which pushes stats)
+    struct StatsSubscription
+    {
+        OstProto::StatsSubscription request;
+        qint64 due;     // msecs since epoch
+    };
+    QMutex statsSubscriptionLock_;
+    QHash<QObject*, StatsSubscription> statsSubscriptions_;
+    QTimer *statsPushTimer_;
+    static const int kMinStatsPushInterval = 100; // msecs
+
 };
 
 #endif
@@ -20,16 +20,35 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _PACKET_SEQUENCE_H
 #define _PACKET_SEQUENCE_H
 
+#include "framepatchtable.h"
 #include "pcapextra.h"
+#include "sendqueuearena.h"
 #include "../common/sign.h"
 #include "streamstats.h"
 
 class PacketSequence
 {
 public:
-    PacketSequence(bool trackGuidStats) {
+    // The send queue is sized to its content (upto kMaxSendQueueSize) if
+    // allocated from an arena - minSize is the space needed for the first
+    // packet
+    PacketSequence(bool trackGuidStats, SendQueueArena *arena = NULL,
+                   uint minSize = kMaxSendQueueSize) {
         trackGuidStats_ = trackGuidStats;
-        sendQueue_ = pcap_sendqueue_alloc(1*1024*1024);
+        arena_ = arena;
+        sendQueue_ = NULL;
+        if (arena_) {
+            uint maxSize = kMaxSendQueueSize;
+            uint size = 0;
+            arenaQueue_.buffer = arena_->allocate(qMin(minSize, maxSize),
+                                                  maxSize, &size);
+            arenaQueue_.maxlen = size;
+            arenaQueue_.len = 0;
+            if (arenaQueue_.buffer)
+                sendQueue_ = &arenaQueue_;
+        }
+        if (!sendQueue_)
+            sendQueue_ = pcap_sendqueue_alloc(kMaxSendQueueSize);
         lastPacket_ = NULL;
         packets_ = 0;
         bytes_ = 0;
@@ -39,7 +58,8 @@ public:
         usecDelay_ = 0;
     }
     ~PacketSequence() {
-        pcap_sendqueue_destroy(sendQueue_);
+        if (sendQueue_ != &arenaQueue_)
+            pcap_sendqueue_destroy(sendQueue_);
     }
     bool hasFreeSpace(int size) {
         if ((sendQueue_->len + size) <= sendQueue_->maxlen)
@@ -71,6 +91,39 @@ public:
         }
         return ret;
     }
+    // Returns the unused space (if any) to the arena - no more packets
+    // can be appended after this
+    void shrinkToFit() {
+        if (sendQueue_ != &arenaQueue_)
+            return;
+        arena_->trim(arenaQueue_.buffer, arenaQueue_.maxlen, arenaQueue_.len);
+        arenaQueue_.maxlen = arenaQueue_.len;
+    }
+    // Marks the last appended packet to be patched at transmit time
+    void addPatchedPacket(const FramePatchTable *table, quint64 frameIndex) {
+        int packet = packets_ - 1;
+        if (!patchRuns_.isEmpty()) {
+            PatchRun &run = patchRuns_.last();
+            if ((run.table == table)
+                    && (run.firstPacket + run.packetCount == packet)
+                    && (run.frameIndex + run.packetCount == frameIndex)) {
+                run.packetCount++;
+                return;
+            }
+        }
+        PatchRun run = { packet, 1, table, frameIndex };
+        patchRuns_.append(run);
+    }
+
+    // Consecutive packets (of a stream) patched at transmit time -
+    // frameIndex is that of firstPacket in the first repeat
+    struct PatchRun {
+        int firstPacket;
+        int packetCount;
+        const FramePatchTable *table;
+        quint64 frameIndex;
+    };
+
     pcap_send_queue *sendQueue_;
     struct pcap_pkthdr *lastPacket_;
     long packets_;
@@ -80,9 +133,14 @@ public:
     int repeatSize_;
     long usecDelay_;
     StreamStats streamStatsMeta_;
+    QList<PatchRun> patchRuns_;
+
+    static const uint kMaxSendQueueSize = 1*1024*1024;
 
 private:
     bool trackGuidStats_;
+    SendQueueArena *arena_;
+    pcap_send_queue arenaQueue_;
 };
 
 #endif
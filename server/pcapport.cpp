@@ -24,17 +24,26 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <QtGlobal>
 
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
 pcap_if_t *PcapPort::deviceList_ = NULL;
 
 PcapPort::PcapPort(int id, const char *device)
     : AbstractPort(id, device)
 {
+    const ThreadPlacement *placement = ThreadPlacement::forDevice(device);
+
     monitorRx_ = new PortMonitor(device, kDirectionRx, &stats_);
     monitorTx_ = new PortMonitor(device, kDirectionTx, &stats_);
-    transmitter_ = new PcapTransmitter(device, streamStats_);
+    transmitter_ = new PcapTransmitter(device, streamStats_,
+                                       streamStatsLock_);
     capturer_ = new PortCapturer(device);
     emulXcvr_ = new EmulationTransceiver(device, deviceManager_);
-    rxStatsPoller_ = new PcapRxStats(device, streamStats_);
+    rxStatsPoller_ = new PcapRxStats(device, streamStats_,
+                                     streamStatsLock_);
 
     if (!monitorRx_->handle() || !monitorTx_->handle())
         isUsable_ = false;
@@ -59,6 +68,13 @@ PcapPort::PcapPort(int id, const char *device)
             //! \todo set port IP addr also
         }
     }
+
+    if (placement->numaNode() >= 0)
+        data_.set_numa_node(placement->numaNode());
+    data_.set_tx_cpu_list(qPrintable(ThreadPlacement::cpuListString(
+                    placement->cpuList(ThreadPlacement::kTxThread))));
+    data_.set_rx_cpu_list(qPrintable(ThreadPlacement::cpuListString(
+                    placement->cpuList(ThreadPlacement::kRxThread))));
 }
 
 void PcapPort::init()
@@ -150,6 +166,13 @@ void PcapPort::stopDeviceEmulation()
     emulXcvr_->stop();
 }
 
+// Device encap config (tpids/vlans) has changed
+void PcapPort::updateDeviceEmulation()
+{
+    emulXcvr_->setFilter(deviceManager_->tpidList(),
+                         deviceManager_->vlanDepth());
+}
+
 int PcapPort::sendEmulationPacket(PacketBuffer *pktBuf)
 {
     return emulXcvr_->transmitPacket(pktBuf);
@@ -210,6 +233,7 @@ PcapPort::PortMonitor::PortMonitor(const char *device, Direction direction,
     isPromisc_ = true;
     noLocalCapture = true;
     stats_ = stats;
+    placement_ = ThreadPlacement::forDevice(device);
     stop_ = false;
 
 _retry:
@@ -289,6 +313,8 @@ PcapPort::PortMonitor::~PortMonitor()
 
 void PcapPort::PortMonitor::run()
 {
+    placement_->placeCurrentThread(ThreadPlacement::kStatsThread);
+
     while (!stop_)
     {
         int ret;
@@ -351,6 +377,7 @@ void PcapPort::PortMonitor::stop()
 PcapPort::PortCapturer::PortCapturer(const char *device)
 {
     device_ = QString::fromLatin1(device);
+    placement_ = ThreadPlacement::forDevice(device);
     stop_ = false;
     state_ = kNotStarted;
 
@@ -375,6 +402,8 @@ void PcapPort::PortCapturer::run()
     
     qDebug("In %s", __PRETTY_FUNCTION__);
 
+    placement_->placeCurrentThread(ThreadPlacement::kRxThread);
+
     if (!capFile_.isOpen())
     {
         qWarning("temp cap file is not open");
@@ -488,14 +517,145 @@ QFile* PcapPort::PortCapturer::captureFile()
  * Transmit+Receiver for Device/ProtocolEmulation
  * ------------------------------------------------------------------- *
  */
+const quint16 kEthTypeArp = 0x0806;
+const quint16 kEthTypeIp4 = 0x0800;
+const quint16 kEthTypeIp6 = 0x86dd;
+const quint8 kIpProtoIcmp = 1;
+const quint8 kIpProtoIcmp6 = 58;
+const int kEmulSnapLen = 65535;
+const int kEmulRxTimeout = 10; // msec
+const int kEmulRxBufferSize = 8*1024*1024; // bytes
+const int kEmulTxBatchSize = 64; // pkts
+
+/*
+ * We build our own classic BPF program instead of compiling a capture
+ * filter expression because the 'vlan' keyword of pcap-filter is a kludge
+ * (each use increments the decoding offsets by 4 for the rest of the
+ * expression) and it does not know about user configured TPIDs.
+ *
+ * The program accepts ARP, ICMPv4 and ICMPv6 frames that are untagged or
+ * tagged with upto vlanDepth tags using any of the TPIDs in tpidList. For
+ * each tag level, with ofs as the offset of the ethType/TPID -
+ *
+ *          ldh [ofs]
+ *          jeq #ARP, accept
+ *          jeq #IPv4, ip4
+ *          jeq #IPv6, ip6
+ *          jeq #TPID1, next-level
+ *          ...
+ *          jeq #TPIDn, next-level, reject
+ *    ip4:  ldb [ofs+2+9]
+ *          jeq #ICMP, accept, reject
+ *    ip6:  ldb [ofs+2+6]
+ *          jeq #ICMPv6, accept, reject
+ *
+ * followed by -
+ *
+ * accept:  ret #snaplen
+ * reject:  ret #0
+ *
+ * Since BPF jump offsets are limited to 8 bits, an empty program is
+ * returned if there are too many TPIDs/levels
+ */
+static bool bpfJump(QVector<struct bpf_insn> &prog, quint32 k,
+        int jt, int jf)
+{
+    struct bpf_insn insn;
+    int pc = prog.size();
+
+    // jt/jf are absolute instruction indices - convert to relative offsets
+    if (((jt - pc - 1) > 255) || ((jf - pc - 1) > 255))
+        return false;
+
+    insn.code = BPF_JMP | BPF_JEQ | BPF_K;
+    insn.jt = jt - pc - 1;
+    insn.jf = jf - pc - 1;
+    insn.k = k;
+    prog.append(insn);
+
+    return true;
+}
+
+static void bpfStmt(QVector<struct bpf_insn> &prog, quint16 code, quint32 k)
+{
+    struct bpf_insn insn;
+
+    insn.code = code;
+    insn.jt = insn.jf = 0;
+    insn.k = k;
+    prog.append(insn);
+}
+
+static QVector<struct bpf_insn> emulationFilter(QList<quint16> tpidList,
+        int vlanDepth)
+{
+    QVector<struct bpf_insn> prog;
+    QList<int> levelStart;
+    int accept, reject;
+
+    // Calculate where each level starts so that we can jump forward
+    levelStart.append(0);
+    for (int i = 0; i <= vlanDepth; i++)
+        levelStart.append(levelStart.at(i) + 8
+                          + (i < vlanDepth ? tpidList.size() : 0));
+    accept = levelStart.last();
+    reject = accept + 1;
+
+    for (int i = 0; i <= vlanDepth; i++) {
+        int ofs = 12 + 4*i; // offset of ethType/tpid
+        int tpidCount = i < vlanDepth ? tpidList.size() : 0;
+        int ip4 = levelStart.at(i) + 4 + tpidCount;
+        int ip6 = ip4 + 2;
+        int next;
+        bool ok = true;
+
+        Q_ASSERT(prog.size() == levelStart.at(i));
+
+        bpfStmt(prog, BPF_LD | BPF_H | BPF_ABS, ofs);
+        ok &= bpfJump(prog, kEthTypeArp, accept, prog.size() + 1);
+        ok &= bpfJump(prog, kEthTypeIp4, ip4, prog.size() + 1);
+        next = tpidCount ? prog.size() + 1 : reject;
+        ok &= bpfJump(prog, kEthTypeIp6, ip6, next);
+        for (int j = 0; j < tpidCount; j++) {
+            next = (j < tpidCount - 1) ? prog.size() + 1 : reject;
+            ok &= bpfJump(prog, tpidList.at(j), levelStart.at(i+1), next);
+        }
+
+        Q_ASSERT(prog.size() == ip4);
+        bpfStmt(prog, BPF_LD | BPF_B | BPF_ABS, ofs + 2 + 9); // IPv4 proto
+        ok &= bpfJump(prog, kIpProtoIcmp, accept, reject);
+
+        Q_ASSERT(prog.size() == ip6);
+        bpfStmt(prog, BPF_LD | BPF_B | BPF_ABS, ofs + 2 + 6); // IPv6 nxthdr
+        ok &= bpfJump(prog, kIpProtoIcmp6, accept, reject);
+
+        if (!ok)
+            return QVector<struct bpf_insn>();
+    }
+
+    Q_ASSERT(prog.size() == accept);
+    bpfStmt(prog, BPF_RET | BPF_K, kEmulSnapLen);
+    bpfStmt(prog, BPF_RET | BPF_K, 0);
+
+    return prog;
+}
+
 PcapPort::EmulationTransceiver::EmulationTransceiver(const char *device,
         DeviceManager *deviceManager)
 {
+    QList<quint16> tpidList;
+
     device_ = QString::fromLatin1(device);
+    placement_ = ThreadPlacement::forDevice(device);
     deviceManager_ = deviceManager;
     stop_ = false;
     state_ = kNotStarted;
     handle_ = NULL;
+
+    // Till we are told about the actual TPIDs/vlans in use, accept upto
+    // 4 tags of the standard TPID
+    tpidList.append(0x8100);
+    setFilter(tpidList, 4);
 }
 
 PcapPort::EmulationTransceiver::~EmulationTransceiver()
@@ -507,45 +667,11 @@ void PcapPort::EmulationTransceiver::run()
 {
     int flags = PCAP_OPENFLAG_PROMISCUOUS;
     char errbuf[PCAP_ERRBUF_SIZE] = "";
-    struct bpf_program bpf;
-#if 0
-    const char *capture_filter =
-        "arp or icmp or icmp6 or "
-        "(vlan and (arp or icmp or icmp6)) or "
-        "(vlan and vlan and (arp or icmp or icmp6)) or "
-        "(vlan and vlan and vlan and (arp or icmp or icmp6)) or "
-        "(vlan and vlan and vlan and vlan and (arp or icmp or icmp6))";
-/*
-    Ideally we should use the above filter, but the 'vlan' capture filter
-    in libpcap is implemented as a kludge. From the pcap-filter man page -
-
-    vlan [vlan_id]
-       Note that the first vlan keyword encountered in expression changes
-       the decoding offsets for the remainder of expression on the
-       assumption that the packet is a VLAN packet.
-
-       The  vlan [vlan_id] expression may be used more than once, to filter on
-       VLAN hierarchies. Each use of that expression increments the filter
-       offsets by 4.
-
-    See https://ask.wireshark.org/questions/31953/unusual-behavior-with-stacked-vlan-tags-and-capture-filter
-
-    So we use the modified filter expression that works as we intend. If ever
-    libpcap changes their implementation, this will need to change as well.
-*/
-#else
-    const char *capture_filter =
-        "arp or icmp or icmp6 or "
-        "(vlan and (arp or icmp or icmp6)) or "
-        "(vlan and (arp or icmp or icmp6)) or "
-        "(vlan and (arp or icmp or icmp6)) or "
-        "(vlan and (arp or icmp or icmp6))";
-#endif
-
-    const int optimize = 1;
 
     qDebug("In %s", __PRETTY_FUNCTION__);
 
+    placement_->placeCurrentThread(ThreadPlacement::kRxThread);
+
 #ifdef Q_OS_WIN32
     flags |= PCAP_OPENFLAG_NOCAPTURE_LOCAL;
 #endif
@@ -553,11 +679,32 @@ void PcapPort::EmulationTransceiver::run()
 #ifdef Q_OS_WIN32
 _retry:
     // NOCAPTURE_LOCAL needs windows only pcap_open()
-    handle_ = pcap_open(qPrintable(device_), 65535,
-                flags, 100 /* ms */, NULL, errbuf);
+    handle_ = pcap_open(qPrintable(device_), kEmulSnapLen,
+                flags, kEmulRxTimeout, NULL, errbuf);
 #else
-    handle_ = pcap_open_live(qPrintable(device_), 65535,
-                    flags, 100 /* ms */, errbuf);
+    // Use pcap_create() + pcap_activate() instead of pcap_open_live() so
+    // that we can ask for a larger kernel ring buffer - we read from it
+    // in batches using pcap_dispatch()
+    handle_ = pcap_create(qPrintable(device_), errbuf);
+    if (handle_) {
+        int ret;
+
+        pcap_set_snaplen(handle_, kEmulSnapLen);
+        pcap_set_promisc(handle_, 1);
+        pcap_set_timeout(handle_, kEmulRxTimeout);
+        pcap_set_buffer_size(handle_, kEmulRxBufferSize);
+
+        ret = pcap_activate(handle_);
+        if (ret == PCAP_WARNING_PROMISC_NOTSUP)
+            snprintf(errbuf, sizeof(errbuf), "promiscuous mode not supported");
+        else if (ret < 0)
+            snprintf(errbuf, sizeof(errbuf), "%s", pcap_geterr(handle_));
+
+        if ((ret < 0) || (ret == PCAP_WARNING_PROMISC_NOTSUP)) {
+            pcap_close(handle_);
+            handle_ = NULL;
+        }
+    }
 #endif
 
     if (handle_ == NULL)
@@ -585,66 +732,33 @@ _retry:
         }
     }
 
-    // TODO: for now the filter is hardcoded to accept tagged/untagged
-    // ARP/NDP or ICMPv4/v6; when more protocols are added, we may need
-    // to derive this filter based on which protocols are configured
-    // on the devices
-    if (pcap_compile(handle_, &bpf, capture_filter, optimize, 0) < 0)
-    {
-        qWarning("%s: error compiling filter: %s", qPrintable(device_),
-                pcap_geterr(handle_));
-        goto _skip_filter;
-    }
-
-    if (pcap_setfilter(handle_, &bpf) < 0)
-    {
-        qWarning("%s: error setting filter: %s", qPrintable(device_),
-                pcap_geterr(handle_));
-        goto _skip_filter;
-    }
+    applyFilter();
 
-_skip_filter:
     state_ = kRunning;
     while (1)
     {
         int ret;
-        struct pcap_pkthdr *hdr;
-        const uchar *data;
 
-        ret = pcap_next_ex(handle_, &hdr, &data);
-        switch (ret)
-        {
-            case 1:
-            {
-                PacketBuffer *pktBuf = new PacketBuffer(data, hdr->caplen);
-#if 0
-                for (int i = 0; i < 64; i++) {
-                    printf("%02x ", data[i]);
-                    if (i % 16 == 0)
-                        printf("\n");
-                }
-                printf("\n");
-#endif
-                // XXX: deviceManager should free pktBuf before returning
-                // from this call; if it needs to process the pkt async
-                // it should make a copy as the pktBuf's data buffer is
-                // owned by libpcap which does not guarantee data will
-                // persist across calls to pcap_next_ex()
-                deviceManager_->receivePacket(pktBuf);
-                break;
-            }
-            case 0:
-                // timeout: just go back to the loop
-                break;
-            case -1:
-                qWarning("%s: error reading packet (%d): %s",
-                        __PRETTY_FUNCTION__, ret, pcap_geterr(handle_));
-                break;
-            case -2:
-            default:
-                qFatal("%s: Unexpected return value %d", __PRETTY_FUNCTION__,
-                        ret);
-        }
+        if (isFilterDirty_)
+            applyFilter();
+
+        // Process all pkts available in the buffer in one go
+        ret = pcap_dispatch(handle_, -1, receivePacket, (u_char*) this);
+        if (ret == -1)
+            qWarning("%s: error reading packet (%d): %s",
+                    __PRETTY_FUNCTION__, ret, pcap_geterr(handle_));
+        else if (ret < 0)
+            qFatal("%s: Unexpected return value %d", __PRETTY_FUNCTION__,
+                    ret);
+
+        // Send pending neighbor resolve requests and age/refresh
+        // neighbors (both paced by the DeviceManager)
+        deviceManager_->processNeighborRequests();
+        deviceManager_->refreshDeviceNeighbors();
+
+        // Send out all replies (and refresh requests) generated for
+        // this batch
+        flushTxQueue();
 
         if (stop_)
         {
@@ -694,5 +808,111 @@ bool PcapPort::EmulationTransceiver::isRunning()
 
 int PcapPort::EmulationTransceiver::transmitPacket(PacketBuffer *pktBuf)
 {
+    if (!handle_)
+        return -1;
+
+    // Pkts sent by devices while processing a rx batch (i.e. replies)
+    // are queued and sent together at the end of the batch; pkts sent
+    // from other threads (e.g. ARP/NDP requests) are sent right away
+    if (QThread::currentThread() == this) {
+        txQueue_.append(QByteArray((const char*)pktBuf->data(),
+                                   pktBuf->length()));
+        if (txQueue_.size() >= kEmulTxBatchSize)
+            flushTxQueue();
+        return 0;
+    }
+
     return pcap_sendpacket(handle_, pktBuf->data(), pktBuf->length());
 }
+
+void PcapPort::EmulationTransceiver::setFilter(QList<quint16> tpidList,
+        int vlanDepth)
+{
+    QVector<struct bpf_insn> filter = emulationFilter(tpidList, vlanDepth);
+
+    if (filter.isEmpty()) {
+        qWarning("%s: too many TPIDs (%d) or vlans (%d) for emulation filter;"
+                 " accepting all packets", qPrintable(device_),
+                 tpidList.size(), vlanDepth);
+        bpfStmt(filter, BPF_RET | BPF_K, kEmulSnapLen);
+    }
+
+    filterLock_.lock();
+    filter_ = filter;
+    isFilterDirty_ = true;
+    filterLock_.unlock();
+}
+
+//
+// Private methods
+//
+void PcapPort::EmulationTransceiver::receivePacket(u_char *user,
+        const struct pcap_pkthdr *hdr, const u_char *data)
+{
+    EmulationTransceiver *self = (EmulationTransceiver*) user;
+    PacketBuffer *pktBuf = new PacketBuffer(data, hdr->caplen);
+
+    // XXX: deviceManager should free pktBuf before returning
+    // from this call; if it needs to process the pkt async
+    // it should make a copy as the pktBuf's data buffer is
+    // owned by libpcap which does not guarantee data will
+    // persist across callbacks
+    self->deviceManager_->receivePacket(pktBuf);
+}
+
+void PcapPort::EmulationTransceiver::applyFilter()
+{
+    struct bpf_program bpf;
+
+    filterLock_.lock();
+    bpf.bf_len = filter_.size();
+    bpf.bf_insns = filter_.data();
+    if (pcap_setfilter(handle_, &bpf) < 0)
+        qWarning("%s: error setting filter: %s", qPrintable(device_),
+                pcap_geterr(handle_));
+    isFilterDirty_ = false;
+    filterLock_.unlock();
+}
+
+void PcapPort::EmulationTransceiver::flushTxQueue()
+{
+    int sent = 0;
+
+    if (txQueue_.isEmpty())
+        return;
+
+#ifdef Q_OS_LINUX
+    // On Linux, pcap_sendpacket() is just a send() on the underlying
+    // packet socket, so we can send the entire queue using sendmmsg()
+    int fd = pcap_fileno(handle_);
+    int count = txQueue_.size();
+    QVector<struct mmsghdr> msgs(count);
+    QVector<struct iovec> iovs(count);
+
+    for (int i = 0; i < count; i++) {
+        iovs[i].iov_base = const_cast<char*>(txQueue_.at(i).constData());
+        iovs[i].iov_len = txQueue_.at(i).size();
+        memset(&msgs[i], 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (sent < count) {
+        int ret = sendmmsg(fd, msgs.data() + sent, count - sent, 0);
+        if (ret <= 0)
+            break;
+        sent += ret;
+    }
+#endif
+
+    // Send the remaining ones (if any) one by one
+    for (int i = sent; i < txQueue_.size(); i++) {
+        const QByteArray &pkt = txQueue_.at(i);
+        if (pcap_sendpacket(handle_, (const uchar*) pkt.constData(),
+                            pkt.size()) < 0)
+            qWarning("%s: error sending packet: %s", qPrintable(device_),
+                    pcap_geterr(handle_));
+    }
+
+    txQueue_.clear();
+}
@@ -20,14 +20,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _SERVER_PCAP_PORT_H
 #define _SERVER_PCAP_PORT_H
 
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
 #include <QTemporaryFile>
 #include <QThread>
+#include <QVector>
 #include <pcap.h>
 
 #include "abstractport.h"
 #include "pcapextra.h"
 #include "pcaprxstats.h"
 #include "pcaptransmitter.h"
+#include "threadplacement.h"
 
 class PcapPort : public AbstractPort
 {
@@ -60,6 +65,10 @@ public:
     {
         transmitter_->setPacketListLoopMode(loop, secDelay, nsecDelay);
     }
+    virtual bool setPacketListPatches(FramePatchTable *patches)
+    {
+        return transmitter_->setPacketListPatches(patches);
+    }
 
     virtual void startTransmit() { 
         Q_ASSERT(!isDirty());
@@ -75,6 +84,7 @@ public:
 
     virtual void startDeviceEmulation();
     virtual void stopDeviceEmulation();
+    virtual void updateDeviceEmulation();
     virtual int sendEmulationPacket(PacketBuffer *pktBuf);
 
 protected:
@@ -98,6 +108,7 @@ protected:
         bool isPromiscuous() { return isPromisc_; }
     protected:
         AbstractPort::PortStats *stats_;
+        const ThreadPlacement *placement_;
         bool stop_;
     private:
         pcap_t *handle_;
@@ -126,6 +137,7 @@ protected:
         };
 
         QString         device_;
+        const ThreadPlacement *placement_;
         volatile bool   stop_;
         QTemporaryFile  capFile_;
         pcap_t          *handle_;
@@ -143,6 +155,7 @@ protected:
         void stop();
         bool isRunning();
         int transmitPacket(PacketBuffer *pktBuf);
+        void setFilter(QList<quint16> tpidList, int vlanDepth);
 
     private:
         enum State
@@ -152,11 +165,27 @@ protected:
             kFinished
         };
 
+        static void receivePacket(u_char *user,
+                const struct pcap_pkthdr *hdr, const u_char *data);
+        void applyFilter();
+        void flushTxQueue();
+
         QString         device_;
+        const ThreadPlacement *placement_;
         DeviceManager   *deviceManager_;
         volatile bool   stop_;
         pcap_t          *handle_;
         volatile State  state_;
+
+        // BPF program is built by setFilter() but is applied only by
+        // the transceiver thread
+        QMutex          filterLock_;
+        QVector<struct bpf_insn> filter_;
+        volatile bool   isFilterDirty_;
+
+        // Pkts sent while processing a rx batch are queued and sent
+        // together at the end of the batch
+        QList<QByteArray> txQueue_;
     };
 
     PortMonitor     *monitorRx_;
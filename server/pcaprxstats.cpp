@@ -24,10 +24,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #define Xnotify qWarning // FIXME
 
-PcapRxStats::PcapRxStats(const char *device, StreamStats &portStreamStats)
-    : streamStats_(portStreamStats)
+PcapRxStats::PcapRxStats(const char *device, StreamStats &portStreamStats,
+                         QMutex &portStreamStatsLock)
+    : streamStats_(portStreamStats), streamStatsLock_(portStreamStatsLock)
 {
     device_ = QString::fromLatin1(device);
+    placement_ = ThreadPlacement::forDevice(device);
     stop_ = false;
     state_ = kNotStarted;
     isDirectional_ = true;
@@ -61,6 +63,8 @@ void PcapRxStats::run()
 
     qDebug("In %s", __PRETTY_FUNCTION__);
 
+    placement_->placeCurrentThread(ThreadPlacement::kRxThread);
+
     handle_ = pcap_open_live(qPrintable(device_), 65535,
                     flags, 100 /* ms */, errbuf);
     if (handle_ == NULL) {
@@ -115,8 +119,11 @@ _skip_filter:
             case 1: {
                 uint guid;
                 if (SignProtocol::packetGuid(data, hdr->caplen, &guid)) {
-                    streamStats_[guid].rx_pkts++;
-                    streamStats_[guid].rx_bytes += hdr->caplen;
+                    QMutexLocker locker(&streamStatsLock_);
+                    StreamStatsTuple &sst = streamStats_[guid];
+
+                    sst.rx_pkts++;
+                    sst.rx_bytes += hdr->caplen;
                 }
                 break;
             }
@@ -21,14 +21,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define _PCAP_RX_STATS_H
 
 #include "streamstats.h"
+#include "threadplacement.h"
 
+#include <QMutex>
 #include <QThread>
 #include <pcap.h>
 
 class PcapRxStats: public QThread
 {
 public:
-    PcapRxStats(const char *device, StreamStats &portStreamStats);
+    PcapRxStats(const char *device, StreamStats &portStreamStats,
+                QMutex &portStreamStatsLock);
     pcap_t* handle();
     void run();
     bool start();
@@ -44,7 +47,9 @@ private:
     };
 
     QString device_;
+    const ThreadPlacement *placement_;
     StreamStats &streamStats_;
+    QMutex &streamStatsLock_;
     volatile bool stop_;
     pcap_t *handle_;
     volatile State state_;
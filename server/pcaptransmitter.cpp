@@ -21,8 +21,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 PcapTransmitter::PcapTransmitter(
         const char *device,
-        StreamStats &portStreamStats)
-    : streamStats_(portStreamStats), txThread_(device)
+        StreamStats &portStreamStats,
+        QMutex &portStreamStatsLock)
+    : streamStats_(portStreamStats), streamStatsLock_(portStreamStatsLock),
+      txThread_(device), txStats_(device)
 {
     adjustRxStreamStats_ = false;
     memset(&stats_, 0, sizeof(stats_));
@@ -74,6 +76,11 @@ bool PcapTransmitter::appendToPacketList(long sec, long nsec,
     return txThread_.appendToPacketList(sec, nsec, packet, length);
 }
 
+bool PcapTransmitter::setPacketListPatches(FramePatchTable *patches)
+{
+    return txThread_.setPacketListPatches(patches);
+}
+
 void PcapTransmitter::setHandle(pcap_t *handle)
 {
     txThread_.setHandle(handle);
@@ -112,6 +119,7 @@ void PcapTransmitter::updateTxThreadStreamStats()
     PcapTxThread *txThread = dynamic_cast<PcapTxThread*>(sender());
     const StreamStats& threadStreamStats = txThread->streamStats();
     StreamStatsIterator i(threadStreamStats);
+    QMutexLocker locker(&streamStatsLock_);
 
     while (i.hasNext())
     {
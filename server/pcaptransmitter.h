@@ -29,7 +29,8 @@ class PcapTransmitter : QObject
 {
     Q_OBJECT
 public:
-    PcapTransmitter(const char *device, StreamStats &portStreamStats);
+    PcapTransmitter(const char *device, StreamStats &portStreamStats,
+                    QMutex &portStreamStatsLock);
     ~PcapTransmitter();
 
     bool setRateAccuracy(AbstractPort::Accuracy accuracy);
@@ -41,6 +42,7 @@ public:
                            long repeatDelaySec, long repeatDelayNsec);
     bool appendToPacketList(long sec, long usec, const uchar *packet,
                             int length);
+    bool setPacketListPatches(FramePatchTable *patches);
     void setPacketListLoopMode(bool loop, quint64 secDelay, quint64 nsecDelay);
 
     void setHandle(pcap_t *handle);
@@ -53,6 +55,7 @@ private slots:
     void updateTxThreadStreamStats();
 private:
     StreamStats &streamStats_;
+    QMutex &streamStatsLock_;
     PcapTxThread txThread_;
     PcapTxStats txStats_;
     StatsTuple stats_;
@@ -20,15 +20,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "pcaptxstats.h"
 
 #include "pcaptxstats.h"
+#include "statsseries.h"
 #include "statstuple.h"
 
-PcapTxStats::PcapTxStats()
+PcapTxStats::PcapTxStats(const char *device)
 {
     txThreadStats_ = NULL;
 
     stats_ = new AbstractPort::PortStats;
     usingInternalStats_ = true;
 
+    placement_ = ThreadPlacement::forDevice(device);
+    refreshInterval_ = StatsSeries::counterRefreshInterval();
+
     stop_ = false;
 }
 
@@ -71,6 +75,8 @@ void PcapTxStats::run()
 {
     Q_ASSERT(txThreadStats_);
 
+    placement_->placeCurrentThread(ThreadPlacement::kStatsThread);
+
     qDebug("txStats: collection start");
 
     while (1) {
@@ -79,7 +85,7 @@ void PcapTxStats::run()
 
         if (stop_)
             break;
-        QThread::msleep(1000);
+        QThread::msleep(refreshInterval_);
     }
     stop_ = false;
     qDebug("txStats: collection end");
@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define _PCAP_TX_STATS_H
 
 #include "abstractport.h"
+#include "threadplacement.h"
 
 #include <QThread>
 
@@ -29,7 +30,7 @@ struct StatsTuple;
 class PcapTxStats : public QThread
 {
 public:
-    PcapTxStats();
+    PcapTxStats(const char *device);
     ~PcapTxStats();
 
     void setTxThreadStats(StatsTuple *stats);
@@ -46,6 +47,8 @@ private:
     bool usingInternalStats_;
     AbstractPort::PortStats *stats_;
 
+    const ThreadPlacement *placement_;
+    int refreshInterval_; // in msecs
     volatile bool stop_;
 };
 
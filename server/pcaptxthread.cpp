@@ -22,6 +22,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "statstuple.h"
 #include "timestamp.h"
 
+// Space for the first packet of a repeat set's sequence (whose size is not
+// known upfront) - larger than the max packet size in the packet list
+static const uint kMinSendQueueSize = 64*1024;
+
 PcapTxThread::PcapTxThread(const char *device)
 {
     char errbuf[PCAP_ERRBUF_SIZE] = "";
@@ -37,6 +41,8 @@ PcapTxThread::PcapTxThread(const char *device)
     state_ = kNotStarted;
     stop_ = false;
     trackStreamStats_ = false;
+    placement_ = ThreadPlacement::forDevice(device);
+    arena_ = new SendQueueArena(placement_);
     clearPacketList();
     handle_ = pcap_open_live(device, 64 /* FIXME */, 0, 1000 /* ms */, errbuf);
 
@@ -58,6 +64,12 @@ PcapTxThread::~PcapTxThread()
 {
     if (usingInternalHandle_)
         pcap_close(handle_);
+
+    // Sequences use the arena memory
+    while(packetSequenceList_.size())
+        delete packetSequenceList_.takeFirst();
+    qDeleteAll(patchTableList_);
+    delete arena_;
 }
 
 bool PcapTxThread::setRateAccuracy(
@@ -93,6 +105,14 @@ void PcapTxThread::clearPacketList()
     while(packetSequenceList_.size())
         delete packetSequenceList_.takeFirst();
 
+    // Reuse the send queue memory for the new packet list
+    arena_->reset();
+
+    qDeleteAll(patchTableList_);
+    patchTableList_.clear();
+    currentPatchTable_ = NULL;
+    patchFrameIndex_ = 0;
+
     currentPacketSequence_ = NULL;
     repeatSequenceStart_ = -1;
     repeatSize_ = 0;
@@ -107,7 +127,11 @@ void PcapTxThread::clearPacketList()
 void PcapTxThread::loopNextPacketSet(qint64 size, qint64 repeats,
         long repeatDelaySec, long repeatDelayNsec)
 {
-    currentPacketSequence_ = new PacketSequence(trackStreamStats_);
+    if (currentPacketSequence_)
+        currentPacketSequence_->shrinkToFit();
+
+    currentPacketSequence_ = new PacketSequence(trackStreamStats_, arena_,
+                                                kMinSendQueueSize);
     currentPacketSequence_->repeatCount_ = repeats;
     currentPacketSequence_->usecDelay_ = repeatDelaySec * long(1e6)
                                             + repeatDelayNsec/1000;
@@ -142,10 +166,12 @@ bool PcapTxThread::appendToPacketList(long sec, long nsec,
             usecs += (pktHdr.ts.tv_usec
                         - currentPacketSequence_->lastPacket_->ts.tv_usec);
             currentPacketSequence_->usecDelay_ = usecs;
+            currentPacketSequence_->shrinkToFit();
         }
 
-        //! \todo (LOW): calculate sendqueue size
-        currentPacketSequence_ = new PacketSequence(trackStreamStats_);
+        // Sized to its content later (see shrinkToFit())
+        currentPacketSequence_ = new PacketSequence(trackStreamStats_, arena_,
+                2*sizeof(pcap_pkthdr) + length);
 
         packetSequenceList_.append(currentPacketSequence_);
 
@@ -158,6 +184,12 @@ bool PcapTxThread::appendToPacketList(long sec, long nsec,
     {
         op = false;
     }
+    else if (currentPatchTable_)
+    {
+        currentPacketSequence_->addPatchedPacket(currentPatchTable_,
+                                                 patchFrameIndex_);
+        patchFrameIndex_++;
+    }
 
     packetCount_++;
     packetListSize_ += repeatSize_ ?
@@ -181,15 +213,35 @@ bool PcapTxThread::appendToPacketList(long sec, long nsec,
                     packetSequenceList_.size() - repeatSequenceStart_;
         }
 
+        // Frames of the packets following the set are after its repeats
+        patchFrameIndex_ += (packetSequenceList_[repeatSequenceStart_]
+                                ->repeatCount_ - 1) * repeatSize_;
         repeatSize_ = 0;
 
         // End current pktSeq and trigger a new pktSeq allocation for next pkt
+        currentPacketSequence_->shrinkToFit();
         currentPacketSequence_ = NULL;
     }
 
     return op;
 }
 
+/*!
+ * Packets appended after this call are patched by patches at transmit time
+ * (see FramePatchTable) - the first of them being frame 0 of the stream;
+ * NULL stops patching. Takes ownership of patches
+ */
+bool PcapTxThread::setPacketListPatches(FramePatchTable *patches)
+{
+    if (patches)
+        patchTableList_.append(patches);
+
+    currentPatchTable_ = patches;
+    patchFrameIndex_ = 0;
+
+    return true;
+}
+
 void PcapTxThread::setPacketListLoopMode(
         bool loop,
         quint64 secDelay,
@@ -242,6 +294,8 @@ void PcapTxThread::run()
     int i;
     long overHead = 0; // overHead should be negative or zero
 
+    placement_->placeCurrentThread(ThreadPlacement::kTxThread);
+
     qDebug("packetSequenceList_.size = %d", packetSequenceList_.size());
     if (packetSequenceList_.size() <= 0)
         goto _exit;
@@ -266,6 +320,10 @@ void PcapTxThread::run()
 _restart:
         int rptSz  = packetSequenceList_.at(i)->repeatSize_;
         int rptCnt = packetSequenceList_.at(i)->repeatCount_;
+        quint64 setSize = 0; // packets - for patched frame indices
+
+        for (int k = 0; k < rptSz; k++)
+            setSize += packetSequenceList_.at(i+k)->packets_;
 
         for (int j = 0; j < rptCnt; j++)
         {
@@ -276,7 +334,8 @@ _restart:
 #ifdef Q_OS_WIN32
                 TimeStamp ovrStart, ovrEnd;
 
-                if (seq->usecDuration_ <= long(1e6)) // 1s
+                if ((seq->usecDuration_ <= long(1e6)) // 1s
+                        && seq->patchRuns_.isEmpty())
                 {
                     getTimeStamp(&ovrStart);
                     ret = pcap_sendqueue_transmit(handle_,
@@ -296,12 +355,12 @@ _restart:
                 }
                 else
                 {
-                    ret = sendQueueTransmit(handle_, seq->sendQueue_,
-                            overHead, kSyncTransmit);
+                    ret = sendQueueTransmit(handle_, seq, overHead,
+                            kSyncTransmit, j * setSize);
                 }
 #else
-                ret = sendQueueTransmit(handle_, seq->sendQueue_,
-                            overHead, kSyncTransmit);
+                ret = sendQueueTransmit(handle_, seq, overHead,
+                            kSyncTransmit, j * setSize);
 #endif
 
                 if (ret >= 0)
@@ -386,13 +445,15 @@ bool PcapTxThread::isRunning()
     return (state_ == kRunning);
 }
 
-int PcapTxThread::sendQueueTransmit(pcap_t *p,
-        pcap_send_queue *queue, long &overHead, int sync)
+int PcapTxThread::sendQueueTransmit(pcap_t *p, PacketSequence *seq,
+        long &overHead, int sync, quint64 frameIndexOffset)
 {
     TimeStamp ovrStart, ovrEnd;
     struct timeval ts;
+    pcap_send_queue *queue = seq->sendQueue_;
     struct pcap_pkthdr *hdr = (struct pcap_pkthdr*) queue->buffer;
     char *end = queue->buffer + queue->len;
+    int packet = 0, runIndex = 0;
 
     ts = hdr->ts;
 
@@ -426,7 +487,24 @@ int PcapTxThread::sendQueueTransmit(pcap_t *p,
 
         Q_ASSERT(pktLen > 0);
 
+        // Patched in place - the patch for the next repeat overwrites it
+        while ((runIndex < seq->patchRuns_.size())
+                && (packet >= seq->patchRuns_.at(runIndex).firstPacket
+                            + seq->patchRuns_.at(runIndex).packetCount))
+            runIndex++;
+
+        if ((runIndex < seq->patchRuns_.size())
+                && (packet >= seq->patchRuns_.at(runIndex).firstPacket))
+        {
+            const PacketSequence::PatchRun &run = seq->patchRuns_.at(runIndex);
+
+            run.table->apply(pkt, pktLen, run.frameIndex + frameIndexOffset
+                                            + (packet - run.firstPacket));
+        }
+        packet++;
+
         pcap_sendpacket(p, pkt, pktLen);
+
         stats_->pkts++;
         stats_->bytes += pktLen;
 
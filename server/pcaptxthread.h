@@ -23,6 +23,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "abstractport.h"
 #include "packetsequence.h"
 #include "statstuple.h"
+#include "threadplacement.h"
 
 #include <QThread>
 #include <pcap.h>
@@ -41,6 +42,7 @@ public:
                            long repeatDelaySec, long repeatDelayNsec);
     bool appendToPacketList(long sec, long usec, const uchar *packet,
                             int length);
+    bool setPacketListPatches(FramePatchTable *patches);
     void setPacketListLoopMode(bool loop, quint64 secDelay, quint64 nsecDelay);
 
     void setHandle(pcap_t *handle);
@@ -65,8 +67,8 @@ private:
     };
 
     static void udelay(unsigned long usec);
-    int sendQueueTransmit(pcap_t *p, pcap_send_queue *queue, long &overHead,
-                int sync);
+    int sendQueueTransmit(pcap_t *p, PacketSequence *seq, long &overHead,
+                int sync, quint64 frameIndexOffset);
     void updateStreamStats();
 
     // Intermediate state variables used while building the packet list
@@ -78,11 +80,18 @@ private:
     QList<PacketSequence*> packetSequenceList_;
     quint64 packetListSize_; // count of pkts in packet List including repeats
 
+    QList<FramePatchTable*> patchTableList_;
+    FramePatchTable *currentPatchTable_;
+    quint64 patchFrameIndex_;
+
     int returnToQIdx_;
     quint64 loopDelay_;
 
     void (*udelayFn_)(unsigned long);
 
+    const ThreadPlacement *placement_;
+    SendQueueArena *arena_;
+
     bool usingInternalHandle_;
     pcap_t *handle_;
     volatile bool stop_;
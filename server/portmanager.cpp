@@ -103,8 +103,10 @@ PortManager::PortManager()
 
     FreePortList(deviceList);
 
-    foreach(AbstractPort *port, portList_)
+    foreach(AbstractPort *port, portList_) {
         port->init();
+        port->startStatsSeries();
+    }
     
     return;
 }
@@ -0,0 +1,217 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "sendqueuearena.h"
+
+#include "threadplacement.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(Q_OS_LINUX)
+#include <sys/mman.h>
+#endif
+
+static const size_t kHugePageSize = 2 << 20;
+
+// Chunks start small (so that small packet lists don't hog memory) and
+// grow with the packet list
+static const size_t kMinChunkSize = kHugePageSize;
+static const size_t kMaxChunkSize = 64 << 20;
+
+// Send queue buffers hold pcap_pkthdr's
+static const size_t kAlignment = 8;
+
+static inline size_t roundUp(size_t size, size_t multiple)
+{
+    return (size + multiple - 1) / multiple * multiple;
+}
+
+SendQueueArena::SendQueueArena(const ThreadPlacement *placement)
+{
+    placement_ = placement;
+    current_ = 0;
+}
+
+SendQueueArena::~SendQueueArena()
+{
+    foreach(const Chunk &chunk, chunkList_)
+        freeChunk(chunk);
+}
+
+/*!
+ * Allocates a block of at least minSize and at most maxSize bytes and sets
+ * size to the actual size - the block is valid till the next reset()
+ *
+ * Returns NULL if the memory could not be allocated
+ */
+char* SendQueueArena::allocate(uint minSize, uint maxSize, uint *size)
+{
+    Q_ASSERT(minSize <= maxSize);
+
+    // Use the chunks left over from the previous packet list, if any,
+    // before adding a new one
+    while (current_ < chunkList_.size()) {
+        Chunk &chunk = chunkList_[current_];
+
+        if (chunk.size - chunk.used >= minSize)
+            break;
+        current_++;
+    }
+
+    if ((current_ == chunkList_.size()) && !addChunk(minSize))
+        return NULL;
+
+    Chunk &chunk = chunkList_[current_];
+    char *block = chunk.base + chunk.used;
+
+    *size = uint(qMin(size_t(maxSize), chunk.size - chunk.used));
+    chunk.used = qMin(chunk.size, roundUp(chunk.used + *size, kAlignment));
+
+    return block;
+}
+
+/*!
+ * Shrinks the block of size bytes to newSize bytes - the freed up space is
+ * reused only if block is the last allocated block
+ */
+void SendQueueArena::trim(const char *block, uint size, uint newSize)
+{
+    Q_ASSERT(newSize <= size);
+
+    if (current_ >= chunkList_.size())
+        return;
+
+    Chunk &chunk = chunkList_[current_];
+    size_t offset;
+
+    if ((block < chunk.base) || (block >= chunk.base + chunk.size))
+        return;
+
+    offset = block - chunk.base;
+    if (qMin(chunk.size, roundUp(offset + size, kAlignment)) != chunk.used)
+        return;
+
+    chunk.used = roundUp(offset + newSize, kAlignment);
+}
+
+/*!
+ * Makes all the memory available for allocation again - any blocks
+ * allocated so far should no longer be used
+ *
+ * Chunks that were not used since the last reset are freed
+ */
+void SendQueueArena::reset()
+{
+    for (int i = chunkList_.size() - 1; i >= 0; i--) {
+        if (chunkList_.at(i).used)
+            break;
+        freeChunk(chunkList_.takeAt(i));
+    }
+
+    for (int i = 0; i < chunkList_.size(); i++)
+        chunkList_[i].used = 0;
+
+    current_ = 0;
+}
+
+//! Returns the total size of the memory held by the arena
+quint64 SendQueueArena::capacity() const
+{
+    quint64 size = 0;
+
+    foreach(const Chunk &chunk, chunkList_)
+        size += chunk.size;
+
+    return size;
+}
+
+//
+// Private methods
+//
+bool SendQueueArena::addChunk(size_t minSize)
+{
+    Chunk chunk;
+
+    // Double the capacity every time (within limits)
+    chunk.size = qBound(kMinChunkSize, size_t(capacity()), kMaxChunkSize);
+    chunk.size = roundUp(qMax(chunk.size, minSize), kHugePageSize);
+    chunk.used = 0;
+    chunk.isMapped = false;
+    chunk.base = NULL;
+
+#if defined(Q_OS_LINUX)
+    void *base = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    // Needs huge pages reserved by the admin (vm.nr_hugepages)
+    base = mmap(NULL, chunk.size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (base == MAP_FAILED) {
+        base = mmap(NULL, chunk.size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+        // Transparent huge pages, if enabled
+        if (base != MAP_FAILED)
+            madvise(base, chunk.size, MADV_HUGEPAGE);
+#endif
+    }
+
+    if (base != MAP_FAILED) {
+        chunk.base = (char*) base;
+        chunk.isMapped = true;
+    }
+    else
+        qDebug("send queue arena: mmap of %lu bytes failed: %s",
+                ulong(chunk.size), strerror(errno));
+#endif
+
+    if (!chunk.base)
+        chunk.base = (char*) malloc(chunk.size);
+
+    if (!chunk.base) {
+        qWarning("send queue arena: unable to allocate %lu bytes",
+                ulong(chunk.size));
+        return false;
+    }
+
+    // Keep the packets on the same NUMA node as the NIC
+    if (placement_)
+        placement_->bindMemory(chunk.base, chunk.size);
+
+    qDebug("send queue arena: added chunk of %lu bytes (total %llu)",
+            ulong(chunk.size), capacity() + chunk.size);
+    chunkList_.append(chunk);
+    current_ = chunkList_.size() - 1;
+
+    return true;
+}
+
+void SendQueueArena::freeChunk(const Chunk &chunk)
+{
+#if defined(Q_OS_LINUX)
+    if (chunk.isMapped) {
+        munmap(chunk.base, chunk.size);
+        return;
+    }
+#endif
+    free(chunk.base);
+}
@@ -0,0 +1,71 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SERVER_SEND_QUEUE_ARENA_H
+#define _SERVER_SEND_QUEUE_ARENA_H
+
+#include <QList>
+#include <QtGlobal>
+
+#include <stddef.h>
+
+class ThreadPlacement;
+
+/*!
+ * Memory for the send queues of a port's packet list
+ *
+ * Send queue buffers are carved out of large chunks - backed by (2MB)
+ * huge pages where possible - instead of a malloc per send queue. A send
+ * queue is allocated as large as it may need to be and trim()'d to its
+ * content once it is complete, so that the next one starts right after it.
+ *
+ * reset() makes all the memory available again without freeing it, so
+ * that rebuilding the packet list reuses the same chunks; chunks that were
+ * not needed for the last packet list are freed at that point
+ */
+class SendQueueArena
+{
+public:
+    SendQueueArena(const ThreadPlacement *placement = NULL);
+    ~SendQueueArena();
+
+    char* allocate(uint minSize, uint maxSize, uint *size);
+    void trim(const char *block, uint size, uint newSize);
+    void reset();
+
+    quint64 capacity() const;
+
+private:
+    struct Chunk
+    {
+        char *base;
+        size_t size;
+        size_t used;
+        bool isMapped;  // mmap'd (vs. malloc'd)
+    };
+
+    bool addChunk(size_t minSize);
+    void freeChunk(const Chunk &chunk);
+
+    const ThreadPlacement *placement_;
+    QList<Chunk> chunkList_;
+    int current_; // index of the chunk being allocated from
+};
+
+#endif
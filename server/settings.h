@@ -42,4 +42,90 @@ const QString kRpcServerAddress("RpcServer/Address");
 const QString kPortListIncludeKey("PortList/Include");
 const QString kPortListExcludeKey("PortList/Exclude");
 
+//
+// NeighborResolve Section Keys
+//
+// ARP/NDP requests are sent in batches of BatchSize with a gap of
+// BatchInterval (msec) between batches; unresolved neighbors are retried
+// upto Retries times waiting Timeout (msec) - doubled on every retry - for
+// the replies
+//
+const QString kNeighborResolveBatchSizeKey("NeighborResolve/BatchSize");
+const int kNeighborResolveBatchSizeDefaultValue = 256;
+const QString kNeighborResolveBatchIntervalKey("NeighborResolve/BatchInterval");
+const int kNeighborResolveBatchIntervalDefaultValue = 10;
+const QString kNeighborResolveRetriesKey("NeighborResolve/Retries");
+const int kNeighborResolveRetriesDefaultValue = 2;
+const QString kNeighborResolveTimeoutKey("NeighborResolve/Timeout");
+const int kNeighborResolveTimeoutDefaultValue = 500;
+
+//
+// Resolved neighbors are aged out AgingTime (secs) after they were last
+// updated; a refresh request is sent RefreshAhead (secs) before that so
+// that neighbors that are still around don't age out. An AgingTime of 0
+// (default) disables aging - neighbors that stop responding are retained
+//
+const QString kNeighborResolveAgingTimeKey("NeighborResolve/AgingTime");
+const int kNeighborResolveAgingTimeDefaultValue = 0;
+const QString kNeighborResolveRefreshAheadKey("NeighborResolve/RefreshAhead");
+const int kNeighborResolveRefreshAheadDefaultValue = 60;
+
+//
+// PacketList Section Keys
+//
+// Memory budgets (in MB) for the packet list of a port and for the packet
+// lists of all ports put together - a packet list that would exceed either
+// is not built and transmit on the port is refused. A PortMemoryBudget of 0
+// means unlimited; a MemoryBudget of 0 means half the physical memory (if
+// known, unlimited otherwise)
+//
+const QString kPacketListPortMemoryBudgetKey("PacketList/PortMemoryBudget");
+const int kPacketListPortMemoryBudgetDefaultValue = 0;
+const QString kPacketListMemoryBudgetKey("PacketList/MemoryBudget");
+const int kPacketListMemoryBudgetDefaultValue = 0;
+
+//
+// Rendered frames of a port's streams are cached (upto FrameCacheSize MB
+// per port) so that streams that haven't changed need not be rendered
+// again when the packet list is rebuilt; 0 disables the cache. The cache
+// counts towards the packet list memory budgets above and is dropped if
+// a packet list needs the memory
+//
+const QString kPacketListFrameCacheSizeKey("PacketList/FrameCacheSize");
+const int kPacketListFrameCacheSizeDefaultValue = 256;
+
+//
+// StatsSeries Section Keys
+//
+// Port and stream counters are sampled every SampleInterval (msecs, min
+// 10) into an in-memory ring of the last Samples samples of each port;
+// stream counters go into a separate ring of StreamSamples entries (one
+// per stream per sample) per port. A SampleInterval of 0 disables
+// sampling. Port counters are refreshed from the OS at least as often as
+// they are sampled, so the port rates become averages over the smaller of
+// SampleInterval and 1 sec
+//
+const QString kStatsSeriesSampleIntervalKey("StatsSeries/SampleInterval");
+const int kStatsSeriesSampleIntervalDefaultValue = 1000;
+const QString kStatsSeriesSamplesKey("StatsSeries/Samples");
+const int kStatsSeriesSamplesDefaultValue = 3600;
+const QString kStatsSeriesStreamSamplesKey("StatsSeries/StreamSamples");
+const int kStatsSeriesStreamSamplesDefaultValue = 65536;
+
+//
+// ThreadPlacement Section Keys
+//
+// CPU lists are in the Linux cpulist format e.g. "2,4-7". Section level
+// keys are defaults for all ports; these can be overridden per port in a
+// subsection named after the port - with any '/' or '\' in the name
+// replaced by '_' e.g. ThreadPlacement/eth0/TxCpus. Tx/Rx threads that
+// are not configured are placed on the cpus of the port's NUMA node
+// (as reported by sysfs, unless NumaNode is configured)
+//
+const QString kThreadPlacementSection("ThreadPlacement");
+const QString kThreadPlacementNumaNodeKey("NumaNode");
+const QString kThreadPlacementTxCpusKey("TxCpus");
+const QString kThreadPlacementRxCpusKey("RxCpus");
+const QString kThreadPlacementStatsCpusKey("StatsCpus");
+
 #endif
@@ -0,0 +1,276 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "statsseries.h"
+
+#include "settings.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QSet>
+
+StatsSeries::StatsSeries(AbstractPort *port, StreamStats &portStreamStats,
+                         QMutex &portStreamStatsLock)
+    : streamStats_(portStreamStats), streamStatsLock_(portStreamStatsLock)
+{
+    port_ = port;
+    placement_ = ThreadPlacement::forDevice(port->name());
+    stop_ = false;
+
+    interval_ = configuredSampleInterval();
+    sampleCount_ = 0;
+    streamSampleCount_ = 0;
+    streamRingSize_ = 0;
+
+    if (!interval_)
+        return;
+
+    samples_.resize(qMax(appSettings->value(kStatsSeriesSamplesKey,
+                    kStatsSeriesSamplesDefaultValue).toInt(), 1));
+    streamRingSize_ = qMax(appSettings->value(kStatsSeriesStreamSamplesKey,
+                kStatsSeriesStreamSamplesDefaultValue).toInt(), 0);
+}
+
+StatsSeries::~StatsSeries()
+{
+    stop();
+}
+
+void StatsSeries::start()
+{
+    if (!interval_)
+        return;
+
+    QThread::start();
+
+    while (!isRunning())
+        QThread::msleep(10);
+}
+
+void StatsSeries::stop()
+{
+    stop_ = true;
+
+    while (isRunning())
+        QThread::msleep(10);
+}
+
+/*!
+ * Returns the samples of the port within the time range of the query
+ *
+ * Stream counters of a sample whose stream ring entries have since been
+ * overwritten are not returned - so a stream series may have fewer values
+ * than the port series; use its sample_index to align the two
+ */
+void StatsSeries::query(const OstProto::StatsSeriesQuery &query,
+                        OstProto::StatsSeries *series)
+{
+    struct StreamState
+    {
+        OstProto::StreamStatsSeries *series;
+        qint64 lastIndex;
+        StreamStatsTuple last;
+    };
+    QHash<uint, StreamState> streamState;
+    QSet<uint> streamFilter;
+    bool withStreams = query.with_stream_stats();
+    Sample last;
+
+    series->set_sample_interval(interval_);
+
+    for (int i = 0; i < query.stream_guid_size(); i++)
+        streamFilter.insert(query.stream_guid(i).id());
+
+    memset((void*) &last, 0, sizeof(last));
+
+    QMutexLocker locker(&lock_);
+
+    if (samples_.isEmpty())
+        return;
+
+    quint64 ringSize = samples_.size();
+    quint64 begin = sampleCount_ > ringSize ? sampleCount_ - ringSize : 0;
+    quint64 end = sampleCount_;
+
+    quint64 streamRingSize = streamSamples_.size();
+    quint64 firstStream = streamSampleCount_ > streamRingSize ?
+                            streamSampleCount_ - streamRingSize : 0;
+    if (!streamRingSize)
+        withStreams = false;
+
+    if (query.has_from_time()) {
+        while ((begin < end) && (samples_.at(begin % ringSize).timestamp
+                                    < qint64(query.from_time())))
+            begin++;
+    }
+    if (query.has_to_time()) {
+        while ((end > begin) && (samples_.at((end - 1) % ringSize).timestamp
+                                    > qint64(query.to_time())))
+            end--;
+    }
+
+    quint64 stride = 1;
+    if (query.max_samples() && ((end - begin) > query.max_samples()))
+        stride = (end - begin + query.max_samples() - 1)/query.max_samples();
+
+    qint64 index = 0;
+    for (quint64 i = begin; i < end; i += stride, index++) {
+        const Sample &s = samples_.at(i % ringSize);
+
+        // Counters may go down (e.g. clearStats) - deltas are signed
+        series->add_timestamp(s.timestamp - last.timestamp);
+        series->add_rx_pkts(qint64(s.rxPkts - last.rxPkts));
+        series->add_rx_bytes(qint64(s.rxBytes - last.rxBytes));
+        series->add_tx_pkts(qint64(s.txPkts - last.txPkts));
+        series->add_tx_bytes(qint64(s.txBytes - last.txBytes));
+        series->add_rx_drops(qint64(s.rxDrops - last.rxDrops));
+        series->add_rx_errors(qint64(s.rxErrors - last.rxErrors));
+        last = s;
+
+        if (!withStreams || (s.streamStart < firstStream))
+            continue;
+
+        for (uint j = 0; j < s.streamCount; j++) {
+            const StreamSample &ss = streamSamples_.at(
+                    (s.streamStart + j) % streamRingSize);
+
+            if (!streamFilter.isEmpty() && !streamFilter.contains(ss.guid))
+                continue;
+
+            if (!streamState.contains(ss.guid)) {
+                StreamState state;
+
+                state.series = series->add_stream_stats_series();
+                state.series->mutable_stream_guid()->set_id(ss.guid);
+                state.lastIndex = 0;
+                memset((void*) &state.last, 0, sizeof(state.last));
+                streamState.insert(ss.guid, state);
+            }
+
+            StreamState &state = streamState[ss.guid];
+            OstProto::StreamStatsSeries *sss = state.series;
+
+            sss->add_sample_index(index - state.lastIndex);
+            sss->add_rx_pkts(qint64(ss.stats.rx_pkts - state.last.rx_pkts));
+            sss->add_rx_bytes(qint64(ss.stats.rx_bytes
+                                        - state.last.rx_bytes));
+            sss->add_tx_pkts(qint64(ss.stats.tx_pkts - state.last.tx_pkts));
+            sss->add_tx_bytes(qint64(ss.stats.tx_bytes
+                                        - state.last.tx_bytes));
+            state.lastIndex = index;
+            state.last = ss.stats;
+        }
+    }
+}
+
+/*!
+ * Returns the sampling interval (msecs) as configured; 0 if disabled
+ */
+int StatsSeries::configuredSampleInterval()
+{
+    int interval = appSettings->value(kStatsSeriesSampleIntervalKey,
+            kStatsSeriesSampleIntervalDefaultValue).toInt();
+
+    if (interval <= 0)
+        return 0;
+
+    return qMax(interval, int(kMinSampleInterval));
+}
+
+/*!
+ * Returns the interval (msecs) at which port counters should be refreshed
+ * from the OS so that the samples aren't stale
+ */
+int StatsSeries::counterRefreshInterval()
+{
+    int interval = configuredSampleInterval();
+
+    return interval ? qMin(interval, int(kMaxRefreshInterval))
+                    : kMaxRefreshInterval;
+}
+
+void StatsSeries::run()
+{
+    QElapsedTimer timer;
+    qint64 next = 0;
+
+    placement_->placeCurrentThread(ThreadPlacement::kStatsThread);
+
+    qDebug("statsSeries: %s sampling every %d msecs start",
+            port_->name(), interval_);
+
+    timer.start();
+    while (!stop_) {
+        takeSample();
+
+        // If we fall behind, skip the missed samples instead of bunching
+        // up the next few
+        next += interval_;
+        qint64 now = timer.elapsed();
+        if (now < next)
+            QThread::msleep(next - now);
+        else
+            next = now;
+    }
+    stop_ = false;
+
+    qDebug("statsSeries: %s sampling end", port_->name());
+}
+
+void StatsSeries::takeSample()
+{
+    AbstractPort::PortStats stats;
+    Sample sample;
+
+    port_->stats(&stats);
+
+    sample.timestamp = QDateTime::currentMSecsSinceEpoch();
+    sample.rxPkts = stats.rxPkts;
+    sample.rxBytes = stats.rxBytes;
+    sample.txPkts = stats.txPkts;
+    sample.txBytes = stats.txBytes;
+    sample.rxDrops = stats.rxDrops;
+    sample.rxErrors = stats.rxErrors;
+
+    QMutexLocker locker(&lock_);
+
+    sample.streamStart = streamSampleCount_;
+    sample.streamCount = 0;
+
+    QMutexLocker streamStatsLocker(&streamStatsLock_);
+    if (streamRingSize_ && !streamStats_.isEmpty()) {
+        if (streamSamples_.isEmpty())
+            streamSamples_.resize(streamRingSize_);
+
+        StreamStatsIterator i(streamStats_);
+        while (i.hasNext() && (sample.streamCount < uint(streamRingSize_))) {
+            i.next();
+            StreamSample &ss = streamSamples_[
+                                    streamSampleCount_ % streamRingSize_];
+            ss.guid = i.key();
+            ss.stats = i.value();
+            streamSampleCount_++;
+            sample.streamCount++;
+        }
+    }
+
+    samples_[sampleCount_ % samples_.size()] = sample;
+    sampleCount_++;
+}
@@ -0,0 +1,100 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _STATS_SERIES_H
+#define _STATS_SERIES_H
+
+#include "abstractport.h"
+#include "streamstats.h"
+#include "threadplacement.h"
+
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+
+/*!
+ * Samples a port's counters (and those of its streams) periodically into
+ * fixed size in-memory rings so that clients can query the counters over
+ * a time range and derive rates at a finer resolution than they poll
+ *
+ * Only counters are kept - rates are derived by the client from the
+ * difference of successive samples. Once a ring is full, the oldest
+ * samples are overwritten
+ */
+class StatsSeries: public QThread
+{
+public:
+    StatsSeries(AbstractPort *port, StreamStats &portStreamStats,
+                QMutex &portStreamStatsLock);
+    ~StatsSeries();
+
+    void start();
+    void stop();
+
+    int sampleInterval() const { return interval_; }
+    void query(const OstProto::StatsSeriesQuery &query,
+               OstProto::StatsSeries *series);
+
+    static int configuredSampleInterval();
+    static int counterRefreshInterval();
+
+private:
+    struct Sample
+    {
+        qint64 timestamp;       // msecs since epoch
+        quint64 rxPkts;
+        quint64 rxBytes;
+        quint64 txPkts;
+        quint64 txBytes;
+        quint64 rxDrops;
+        quint64 rxErrors;
+        quint64 streamStart;    // stream sample no. of the first stream
+        uint streamCount;
+    };
+
+    struct StreamSample
+    {
+        uint guid;
+        StreamStatsTuple stats;
+    };
+
+    void run();
+    void takeSample();
+
+    static const int kMinSampleInterval = 10; // msecs
+    static const int kMaxRefreshInterval = 1000; // msecs
+
+    AbstractPort *port_;
+    StreamStats &streamStats_;
+    QMutex &streamStatsLock_;
+    const ThreadPlacement *placement_;
+    int interval_;
+    volatile bool stop_;
+
+    // Rings are indexed by sample no. modulo ring size; the sample nos.
+    // keep counting up so that overwritten samples can be detected
+    QMutex lock_;
+    QVector<Sample> samples_;
+    quint64 sampleCount_;
+    QVector<StreamSample> streamSamples_; // allocated on first use
+    int streamRingSize_;
+    quint64 streamSampleCount_;
+};
+
+#endif
@@ -0,0 +1,367 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "threadplacement.h"
+
+#include "settings.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QStringList>
+
+#include <errno.h>
+#include <string.h>
+
+#if defined(Q_OS_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(Q_OS_FREEBSD)
+#include <sys/param.h>
+#include <sys/cpuset.h>
+#elif defined(Q_OS_WIN32)
+#include <windows.h>
+#endif
+
+QMutex ThreadPlacement::listLock_;
+QHash<QString, ThreadPlacement*> ThreadPlacement::placementList_;
+
+/*!
+ * Returns the placement for the given device (port) or the global
+ * placement if device is NULL
+ *
+ * The placement is created (from drone settings) on first use - this
+ * is expected to be done by the port constructor, so that the threads
+ * of the port (which may call this) only ever lookup the list
+ */
+const ThreadPlacement* ThreadPlacement::forDevice(const char *device)
+{
+    QString name = device ? QString::fromLatin1(device) : QString();
+    QMutexLocker locker(&listLock_);
+    ThreadPlacement *placement = placementList_.value(name);
+
+    if (!placement) {
+        placement = new ThreadPlacement(name);
+        placementList_.insert(name, placement);
+    }
+
+    return placement;
+}
+
+ThreadPlacement::ThreadPlacement(const QString &device)
+{
+    // Settings group for this port - port names may have '/' or '\'
+    // (e.g. WinPcap device names) which are QSettings key separators
+    QString group = device;
+    QString globalTxCpus, globalRxCpus, globalStatsCpus;
+    QList<int> nodeCpus;
+
+    group.replace('/', '_').replace('\\', '_');
+    device_ = device;
+
+    appSettings->beginGroup(kThreadPlacementSection);
+    globalTxCpus = appSettings->value(kThreadPlacementTxCpusKey).toString();
+    globalRxCpus = appSettings->value(kThreadPlacementRxCpusKey).toString();
+    globalStatsCpus = appSettings->value(
+                            kThreadPlacementStatsCpusKey).toString();
+
+    if (device.isEmpty()) {
+        numaNode_ = -1;
+        statsCpus_ = parseCpuList(globalStatsCpus);
+        appSettings->endGroup();
+        goto _exit;
+    }
+
+    appSettings->beginGroup(group);
+    numaNode_ = appSettings->value(kThreadPlacementNumaNodeKey,
+                                   deviceNumaNode(device)).toInt();
+    txCpus_ = parseCpuList(appSettings->value(kThreadPlacementTxCpusKey,
+                                              globalTxCpus).toString());
+    rxCpus_ = parseCpuList(appSettings->value(kThreadPlacementRxCpusKey,
+                                              globalRxCpus).toString());
+    statsCpus_ = parseCpuList(appSettings->value(kThreadPlacementStatsCpusKey,
+                                                 globalStatsCpus).toString());
+    appSettings->endGroup();
+    appSettings->endGroup();
+
+    // Whatever is not configured is placed on the NIC's NUMA node - for
+    // stats threads we try to keep off the tx cpus as tx may busy-wait
+    nodeCpus = numaNodeCpuList(numaNode_);
+    if (txCpus_.isEmpty())
+        txCpus_ = nodeCpus;
+    if (rxCpus_.isEmpty())
+        rxCpus_ = nodeCpus;
+    if (statsCpus_.isEmpty()) {
+        foreach(int cpu, nodeCpus) {
+            if (!txCpus_.contains(cpu))
+                statsCpus_.append(cpu);
+        }
+        if (statsCpus_.isEmpty())
+            statsCpus_ = nodeCpus;
+    }
+
+_exit:
+    qDebug("%s: numa node %d, tx cpus [%s], rx cpus [%s], stats cpus [%s]",
+            qPrintable(device.isEmpty() ? QString("global") : device),
+            numaNode_,
+            qPrintable(cpuListString(txCpus_)),
+            qPrintable(cpuListString(rxCpus_)),
+            qPrintable(cpuListString(statsCpus_)));
+}
+
+//! Returns the NUMA node of the port or -1 if not known
+int ThreadPlacement::numaNode() const
+{
+    return numaNode_;
+}
+
+//! Returns the cpus for the given thread role - empty means any cpu
+QList<int> ThreadPlacement::cpuList(Role role) const
+{
+    switch (role) {
+    case kTxThread:
+        return txCpus_;
+    case kRxThread:
+        return rxCpus_;
+    case kStatsThread:
+        return statsCpus_;
+    default:
+        Q_ASSERT(false); // Unreachable!
+    }
+
+    return QList<int>();
+}
+
+/*!
+ * Sets the affinity of the calling thread as per its role
+ *
+ * Returns false if the affinity could not be set; if no cpus are
+ * configured for the role, the thread is left alone and true is returned
+ */
+bool ThreadPlacement::placeCurrentThread(Role role) const
+{
+    QList<int> cpus = cpuList(role);
+
+    if (cpus.isEmpty())
+        return true;
+
+#if defined(Q_OS_LINUX)
+    cpu_set_t cpuSet;
+    int ret;
+
+    CPU_ZERO(&cpuSet);
+    foreach(int cpu, cpus) {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &cpuSet);
+    }
+
+    ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+    if (ret) {
+        qWarning("%s: unable to set thread %d affinity to cpus [%s]: %s",
+                qPrintable(device_), role, qPrintable(cpuListString(cpus)),
+                strerror(ret));
+        return false;
+    }
+#elif defined(Q_OS_FREEBSD)
+    cpuset_t cpuSet;
+
+    CPU_ZERO(&cpuSet);
+    foreach(int cpu, cpus) {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &cpuSet);
+    }
+
+    // id -1 with CPU_WHICH_TID is the calling thread
+    if (cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_TID, -1,
+                sizeof(cpuSet), &cpuSet) < 0) {
+        qWarning("%s: unable to set thread %d affinity to cpus [%s]: %s",
+                qPrintable(device_), role, qPrintable(cpuListString(cpus)),
+                strerror(errno));
+        return false;
+    }
+#elif defined(Q_OS_WIN32)
+    DWORD_PTR mask = 0;
+
+    foreach(int cpu, cpus) {
+        if (cpu < int(8*sizeof(mask)))
+            mask |= DWORD_PTR(1) << cpu;
+    }
+
+    if (!SetThreadAffinityMask(GetCurrentThread(), mask)) {
+        qWarning("%s: unable to set thread %d affinity to cpus [%s]: %lu",
+                qPrintable(device_), role, qPrintable(cpuListString(cpus)),
+                GetLastError());
+        return false;
+    }
+#else
+    qDebug("%s: thread placement not supported on this platform",
+            qPrintable(device_));
+    return false;
+#endif
+
+    qDebug("%s: thread %d placed on cpus [%s]", qPrintable(device_), role,
+            qPrintable(cpuListString(cpus)));
+    return true;
+}
+
+/*!
+ * Asks the kernel to allocate the (page aligned part of) given memory
+ * from the port's NUMA node - already allocated pages are moved
+ *
+ * This is a hint - it silently does nothing if the node is not known or
+ * the platform doesn't support it
+ */
+void ThreadPlacement::bindMemory(void *addr, size_t size) const
+{
+#if defined(Q_OS_LINUX) && defined(SYS_mbind)
+    const int kMpolPreferred = 1; // from <linux/mempolicy.h>
+    const unsigned kMpolMfMove = 1 << 1;
+    const int kBitsPerLong = 8*sizeof(long);
+    unsigned long nodeMask[4];
+    long pageSize = sysconf(_SC_PAGESIZE);
+    quintptr start, end;
+
+    if ((numaNode_ < 0) || (numaNode_ >= int(8*sizeof(nodeMask))))
+        return;
+
+    start = (quintptr(addr) + pageSize - 1) & ~quintptr(pageSize - 1);
+    end = (quintptr(addr) + size) & ~quintptr(pageSize - 1);
+    if (end <= start)
+        return;
+
+    memset(nodeMask, 0, sizeof(nodeMask));
+    nodeMask[numaNode_/kBitsPerLong] |= 1UL << (numaNode_ % kBitsPerLong);
+
+    // maxnode is one more than the number of bits (kernel quirk)
+    if (syscall(SYS_mbind, start, end - start, kMpolPreferred, nodeMask,
+                8*sizeof(nodeMask) + 1, kMpolMfMove) < 0)
+        qDebug("%s: mbind to node %d failed: %s", qPrintable(device_),
+                numaNode_, strerror(errno));
+#else
+    Q_UNUSED(addr);
+    Q_UNUSED(size);
+#endif
+}
+
+/*!
+ * Parses a cpu list in the Linux cpulist format e.g. "0,2,4-7"
+ */
+QList<int> ThreadPlacement::parseCpuList(const QString &cpuList)
+{
+    QList<int> cpus;
+
+    foreach(QString range, cpuList.split(',', QString::SkipEmptyParts)) {
+        QStringList bounds = range.trimmed().split('-');
+        bool isOk1 = false, isOk2 = false;
+        int first, last;
+
+        first = bounds.at(0).toInt(&isOk1);
+        last = bounds.size() > 1 ? bounds.at(1).toInt(&isOk2) : first;
+        if (bounds.size() == 1)
+            isOk2 = isOk1;
+
+        if (!isOk1 || !isOk2 || (bounds.size() > 2) || (first < 0)
+                || (last < first)) {
+            qWarning("ignoring invalid cpu range '%s' in cpu list '%s'",
+                    qPrintable(range), qPrintable(cpuList));
+            continue;
+        }
+
+        for (int cpu = first; cpu <= last; cpu++) {
+            if (!cpus.contains(cpu))
+                cpus.append(cpu);
+        }
+    }
+
+    qSort(cpus);
+    return cpus;
+}
+
+/*!
+ * Returns the cpu list in the Linux cpulist format - inverse of
+ * parseCpuList()
+ */
+QString ThreadPlacement::cpuListString(const QList<int> &cpuList)
+{
+    QStringList ranges;
+    int i = 0;
+
+    while (i < cpuList.size()) {
+        int first = cpuList.at(i);
+        int last = first;
+
+        while ((i + 1 < cpuList.size()) && (cpuList.at(i + 1) == last + 1))
+            last = cpuList.at(++i);
+        i++;
+
+        if (first == last)
+            ranges.append(QString::number(first));
+        else
+            ranges.append(QString("%1-%2").arg(first).arg(last));
+    }
+
+    return ranges.join(",");
+}
+
+//
+// Private methods
+//
+int ThreadPlacement::deviceNumaNode(const QString &device)
+{
+    int node = -1;
+#if defined(Q_OS_LINUX)
+    QFile file(QString("/sys/class/net/%1/device/numa_node").arg(device));
+    bool isOk;
+
+    // Virtual interfaces don't have a device, nor do single node systems
+    // have a valid numa_node (it is -1)
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    node = QString(file.readAll()).trimmed().toInt(&isOk);
+    if (!isOk)
+        node = -1;
+#else
+    Q_UNUSED(device);
+#endif
+
+    return node;
+}
+
+QList<int> ThreadPlacement::numaNodeCpuList(int node)
+{
+    QList<int> cpus;
+
+    if (node < 0)
+        return cpus;
+
+#if defined(Q_OS_LINUX)
+    QFile file(QString("/sys/devices/system/node/node%1/cpulist").arg(node));
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning("unable to read cpu list for numa node %d", node);
+        return cpus;
+    }
+
+    cpus = parseCpuList(QString(file.readAll()).trimmed());
+#endif
+
+    return cpus;
+}
@@ -0,0 +1,74 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SERVER_THREAD_PLACEMENT_H
+#define _SERVER_THREAD_PLACEMENT_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+#include <stddef.h>
+
+/*!
+ * Placement (CPU affinity and NUMA node) of the threads of a port
+ *
+ * There's one instance per port (device) and one global instance (for
+ * threads not associated with any port) - use forDevice() to get it.
+ * Threads place themselves by calling placeCurrentThread() from their
+ * run() as affinity can only be set from within a thread portably
+ */
+class ThreadPlacement
+{
+public:
+    enum Role {
+        kTxThread,      //!< packet transmit
+        kRxThread,      //!< capture, rx stream stats, emulation
+        kStatsThread    //!< port stats monitoring
+    };
+
+    static const ThreadPlacement* forDevice(const char *device = NULL);
+
+    int numaNode() const;
+    QList<int> cpuList(Role role) const;
+
+    bool placeCurrentThread(Role role) const;
+    void bindMemory(void *addr, size_t size) const;
+
+    static QList<int> parseCpuList(const QString &cpuList);
+    static QString cpuListString(const QList<int> &cpuList);
+
+private:
+    ThreadPlacement(const QString &device);
+
+    static int deviceNumaNode(const QString &device);
+    static QList<int> numaNodeCpuList(int node);
+
+    QString device_;
+    int numaNode_;
+    QList<int> txCpus_;
+    QList<int> rxCpus_;
+    QList<int> statsCpus_;
+
+    static QMutex listLock_;
+    static QHash<QString, ThreadPlacement*> placementList_;
+};
+
+#endif
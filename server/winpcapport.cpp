@@ -144,6 +144,8 @@ void WinPcapPort::PortMonitor::run()
 
     qDebug("in %s", __PRETTY_FUNCTION__);
 
+    placement_->placeCurrentThread(ThreadPlacement::kStatsThread);
+
     lastTs.tv_sec = 0;
     lastTs.tv_usec = 0;
 
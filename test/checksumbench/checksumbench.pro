@@ -0,0 +1,23 @@
+TEMPLATE = app
+CONFIG += qt console
+QT -= gui
+INCLUDEPATH += "../../common/"
+win32 {
+    CONFIG(debug, debug|release) {
+        LIBS += -L"../../common/debug" -lostproto
+        POST_TARGETDEPS += "../../common/debug/libostproto.a"
+    } else {
+        LIBS += -L"../../common/release" -lostproto
+        POST_TARGETDEPS += "../../common/release/libostproto.a"
+    }
+} else {
+    LIBS += -L"../../common" -lostproto
+    POST_TARGETDEPS += "../../common/libostproto.a"
+}
+
+HEADERS +=
+SOURCES += main.cpp
+
+QMAKE_DISTCLEAN += object_script.*
+
+include(../../options.pri)
@@ -0,0 +1,151 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/*
+ * Micro-benchmark for the checksum kernels - compares the CPU specific
+ * kernels with the portable ones for a range of buffer sizes and checks
+ * that both compute the same value
+ */
+
+#include "checksum.h"
+
+#include <QElapsedTimer>
+#include <QVector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const qint64 kMinBenchTime = 200; // msecs
+static const uint kBufferSizes[] = {
+    64, 256, 1514, 9018, 65536, 1048576
+};
+static const int kBufferSizeCount =
+        int(sizeof(kBufferSizes)/sizeof(kBufferSizes[0]));
+
+enum Kernel { kCrc32C, kCrc32, kOnesSum };
+
+// Offset the buffer to not be aligned, as is usual for packets
+static const int kBufferOffset = 2;
+
+static quint32 runKernel(Kernel kernel, const quint8 *buffer, uint length)
+{
+    switch (kernel) {
+    case kCrc32C: return checksumCrc32C(buffer, length);
+    case kCrc32: return checksumCrc32(buffer, length);
+    case kOnesSum: return checksumOnesSum(buffer, length);
+    }
+    return 0;
+}
+
+/*!
+ * Runs the kernel for at least kMinBenchTime and returns the time taken
+ * per call (in nsecs); value is set to the checksum
+ */
+static double benchKernel(Kernel kernel, const quint8 *buffer, uint length,
+                          quint32 &value)
+{
+    QElapsedTimer timer;
+    quint64 calls = 0;
+    quint32 sink = 0;
+    int batch = 1;
+
+    timer.start();
+    do {
+        for (int i = 0; i < batch; i++)
+            sink ^= runKernel(kernel, buffer, length);
+        calls += batch;
+        batch *= 2;
+    } while (timer.elapsed() < kMinBenchTime);
+
+    value = runKernel(kernel, buffer, length);
+    if (sink == 0xdeadbeef) // don't let the calls be optimized away
+        printf(" ");
+
+    return double(timer.nsecsElapsed())/calls;
+}
+
+static int bench(Kernel kernel, const char *name)
+{
+    QVector<quint8> buf(kBufferSizes[kBufferSizeCount-1] + kBufferOffset);
+    const quint8 *buffer = buf.constData() + kBufferOffset;
+    int failed = 0;
+
+    for (int i = 0; i < buf.size(); i++)
+        buf[i] = quint8(rand());
+
+    printf("%s\n", name);
+    printf("%10s %14s %10s %14s %10s %8s\n", "bytes",
+            "cpu ns/call", "MB/s", "portable ns", "MB/s", "speedup");
+
+    for (int i = 0; i < kBufferSizeCount; i++) {
+        uint length = kBufferSizes[i];
+        quint32 hwValue, swValue;
+        double hwTime, swTime;
+
+        checksumSetHwKernels(true);
+        hwTime = benchKernel(kernel, buffer, length, hwValue);
+        checksumSetHwKernels(false);
+        swTime = benchKernel(kernel, buffer, length, swValue);
+        checksumSetHwKernels(true);
+
+        printf("%10u %14.1f %10.0f %14.1f %10.0f %7.1fx%s\n", length,
+                hwTime, length*1e3/hwTime, swTime, length*1e3/swTime,
+                swTime/hwTime, hwValue != swValue ? " MISMATCH!" : "");
+        if (hwValue != swValue)
+            failed++;
+    }
+    printf("\n");
+
+    return failed;
+}
+
+int usage(char* argv[])
+{
+    printf("usage:\n");
+    printf("%s [crc32c|crc32|onessum]...\n", argv[0]);
+
+    return 255;
+}
+
+int main(int argc, char* argv[])
+{
+    int failed = 0;
+
+    printf("Kernels: %s\n\n", checksumKernelNames());
+
+    if (argc < 2) {
+        failed += bench(kCrc32C, "crc32c");
+        failed += bench(kCrc32, "crc32");
+        failed += bench(kOnesSum, "onessum");
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "crc32c") == 0)
+            failed += bench(kCrc32C, "crc32c");
+        else if (strcmp(argv[i], "crc32") == 0)
+            failed += bench(kCrc32, "crc32");
+        else if (strcmp(argv[i], "onessum") == 0)
+            failed += bench(kOnesSum, "onessum");
+        else
+            return usage(argv);
+    }
+
+    return failed ? 1 : 0;
+}
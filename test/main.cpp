@@ -1,14 +1,19 @@
 
+#include "framedissector.h"
 #include "ostprotolib.h"
 #include "pcapfileformat.h"
+#include "pcapfilereader.h"
+#include "prng.h"
 #include "protocol.pb.h"
 #include "protocolmanager.h"
 #include "settings.h"
+#include "streambase.h"
 
 #include <QCoreApplication>
 #include <QFile>
 #include <QSettings>
 #include <QString>
+#include <QStringList>
 
 extern ProtocolManager *OstProtocolManager;
 
@@ -46,6 +51,8 @@ int usage(int /*argc*/, char* argv[])
     printf("%s <command>\n", argv[0]);
     printf("command -\n");
     printf("  importpcap\n");
+    printf("  prng\n");
+    printf("  selftest\n");
 
     return 255;
 }
@@ -79,6 +86,237 @@ int testImportPcap(int argc, char* argv[])
     return 0;
 }
 
+/*
+ * Self tests - the sample captures are in test/pcap (see mksamples.py
+ * there for what they contain)
+ */
+static int failCount = 0;
+
+static void check(bool isOk, const QString &what)
+{
+    printf("%s: %s\n", isOk ? "PASS" : "FAIL", qPrintable(what));
+    if (!isOk)
+        failCount++;
+}
+
+struct PcapSample
+{
+    const char *fileName;
+    bool isPcapng;
+    bool isCompressed;
+    int packetCount;
+    int truncatedCount;     // by snaplen
+    quint64 lastTimestamp;  // nsecs
+};
+
+static const PcapSample kPcapSamples[] = {
+    { "truncated.pcap",      false, false, 3, 2, Q_UINT64_C(3250000000) },
+    { "truncated.pcap.gz",   false, true,  3, 2, Q_UINT64_C(3250000000) },
+    { "multisection.pcapng", true,  false, 4, 1, Q_UINT64_C(2000000000) },
+};
+
+// Protocols expected for each frame of dissect.pcap - "*" means any, as
+// long as the frame is imported byte exact
+static const char *kDissectSamples[] = {
+    "mac eth2 ip4 udp hexdump",
+    "mac eth2 arp",
+    "mac eth2 ip4 tcp hexdump hexdump",
+    "mac eth2 hexdump",
+    "mac dot3 hexdump",
+    "mac vlan eth2 ip6 udp hexdump",
+    "mac eth2 ip6 hexdump",
+    "mac eth2 ip4 hexdump",
+    "mac eth2 ip4 icmp hexdump",
+    "*",
+    "*",
+};
+
+static QString protocolName(int protocolNumber)
+{
+    switch (protocolNumber) {
+    case OstProto::Protocol::kMacFieldNumber: return "mac";
+    case OstProto::Protocol::kHexDumpFieldNumber: return "hexdump";
+    case OstProto::Protocol::kEth2FieldNumber: return "eth2";
+    case OstProto::Protocol::kDot3FieldNumber: return "dot3";
+    case OstProto::Protocol::kSvlanFieldNumber: return "svlan";
+    case OstProto::Protocol::kVlanFieldNumber: return "vlan";
+    case OstProto::Protocol::kArpFieldNumber: return "arp";
+    case OstProto::Protocol::kIp4FieldNumber: return "ip4";
+    case OstProto::Protocol::kIp6FieldNumber: return "ip6";
+    case OstProto::Protocol::kTcpFieldNumber: return "tcp";
+    case OstProto::Protocol::kUdpFieldNumber: return "udp";
+    case OstProto::Protocol::kIcmpFieldNumber: return "icmp";
+    case OstProto::Protocol::kIgmpFieldNumber: return "igmp";
+    case OstProto::Protocol::kMldFieldNumber: return "mld";
+    default: return QString::number(protocolNumber);
+    }
+}
+
+static void testPcapSamples(const QString &dir)
+{
+    for (uint i = 0; i < sizeof(kPcapSamples)/sizeof(kPcapSamples[0]); i++) {
+        const PcapSample &sample = kPcapSamples[i];
+        QString fileName = dir + "/" + sample.fileName;
+        PcapFileReader reader;
+        PcapFileReader::Packet packet;
+        int count = 0, truncated = 0;
+        bool isLinkTypeOk = true;
+        quint64 timestamp = 0;
+
+        if (!reader.open(fileName)) {
+            check(false, QString("%1: open - %2")
+                    .arg(sample.fileName).arg(reader.errorString()));
+            continue;
+        }
+
+        check((reader.isPcapng() == sample.isPcapng)
+                && (reader.isCompressed() == sample.isCompressed),
+                QString("%1: format").arg(sample.fileName));
+
+        while (reader.readPacket(packet)) {
+            count++;
+            if (packet.data.size() < int(packet.origLen))
+                truncated++;
+            isLinkTypeOk = isLinkTypeOk && (packet.linkType == 1);
+            timestamp = packet.timestamp;
+        }
+
+        check(reader.errorString().isEmpty(), QString("%1: read errors %2")
+                .arg(sample.fileName).arg(reader.errorString()));
+        check(count == sample.packetCount, QString("%1: %2 packets")
+                .arg(sample.fileName).arg(count));
+        check(truncated == sample.truncatedCount,
+                QString("%1: %2 packets truncated by snaplen")
+                    .arg(sample.fileName).arg(truncated));
+        check(isLinkTypeOk, QString("%1: link type").arg(sample.fileName));
+        check(timestamp == sample.lastTimestamp,
+                QString("%1: last timestamp %2")
+                    .arg(sample.fileName).arg(timestamp));
+    }
+}
+
+static void testDissectSamples(const QString &dir)
+{
+    int sampleCount = sizeof(kDissectSamples)/sizeof(kDissectSamples[0]);
+    PcapFileReader reader;
+    PcapFileReader::Packet packet;
+    FrameDissector dissector;
+    int i = 0;
+
+    if (!reader.open(dir + "/dissect.pcap")) {
+        check(false, QString("dissect.pcap: open - %1")
+                .arg(reader.errorString()));
+        return;
+    }
+
+    for (i = 0; reader.readPacket(packet); i++) {
+        OstProto::Stream stream;
+        StreamBase streamBase(-1, false);
+        QByteArray frame(packet.data.size(), 0);
+        QStringList names;
+        int len;
+
+        stream.mutable_stream_id()->set_id(i);
+        stream.mutable_core()->set_frame_len(packet.data.size() + 4); // FCS
+        dissector.dissect((const uchar*) packet.data.constData(),
+                          packet.data.size(), &stream);
+
+        for (int j = 0; j < stream.protocol_size(); j++)
+            names.append(protocolName(stream.protocol(j).protocol_id().id()));
+
+        if (i < sampleCount && strcmp(kDissectSamples[i], "*"))
+            check(names.join(" ") == kDissectSamples[i],
+                    QString("dissect.pcap: frame %1 protocols %2")
+                        .arg(i).arg(names.join(" ")));
+
+        // Decoded or not, the imported frame must be the same
+        streamBase.protoDataCopyFrom(stream);
+        len = streamBase.frameValue((uchar*) frame.data(), frame.size(), 0);
+        check((len == packet.data.size()) && (frame == packet.data),
+                QString("dissect.pcap: frame %1 imported as is").arg(i));
+    }
+
+    check(i == sampleCount, QString("dissect.pcap: %1 frames").arg(i));
+}
+
+int testSelf(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        printf("usage:\n");
+        printf("%s selftest <sampledir>\n", argv[0]);
+        return 255;
+    }
+
+    testPcapSamples(argv[2]);
+    testDissectSamples(argv[2]);
+
+    printf("%d failed\n", failCount);
+    return failCount ? 1 : 0;
+}
+
+/*
+ * prng - counter based random values and their use for random fields
+ */
+static OstProto::Protocol* addIp4RandomSrcIp(OstProto::Stream &stream)
+{
+    OstProto::Protocol *ip4 = stream.add_protocol();
+    OstProto::VariableField *field = ip4->add_variable_field();
+
+    ip4->mutable_protocol_id()->set_id(OstProto::Protocol::kIp4FieldNumber);
+    field->set_type(OstProto::VariableField::kCounter32);
+    field->set_offset(12);
+    field->set_mode(OstProto::VariableField::kRandom);
+    field->set_count(1000);
+
+    return ip4;
+}
+
+int testPrng(int /*argc*/, char* /*argv*/[])
+{
+    OstProto::Stream config;
+    StreamBase stream(-1, false);
+    QByteArray frame0(64, 0), frame0Again(64, 0), frame1(64, 0);
+    uchar buf[40], prefix[13];
+    bool isUniformOk = true;
+
+    // SplitMix64's first output for seed 0
+    check(prng::value(0, 0) == Q_UINT64_C(0xe220a8397b1dcdaf),
+            "prng: SplitMix64 reference value");
+
+    for (int i = 0; i < 1000; i++)
+        isUniformOk = isUniformOk && (prng::uniform(1, i, 10) < 10);
+    check(isUniformOk, "prng: uniform() within range");
+
+    // Random bytes don't depend on how many are asked for
+    prng::fill(1, 2, buf, sizeof(buf));
+    prng::fill(1, 2, prefix, sizeof(prefix));
+    check(memcmp(buf, prefix, sizeof(prefix)) == 0, "prng: fill() prefix");
+
+    // Same random field in two identical (IP in IP) headers
+    config.mutable_stream_id()->set_id(1);
+    config.add_protocol()->mutable_protocol_id()->set_id(
+            OstProto::Protocol::kMacFieldNumber);
+    config.add_protocol()->mutable_protocol_id()->set_id(
+            OstProto::Protocol::kEth2FieldNumber);
+    addIp4RandomSrcIp(config);
+    addIp4RandomSrcIp(config);
+    stream.protoDataCopyFrom(config);
+
+    stream.frameValue((uchar*) frame0.data(), frame0.size(), 0);
+    stream.frameValue((uchar*) frame0Again.data(), frame0Again.size(), 0);
+    stream.frameValue((uchar*) frame1.data(), frame1.size(), 1);
+
+    check(frame0 == frame0Again, "prng: random field repeatable");
+    check(frame0 != frame1, "prng: random field varies across frames");
+    // Outer and inner IPv4 source address at 14+12 and 14+20+12
+    check(frame0.mid(26, 4) != frame0.mid(46, 4),
+            "prng: random field differs across identical headers");
+
+    printf("%d failed\n", failCount);
+    return failCount ? 1 : 0;
+}
+
 int main(int argc, char* argv[])
 {
     QCoreApplication app(argc, argv);
@@ -121,6 +359,10 @@ int main(int argc, char* argv[])
         exitCode = usage(argc, argv);
     else if (strcmp(argv[1],"importpcap") == 0)
         exitCode = testImportPcap(argc, argv);
+    else if (strcmp(argv[1],"prng") == 0)
+        exitCode = testPrng(argc, argv);
+    else if (strcmp(argv[1],"selftest") == 0)
+        exitCode = testSelf(argc, argv);
     else
         exitCode = usage(argc, argv);
 
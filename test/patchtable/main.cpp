@@ -0,0 +1,195 @@
+/*
+Copyright (C) 2016 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+/*
+ * Checks that frames patched at transmit time by FramePatchTable are the
+ * same as the fully rendered frames of the stream - for streams with
+ * counter and random fields covered by the IPv4 and UDP/TCP checksums
+ */
+
+#include "framepatchtable.h"
+#include "protocol.pb.h"
+#include "protocolmanager.h"
+#include "streambase.h"
+
+#include <QByteArray>
+#include <QCoreApplication>
+
+#include <stdio.h>
+
+extern ProtocolManager *OstProtocolManager;
+
+/*
+ * Dummy Stuff for successful linking
+ */
+char *version = (char*) "";
+char *revision = (char*) "";
+quint64 getDeviceMacAddress(
+        int /*portId*/,
+        int /*streamId*/,
+        int /*frameIndex*/)
+{
+    return 0;
+}
+
+quint64 getNeighborMacAddress(
+        int /*portId*/,
+        int /*streamId*/,
+        int /*frameIndex*/)
+{
+    return 0;
+}
+
+struct PatchSample
+{
+    const char *name;
+    int protocol;           // IPv4 or TCP (UDP is used if no TCP field)
+    OstProto::VariableField::Type type;
+    int offset;             // within the protocol header
+    OstProto::VariableField::Mode mode;
+    int count;
+};
+
+// Each test stream has two variable fields - the second one with a small
+// count, so that it is patched while the first one determines the frames
+// built (or vice versa)
+static const PatchSample kPatchSamples[][2] = {
+    {
+        { "srcip inc", OstProto::Protocol::kIp4FieldNumber,
+            OstProto::VariableField::kCounter32, 12,
+            OstProto::VariableField::kIncrement, 2000 },
+        { "id dec", OstProto::Protocol::kIp4FieldNumber,
+            OstProto::VariableField::kCounter16, 4,
+            OstProto::VariableField::kDecrement, 3 },
+    },
+    {
+        { "dstip random", OstProto::Protocol::kIp4FieldNumber,
+            OstProto::VariableField::kCounter32, 16,
+            OstProto::VariableField::kRandom, 1000 },
+        { "tos inc", OstProto::Protocol::kIp4FieldNumber,
+            OstProto::VariableField::kCounter8, 1,
+            OstProto::VariableField::kIncrement, 7 },
+    },
+    {
+        { "tcp seq inc", OstProto::Protocol::kTcpFieldNumber,
+            OstProto::VariableField::kCounter32, 4,
+            OstProto::VariableField::kIncrement, 5000 },
+        { "id inc", OstProto::Protocol::kIp4FieldNumber,
+            OstProto::VariableField::kCounter16, 4,
+            OstProto::VariableField::kIncrement, 3 },
+    },
+};
+static const int kPatchSampleCount =
+        int(sizeof(kPatchSamples)/sizeof(kPatchSamples[0]));
+
+static OstProto::Protocol* addProtocol(OstProto::Stream &stream,
+                                       int protocolNumber)
+{
+    OstProto::Protocol *proto = stream.add_protocol();
+
+    proto->mutable_protocol_id()->set_id(protocolNumber);
+    return proto;
+}
+
+static void addVariableField(OstProto::Protocol *proto,
+                             const PatchSample &sample)
+{
+    OstProto::VariableField *field = proto->add_variable_field();
+
+    field->set_type(sample.type);
+    field->set_offset(sample.offset);
+    field->set_mode(sample.mode);
+    field->set_count(sample.count);
+}
+
+static int testPatchTable(const PatchSample *sample)
+{
+    OstProto::Stream config;
+    OstProto::Protocol *ip4, *l4;
+    StreamBase stream(-1, false);
+    FramePatchTable *patches;
+    QByteArray frame(128, 0), expected(128, 0);
+    int frameCount, checkCount, mismatchCount = 0;
+    bool isTcp = (sample[0].protocol == OstProto::Protocol::kTcpFieldNumber)
+            || (sample[1].protocol == OstProto::Protocol::kTcpFieldNumber);
+
+    config.mutable_stream_id()->set_id(1);
+    addProtocol(config, OstProto::Protocol::kMacFieldNumber);
+    addProtocol(config, OstProto::Protocol::kEth2FieldNumber);
+    ip4 = addProtocol(config, OstProto::Protocol::kIp4FieldNumber);
+    l4 = addProtocol(config, isTcp ? OstProto::Protocol::kTcpFieldNumber
+                                   : OstProto::Protocol::kUdpFieldNumber);
+    for (int i = 0; i < 2; i++) {
+        if (sample[i].protocol == OstProto::Protocol::kIp4FieldNumber)
+            addVariableField(ip4, sample[i]);
+        else
+            addVariableField(l4, sample[i]);
+    }
+    addProtocol(config, OstProto::Protocol::kPayloadFieldNumber);
+    stream.protoDataCopyFrom(config);
+
+    printf("%s, %s: ", sample[0].name, sample[1].name);
+
+    frameCount = stream.frameVariableCount();
+    patches = FramePatchTable::build(&stream);
+    if (!patches) {
+        printf("FAIL (not patchable)\n");
+        return 1;
+    }
+
+    // Beyond frameCount as well, as the packet list repeats - except for
+    // random fields which (by design) don't repeat when patched
+    checkCount = frameCount;
+    if ((sample[0].mode != OstProto::VariableField::kRandom)
+            && (sample[1].mode != OstProto::VariableField::kRandom))
+        checkCount += 100;
+
+    for (int i = 0; i < checkCount; i++) {
+        int len = stream.frameValue((uchar*) frame.data(), frame.size(),
+                                    i % patches->baseFrameCount());
+
+        patches->apply((uchar*) frame.data(), len, i);
+        stream.frameValue((uchar*) expected.data(), expected.size(),
+                          i % frameCount);
+        if (frame != expected)
+            mismatchCount++;
+    }
+
+    printf("%s (frames %d -> %d, %d mismatched)\n",
+            mismatchCount ? "FAIL" : "PASS", frameCount,
+            patches->baseFrameCount(), mismatchCount);
+
+    delete patches;
+    return mismatchCount ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    int failed = 0;
+
+    OstProtocolManager = new ProtocolManager();
+
+    for (int i = 0; i < kPatchSampleCount; i++)
+        failed += testPatchTable(kPatchSamples[i]);
+
+    delete OstProtocolManager;
+    return failed ? 1 : 0;
+}
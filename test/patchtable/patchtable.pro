@@ -0,0 +1,27 @@
+TEMPLATE = app
+CONFIG += qt console
+QT += network script xml
+QT -= gui
+INCLUDEPATH += "../../common/" "../../server/"
+win32 {
+    CONFIG(debug, debug|release) {
+        LIBS += -L"../../common/debug" -lostproto
+        POST_TARGETDEPS += "../../common/debug/libostproto.a"
+    } else {
+        LIBS += -L"../../common/release" -lostproto
+        POST_TARGETDEPS += "../../common/release/libostproto.a"
+    }
+} else {
+    LIBS += -L"../../common" -lostproto
+    POST_TARGETDEPS += "../../common/libostproto.a"
+}
+LIBS += -lm
+LIBS += -lprotobuf
+
+HEADERS += ../../server/framepatchtable.h
+SOURCES += main.cpp \
+    ../../server/framepatchtable.cpp
+
+QMAKE_DISTCLEAN += object_script.*
+
+include(../../options.pri)
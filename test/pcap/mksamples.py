@@ -0,0 +1,136 @@
+#!/usr/bin/env python
+#
+# Generates the sample captures used by "test selftest" - the samples are
+# checked in, so this needs to be run only if they are to be changed (the
+# expected results in test/main.cpp need to be updated accordingly)
+#
+import gzip
+import struct
+
+SRC_MAC = b'\x00\x01\x02\x03\x04\x05'
+DST_MAC = b'\x00\x0a\x0b\x0c\x0d\x0e'
+
+def cksum(data):
+    if len(data) % 2:
+        data += b'\x00'
+    s = sum(struct.unpack('!%dH' % (len(data) // 2), data))
+    while s >> 16:
+        s = (s & 0xffff) + (s >> 16)
+    return ~s & 0xffff
+
+def eth(ethType, payload):
+    return DST_MAC + SRC_MAC + struct.pack('!H', ethType) + payload
+
+def ip4(proto, payload, fragOfs=0, options=b'', totLen=None):
+    hdrLen = 20 + len(options)
+    if totLen is None:
+        totLen = hdrLen + len(payload)
+    hdr = struct.pack('!BBHHHBBH4s4s', 0x40 | (hdrLen // 4), 0, totLen,
+            1234, fragOfs, 64, proto, 0, b'\x0a\x00\x00\x01',
+            b'\x0a\x00\x00\x02') + options
+    hdr = hdr[:10] + struct.pack('!H', cksum(hdr)) + hdr[12:]
+    return hdr + payload
+
+def ip6(nextHeader, payload):
+    return struct.pack('!IHBB16s16s', 0x60000000, len(payload), nextHeader,
+            64, b'\xfe\x80' + b'\x00'*13 + b'\x01',
+            b'\xfe\x80' + b'\x00'*13 + b'\x02') + payload
+
+def udp(payload):
+    return struct.pack('!HHHH', 1024, 2048, 8 + len(payload), 0) + payload
+
+def tcp(payload, options=b''):
+    hdrLen = 20 + len(options)
+    return struct.pack('!HHIIBBHHH', 1024, 80, 1, 0, (hdrLen // 4) << 4,
+            0x02, 8192, 0x1234, 0) + options + payload
+
+def arp(opCode=1, hwType=1):
+    return struct.pack('!HHBBH6s4s6s4s', hwType, 0x0800, 6, 4, opCode,
+            SRC_MAC, b'\x0a\x00\x00\x01', b'\x00'*6, b'\x0a\x00\x00\x02')
+
+def pad(frame, length=60):
+    return frame + b'\x00'*max(0, length - len(frame))
+
+#
+# Classic pcap
+#
+def pcap(packets, snapLen=65535, endian='<'):
+    out = struct.pack(endian + 'IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, snapLen, 1)
+    for (ts, frame) in packets:
+        data = frame[:snapLen]
+        out += struct.pack(endian + 'IIII', ts // 1000000, ts % 1000000,
+                len(data), len(frame)) + data
+    return out
+
+#
+# pcapng
+#
+def block(endian, blockType, body):
+    body += b'\x00' * (-len(body) % 4)
+    length = 12 + len(body)
+    return (struct.pack(endian + 'II', blockType, length) + body
+            + struct.pack(endian + 'I', length))
+
+def shb(endian):
+    return block(endian, 0x0a0d0d0a,
+            struct.pack(endian + 'IHHq', 0x1a2b3c4d, 1, 0, -1))
+
+def idb(endian, snapLen=0, tsResol=None):
+    body = struct.pack(endian + 'HHI', 1, 0, snapLen)
+    if tsResol is not None:
+        body += struct.pack(endian + 'HHB3x', 9, 1, tsResol)
+        body += struct.pack(endian + 'HH', 0, 0)
+    return block(endian, 0x00000001, body)
+
+def epb(endian, ts, frame):
+    return block(endian, 0x00000006, struct.pack(endian + 'IIIII', 0,
+            ts >> 32, ts & 0xffffffff, len(frame), len(frame)) + frame)
+
+def spb(endian, frame):
+    return block(endian, 0x00000003,
+            struct.pack(endian + 'I', len(frame)) + frame)
+
+udpFrame = eth(0x0800, ip4(17, udp(b'\x55'*18)))
+arpFrame = eth(0x0806, arp())
+tcpFrame = eth(0x0800, ip4(6, tcp(b'\x66'*6, b'\x02\x04\x05\xb4')))
+longUdpFrame = eth(0x0800, ip4(17, udp(b'\x77'*58)))
+
+# Snaplen truncation - timestamps (usecs) 1s, 2s, 3.25s
+truncated = pcap([(1000000, longUdpFrame), (2000000, arpFrame),
+                  (3250000, eth(0x0800, ip4(6, tcp(b'\x66'*26))))],
+                 snapLen=64)
+open('truncated.pcap', 'wb').write(truncated)
+
+# Same, gzip'd
+f = gzip.GzipFile('truncated.pcap.gz', 'wb', mtime=0)
+f.write(truncated)
+f.close()
+
+# Two sections of different byte order - the second with nsec timestamps
+# and a snaplen which truncates its simple packet block
+multi = (shb('<') + idb('<')
+            + epb('<', 1000000, udpFrame) + epb('<', 1500000, arpFrame)
+         + shb('>') + idb('>', snapLen=64, tsResol=9)
+            + spb('>', longUdpFrame) + epb('>', 2000000000, tcpFrame))
+open('multisection.pcapng', 'wb').write(multi)
+
+# Frames for the dissector - see kDissectSamples in test/main.cpp
+frames = [
+    udpFrame,
+    arpFrame,
+    tcpFrame,
+    pad(eth(0x88b5, b'\x88'*46)),
+    eth(46, b'\xaa\xaa\x03' + b'\x00'*43),
+    DST_MAC + SRC_MAC + struct.pack('!HH', 0x8100, 100)
+        + struct.pack('!H', 0x86dd) + ip6(17, udp(b'\x99'*8)),
+    eth(0x86dd, ip6(0, b'\x11\x00' + b'\x00'*6 + udp(b'\x99'*8))),
+    pad(eth(0x0800, ip4(17, b'\x44'*24, fragOfs=100))),
+    pad(eth(0x0800, ip4(1, struct.pack('!BBHHH', 8, 0, 0, 1, 1)
+        + b'\x33'*8))),
+    # Unusual field values - decoded as far as they render back exactly
+    pad(eth(0x0800, ip4(2, struct.pack('!BBH4s', 0x12, 0x5a, 0,
+        b'\xe0\x00\x00\x01')))),
+    eth(0x0806, arp(opCode=0x1234, hwType=0x0006)),
+]
+open('dissect.pcap', 'wb').write(
+        pcap([(i*1000000, f) for (i, f) in enumerate(frames)]))
@@ -29,6 +29,7 @@ win32 {
         "../rpc/libpbrpc.a" 
 }
 LIBS += -lprotobuf
+LIBS += -lz
 LIBS += -L"../extra/qhexedit2/$(OBJECTS_DIR)/" -lqhexedit2
 
 HEADERS += 